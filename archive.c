@@ -0,0 +1,416 @@
+/**************************************************************************/
+/*! 
+    @file     archive.c
+
+    @brief    Archives captured cards to the SD card
+
+    Each session is written to a new file (ARC00000.RCA, ARC00001.RCA,
+    ...) which is pre-allocated to CFG_ARCHIVE_PREALLOCATE bytes when
+    it is created, so that the clusters are allocated in one go and are
+    normally contiguous.  Data is collected in a RAM buffer and only
+    written out in whole, sector-aligned blocks, which FatFS passes
+    straight to disk_write as a single multi-block (CMD25) write.  The
+    directory entry and FAT are only synced at the end of each deck.
+    With CFG_SDCARD_WRITECOMBINE the driver also joins consecutive
+    blocks into longer bursts; archivePoll writes them out once idle.
+
+    File layout (all values big-endian):
+
+    @code
+    "RCA1" LLLLLLLL           File header: number of valid bytes in
+                              the file, padded out to 512 bytes
+    0x01 NNNN TTTTTTTT        Start of deck: deck number, systick ms
+    0x02 LL <packed columns>  Card: LL columns, 12 bits per column
+                              packed two columns into three bytes
+    0x03 NNNN                 End of deck: number of cards in the deck
+    0xFF ...                  Padding up to the next 512 byte boundary
+    @endcode
+
+    Every deck ends on a sector boundary, after which the length in
+    the file header is updated.  If power is lost the file keeps its
+    pre-allocated size and the space past the last deck holds whatever
+    was on the card before, so readers must stop at the length given
+    in the header.
+
+    @section Example
+
+    @code 
+    #include "archive.h"
+
+    if (archiveOpen() == ARCHIVE_ERROR_NONE)
+    {
+      archiveAddCard(card, len);
+      ...
+      archiveEndDeck();
+      ...
+      archiveClose();
+    }
+    @endcode
+
+    @section LICENSE
+
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <stdio.h>
+
+#include "archive.h"
+
+#ifdef CFG_ARCHIVE
+
+#include "core/systick/systick.h"
+#include "drivers/fatfs/diskio.h"
+#include "drivers/fatfs/ff.h"
+
+static FATFS    archiveFatFs;
+static FIL      archiveFile;
+static bool     archiveOpened = false;
+static bool     archiveInDeck = false;
+static uint16_t archiveDeck = 0;
+static uint16_t archiveCards = 0;
+
+static uint8_t  archiveBuffer[ARCHIVE_SECTORSIZE * ARCHIVE_BUFFERSECTORS];
+static uint32_t archivePos = 0;
+static uint32_t archiveLength = 0;
+static bool     archiveFailed = false;
+
+/**************************************************************************/
+/*!
+    @brief  Writes the first len bytes of the buffer (a whole number of
+            sectors) to the file
+*/
+/**************************************************************************/
+static void archiveFlush(uint32_t len)
+{
+  UINT bytesWritten;
+
+  if (archiveFailed || !len)
+  {
+    archivePos = 0;
+    return;
+  }
+
+  if ((f_write(&archiveFile, archiveBuffer, len, &bytesWritten) != FR_OK) || (bytesWritten != len))
+  {
+    archiveFailed = true;
+  }
+  archiveLength += len;
+  archivePos = 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Stores the number of valid bytes in the file header and
+            syncs the file.  The header sector goes through the FatFS
+            window, so it reaches the card after the data it covers.
+*/
+/**************************************************************************/
+static void archiveSync(void)
+{
+  uint8_t length[4];
+  UINT bytesWritten;
+
+  if (archiveFailed)
+  {
+    return;
+  }
+
+  length[0] = archiveLength >> 24;
+  length[1] = (archiveLength >> 16) & 0xFF;
+  length[2] = (archiveLength >> 8) & 0xFF;
+  length[3] = archiveLength & 0xFF;
+
+  if ((f_lseek(&archiveFile, 4) != FR_OK) ||
+      (f_write(&archiveFile, length, 4, &bytesWritten) != FR_OK) || (bytesWritten != 4) ||
+      (f_lseek(&archiveFile, archiveLength) != FR_OK) ||
+      (f_sync(&archiveFile) != FR_OK))
+  {
+    archiveFailed = true;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds one byte to the buffer, writing it out once full
+*/
+/**************************************************************************/
+static void archivePutByte(uint8_t value)
+{
+  archiveBuffer[archivePos++] = value;
+  if (archivePos == sizeof(archiveBuffer))
+  {
+    archiveFlush(archivePos);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds a big-endian 16-bit value to the buffer
+*/
+/**************************************************************************/
+static void archivePutU16(uint16_t value)
+{
+  archivePutByte(value >> 8);
+  archivePutByte(value & 0xFF);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Mounts the SD card, and creates and pre-allocates a new
+            archive file
+*/
+/**************************************************************************/
+archiveError_t archiveOpen(void)
+{
+  char filename[13];
+  FRESULT res;
+  uint32_t i;
+
+  if (archiveOpened)
+  {
+    archiveClose();
+  }
+
+  if (disk_initialize(0) & (STA_NOINIT | STA_NODISK))
+  {
+    return ARCHIVE_ERROR_NODISK;
+  }
+  if (f_mount(0, &archiveFatFs) != FR_OK)
+  {
+    return ARCHIVE_ERROR_MOUNTFAILED;
+  }
+
+  // Find the first unused file name
+  res = FR_EXIST;
+  for (i = 0; (i < 100000) && (res == FR_EXIST); i++)
+  {
+    sprintf(filename, "ARC%05u.RCA", (unsigned int)i);
+    res = f_open(&archiveFile, filename, FA_CREATE_NEW | FA_WRITE);
+  }
+  if (res != FR_OK)
+  {
+    return ARCHIVE_ERROR_CREATEFAILED;
+  }
+
+  // Allocate the whole cluster chain up front by seeking past the end
+  // of the file, then go back and write from the start
+  if ((f_lseek(&archiveFile, CFG_ARCHIVE_PREALLOCATE) != FR_OK) ||
+      (f_lseek(&archiveFile, 0) != FR_OK) ||
+      (f_sync(&archiveFile) != FR_OK))
+  {
+    f_close(&archiveFile);
+    return ARCHIVE_ERROR_CREATEFAILED;
+  }
+
+  archiveOpened = true;
+  archiveInDeck = false;
+  archiveFailed = false;
+  archiveDeck = 0;
+  archivePos = 0;
+  archiveLength = 0;
+
+  // Write the header sector straight away, so that the length in it is
+  // valid (and covers nothing but the header) from the start
+  archivePutByte('R');
+  archivePutByte('C');
+  archivePutByte('A');
+  archivePutByte('1');
+  archivePutU16(0);
+  archivePutU16(ARCHIVE_SECTORSIZE);
+  while (archivePos < ARCHIVE_SECTORSIZE)
+  {
+    archiveBuffer[archivePos++] = ARCHIVE_RECORD_PAD;
+  }
+  archiveFlush(archivePos);
+  archiveSync();
+
+  if (archiveFailed)
+  {
+    f_close(&archiveFile);
+    archiveOpened = false;
+    return ARCHIVE_ERROR_CREATEFAILED;
+  }
+
+  return ARCHIVE_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds a card to the archive, starting a new deck if required.
+            Nothing is written to the SD card until a full buffer has
+            been collected.
+
+    @param[in]  data
+                Column values (the lower 12 bits are stored)
+    @param[in]  len
+                Number of columns (0..255)
+*/
+/**************************************************************************/
+archiveError_t archiveAddCard(const int *data, int len)
+{
+  uint32_t ticks;
+  int i;
+
+  if (!archiveOpened)
+  {
+    return ARCHIVE_ERROR_NOTOPEN;
+  }
+  if (len > 255)
+  {
+    len = 255;
+  }
+
+  if (!archiveInDeck)
+  {
+    ticks = systickGetTicks();
+    archivePutByte(ARCHIVE_RECORD_DECK);
+    archivePutU16(archiveDeck);
+    archivePutU16(ticks >> 16);
+    archivePutU16(ticks & 0xFFFF);
+    archiveInDeck = true;
+    archiveCards = 0;
+  }
+
+  archivePutByte(ARCHIVE_RECORD_CARD);
+  archivePutByte(len);
+  for (i = 0; i + 1 < len; i += 2)
+  {
+    archivePutByte((data[i] >> 4) & 0xFF);
+    archivePutByte(((data[i] & 0x0F) << 4) | ((data[i + 1] >> 8) & 0x0F));
+    archivePutByte(data[i + 1] & 0xFF);
+  }
+  if (i < len)
+  {
+    archivePutByte((data[i] >> 4) & 0xFF);
+    archivePutByte((data[i] & 0x0F) << 4);
+  }
+  archiveCards++;
+
+  return archiveFailed ? ARCHIVE_ERROR_WRITEFAILED : ARCHIVE_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Ends the current deck, pads it out to a sector boundary,
+            updates the length in the header and syncs the file so
+            everything so far survives a power loss
+*/
+/**************************************************************************/
+archiveError_t archiveEndDeck(void)
+{
+  if (!archiveOpened)
+  {
+    return ARCHIVE_ERROR_NOTOPEN;
+  }
+  if (!archiveInDeck)
+  {
+    return ARCHIVE_ERROR_NONE;
+  }
+
+  archivePutByte(ARCHIVE_RECORD_END);
+  archivePutU16(archiveCards);
+  archiveInDeck = false;
+  archiveDeck++;
+
+  // Pad to a sector boundary so that every write stays sector aligned
+  while (archivePos % ARCHIVE_SECTORSIZE)
+  {
+    archiveBuffer[archivePos++] = ARCHIVE_RECORD_PAD;
+  }
+  archiveFlush(archivePos);
+  archiveSync();
+
+  return archiveFailed ? ARCHIVE_ERROR_WRITEFAILED : ARCHIVE_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Ends the current deck, trims the unused pre-allocated space
+            from the file and closes it
+*/
+/**************************************************************************/
+archiveError_t archiveClose(void)
+{
+  archiveError_t error;
+
+  if (!archiveOpened)
+  {
+    return ARCHIVE_ERROR_NOTOPEN;
+  }
+
+  error = archiveEndDeck();
+
+  if ((f_truncate(&archiveFile) != FR_OK) || (f_close(&archiveFile) != FR_OK))
+  {
+    error = ARCHIVE_ERROR_WRITEFAILED;
+  }
+  archiveOpened = false;
+
+  return archiveFailed ? ARCHIVE_ERROR_WRITEFAILED : error;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Call from the main loop.  Lets the SD card driver write out
+            any sectors it is still holding to combine with later
+            writes once none have arrived for CFG_SDCARD_WRITETIMEOUT
+
+    @note   Only returns an error for the poll that failed, so that the
+            main loop doesn't report it on every pass
+*/
+/**************************************************************************/
+archiveError_t archivePoll(void)
+{
+  if (!archiveOpened)
+  {
+    return ARCHIVE_ERROR_NOTOPEN;
+  }
+
+#if CFG_SDCARD_WRITECOMBINE > 0
+  if (!archiveFailed && (disk_ioctl(0, CTRL_WRITE_IDLE, 0) != RES_OK))
+  {
+    archiveFailed = true;
+    return ARCHIVE_ERROR_WRITEFAILED;
+  }
+#endif
+
+  return ARCHIVE_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns true if an archive file is currently open
+*/
+/**************************************************************************/
+bool archiveIsOpen(void)
+{
+  return archiveOpened;
+}
+
+#endif
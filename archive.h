@@ -0,0 +1,67 @@
+/**************************************************************************/
+/*! 
+    @file     archive.h
+
+    @section LICENSE
+
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include "projectconfig.h"
+
+#define ARCHIVE_SECTORSIZE      (512)
+#define ARCHIVE_BUFFERSECTORS   (2)     // Sectors sent to the card per write
+
+/* Record types in an archive file (see archive.c for the layout) */
+#define ARCHIVE_RECORD_DECK     (0x01)  // Start of deck
+#define ARCHIVE_RECORD_CARD     (0x02)  // One card
+#define ARCHIVE_RECORD_END      (0x03)  // End of deck
+#define ARCHIVE_RECORD_PAD      (0xFF)  // Skip to the next sector
+
+typedef enum
+{
+  ARCHIVE_ERROR_NONE = 0,
+  ARCHIVE_ERROR_NODISK = 1,           // No SD card or card init failed
+  ARCHIVE_ERROR_MOUNTFAILED = 2,      // Unable to mount the FAT partition
+  ARCHIVE_ERROR_CREATEFAILED = 3,     // Unable to create a new archive file
+  ARCHIVE_ERROR_WRITEFAILED = 4,      // Write or sync failed (or disk full)
+  ARCHIVE_ERROR_NOTOPEN = 5           // archiveOpen hasn't been called
+} archiveError_t;
+
+archiveError_t archiveOpen(void);
+archiveError_t archiveAddCard(const int *data, int len);
+archiveError_t archiveEndDeck(void);
+archiveError_t archiveClose(void);
+archiveError_t archivePoll(void);
+bool           archiveIsOpen(void);
+
+#endif
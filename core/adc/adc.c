@@ -7,9 +7,10 @@
 	
     @section Description
 	
-    SW-based single-channel A/D conversion.  If you wish to convert
-    multiple ADC channels simultaneously, this code will need to be
-    modified to work in BURST mode.
+    SW-based single-channel A/D conversion, either blocking (adcRead) or
+    interrupt-driven (adcReadAsync).  If you wish to convert multiple ADC
+    channels simultaneously, this code will need to be modified to work
+    in BURST mode.
 
     @section Example
 
@@ -67,6 +68,49 @@
 
 static bool _adcInitialised = false;
 static uint8_t _adcLastChannel = 0;
+static volatile bool _adcBusy = false;
+static volatile adcCallback_t _adcCallback = 0;
+
+/* Continuous sampling (adcStreamStart) */
+#define ADC_STREAM_MAXCLOCK   (4500000)   /* Max A/D clock in Hz */
+#define ADC_STREAM_NOBLOCK    (0xFF)
+
+static volatile bool _adcStreaming = false;
+static adcStreamMode_t _adcStreamMode;
+static uint32_t _adcStreamSavedCR;
+static uint8_t _adcStreamList[8];         /* Channels in the scan, ascending */
+static uint8_t _adcStreamChannels;        /* Number of channels in the scan */
+static uint8_t _adcStreamCurrent;         /* Index into _adcStreamList (timer mode) */
+static uint8_t _adcStreamDecimation;
+static uint8_t _adcStreamScans;           /* Scans summed so far */
+static uint32_t _adcStreamSum[8];
+static uint16_t *_adcStreamBuffer;
+static uint16_t _adcStreamBlockLen;       /* Samples per block */
+static uint16_t _adcStreamPos;            /* Next sample in the block being filled */
+static uint8_t _adcStreamFill;            /* Block the interrupt is filling (0 or 1) */
+static volatile uint8_t _adcStreamReady = ADC_STREAM_NOBLOCK;
+static volatile uint32_t _adcStreamOverruns = 0;
+
+/**************************************************************************/
+/*! 
+    @brief Claims the A/D converter, returning false if a conversion is
+           already in progress
+*/
+/**************************************************************************/
+static bool adcClaim (void)
+{
+  bool claimed = false;
+
+  __disable_irq();
+  if (!_adcBusy)
+  {
+    _adcBusy = true;
+    claimed = true;
+  }
+  __enable_irq();
+
+  return claimed;
+}
 
 /**************************************************************************/
 /*! 
@@ -91,6 +135,12 @@ uint32_t adcRead (uint8_t channelNum)
 {
   if (!_adcInitialised) adcInit();
 
+  /* The A/D converter belongs to adcStreamStart until it's stopped */
+  if (_adcStreaming)
+  {
+    return 0;
+  }
+
   uint32_t regVal, adcData;
 
   /* make sure that channel number is 0..7 */
@@ -100,6 +150,9 @@ uint32_t adcRead (uint8_t channelNum)
     channelNum = 0;
   }
 
+  /* Wait for any adcReadAsync conversion to complete */
+  while (!adcClaim());
+
   /* Deselect all channels */
   ADC_AD0CR &= ~ADC_AD0CR_SEL_MASK;
 
@@ -150,6 +203,7 @@ uint32_t adcRead (uint8_t channelNum)
 
   /* stop ADC */
   ADC_AD0CR &= ~ADC_AD0CR_START_MASK;
+  _adcBusy = false;
 
   /* return 0 if an overrun occurred */
   if ( regVal & ADC_DR_OVERRUN )
@@ -162,6 +216,443 @@ uint32_t adcRead (uint8_t channelNum)
   return (adcData);
 }
 
+/**************************************************************************/
+/*! 
+    @brief Starts an A/D conversion on a single channel without waiting
+    for the results.  The supplied callback is called from the ADC
+    interrupt once the conversion is complete, and may start another
+    conversion itself to chain several channels together.
+
+    @param[in]  channelNum
+                The A/D channel [0..7] that will be used during the A/D 
+                conversion.
+    @param[in]  callback
+                The function to call with the conversion results (0 if
+                an overrun error occured, otherwise a 10-bit value).
+
+    @return     false if another conversion is already in progress,
+                otherwise true.
+*/
+/**************************************************************************/
+bool adcReadAsync (uint8_t channelNum, adcCallback_t callback)
+{
+  if (!_adcInitialised) adcInit();
+
+  if ( channelNum >= 8 )
+  {
+    channelNum = 0;
+  }
+
+  if (!adcClaim())
+  {
+    return false;
+  }
+
+  _adcCallback = callback;
+  _adcLastChannel = channelNum;
+
+  /* Only interrupt on the selected channel */
+  *(pREG32(ADC_AD0INTEN)) = (1 << channelNum);
+  NVIC_EnableIRQ(ADC_IRQn);
+
+  ADC_AD0CR &= ~(ADC_AD0CR_SEL_MASK | ADC_AD0CR_START_MASK);
+  ADC_AD0CR |= ADC_AD0CR_START_STARTNOW | (1 << channelNum);
+
+  return true;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Returns the CLKDIV value for an A/D clock no faster than
+           the specified frequency (or ADC_STREAM_MAXCLOCK)
+*/
+/**************************************************************************/
+static uint32_t adcStreamClockDiv (uint32_t clock)
+{
+  uint32_t pclk = CFG_CPU_CCLK / SCB_SYSAHBCLKDIV;
+  uint32_t div;
+
+  if ((clock == 0) || (clock > ADC_STREAM_MAXCLOCK))
+  {
+    clock = ADC_STREAM_MAXCLOCK;
+  }
+
+  /* Round up so the clock is never faster than requested */
+  div = (pclk + clock - 1) / clock;
+  if (div > 256)
+  {
+    div = 256;
+  }
+  return div - 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Adds one scan of results to the current block, called from
+           the ADC interrupt once every channel has been converted
+*/
+/**************************************************************************/
+static inline void adcStreamScanDone (void)
+{
+  uint16_t *out;
+  uint8_t i;
+
+  if (++_adcStreamScans < _adcStreamDecimation)
+  {
+    return;
+  }
+
+  /* Store the average of the last 'decimation' scans */
+  out = _adcStreamBuffer + _adcStreamFill * _adcStreamBlockLen + _adcStreamPos;
+  for (i = 0; i < _adcStreamChannels; i++)
+  {
+    out[i] = _adcStreamSum[i] / _adcStreamDecimation;
+    _adcStreamSum[i] = 0;
+  }
+  _adcStreamScans = 0;
+  _adcStreamPos += _adcStreamChannels;
+
+  if (_adcStreamPos < _adcStreamBlockLen)
+  {
+    return;
+  }
+
+  /* Block full, hand it over unless the other one hasn't been released
+     yet, in which case this block is dropped and filled again */
+  _adcStreamPos = 0;
+  if (_adcStreamReady != ADC_STREAM_NOBLOCK)
+  {
+    _adcStreamOverruns++;
+    return;
+  }
+  _adcStreamReady = _adcStreamFill;
+  _adcStreamFill ^= 1;
+}
+
+/**************************************************************************/
+/*! 
+    @brief ADC interrupt handling while streaming
+*/
+/**************************************************************************/
+static inline void adcStreamIRQ (void)
+{
+  uint32_t regVal;
+  uint8_t i;
+
+  if (_adcStreamMode == ADC_STREAM_BURST)
+  {
+    /* Interrupt is on the last channel of the scan, the others have
+       been converted already.  Reading each result clears its DONE. */
+    for (i = 0; i < _adcStreamChannels; i++)
+    {
+      regVal = *(pREG32(ADC_AD0DR0 + (_adcStreamList[i] << 2)));
+      _adcStreamSum[i] += (regVal >> 6) & 0x3FF;
+    }
+    adcStreamScanDone();
+    return;
+  }
+
+  /* Timer mode, the trigger converts the first channel and the rest
+     of the scan is started from here */
+  i = _adcStreamCurrent;
+  regVal = *(pREG32(ADC_AD0DR0 + (_adcStreamList[i] << 2)));
+  _adcStreamSum[i] += (regVal >> 6) & 0x3FF;
+
+  if (++i < _adcStreamChannels)
+  {
+    _adcStreamCurrent = i;
+    ADC_AD0CR = (ADC_AD0CR & ~(ADC_AD0CR_SEL_MASK | ADC_AD0CR_START_MASK)) |
+                (1 << _adcStreamList[i]) | ADC_AD0CR_START_STARTNOW;
+    return;
+  }
+
+  /* Back to the first channel, waiting for the next match */
+  _adcStreamCurrent = 0;
+  if (_adcStreamChannels > 1)
+  {
+    ADC_AD0CR = (ADC_AD0CR & ~(ADC_AD0CR_SEL_MASK | ADC_AD0CR_START_MASK)) |
+                (1 << _adcStreamList[0]) | ADC_AD0CR_START_CT32B0_MAT0;
+  }
+  adcStreamScanDone();
+}
+
+/**************************************************************************/
+/*! 
+    @brief Starts converting one or more channels continuously, with the
+    results collected into blocks from the ADC interrupt.
+
+    The buffer is split into two blocks: while the interrupt fills one,
+    the other can be processed after adcStreamGetBlock returns it.
+    Samples are stored as 10-bit values, one per channel per scan, in
+    ascending channel order.  If a block fills up before the previous
+    one has been released, it's dropped and adcStreamOverruns goes up.
+
+    @param[in]  mode
+                ADC_STREAM_TIMER to start each scan from CT32B0_MAT0
+                at exactly scanRate (CT32B0 can't be used for anything
+                else meanwhile), or ADC_STREAM_BURST to let the A/D
+                converter run freely, with the A/D clock set to
+                approximately scanRate.  The slowest A/D clock is
+                pclk/256, so burst mode can't scan slower than
+                pclk / (256 * 11 * channels), about 25kHz for one
+                channel at 72MHz.  Slower burst requests run in timer
+                mode instead.  Timer mode isn't available when
+                CFG_CHIBI_RXTIMESTAMP is 0 (chibi owns CT32B0).
+    @param[in]  channelMask
+                The channels to convert (bit 0 = AD0 .. bit 7 = AD7).
+                Only AD0..3 are configured as analog inputs by adcInit.
+    @param[in]  scanRate
+                The number of scans of all channels per second.  One
+                conversion takes 11 A/D clocks (2.4us at the maximum of
+                4.5MHz), and the whole scan has to fit in one period.
+    @param[in]  decimation
+                The number of scans averaged into each stored sample,
+                1 to keep every scan.
+    @param[in]  buffer
+                Space for 2 * blockScans * (number of channels) samples
+    @param[in]  blockScans
+                The number of (decimated) scans in each block
+
+    @return     false if the A/D converter is busy, the parameters are
+                out of range or CT32B0 is needed but not available,
+                otherwise true.
+
+    @warning    The stream holds the A/D converter until adcStreamStop,
+                so adcRead returns 0 and adcReadAsync fails meanwhile.
+                That includes the touch screen, whose readings are
+                skipped (no touch events) for as long as the stream
+                runs.
+
+    @section Example
+
+    @code 
+    uint16_t samples[2 * 128];
+
+    // AD0 and AD1 at 10kHz each, 64 pairs per block
+    adcStreamStart(ADC_STREAM_TIMER, 0x03, 10000, 1, samples, 64);
+    while (1)
+    {
+      uint16_t *block = adcStreamGetBlock();
+      if (block)
+      {
+        // block[0] = AD0, block[1] = AD1, block[2] = AD0, ...
+        adcStreamReleaseBlock();
+      }
+    }
+    @endcode
+*/
+/**************************************************************************/
+bool adcStreamStart (adcStreamMode_t mode, uint8_t channelMask, uint32_t scanRate, uint8_t decimation, uint16_t *buffer, uint16_t blockScans)
+{
+  uint32_t pclk = CFG_CPU_CCLK / SCB_SYSAHBCLKDIV;
+  uint32_t clkdiv, channels;
+  uint8_t i;
+
+  if (!_adcInitialised) adcInit();
+
+  if ((channelMask == 0) || (scanRate == 0) || (decimation == 0) || 
+      (buffer == 0) || (blockScans == 0))
+  {
+    return false;
+  }
+
+  /* The whole scan, 11 clocks per channel, has to fit in one period */
+  channels = 0;
+  for (i = 0; i < 8; i++)
+  {
+    if (channelMask & (1 << i)) channels++;
+  }
+  if (scanRate > ADC_STREAM_MAXCLOCK / (channels * 11))
+  {
+    return false;
+  }
+
+  /* Burst mode would run faster than asked with the A/D clock at its
+     slowest (pclk/256), so let the timer pace the scans instead */
+  if ((mode == ADC_STREAM_BURST) && (scanRate * channels * 11 < (pclk + 255) / 256))
+  {
+    mode = ADC_STREAM_TIMER;
+  }
+
+  #if defined CFG_CHIBI_RXTIMESTAMP && CFG_CHIBI_RXTIMESTAMP == 0
+    /* CT32B0 is counting receive timestamps for chibi */
+    if (mode == ADC_STREAM_TIMER)
+    {
+      return false;
+    }
+  #endif
+
+  if (!adcClaim())
+  {
+    return false;
+  }
+
+  _adcStreamChannels = 0;
+  for (i = 0; i < 8; i++)
+  {
+    if (channelMask & (1 << i))
+    {
+      _adcStreamList[_adcStreamChannels++] = i;
+    }
+    _adcStreamSum[i] = 0;
+  }
+
+  _adcStreamMode = mode;
+  _adcStreamCurrent = 0;
+  _adcStreamDecimation = decimation;
+  _adcStreamScans = 0;
+  _adcStreamBuffer = buffer;
+  _adcStreamBlockLen = blockScans * _adcStreamChannels;
+  _adcStreamPos = 0;
+  _adcStreamFill = 0;
+  _adcStreamReady = ADC_STREAM_NOBLOCK;
+  _adcStreamOverruns = 0;
+  _adcStreamSavedCR = ADC_AD0CR;
+  _adcStreaming = true;
+
+  /* Stop any conversions and clear old results */
+  ADC_AD0CR &= ~(ADC_AD0CR_START_MASK | ADC_AD0CR_BURST_MASK);
+  for (i = 0; i < 8; i++)
+  {
+    (void)*(pREG32(ADC_AD0DR0 + (i << 2)));
+  }
+
+  if (mode == ADC_STREAM_BURST)
+  {
+    /* Burst mode converts each selected channel in turn, 11 clocks each */
+    clkdiv = adcStreamClockDiv(scanRate * _adcStreamChannels * 11);
+    *(pREG32(ADC_AD0INTEN)) = (1 << _adcStreamList[_adcStreamChannels - 1]);
+    NVIC_EnableIRQ(ADC_IRQn);
+    ADC_AD0CR = (channelMask | 
+                (clkdiv << 8) |
+                ADC_AD0CR_BURST_HWSCANMODE |
+                ADC_AD0CR_CLKS_10BITS |
+                ADC_AD0CR_START_NOSTART);
+    return true;
+  }
+
+  /* Timer mode, the A/D converter runs as fast as possible so the scan
+     is over quickly, and each rising edge on MAT0 starts a new scan */
+  clkdiv = adcStreamClockDiv(0);
+  *(pREG32(ADC_AD0INTEN)) = channelMask;
+  NVIC_EnableIRQ(ADC_IRQn);
+  ADC_AD0CR = ((1 << _adcStreamList[0]) |
+              (clkdiv << 8) |
+              ADC_AD0CR_BURST_SWMODE |
+              ADC_AD0CR_CLKS_10BITS |
+              ADC_AD0CR_START_CT32B0_MAT0 |
+              ADC_AD0CR_EDGE_RISING);
+
+  /* MAT0 toggles on every match, so match at twice the scan rate */
+  SCB_SYSAHBCLKCTRL |= (SCB_SYSAHBCLKCTRL_CT32B0);
+  TMR_TMR32B0TCR = TMR_TMR32B0TCR_COUNTERRESET_ENABLED;
+  TMR_TMR32B0PR = 0;
+  TMR_TMR32B0MR0 = pclk / (2 * scanRate) - 1;
+  TMR_TMR32B0MCR = TMR_TMR32B0MCR_MR0_RESET_ENABLED;
+  TMR_TMR32B0EMR = TMR_TMR32B0EMR_EMC0_TOGGLE;
+  TMR_TMR32B0TCR = TMR_TMR32B0TCR_COUNTERENABLE_ENABLED;
+
+  return true;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Returns the next full block of samples, or 0 if there isn't
+    one yet.  The block stays valid until adcStreamReleaseBlock is
+    called.
+*/
+/**************************************************************************/
+uint16_t * adcStreamGetBlock (void)
+{
+  uint8_t block = _adcStreamReady;
+
+  if (block == ADC_STREAM_NOBLOCK)
+  {
+    return 0;
+  }
+  return _adcStreamBuffer + block * _adcStreamBlockLen;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Hands the block returned by adcStreamGetBlock back to the
+    interrupt, to be filled once the current block is done
+*/
+/**************************************************************************/
+void adcStreamReleaseBlock (void)
+{
+  _adcStreamReady = ADC_STREAM_NOBLOCK;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Returns the number of blocks dropped because the previous
+    block hadn't been released in time
+*/
+/**************************************************************************/
+uint32_t adcStreamOverruns (void)
+{
+  return _adcStreamOverruns;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Stops continuous sampling and restores the single conversion
+    setup used by adcRead
+*/
+/**************************************************************************/
+void adcStreamStop (void)
+{
+  if (!_adcStreaming)
+  {
+    return;
+  }
+
+  if (_adcStreamMode == ADC_STREAM_TIMER)
+  {
+    TMR_TMR32B0TCR = TMR_TMR32B0TCR_COUNTERENABLE_DISABLED;
+    TMR_TMR32B0EMR = 0;
+  }
+
+  *(pREG32(ADC_AD0INTEN)) = 0;
+  ADC_AD0CR = _adcStreamSavedCR & ~(ADC_AD0CR_START_MASK | ADC_AD0CR_BURST_MASK);
+  NVIC_DisableIRQ(ADC_IRQn);
+
+  _adcStreaming = false;
+  _adcBusy = false;
+}
+
+/**************************************************************************/
+/*! 
+    @brief ADC interrupt handler, used by adcReadAsync and adcStreamStart
+*/
+/**************************************************************************/
+void ADC_IRQHandler (void)
+{
+  uint32_t regVal;
+  adcCallback_t callback;
+
+  if (_adcStreaming)
+  {
+    adcStreamIRQ();
+    return;
+  }
+
+  /* Reading the data register clears the DONE flag and the interrupt */
+  regVal = *(pREG32(ADC_AD0DR0 + (_adcLastChannel << 2)));
+  ADC_AD0CR &= ~ADC_AD0CR_START_MASK;
+  *(pREG32(ADC_AD0INTEN)) = 0;
+
+  callback = _adcCallback;
+  _adcCallback = 0;
+  _adcBusy = false;
+
+  if (callback)
+  {
+    callback(_adcLastChannel, (regVal & ADC_DR_OVERRUN) ? 0 : (regVal >> 6) & 0x3FF);
+  }
+}
+
 /**************************************************************************/
 /*! 
     @brief      Initialises the A/D converter and configures channels 0..3
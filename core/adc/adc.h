@@ -41,7 +41,27 @@
 
 #include "projectconfig.h"
 
+typedef void (*adcCallback_t)(uint8_t channelNum, uint32_t result);
+
+/**************************************************************************/
+/*! 
+    How adcStreamStart paces the conversions
+*/
+/**************************************************************************/
+typedef enum
+{
+  ADC_STREAM_TIMER = 0,   // Each scan started by CT32B0_MAT0, exact rate
+  ADC_STREAM_BURST        // Free running burst mode, rate set by the ADC clock
+}
+adcStreamMode_t;
+
 uint32_t   adcRead (uint8_t channelNum);
+bool  adcReadAsync (uint8_t channelNum, adcCallback_t callback);
+bool  adcStreamStart (adcStreamMode_t mode, uint8_t channelMask, uint32_t scanRate, uint8_t decimation, uint16_t *buffer, uint16_t blockScans);
+uint16_t * adcStreamGetBlock (void);
+void  adcStreamReleaseBlock (void);
+uint32_t   adcStreamOverruns (void);
+void  adcStreamStop (void);
 void  adcInit (void);
 
 #endif
@@ -11,11 +11,16 @@
  *                           Major cleaning and a rewrite of some functions
  *                           - adding ACK/NACK handling to the state machine
  *                           - adding a return result to the I2CEngine()
+ *   2011.xx.xx              Transactions are described by i2cTransfer_t
+ *                           and queued, the interrupt handler works
+ *                           through the queue on its own.  i2cEngine()
+ *                           is now a blocking wrapper around the queue.
  *
 *****************************************************************************/
 #include "i2c.h"
 
-volatile uint32_t I2CMasterState = I2CSTATE_IDLE;
+#include "core/systick/systick.h"
+
 volatile uint32_t I2CSlaveState = I2CSTATE_IDLE;
 
 volatile uint8_t I2CMasterBuffer[I2C_BUFSIZE];
@@ -26,6 +31,70 @@ volatile uint32_t I2CWriteLength;
 volatile uint32_t RdIndex = 0;
 volatile uint32_t WrIndex = 0;
 
+/* Transfer queue: i2cCurrent is on the bus, i2cLast is the end of the
+   list that hangs off it (linked through 'next') */
+static i2cTransfer_t * volatile i2cCurrent = NULL;
+static i2cTransfer_t * volatile i2cLast = NULL;
+
+/* Used by i2cEngine() for the global I2CMasterBuffer/I2CSlaveBuffer */
+static i2cTransfer_t i2cGlobalTransfer;
+
+/*****************************************************************************
+** Function name:	I2CStartNext
+**
+** Descriptions:	Issues a START for the transfer at the head of
+**			the queue, if there is one.  Called with the
+**			queue protected (from the IRQ or with IRQs off).
+**
+** parameters:		None
+** Returned value:	None
+** 
+*****************************************************************************/
+static void I2CStartNext( void )
+{
+	if ( i2cCurrent == NULL )
+	{
+		return;
+	}
+
+	RdIndex = 0;
+	WrIndex = 0;
+	i2cCurrent->started = systickGetTicks();
+	I2C_I2CCONSET = I2CONSET_STA;	/* Set Start flag */
+}
+
+/*****************************************************************************
+** Function name:	I2CComplete
+**
+** Descriptions:	Finishes the current transfer with the supplied
+**			state, calls its callback and moves on to the
+**			next queued transfer.
+**
+** parameters:		Any of the terminal I2CSTATE_... values
+** Returned value:	None
+** 
+*****************************************************************************/
+static void I2CComplete( uint32_t state )
+{
+	i2cTransfer_t *done = i2cCurrent;
+
+	i2cCurrent = done->next;
+	if ( i2cCurrent == NULL )
+	{
+		i2cLast = NULL;
+	}
+	done->next = NULL;
+	done->state = state;
+
+	/* Start the next one first, so that the callback can requeue */
+	I2CStartNext();
+
+	if ( done->callback )
+	{
+		done->callback( done );
+	}
+}
+
 
 /*****************************************************************************
 ** Function name:		I2C_IRQHandler
@@ -39,9 +108,16 @@ volatile uint32_t WrIndex = 0;
 void I2C_IRQHandler(void) 
 {
 	uint8_t StatValue;
+	i2cTransfer_t *t = i2cCurrent;
 
 	/* this handler deals with master read and master write only */
 	StatValue = I2C_I2CSTAT;
+	if ( t == NULL )
+	{
+		/* Nothing on the bus (e.g. a transfer that just timed out) */
+		I2C_I2CCONCLR = I2CONCLR_SIC;
+		return;
+	}
 	switch ( StatValue )
 	{
 	case 0x08:
@@ -52,9 +128,9 @@ void I2C_IRQHandler(void)
 		 * (we always start with a write after START+SLA)
 		 */
 		WrIndex = 0;
-		I2C_I2CDAT = I2CMasterBuffer[WrIndex++];
+		I2C_I2CDAT = t->writeBuffer[WrIndex++];
 		I2C_I2CCONCLR = (I2CONCLR_SIC | I2CONCLR_STAC);
-		I2CMasterState = I2CSTATE_PENDING;
+		t->state = I2CSTATE_PENDING;
 		break;
 	
 	case 0x10:
@@ -65,19 +141,10 @@ void I2C_IRQHandler(void)
 		 */
 		RdIndex = 0;
 		/* Send SLA with R bit set, */
-		I2C_I2CDAT = I2CMasterBuffer[WrIndex++];
+		I2C_I2CDAT = t->writeBuffer[WrIndex++];
 		I2C_I2CCONCLR = (I2CONCLR_SIC | I2CONCLR_STAC);
 	break;
 	
-	case 0x18:
-		/*
-		 * SLA+W has been transmitted; ACK has been received.
-		 * We now start writing bytes.
-		 */
-		I2C_I2CDAT = I2CMasterBuffer[WrIndex++];
-		I2C_I2CCONCLR = I2CONCLR_SIC;
-		break;
-
 	case 0x20:
 		/*
 		 * SLA+W has been transmitted; NOT ACK has been received.
@@ -86,23 +153,24 @@ void I2C_IRQHandler(void)
 		 */
 		I2C_I2CCONSET = I2CONSET_STO;
 		I2C_I2CCONCLR = I2CONCLR_SIC;
-		I2CMasterState = I2CSTATE_SLA_NACK;
+		I2CComplete( I2CSTATE_SLA_NACK );
 		break;
 
+	case 0x18:
 	case 0x28:
 		/*
-		 * Data in I2DAT has been transmitted; ACK has been received.
+		 * SLA+W or data in I2DAT has been transmitted; ACK has been received.
 		 * Continue sending more bytes as long as there are bytes to send
 		 * and after this check if a read transaction should follow.
 		 */
-		if ( WrIndex < I2CWriteLength )
+		if ( WrIndex < t->writeLength )
 		{
 			/* Keep writing as long as bytes avail */
-			I2C_I2CDAT = I2CMasterBuffer[WrIndex++];
+			I2C_I2CDAT = t->writeBuffer[WrIndex++];
 		}
 		else
 		{
-			if ( I2CReadLength != 0 )
+			if ( t->readLength != 0 )
 			{
 				/* Send a Repeated START to initialize a read transaction */
 				/* (handled in state 0x10)                                */
@@ -110,8 +178,10 @@ void I2C_IRQHandler(void)
 			}
 			else
 			{
-				I2CMasterState = I2CSTATE_ACK;
 				I2C_I2CCONSET = I2CONSET_STO;      /* Set Stop flag */
+				I2C_I2CCONCLR = I2CONCLR_SIC;
+				I2CComplete( I2CSTATE_ACK );
+				break;
 			}
 		}
 		I2C_I2CCONCLR = I2CONCLR_SIC;
@@ -125,7 +195,7 @@ void I2C_IRQHandler(void)
 		 */
 		I2C_I2CCONSET = I2CONSET_STO;
 		I2C_I2CCONCLR = I2CONCLR_SIC;
-		I2CMasterState = I2CSTATE_NACK;
+		I2CComplete( I2CSTATE_NACK );
 		break;
 
 	case 0x38:
@@ -136,8 +206,8 @@ void I2C_IRQHandler(void)
 		 * Inform the I2CEngine of this and cancel the transaction
 		 * (this is automatically done by the I2C hardware)
 		 */
-		I2CMasterState = I2CSTATE_ARB_LOSS;
 		I2C_I2CCONCLR = I2CONCLR_SIC;
+		I2CComplete( I2CSTATE_ARB_LOSS );
 		break;
 
 	case 0x40:
@@ -147,7 +217,7 @@ void I2C_IRQHandler(void)
 		 * Since a NOT ACK is sent after reading the last byte,
 		 * we need to prepare a NOT ACK in case we only read 1 byte.
 		 */
-		if ( I2CReadLength == 1 )
+		if ( t->readLength == 1 )
 		{
 			/* last (and only) byte: send a NACK after data is received */
 			I2C_I2CCONCLR = I2CONCLR_AAC;
@@ -168,7 +238,7 @@ void I2C_IRQHandler(void)
 		 */
 		I2C_I2CCONSET = I2CONSET_STO;
 		I2C_I2CCONCLR = I2CONCLR_SIC;
-		I2CMasterState = I2CSTATE_SLA_NACK;
+		I2CComplete( I2CSTATE_SLA_NACK );
 		break;
 
 	case 0x50:
@@ -177,8 +247,8 @@ void I2C_IRQHandler(void)
 		 * Read the byte and check for more bytes to read.
 		 * Send a NOT ACK after the last byte is received
 		 */
-		I2CSlaveBuffer[RdIndex++] = I2C_I2CDAT;
-		if ( RdIndex < (I2CReadLength-1) )
+		t->readBuffer[RdIndex++] = I2C_I2CDAT;
+		if ( RdIndex < (t->readLength-1) )
 		{
 			/* lmore bytes to follow: send an ACK after data is received */
 			I2C_I2CCONSET = I2CONSET_AA;
@@ -198,10 +268,10 @@ void I2C_IRQHandler(void)
 		 * Generate a STOP condition and flag the I2CEngine that the
 		 * transaction is finished.
 		 */
-		I2CSlaveBuffer[RdIndex++] = I2C_I2CDAT;
-		I2CMasterState = I2CSTATE_ACK;
+		t->readBuffer[RdIndex++] = I2C_I2CDAT;
 		I2C_I2CCONSET = I2CONSET_STO;	/* Set Stop flag */
 		I2C_I2CCONCLR = I2CONCLR_SIC;	/* Clear SI flag */
+		I2CComplete( I2CSTATE_ACK );
 		break;
 
 	
@@ -212,56 +282,6 @@ void I2C_IRQHandler(void)
   return;
 }
 
-/*****************************************************************************
-** Function name:	I2CStart
-**
-** Descriptions:	Create I2C start condition, a timeout
-**			value is set if the I2C never gets started,
-**			and timed out. It's a fatal error.
-**
-** parameters:		None
-** Returned value:	true or false, return false if timed out
-** 
-*****************************************************************************/
-static uint32_t I2CStart( void )
-{
-	uint32_t timeout = 0;
-
-	/*--- Issue a start condition ---*/
-	I2C_I2CCONSET = I2CONSET_STA;	/* Set Start flag */
-    
-	while((I2CMasterState != I2CSTATE_PENDING) && (timeout < MAX_TIMEOUT))
-	{
-		timeout++;
-	}
-
-	return (timeout < MAX_TIMEOUT);
-}
-
-/*****************************************************************************
-** Function name:	I2CStop
-**
-** Descriptions:	Set the I2C stop condition
-**
-** parameters:		None
-** Returned value:	true or never return
-** 
-*****************************************************************************/
-static uint32_t I2CStop( void )
-{
-	uint32_t timeout = 0;
-
-	I2C_I2CCONSET = I2CONSET_STO;      /* Set Stop flag */
-	I2C_I2CCONCLR = I2CONCLR_SIC;  /* Clear SI flag */
-
-	/*--- Wait for STOP detected ---*/
-	while((I2C_I2CCONSET & I2CONSET_STO) && (timeout < MAX_TIMEOUT))
-	{
-		timeout++;
-	}
-	return (timeout >= MAX_TIMEOUT);
-}
-
 /*****************************************************************************
 ** Function name:	I2CInit
 **
@@ -316,6 +336,114 @@ uint32_t i2cInit( uint32_t I2cMode )
   return( TRUE );
 }
 
+/*****************************************************************************
+** Function name:	i2cQueue
+**
+** Descriptions:	Adds a transfer to the end of the queue.  The
+**			interrupt handler starts it once the transfers
+**			ahead of it are done, so this returns at once
+**			and can be called from any context (including
+**			a transfer callback).  The transfer and its
+**			buffers must stay valid until its state is
+**			terminal (>= I2CSTATE_ACK).  writeBuffer holds
+**			SLA+W, the bytes to write and, if readLength
+**			isn't 0, SLA+R, just like I2CMasterBuffer.
+**
+** parameters:		The transfer to queue
+** Returned value:	true, or false if the transfer is already queued
+** 
+*****************************************************************************/
+uint32_t i2cQueue( i2cTransfer_t *transfer )
+{
+  __disable_irq();
+  if ( transfer->state == I2CSTATE_QUEUED || transfer->state == I2CSTATE_PENDING )
+  {
+    __enable_irq();
+    return ( FALSE );
+  }
+
+  transfer->state = I2CSTATE_QUEUED;
+  transfer->next = NULL;
+  if ( i2cLast == NULL )
+  {
+    i2cCurrent = i2cLast = transfer;
+    I2CStartNext();
+  }
+  else
+  {
+    i2cLast->next = transfer;
+    i2cLast = transfer;
+  }
+  __enable_irq();
+
+  return ( TRUE );
+}
+
+/*****************************************************************************
+** Function name:	i2cWait
+**
+** Descriptions:	Blocks until the supplied (queued) transfer has
+**			finished.  Don't call this from an interrupt, the
+**			queue can't move on until it returns.
+**
+** parameters:		The transfer to wait for
+** Returned value:	Any of the I2CSTATE_... values. See i2c.h
+** 
+*****************************************************************************/
+uint32_t i2cWait( i2cTransfer_t *transfer )
+{
+  while ( transfer->state < 0x100 );
+
+  return ( transfer->state );
+}
+
+/*****************************************************************************
+** Function name:	i2cBusy
+**
+** Descriptions:	Checks whether any transfer is queued or running
+**
+** parameters:		None
+** Returned value:	true if the queue isn't empty
+** 
+*****************************************************************************/
+uint32_t i2cBusy( void )
+{
+  return ( i2cCurrent != NULL );
+}
+
+/*****************************************************************************
+** Function name:	i2cTimerProc
+**
+** Descriptions:	Called every ms from the systick handler.  If the
+**			transfer on the bus has run for longer than its
+**			timeout (a device holding SCL, or a START that
+**			never made it onto a busy bus) the controller is
+**			reset, the transfer ends with I2CSTATE_TIMEOUT
+**			and the next one is started.
+**
+** parameters:		None
+** Returned value:	None
+** 
+*****************************************************************************/
+void i2cTimerProc( void )
+{
+  uint32_t timeout;
+
+  __disable_irq();
+  if ( i2cCurrent != NULL )
+  {
+    timeout = i2cCurrent->timeout ? i2cCurrent->timeout : I2C_DEFAULTTIMEOUT;
+    if ( systickGetTicks() - i2cCurrent->started > timeout / CFG_SYSTICK_DELAY_IN_MS )
+    {
+      /* Disabling the controller drops it back to the idle state */
+      I2C_I2CCONCLR = I2CONCLR_I2ENC | I2CONCLR_STAC | I2CONCLR_SIC | I2CONCLR_AAC;
+      I2C_I2CCONSET = I2CONSET_I2EN;
+      I2CComplete( I2CSTATE_TIMEOUT );
+    }
+  }
+  __enable_irq();
+}
+
 /*****************************************************************************
 ** Function name:	I2CEngine
 **
@@ -324,7 +452,8 @@ uint32_t i2cInit( uint32_t I2cMode )
 **			steps are handled in the interrupt handler.
 **			Before this routine is called, the read
 **			length, write length and I2C master buffer
-**			need to be filled.
+**			need to be filled.  The transaction waits
+**			behind anything already queued.
 **
 ** parameters:		None
 ** Returned value:	Any of the I2CSTATE_... values. See i2c.h
@@ -332,19 +461,19 @@ uint32_t i2cInit( uint32_t I2cMode )
 *****************************************************************************/
 uint32_t i2cEngine( void ) 
 {
-  I2CMasterState = I2CSTATE_IDLE;
-  RdIndex = 0;
-  WrIndex = 0;
-  if ( I2CStart() != TRUE )
+  i2cGlobalTransfer.writeBuffer = (uint8_t *)I2CMasterBuffer;
+  i2cGlobalTransfer.writeLength = I2CWriteLength;
+  i2cGlobalTransfer.readBuffer = (uint8_t *)I2CSlaveBuffer;
+  i2cGlobalTransfer.readLength = I2CReadLength;
+  i2cGlobalTransfer.timeout = 0;
+  i2cGlobalTransfer.callback = NULL;
+
+  if ( i2cQueue( &i2cGlobalTransfer ) != TRUE )
   {
-	I2CStop();
-	return ( FALSE );
+    return ( FALSE );
   }
 
-  /* wait until the state is a terminal state */
-  while (I2CMasterState < 0x100);
-
-  return ( I2CMasterState );
+  return ( i2cWait( &i2cGlobalTransfer ) );
 }
 
 /*****************************************************************************
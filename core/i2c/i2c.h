@@ -20,7 +20,8 @@
  * These are states returned by the I2CEngine:
  *
  * IDLE     - is never returned but only used internally
- * PENDING  - is never returned but only used internally in the I2C functions
+ * QUEUED   - the transfer is waiting for the ones queued ahead of it
+ * PENDING  - the transfer is on the bus
  * ACK      - The transaction finished and the slave returned ACK (on all bytes)
  * NACK     - The transaction is aborted since the slave returned a NACK
  * SLA_NACK - The transaction is aborted since the slave returned a NACK on the SLA
@@ -29,6 +30,8 @@
  * ARB_LOSS - Arbitration loss during any part of the transaction.
  *            This could only happen in a multi master system or could also
  *            identify a hardware problem in the system.
+ * TIMEOUT  - The transfer didn't finish within its timeout and the
+ *            controller was reset (a device holding the bus, or no bus).
  */
 #define I2CSTATE_IDLE     0x000
 #define I2CSTATE_PENDING  0x001
@@ -36,11 +39,14 @@
 #define I2CSTATE_NACK     0x102
 #define I2CSTATE_SLA_NACK 0x103
 #define I2CSTATE_ARB_LOSS 0x104
+#define I2CSTATE_TIMEOUT  0x105
+#define I2CSTATE_QUEUED   0x002
 
 #define FAST_MODE_PLUS    0
 
 #define I2C_BUFSIZE       64
 #define MAX_TIMEOUT       0x00FFFFFF
+#define I2C_DEFAULTTIMEOUT 100        /* ms, for transfers with timeout 0 */
 
 #define I2CMASTER         0x01
 #define I2CSLAVE          0x02
@@ -84,10 +90,37 @@ extern volatile uint8_t I2CMasterBuffer[I2C_BUFSIZE];
 extern volatile uint8_t I2CSlaveBuffer[I2C_BUFSIZE];
 extern volatile uint32_t I2CReadLength, I2CWriteLength;
 
+/*
+ * One queued transaction.  The caller owns the descriptor and both
+ * buffers until state reaches a terminal (>= 0x100) value.  The
+ * callback runs in interrupt context (I2C or systick) and may queue
+ * further transfers, including this one again.
+ */
+struct i2cTransfer_s;
+typedef void (*i2cCallback_t)( struct i2cTransfer_s *transfer );
+
+typedef struct i2cTransfer_s
+{
+  uint8_t              *writeBuffer;  /* SLA+W, data, then SLA+R when reading */
+  uint32_t              writeLength;  /* Bytes up to (not including) SLA+R */
+  uint8_t              *readBuffer;
+  uint32_t              readLength;
+  uint32_t              timeout;      /* ms, 0 for I2C_DEFAULTTIMEOUT */
+  i2cCallback_t         callback;     /* Called when done, may be NULL */
+  void                 *context;      /* For the callback */
+  volatile uint32_t     state;        /* I2CSTATE_... */
+  uint32_t              started;      /* Internal: systick at START */
+  struct i2cTransfer_s *next;         /* Internal: queue link */
+} i2cTransfer_t;
+
 extern void I2C_IRQHandler( void );
 extern uint32_t i2cInit( uint32_t I2cMode );
 extern uint32_t i2cEngine( void );
 uint32_t i2cSendGeneralCall( void );
+uint32_t i2cQueue( i2cTransfer_t *transfer );
+uint32_t i2cWait( i2cTransfer_t *transfer );
+uint32_t i2cBusy( void );
+void i2cTimerProc( void );
 
 #endif /* end __I2C_H */
 /****************************************************************************
@@ -228,39 +228,72 @@ void sspInit (uint8_t portNum, sspClockPolarity_t polarity, sspClockPhase_t phas
 
 /**************************************************************************/
 /*! 
-    @brief Sends a block of data to the SSP0 port
+    @brief Transfers a block of data over the SSP0 port, keeping the
+    TX FIFO topped up while the RX FIFO is drained so that the bus is
+    never idle between bytes.
 
     @param[in]  portNum
                 The SPI port to use (0..1)
-    @param[in]  buf
-                Pointer to the data buffer
+    @param[in]  txBuf
+                Pointer to the data to send, or 0 to send 0xFF
+    @param[out] rxBuf
+                Pointer to the buffer for the received data, or 0 to
+                discard anything received
     @param[in]  length
-                Block length of the data buffer
+                Number of bytes to transfer
 */
 /**************************************************************************/
-void sspSend (uint8_t portNum, uint8_t *buf, uint32_t length)
+void sspTransfer (uint8_t portNum, const uint8_t *txBuf, uint8_t *rxBuf, uint32_t length)
 {
-  uint32_t i;
-  uint8_t Dummy = Dummy;
+  uint32_t txCount = 0;
+  uint32_t rxCount = 0;
+  uint8_t rxData;
 
   if (portNum == 0)
   {
-    for (i = 0; i < length; i++)
+    while (rxCount < length)
     {
-      /* Move on only if NOT busy and TX FIFO not full. */
-      while ((SSP_SSP0SR & (SSP_SSP0SR_TNF_NOTFULL | SSP_SSP0SR_BSY_BUSY)) != SSP_SSP0SR_TNF_NOTFULL);
-      SSP_SSP0DR = *buf;
-      buf++;
-  
-      while ( (SSP_SSP0SR & (SSP_SSP0SR_BSY_BUSY|SSP_SSP0SR_RNE_NOTEMPTY)) != SSP_SSP0SR_RNE_NOTEMPTY );
-      /* Whenever a byte is written, MISO FIFO counter increments, Clear FIFO 
-      on MISO. Otherwise, when SSP0Receive() is called, previous data byte
-      is left in the FIFO. */
-      Dummy = SSP_SSP0DR;
+      /* Never get more than a FIFO ahead, or the RX FIFO could overrun */
+      while ((txCount < length) && 
+             (txCount - rxCount < SSP_FIFOSIZE) && 
+             (SSP_SSP0SR & SSP_SSP0SR_TNF_NOTFULL))
+      {
+        SSP_SSP0DR = txBuf ? txBuf[txCount] : 0xFF;
+        txCount++;
+      }
+
+      /* Drain whatever has been received so far */
+      while (SSP_SSP0SR & SSP_SSP0SR_RNE_NOTEMPTY)
+      {
+        rxData = SSP_SSP0DR;
+        if (rxBuf)
+        {
+          rxBuf[rxCount] = rxData;
+        }
+        rxCount++;
+      }
     }
   }
+  return;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Sends a block of data to the SSP0 port
 
-  return; 
+    @param[in]  portNum
+                The SPI port to use (0..1)
+    @param[in]  buf
+                Pointer to the data buffer
+    @param[in]  length
+                Block length of the data buffer
+*/
+/**************************************************************************/
+void sspSend (uint8_t portNum, uint8_t *buf, uint32_t length)
+{
+  /* Anything received is discarded, so nothing is left in the RX FIFO
+     when sspReceive() is called */
+  sspTransfer(portNum, buf, 0, length);
 }
 
 /**************************************************************************/
@@ -277,23 +310,6 @@ void sspSend (uint8_t portNum, uint8_t *buf, uint32_t length)
 /**************************************************************************/
 void sspReceive(uint8_t portNum, uint8_t *buf, uint32_t length)
 {
-  uint32_t i;
-
-  if (portNum == 0)
-  {
-    for ( i = 0; i < length; i++ )
-    {
-      /* As long as the receive FIFO is not empty, data can be received. */
-      SSP_SSP0DR = 0xFF;
-  
-      /* Wait until the Busy bit is cleared */
-      while ( (SSP_SSP0SR & (SSP_SSP0SR_BSY_BUSY|SSP_SSP0SR_RNE_NOTEMPTY)) != SSP_SSP0SR_RNE_NOTEMPTY );
-      
-      *buf = SSP_SSP0DR;
-      buf++;
-    }
-  }
-
-  return; 
+  /* 0xFF is clocked out while receiving */
+  sspTransfer(portNum, 0, buf, length);
 }
-
@@ -79,6 +79,7 @@ sspClockPhase_t;
 
 extern void SSP_IRQHandler (void);
 void sspInit (uint8_t portNum, sspClockPolarity_t polarity, sspClockPhase_t phase);
+void sspTransfer (uint8_t portNum, const uint8_t *txBuf, uint8_t *rxBuf, uint32_t length);
 void sspSend (uint8_t portNum, uint8_t *buf, uint32_t length);
 void sspReceive (uint8_t portNum, uint8_t *buf, uint32_t length);
 
@@ -62,12 +62,17 @@
 /**************************************************************************/
 
 #include "systick.h"
+#include "core/i2c/i2c.h"
 
 #ifdef CFG_SDCARD
 #include "drivers/fatfs/diskio.h"
 volatile uint32_t fatTicks = 0;
 #endif
 
+#ifdef CFG_TFTLCD
+#include "drivers/lcd/tft/touchscreen.h"
+#endif
+
 volatile uint32_t systickTicks = 0;             // 1ms tick counter
 volatile uint32_t systickRollovers = 0;
 
@@ -91,6 +96,13 @@ void SysTick_Handler (void)
     disk_timerproc();
   }
   #endif
+
+  #ifdef CFG_TFTLCD
+  tsTimerProc();
+  #endif
+
+  // Time out stuck I2C transfers
+  i2cTimerProc();
 }
 
 /**************************************************************************/
@@ -342,3 +342,67 @@ void timer32Init(uint8_t timerNum, uint32_t timerInterval)
 }
 
 
+
+/**************************************************************************/
+/*! 
+    @brief  Initialises the specified 32-bit timer as a free-running
+            counter (no match interrupt, wraps at 0xFFFFFFFF) and starts
+            it.  The current count can be read with timer32GetCount.
+    
+    @param[in]  timerNum
+                The 32-bit timer to initiliase (0..1)
+    @param[in]  prescale
+                The number of clock 'ticks' per count, for example
+                TIMER32_CCLK_1US to count in microseconds
+
+    @note   The timer can't be used with timer32Init or timer32Delay at
+            the same time.
+*/
+/**************************************************************************/
+void timer32InitCounter(uint8_t timerNum, uint32_t prescale)
+{
+  if (prescale < 1)
+  {
+    prescale = 1;
+  }
+
+  if ( timerNum == 0 )
+  {
+    /* Enable the clock for CT32B0 */
+    SCB_SYSAHBCLKCTRL |= (SCB_SYSAHBCLKCTRL_CT32B0);
+
+    TMR_TMR32B0PR = prescale - 1;
+    TMR_TMR32B0MCR = (TMR_TMR32B0MCR_MR0_INT_DISABLED | TMR_TMR32B0MCR_MR0_RESET_DISABLED);
+
+    /* Clear the counter, then let it run */
+    TMR_TMR32B0TCR = TMR_TMR32B0TCR_COUNTERRESET_ENABLED;
+    TMR_TMR32B0TCR = TMR_TMR32B0TCR_COUNTERENABLE_ENABLED;
+  }
+
+  else if ( timerNum == 1 )
+  {
+    /* Enable the clock for CT32B1 */
+    SCB_SYSAHBCLKCTRL |= (SCB_SYSAHBCLKCTRL_CT32B1);
+
+    TMR_TMR32B1PR = prescale - 1;
+    TMR_TMR32B1MCR = (TMR_TMR32B1MCR_MR0_INT_DISABLED | TMR_TMR32B1MCR_MR0_RESET_DISABLED);
+
+    /* Clear the counter, then let it run */
+    TMR_TMR32B1TCR = TMR_TMR32B1TCR_COUNTERRESET_ENABLED;
+    TMR_TMR32B1TCR = TMR_TMR32B1TCR_COUNTERENABLE_ENABLED;
+  }
+  return;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Returns the current count of the specified 32-bit timer
+
+    @param[in]  timerNum
+                The 32-bit timer to read (0..1)
+*/
+/**************************************************************************/
+uint32_t timer32GetCount(uint8_t timerNum)
+{
+  return (timerNum == 0) ? TMR_TMR32B0TC : TMR_TMR32B1TC;
+}
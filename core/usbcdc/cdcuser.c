@@ -40,6 +40,7 @@ unsigned char NotificationBuf [10];
 CDC_LINE_CODING CDC_LineCoding  = {CFG_USBCDC_BAUDRATE, 0, 0, 8};
 unsigned short  CDC_SerialState = 0x0000;
 unsigned short  CDC_DepInEmpty  = 1;                   // Data IN EP is empty
+static volatile unsigned short CDC_LineState = 0;     // Last SET_CONTROL_LINE_STATE bitmap (bit 0: DTR)
 
 /*----------------------------------------------------------------------------
   CDC Initialisation
@@ -179,7 +180,7 @@ uint32_t CDC_GetLineCoding (void) {
  *---------------------------------------------------------------------------*/
 uint32_t CDC_SetControlLineState (unsigned short wControlSignalBitmap) {
 
-  /* ... add code to handle request */
+  CDC_LineState = wControlSignalBitmap;
   return (TRUE);
 }
 
@@ -298,6 +299,14 @@ CDC_getchar(void)
 	return (fifo_get(&rx_fifo));
 }
 
+/* True while the host is configured and has the port open (DTR set) */
+int
+CDC_isOpen(void)
+{
+
+	return (USB_Configuration && (CDC_LineState & 0x0001));
+}
+
 int
 CDC_putchar(int8_t c)
 {
@@ -321,3 +330,23 @@ CDC_putchar(int8_t c)
 	__enable_irq();
 	return (retval);
 }
+
+/*
+ * Send up to one full packet (64 bytes) straight from the caller's buffer,
+ * without going through tx_fifo.  Returns 0 while the IN endpoint is still
+ * busy (or CDC_putchar data is waiting), in which case nothing was sent.
+ */
+int
+CDC_writePacket(uint8_t *buf, uint32_t len)
+{
+	int retval = 0;
+
+	__disable_irq();
+	if (tx_idle && fifo_empty(&tx_fifo)) {
+		USB_WriteEP (CDC_DEP_IN, buf, len);
+		tx_idle = 0;
+		retval = 1;
+	}
+	__enable_irq();
+	return (retval);
+}
@@ -62,6 +62,8 @@ extern unsigned short CDC_DepInEmpty;         // DataEndPoint IN empty
 /* PHK */
 int CDC_getchar(void);
 int CDC_putchar(int8_t c);
+int CDC_isOpen(void);
+int CDC_writePacket(uint8_t *buf, uint32_t len);
 
 #endif  /* __CDCUSER_H__ */
 
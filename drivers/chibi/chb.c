@@ -37,6 +37,7 @@
 #include "chb.h"
 #include "chb_drvr.h"
 #include "chb_buf.h"
+#include "chb_survey.h"
 
 static chb_pcb_t pcb;
 // these are for the duplicate checking and rejection
@@ -52,6 +53,14 @@ void chb_init()
     memset(&pcb, 0, sizeof(chb_pcb_t));
     pcb.src_addr = chb_get_short_addr();
     chb_drvr_init();
+
+#ifdef CFG_CHIBI_AUTOCHANNEL
+    #if (CFG_CHIBI_MODE != 1) && (CFG_CHIBI_MODE != 3)
+        #error "CFG_CHIBI_AUTOCHANNEL needs a 915 MHz mode (OQPSK_915MHZ or BPSK40_915MHZ)"
+    #endif
+    // listen to channels 1-10 for a while and settle on the quietest
+    chb_set_channel(chb_survey_run(1, CHB_SURVEY_MAXCHANNEL, CFG_CHIBI_AUTOCHANNEL));
+#endif
 }
 
 /**************************************************************************/
@@ -99,12 +108,13 @@ static U8 chb_gen_hdr(U8 *hdr, U16 addr, U8 len)
 
 /**************************************************************************/
 /*!
-
+    Send data, splitting it into frames of up to CHB_MAX_PAYLOAD bytes, and
+    wait for each frame to go out. Stops at the first frame that fails and
+    returns its status.
 */
 /**************************************************************************/
 U8 chb_write(U16 addr, U8 *data, U8 len)
 {
-    // U8 status, frm_len, hdr_len, hdr[CHB_HDR_SZ + 1];
     U8 status, frm_len, hdr[CHB_HDR_SZ + 1];
     
     while (len > 0)
@@ -114,42 +124,92 @@ U8 chb_write(U16 addr, U8 *data, U8 len)
         frm_len = (len > CHB_MAX_PAYLOAD) ? CHB_MAX_PAYLOAD : len;
 
         // gen frame header
-        // hdr_len = chb_gen_hdr(hdr, addr, frm_len);
         chb_gen_hdr(hdr, addr, frm_len);
 
         // send data to chip
         status = chb_tx(hdr, data, frm_len);
-    
         if (status != CHB_SUCCESS)
         {
-            switch (status)
-            {
-            case RADIO_SUCCESS:
-                // fall through
-            case CHB_SUCCESS_DATA_PENDING:
-                pcb.txd_success++;
-                break;
-
-            case CHB_NO_ACK:
-                pcb.txd_noack++;
-                break;
-
-            case CHB_CHANNEL_ACCESS_FAILURE:
-                pcb.txd_channel_fail++;
-                break;
-
-            default:
-                break;
-            }
             return status;
         }
 
         // adjust len and restart
+        data += frm_len;
+        len = len - frm_len;
+    }
+    return CHB_SUCCESS;
+}
+
+/**************************************************************************/
+/*!
+    Queue data for transmission and return without waiting for it. All of
+    the frames it is split into are queued, or none of them are (in which
+    case CHB_TX_QUEUE_FULL is returned). Each frame's result goes to the
+    callback set with chb_set_tx_callback.
+*/
+/**************************************************************************/
+U8 chb_write_async(U16 addr, U8 *data, U8 len)
+{
+    U8 frm_len, hdr[CHB_HDR_SZ + 1];
+
+    if (chb_tx_free() < (len + CHB_MAX_PAYLOAD - 1) / CHB_MAX_PAYLOAD)
+    {
+        return CHB_TX_QUEUE_FULL;
+    }
+
+    while (len > 0)
+    {
+        frm_len = (len > CHB_MAX_PAYLOAD) ? CHB_MAX_PAYLOAD : len;
+        chb_gen_hdr(hdr, addr, frm_len);
+        chb_tx_queue(hdr, data, frm_len);
+        data += frm_len;
         len = len - frm_len;
     }
     return CHB_SUCCESS;
 }
 
+/**************************************************************************/
+/*!
+    Set the function called (from the radio ISR) as each queued frame
+    completes, or NULL for none
+*/
+/**************************************************************************/
+void chb_set_tx_callback(chb_tx_cb_t cb)
+{
+    pcb.tx_done = cb;
+}
+
+/**************************************************************************/
+/*!
+    Returns the oldest received frame, in place in the receive queue, or
+    NULL if nothing has been received. The descriptor and its data stay
+    valid until chb_free_frame is called, so nothing needs to be copied.
+*/
+/**************************************************************************/
+chb_frame_t *chb_get_frame()
+{
+    return chb_buf_peek();
+}
+
+/**************************************************************************/
+/*!
+    Releases the frame returned by chb_get_frame
+*/
+/**************************************************************************/
+void chb_free_frame()
+{
+    chb_buf_release();
+
+    // the ISR may queue a frame between the check and the write, so
+    // keep it out while the flag is updated
+    CHB_ENTER_CRIT();
+    if (!chb_buf_get_len())
+    {
+        pcb.data_rcv = false;
+    }
+    CHB_LEAVE_CRIT();
+}
+
 /**************************************************************************/
 /*!
     Read data from the buffer. Need to pass in a buffer of at leasts max frame
@@ -161,49 +221,29 @@ U8 chb_write(U16 addr, U8 *data, U8 len)
 /**************************************************************************/
 U8 chb_read(chb_rx_data_t *rx)
 {
-    U8 i, len, seq, *data_ptr;
-
-    data_ptr = rx->data;
+    U8 len, seq, *data_ptr;
+    chb_frame_t *frame;
 
-    // first byte is always len. check it to make sure 
-    // we have a valid len byte.
-    if ((len = chb_buf_read()) > CHB_MAX_FRAME_LENGTH)
+    if ((frame = chb_get_frame()) == NULL)
     {
         return 0;
     }
-    *data_ptr++ = len;
+    len = frame->len;
 
-    // load the rest of the data into buffer
-    for (i=0; i<len; i++)
-    {
-        *data_ptr++ = chb_buf_read();
-    }
-
-    // we're using the buffer that's fed in as an argument as a temp
-    // buffer as well to save resources.
-    // we'll use it as temp storage to parse the frame. then move the frame
-    // down so that only the payload will be in the buffer.
-
-    // extract the sequence number
-    data_ptr = rx->data + 3;    // location of sequence number
-    seq = *data_ptr;
-
-    // parse the buffer and extract the dest and src addresses
-    data_ptr = rx->data + 6;                // location of dest addr
+    // extract the sequence number and the dest and src addresses
+    seq = frame->data[2];
+    data_ptr = frame->data + 5;             // location of dest addr
     rx->dest_addr = *(U16 *)data_ptr;
     data_ptr += sizeof(U16);
     rx->src_addr = *(U16 *)data_ptr;
     data_ptr += sizeof(U16);
 
-    // if the data in the rx buf is 0, then clear the rx_flag. otherwise, keep it raised
-    if (!chb_buf_get_len())
-    {
-        pcb.data_rcv = false;
-    }
-
 #if (CFG_CHIBI_PROMISCUOUS == 1)
-    // if we're in promiscuous mode, we don't want to do any duplicate rejection and we don't want to move the payload
-    // to the front of the buffer. We want to capture the full frame so just keep the frame intact and return the length.
+    // if we're in promiscuous mode, we don't want to do any duplicate rejection and we don't want to strip
+    // the header. the caller gets the len byte followed by the frame, as much of it as fits.
+    rx->data[0] = len;
+    memcpy(rx->data + 1, frame->data, (len < CHB_MAX_PAYLOAD) ? len : CHB_MAX_PAYLOAD - 1);
+    chb_free_frame();
     return len;
 #else
     // duplicate frame check (dupe check). we want to remove frames that have been already been received since they 
@@ -214,6 +254,7 @@ U8 chb_read(chb_rx_data_t *rx)
     {
         // this is a duplicate frame from a retry. the remote node thinks we didn't receive 
         // it properly. discard.
+        chb_free_frame();
         return 0;
     }
     else
@@ -222,10 +263,21 @@ U8 chb_read(chb_rx_data_t *rx)
         prev_src_addr = rx->src_addr;
     }
 
-    // move the payload down to the beginning of the data buffer
-    memmove(rx->data, data_ptr, len - CHB_HDR_SZ);
+    // copy the payload out, the only copy that is made
+    if (len < CHB_HDR_SZ + CHB_FCS_LEN)
+    {
+        chb_free_frame();
+        return 0;
+    }
+    len = len - CHB_HDR_SZ - CHB_FCS_LEN;
+    if (len > CHB_MAX_PAYLOAD)
+    {
+        len = CHB_MAX_PAYLOAD;
+    }
+    memcpy(rx->data, data_ptr, len);
+    chb_free_frame();
+
     // finally, return the len of the payload
-    return len - CHB_HDR_SZ - CHB_FCS_LEN;
+    return len;
 #endif
 }
-
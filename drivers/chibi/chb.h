@@ -35,6 +35,7 @@
 #define CHIBI_H
 
 #include "types.h"
+#include "chb_buf.h"
 
 #define CHB_HDR_SZ        9    // FCF + seq + pan_id + dest_addr + src_addr (2 + 1 + 2 + 2 + 2)
 #define CHB_FCS_LEN       2
@@ -61,9 +62,14 @@ enum
     CHB_SUCCESS_DATA_PENDING    = 1,
     CHB_CHANNEL_ACCESS_FAILURE  = 3,
     CHB_NO_ACK                  = 5,
-    CHB_INVALID                 = 7
+    CHB_INVALID                 = 7,
+    CHB_TX_QUEUE_FULL           = 8     // chb_write_async: no room in the tx queue
 };
 
+// Called from the radio ISR when a queued frame has been sent (or has
+// failed), with the frame's sequence number and its CHB_* status
+typedef void (*chb_tx_cb_t)(U8 seq, U8 status);
+
 // Chibi Protocol control block
 typedef struct
 {
@@ -71,6 +77,7 @@ typedef struct
     U8 seq;
     volatile bool data_rcv;
     volatile bool tx_end;
+    chb_tx_cb_t tx_done;
 
     // stats
     U16 rcvd_xfers;
@@ -95,6 +102,10 @@ typedef struct
 void chb_init();
 chb_pcb_t *chb_get_pcb();
 U8 chb_write(U16 addr, U8 *data, U8 len);
+U8 chb_write_async(U16 addr, U8 *data, U8 len);
+void chb_set_tx_callback(chb_tx_cb_t cb);
 U8 chb_read(chb_rx_data_t *rx);
+chb_frame_t *chb_get_frame();
+void chb_free_frame();
 
 #endif
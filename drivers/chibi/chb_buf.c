@@ -31,13 +31,24 @@
     Please post support questions to the FreakLabs forum.
 
 *******************************************************************/
-#include <stdio.h>
 #include "chb_buf.h"
 #include "projectconfig.h"
 
-static U8 chb_buf[CFG_CHIBI_BUFFERSIZE];
-static volatile U32 rd_ptr, wr_ptr;
-static volatile U32 len;
+/*
+    Received frames are kept in a ring of fixed size frame slots.  The
+    radio ISR is the only producer and the main loop the only consumer,
+    so the two indexes need no locking: the ISR only moves wr_idx, the
+    consumer only moves rd_idx.  They count modulo twice the number of
+    slots, which tells a full ring apart from an empty one.
+*/
+#if CFG_CHIBI_RXFRAMES < 1 || CFG_CHIBI_RXFRAMES > 127
+    #error "CFG_CHIBI_RXFRAMES must be between 1 and 127"
+#endif
+
+#define CHB_BUF_WRAP    (2 * CFG_CHIBI_RXFRAMES)
+
+static chb_frame_t chb_buf[CFG_CHIBI_RXFRAMES];
+static volatile U8 rd_idx, wr_idx;
 
 /**************************************************************************/
 /*!
@@ -46,44 +57,70 @@ static volatile U32 len;
 /**************************************************************************/
 void chb_buf_init()
 {
-    rd_ptr = 0;
-    wr_ptr = 0;
-    len = 0;
+    rd_idx = 0;
+    wr_idx = 0;
 }
 
 /**************************************************************************/
 /*!
-
+    Returns the free slot the next received frame should be read into,
+    or NULL if all slots are taken. The frame is only visible to the
+    consumer once chb_buf_commit is called.
 */
 /**************************************************************************/
-void chb_buf_write(U8 data)
+chb_frame_t *chb_buf_alloc()
 {
-    chb_buf[wr_ptr] = data;
-    wr_ptr = (wr_ptr + 1) % CFG_CHIBI_BUFFERSIZE;
-    len++;
+    if (chb_buf_get_len() >= CFG_CHIBI_RXFRAMES)
+    {
+        return NULL;
+    }
+    return &chb_buf[wr_idx % CFG_CHIBI_RXFRAMES];
 }
 
 /**************************************************************************/
 /*!
-
+    Hands the slot returned by chb_buf_alloc over to the consumer
 */
 /**************************************************************************/
-U8 chb_buf_read()
+void chb_buf_commit()
 {
-    U8 data;
+    wr_idx = (wr_idx + 1) % CHB_BUF_WRAP;
+}
 
-    data = chb_buf[rd_ptr];
-    rd_ptr = (rd_ptr + 1) % CFG_CHIBI_BUFFERSIZE;
-    len--;
-    return data;
+/**************************************************************************/
+/*!
+    Returns the oldest received frame (in place, not a copy), or NULL if
+    there is none. It stays valid until chb_buf_release is called.
+*/
+/**************************************************************************/
+chb_frame_t *chb_buf_peek()
+{
+    if (rd_idx == wr_idx)
+    {
+        return NULL;
+    }
+    return &chb_buf[rd_idx % CFG_CHIBI_RXFRAMES];
 }
 
 /**************************************************************************/
 /*!
+    Frees the frame returned by chb_buf_peek
+*/
+/**************************************************************************/
+void chb_buf_release()
+{
+    if (rd_idx != wr_idx)
+    {
+        rd_idx = (rd_idx + 1) % CHB_BUF_WRAP;
+    }
+}
 
+/**************************************************************************/
+/*!
+    Returns the number of frames waiting to be read
 */
 /**************************************************************************/
 U32 chb_buf_get_len()
 {
-    return len;
+    return (wr_idx + CHB_BUF_WRAP - rd_idx) % CHB_BUF_WRAP;
 }
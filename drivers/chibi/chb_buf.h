@@ -36,9 +36,25 @@
 
 #include "types.h"
 
+#define CHB_BUF_FRAMESIZE   127     // aMaxPHYPacketSize
+
+// One received frame, filled straight from the radio's frame buffer
+typedef struct
+{
+    U8 len;                         // PHY frame length, including the FCS
+    U8 lqi;                         // link quality, as appended by the radio
+    U8 ed;                          // energy detect level (PHY_ED_LEVEL)
+    U8 crc_ok;                      // 1 if the FCS was valid
+    U32 timestamp;                  // systick (ms) when the frame ended
+    U32 rx_start;                   // timer32 count (us) at RX_START, see CFG_CHIBI_RXTIMESTAMP
+    U8 data[CHB_BUF_FRAMESIZE];     // MAC header, payload and FCS
+} chb_frame_t;
+
 void chb_buf_init();
-void chb_buf_write(U8 data);
-U8 chb_buf_read();
+chb_frame_t *chb_buf_alloc();
+void chb_buf_commit();
+chb_frame_t *chb_buf_peek();
+void chb_buf_release();
 U32 chb_buf_get_len();
 
 #endif
@@ -32,6 +32,7 @@
 
 *******************************************************************/
 #include <stdio.h>
+#include <string.h>
 #include "chb.h"
 #include "chb_drvr.h"
 #include "chb_buf.h"
@@ -39,11 +40,33 @@
 #include "chb_eeprom.h"
 
 #include "core/systick/systick.h"
+#ifdef CFG_CHIBI_RXTIMESTAMP
+  #include "core/timer32/timer32.h"
+#endif
 #include "core/timer16/timer16.h"
 
 // store string messages in flash rather than RAM
-const char chb_err_overflow[] = "BUFFER FULL. TOSSING INCOMING DATA\r\n";
 const char chb_err_init[] = "RADIO NOT INITIALIZED PROPERLY\r\n";
+
+#if CFG_CHIBI_TXFRAMES < 1 || CFG_CHIBI_TXFRAMES > 127
+    #error "CFG_CHIBI_TXFRAMES must be between 1 and 127"
+#endif
+
+// transmit queue. each slot holds a complete frame as it is written to the
+// radio: the len byte, the header and the payload (the radio adds the FCS).
+// the indexes count modulo twice the number of slots, like the rx queue.
+#define CHB_TXQ_WRAP    (2 * CFG_CHIBI_TXFRAMES)
+
+static U8 chb_txq[CFG_CHIBI_TXFRAMES][1 + CHB_BUF_FRAMESIZE];
+static volatile U8 txq_rd, txq_wr;
+static volatile bool tx_active = false;
+static volatile U8 tx_status[CFG_CHIBI_TXFRAMES];   // result of the last frame sent from each slot
+
+// nesting depth of CHB_ENTER_CRIT
+volatile U8 chb_crit_nest = 0;
+
+// timer32 count at the last RX_START, for the frame that follows it
+static volatile U32 rx_start = 0;
 /**************************************************************************/
 /*!
 
@@ -290,11 +313,24 @@ void chb_frame_write(U8 *hdr, U8 hdr_len, U8 *data, U8 data_len)
 
 */
 /**************************************************************************/
-static void chb_frame_read()
+/*!
+    Reads the received frame from the radio straight into a free frame
+    slot. If every slot is taken the frame is left in the radio (the
+    next one overwrites it) and only counted as an overflow.
+*/
+/**************************************************************************/
+static void chb_frame_read(U8 ed, U8 crc_ok)
 {
-    U8 i, len, data;
+    U8 len;
+    chb_frame_t *frame;
+
+    frame = chb_buf_alloc();
+    if (frame == NULL)
+    {
+        chb_get_pcb()->overflow++;
+        return;
+    }
 
-    // CHB_ENTER_CRIT();
     CHB_SPI_ENABLE();
 
     /*Send frame read command and read the length.*/
@@ -304,38 +340,18 @@ static void chb_frame_read()
     /*Check for correct frame length.*/
     if ((len >= CHB_MIN_FRAME_LENGTH) && (len <= CHB_MAX_FRAME_LENGTH))
     {
-        // check to see if there is room to write the frame in the buffer. if not, then drop it
-        if (len < (CFG_CHIBI_BUFFERSIZE - chb_buf_get_len()))
-        {
-            chb_buf_write(len);
-            
-            for (i=0; i<len; i++)
-            {
-                data = chb_xfer_byte(0);
-                chb_buf_write(data);
-            }
-        }
-        else
-        {
-            // we've overflowed the buffer. toss the data and do some housekeeping
-            chb_pcb_t *pcb = chb_get_pcb();
-
-            // read out the data and throw it away
-            for (i=0; i<len; i++)
-            {
-                data = chb_xfer_byte(0);
-            }
-
-            // Increment the overflow stat
-            pcb->overflow++;
-
-            // print the error message
-            printf(chb_err_overflow);
-        }
+        // the PSDU is followed by the LQI byte
+        chb_read_burst(frame->data, len);
+        frame->lqi = chb_xfer_byte(0);
+        frame->len = len;
+        frame->ed = ed;
+        frame->crc_ok = crc_ok;
+        frame->timestamp = systickGetTicks();
+        frame->rx_start = rx_start;
+        chb_buf_commit();
     }
 
     CHB_SPI_DISABLE();
-    CHB_LEAVE_CRIT();
 }
 
 /**************************************************************************/
@@ -496,6 +512,37 @@ U8 chb_set_channel(U8 channel)
     return ((chb_reg_read(PHY_CC_CCA) & 0x1f) == channel) ? RADIO_SUCCESS : RADIO_TIMED_OUT;
 }
 
+/**************************************************************************/
+/*!
+    Get the channel the radio is currently tuned to
+*/
+/**************************************************************************/
+U8 chb_get_channel()
+{
+    return chb_reg_read(PHY_CC_CCA) & 0x1f;
+}
+
+/**************************************************************************/
+/*!
+    Do a manual energy detect measurement on the current channel and
+    return the ED level (0..0x54, about 1dB per step). This switches the
+    radio to RX_ON if it isn't already there, since manual measurements
+    don't work in the extended operating mode. Takes about half a ms.
+*/
+/**************************************************************************/
+U8 chb_ed_measure()
+{
+    if (chb_get_state() != RX_ON)
+    {
+        chb_set_state(RX_ON);
+    }
+
+    // any write to PHY_ED_LEVEL starts a measurement
+    chb_reg_write(PHY_ED_LEVEL, 0);
+    chb_delay_us(TIME_ED_MEASURE);
+    return chb_reg_read(PHY_ED_LEVEL);
+}
+
 /**************************************************************************/
 /*!
     Set the power level
@@ -645,39 +692,184 @@ void chb_set_hgm(U8 enb)
 
 /**************************************************************************/
 /*!
-    Load the data into the fifo, initiate a transmission attempt,
-    and return the status of the transmission attempt.
+    Load the frame at the head of the tx queue into the fifo and initiate
+    a transmission attempt. TRX_END (chb_tx_done) finishes it.
 */
 /**************************************************************************/
-U8 chb_tx(U8 *hdr, U8 *data, U8 len)
+static void chb_tx_start()
 {
-    U8 state = chb_get_state();
-    chb_pcb_t *pcb = chb_get_pcb();
-
-    if ((state == BUSY_TX) || (state == BUSY_TX_ARET))
-    {
-        return RADIO_WRONG_STATE;
-    }
+    U8 *frame = chb_txq[txq_rd % CFG_CHIBI_TXFRAMES];
 
     // TODO: check why we need to transition to the off state before we go to tx_aret_on
     chb_set_state(TRX_OFF);
     chb_set_state(TX_ARET_ON);
 
-    // TODO: try and start the frame transmission by writing TX_START command instead of toggling
-    // sleep pin...i just feel like it's kind of weird...
-
-    // write frame to buffer. first write header into buffer (add 1 for len byte), then data. 
-    chb_frame_write(hdr, CHB_HDR_SZ + 1, data, len);
+    // write frame to buffer: the len byte, header and payload (the len
+    // byte counts the FCS, which the radio appends itself)
+    chb_frame_write(frame, frame[0] - CHB_FCS_LEN + 1, NULL, 0);
 
     //Do frame transmission
     chb_reg_read_mod_write(TRX_STATE, CMD_TX_START, 0x1F);
+}
 
-    // wait for the transmission to end, signalled by the TRX END flag
-    while (!pcb->tx_end);
-    pcb->tx_end = false;
+/**************************************************************************/
+/*!
+    Called from the ISR when a transmission has ended. Records the result,
+    reports it and starts the next queued frame, if there is one.
+    Returns true if another transmission was started.
+*/
+/**************************************************************************/
+static bool chb_tx_done()
+{
+    chb_pcb_t *pcb = chb_get_pcb();
+    U8 slot = txq_rd % CFG_CHIBI_TXFRAMES;
+    U8 seq = chb_txq[slot][3];
+    U8 status;
+
+    // the status has to be read before leaving the tx state
+    status = tx_status[slot] = chb_get_status();
+    switch (status)
+    {
+    case CHB_SUCCESS:
+        // fall through
+    case CHB_SUCCESS_DATA_PENDING:
+        pcb->txd_success++;
+        break;
+
+    case CHB_NO_ACK:
+        pcb->txd_noack++;
+        break;
+
+    case CHB_CHANNEL_ACCESS_FAILURE:
+        pcb->txd_channel_fail++;
+        break;
+
+    default:
+        break;
+    }
+
+    txq_rd = (txq_rd + 1) % CHB_TXQ_WRAP;
+    if (txq_rd == txq_wr)
+    {
+        tx_active = false;
+    }
+    else
+    {
+        chb_tx_start();
+    }
+
+    if (pcb->tx_done)
+    {
+        pcb->tx_done(seq, status);
+    }
+    pcb->tx_end = true;
+
+    return tx_active;
+}
+
+/**************************************************************************/
+/*!
+    Returns the number of free slots in the tx queue
+*/
+/**************************************************************************/
+U8 chb_tx_free()
+{
+    return CFG_CHIBI_TXFRAMES - (txq_wr + CHB_TXQ_WRAP - txq_rd) % CHB_TXQ_WRAP;
+}
+
+/**************************************************************************/
+/*!
+    Returns true while frames are queued or on the air
+*/
+/**************************************************************************/
+bool chb_tx_busy()
+{
+    return tx_active;
+}
+
+/**************************************************************************/
+/*!
+    Copy a frame into the tx queue and return straight away. If the radio
+    is idle the transmission starts now, otherwise the ISR starts it when
+    the frames ahead of it are done. Returns CHB_TX_QUEUE_FULL if there
+    is no free slot.
+*/
+/**************************************************************************/
+U8 chb_tx_queue(U8 *hdr, U8 *data, U8 len)
+{
+    U8 *frame;
+    bool start;
+
+    // dont allow transmission longer than max frame size
+    if ((CHB_HDR_SZ + 1 + len) > 127)
+    {
+        return CHB_INVALID;
+    }
+
+    if (!chb_tx_free())
+    {
+        return CHB_TX_QUEUE_FULL;
+    }
+
+    // the hdr starts with the len byte
+    frame = chb_txq[txq_wr % CFG_CHIBI_TXFRAMES];
+    memcpy(frame, hdr, CHB_HDR_SZ + 1);
+    memcpy(frame + CHB_HDR_SZ + 1, data, len);
+
+    // publish the frame, and find out whether the ISR will pick it up
+    CHB_ENTER_CRIT();
+    txq_wr = (txq_wr + 1) % CHB_TXQ_WRAP;
+    start = !tx_active;
+    tx_active = true;
+    CHB_LEAVE_CRIT();
+
+    if (start)
+    {
+        chb_tx_start();
+    }
+    return CHB_SUCCESS;
+}
+
+/**************************************************************************/
+/*!
+    Returns true while the frame queued at index idx is still waiting or
+    on the air
+*/
+/**************************************************************************/
+static bool chb_tx_pending(U8 idx)
+{
+    U8 rd = txq_rd;
+
+    return ((idx + CHB_TXQ_WRAP - rd) % CHB_TXQ_WRAP) < ((txq_wr + CHB_TXQ_WRAP - rd) % CHB_TXQ_WRAP);
+}
+
+/**************************************************************************/
+/*!
+    Queue a frame, wait until it has been sent, and return the status of
+    the transmission attempt for this frame (not whichever frame the
+    radio sent last).
+*/
+/**************************************************************************/
+U8 chb_tx(U8 *hdr, U8 *data, U8 len)
+{
+    U8 status, idx;
+
+    // wait for room in the queue, then for it (and anything queued ahead
+    // of it) to go out. frames are only queued from here and chb_tx_queue,
+    // so the frame goes into the slot at txq_wr.
+    do
+    {
+        idx = txq_wr;
+        status = chb_tx_queue(hdr, data, len);
+    } while (status == CHB_TX_QUEUE_FULL);
+    if (status != CHB_SUCCESS)
+    {
+        return status;
+    }
+    while (chb_tx_pending(idx));
 
     // check the status of the transmission
-    return chb_get_status();
+    return tx_status[idx % CFG_CHIBI_TXFRAMES];
 }
 
 /**************************************************************************/
@@ -796,6 +988,11 @@ void chb_drvr_init()
     timer16Init(0, 0xFFFF);
     timer16Enable(0);
 
+#ifdef CFG_CHIBI_RXTIMESTAMP
+    // 32-bit timer counting microseconds, for the frame timestamps
+    timer32InitCounter(CFG_CHIBI_RXTIMESTAMP, TIMER32_CCLK_1US);
+#endif
+
     // Set sleep and reset as output
     gpioSetDir(CHB_SLPTRPORT, CHB_SLPTRPIN, 1);
     gpioSetDir(CHB_RSTPORT, CHB_RSTPIN, 1);
@@ -851,6 +1048,10 @@ void chb_ISR_Handler (void)
     // U8 dummy, state, intp_src = 0;
     U8 state, intp_src = 0;
     chb_pcb_t *pcb = chb_get_pcb();
+#ifdef CFG_CHIBI_RXTIMESTAMP
+    // read the timer before the slow SPI access to keep the latency constant
+    U32 now = timer32GetCount(CFG_CHIBI_RXTIMESTAMP);
+#endif
 
     CHB_ENTER_CRIT();
 
@@ -869,6 +1070,9 @@ void chb_ISR_Handler (void)
         /*Handle the incomming interrupt. Prioritized.*/
         if ((intp_src & CHB_IRQ_RX_START_MASK))
         {
+#ifdef CFG_CHIBI_RXTIMESTAMP
+            rx_start = now;
+#endif
             intp_src &= ~CHB_IRQ_RX_START_MASK;
         }
         else if (intp_src & CHB_IRQ_TRX_END_MASK)
@@ -883,18 +1087,21 @@ void chb_ISR_Handler (void)
                 // get the crc
                 pcb->crc = (chb_reg_read(PHY_RSSI) & (1<<7)) ? 1 : 0;
 
-                // if the crc is not valid, then do not read the frame and set the rx flag
-                if (pcb->crc)
+                // frames with a bad crc are dropped, except when sniffing
+                // (they are still flagged as bad in the frame descriptor)
+                if (pcb->crc || (CFG_CHIBI_PROMISCUOUS == 1))
                 {
                     // get the data
-                    chb_frame_read();
+                    chb_frame_read(pcb->ed, pcb->crc);
                     pcb->rcvd_xfers++;
                     pcb->data_rcv = true;
                 }
             }
-            else
+            else if (tx_active && chb_tx_done())
             {
-                pcb->tx_end = true;
+                // the next queued frame is already on its way
+                intp_src &= ~CHB_IRQ_TRX_END_MASK;
+                continue;
             }
             intp_src &= ~CHB_IRQ_TRX_END_MASK;
             while (chb_set_state(RX_STATE) != RADIO_SUCCESS);
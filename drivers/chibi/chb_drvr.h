@@ -83,8 +83,13 @@
 //#define CHB_RADIO_IRQ       INT6_vect
 //#define CHB_RADIO_IRQ_PIN   INT6
     
-#define CHB_ENTER_CRIT()    __disable_irq()
-#define CHB_LEAVE_CRIT()    __enable_irq()
+// critical sections nest, and interrupts are only enabled again when the
+// outermost one ends. the ISR runs in one, so the register and fifo
+// functions it calls (e.g. to start the next queued frame) can't turn
+// interrupts back on halfway through it.
+extern volatile U8 chb_crit_nest;
+#define CHB_ENTER_CRIT()    do { __disable_irq(); chb_crit_nest++; } while (0)
+#define CHB_LEAVE_CRIT()    do { if (--chb_crit_nest == 0) __enable_irq(); } while (0)
 #define CHB_RST_ENABLE()    do {gpioSetValue(CHB_RSTPORT, CHB_RSTPIN, 0); } while (0)
 #define CHB_RST_DISABLE()   do {gpioSetValue(CHB_RSTPORT, CHB_RSTPIN, 1); } while (0)
 #define CHB_SLPTR_ENABLE()  do {gpioSetValue(CHB_SLPTRPORT, CHB_SLPTRPIN, 1); } while (0)
@@ -204,7 +209,8 @@ enum{
     TIME_RESET_TRX_OFF          = 26,
     TIME_TRX_IRQ_DELAY          = 9,
     TIME_TRX_OFF_PLL_ON         = 110,
-    TIME_IRQ_PROCESSING_DLY     = 32
+    TIME_IRQ_PROCESSING_DLY     = 32,
+    TIME_ED_MEASURE             = 400   // 8 symbols at the slowest rate (BPSK-20)
 };
 
 // trac status
@@ -345,6 +351,8 @@ void chb_frame_write(U8 *hdr, U8 hdr_len, U8 *data, U8 data_len);
 // general configuration
 void chb_set_mode(U8 mode);
 U8 chb_set_channel(U8 channel);
+U8 chb_get_channel();
+U8 chb_ed_measure();
 void chb_set_pwr(U8 val);
 void chb_set_ieee_addr(U8 *addr);
 void chb_get_ieee_addr(U8 *addr);
@@ -357,6 +365,9 @@ void chb_sleep(U8 enb);
 
 // data transmit
 U8 chb_tx(U8 *hdr, U8 *data, U8 len);
+U8 chb_tx_queue(U8 *hdr, U8 *data, U8 len);
+U8 chb_tx_free();
+bool chb_tx_busy();
 
 #if (CHB_CC1190_PRESENT)
     void chb_set_hgm(U8 enb);
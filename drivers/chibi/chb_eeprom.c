@@ -48,13 +48,9 @@
 /**************************************************************************/
 void chb_eeprom_write(uint16_t addr, uint8_t *buf, uint16_t size)
 {
-  // Write the address one byte at a time
-  uint16_t a = 0;
-  while (a < size)
-  {
-    eepromWriteU8(addr + a, buf[a]);
-    a++;
-  }
+  // Shadowed bytes are only written out on the flush
+  eepromWriteBuffer(addr, buf, size);
+  eepromFlush();
 }
 
 /**************************************************************************/
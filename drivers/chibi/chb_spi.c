@@ -75,3 +75,15 @@ U8 chb_xfer_byte(U8 data)
     // Read the queue
     return SSP_SSP0DR;
 }
+
+/**************************************************************************/
+/*!
+    Reads len bytes into buf, keeping the SSP FIFO full rather than
+    waiting for each byte to finish before sending the next one. The
+    0xFF bytes sspTransfer clocks out are ignored by the radio.
+*/
+/**************************************************************************/
+void chb_read_burst(U8 *buf, U8 len)
+{
+    sspTransfer(0, 0, buf, len);
+}
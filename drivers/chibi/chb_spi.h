@@ -58,5 +58,6 @@
 
 void chb_spi_init();
 U8 chb_xfer_byte(U8 data);
+void chb_read_burst(U8 *buf, U8 len);
 
 #endif
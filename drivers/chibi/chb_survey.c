@@ -0,0 +1,307 @@
+/**************************************************************************/
+/*!
+    @file     chb_survey.c
+
+    @section DESCRIPTION
+
+    Channel survey for the AT86RF212
+
+    The radio hops through a range of channels, staying CHB_SURVEY_DWELL
+    ms on each (timed off systick).  While it dwells it takes manual
+    energy detect measurements in batches of CHB_SURVEY_BATCH, and every
+    sample goes into that channel's histogram of CHB_SURVEY_BINS ED
+    ranges.  The histograms add up over all the sweeps, so the table
+    stays the same size however long the survey runs.
+
+    A callback can be given to stream each channel's histogram as its
+    dwell ends.  Once the survey is done chb_survey_quietest picks the
+    channel that was busy (ED in CHB_SURVEY_BUSYBIN or above) the least
+    often, and chb_survey_run does the whole thing in one blocking call,
+    which is what chb_init uses when CFG_CHIBI_AUTOCHANNEL is defined.
+
+    @code
+    chb_survey_start(1, 10, 0, print_channel);     // 0 = until stopped
+    while (1)
+    {
+        chb_survey_poll();
+        ...
+    }
+    @endcode
+
+    The radio isn't listening on its own channel during a survey.  It
+    is put back on its channel, in its normal receive state, at the end.
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <string.h>
+
+#include "chb_survey.h"
+#include "chb_drvr.h"
+#include "core/systick/systick.h"
+
+static chb_survey_chan_t table[CHB_SURVEY_MAXCHANNEL + 1];
+
+static struct
+{
+    U8 state;
+    U8 first;
+    U8 last;
+    U8 channel;                     // channel being measured
+    U8 home;                        // channel to go back to at the end
+    U16 sweeps;                     // sweeps to do, 0 = until stopped
+    U16 done;                       // sweeps finished
+    U32 dwell_end;
+    chb_survey_cb_t cb;
+} survey;
+
+/**************************************************************************/
+/*!
+    Tune to a channel and start its dwell
+*/
+/**************************************************************************/
+static void chb_survey_tune(U8 channel)
+{
+    survey.channel = channel;
+    chb_set_channel(channel);
+    survey.dwell_end = systickGetTicks() + CHB_SURVEY_DWELL;
+}
+
+/**************************************************************************/
+/*!
+    Go back to the original channel and receive state
+*/
+/**************************************************************************/
+static void chb_survey_finish()
+{
+    chb_set_channel(survey.home);
+    chb_set_state(RX_STATE);
+    survey.state = CHB_SURVEY_DONE;
+}
+
+/**************************************************************************/
+/*!
+    Starts a survey of channels 'first' to 'last', 'sweeps' times over
+    (0 to keep going until chb_survey_stop). 'cb' can be NULL. The
+    previous results are cleared. Returns false if the channel range
+    isn't valid or a frame is still being sent.
+*/
+/**************************************************************************/
+bool chb_survey_start(U8 first, U8 last, U16 sweeps, chb_survey_cb_t cb)
+{
+    if ((first > last) || (last > CHB_SURVEY_MAXCHANNEL) || chb_tx_busy())
+    {
+        return false;
+    }
+
+    if (survey.state == CHB_SURVEY_BUSY)
+    {
+        chb_survey_stop();
+    }
+
+    memset(table, 0, sizeof(table));
+    survey.first = first;
+    survey.last = last;
+    survey.sweeps = sweeps;
+    survey.done = 0;
+    survey.cb = cb;
+    survey.home = chb_get_channel();
+    survey.state = CHB_SURVEY_BUSY;
+    chb_survey_tune(first);
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Stops a survey that is still running. The results so far are kept.
+*/
+/**************************************************************************/
+void chb_survey_stop()
+{
+    if (survey.state == CHB_SURVEY_BUSY)
+    {
+        chb_survey_finish();
+    }
+}
+
+/**************************************************************************/
+/*!
+    Returns CHB_SURVEY_IDLE, CHB_SURVEY_BUSY or CHB_SURVEY_DONE
+*/
+/**************************************************************************/
+U8 chb_survey_status()
+{
+    return survey.state;
+}
+
+/**************************************************************************/
+/*!
+    Takes the next batch of samples and moves on to the next channel when
+    the dwell is over. Call it from the main loop while a survey runs.
+*/
+/**************************************************************************/
+void chb_survey_poll()
+{
+    chb_survey_chan_t *entry;
+    U8 i, ed, bin;
+
+    if (survey.state != CHB_SURVEY_BUSY)
+    {
+        return;
+    }
+
+    entry = &table[survey.channel];
+    for (i=0; i<CHB_SURVEY_BATCH; i++)
+    {
+        ed = chb_ed_measure();
+        bin = ed / CHB_SURVEY_BINWIDTH;
+        if (bin >= CHB_SURVEY_BINS)
+        {
+            bin = CHB_SURVEY_BINS - 1;
+        }
+        if (entry->bins[bin] != 0xFFFF)
+        {
+            entry->bins[bin]++;
+        }
+        if (ed > entry->max)
+        {
+            entry->max = ed;
+        }
+    }
+
+    if ((S32)(systickGetTicks() - survey.dwell_end) < 0)
+    {
+        return;
+    }
+
+    // dwell over, hand the results out and hop
+    if (survey.cb)
+    {
+        survey.cb(survey.channel, entry);
+    }
+
+    if (survey.channel < survey.last)
+    {
+        chb_survey_tune(survey.channel + 1);
+    }
+    else if (survey.sweeps && (++survey.done >= survey.sweeps))
+    {
+        chb_survey_finish();
+    }
+    else
+    {
+        chb_survey_tune(survey.first);
+    }
+}
+
+/**************************************************************************/
+/*!
+    Returns the histogram for a channel (all zero if it wasn't surveyed)
+*/
+/**************************************************************************/
+const chb_survey_chan_t *chb_survey_get(U8 channel)
+{
+    return (channel <= CHB_SURVEY_MAXCHANNEL) ? &table[channel] : NULL;
+}
+
+/**************************************************************************/
+/*!
+    Returns the channel in the last survey's range that was busy the
+    smallest share of the time. Ties go to the lowest average energy,
+    then to the lowest peak. Returns the current channel if nothing was
+    measured.
+*/
+/**************************************************************************/
+U8 chb_survey_quietest()
+{
+    U8 ch, i, best = 0xFF;
+    U32 total, busy, energy;
+    U32 best_busy = 0, best_energy = 0;
+
+    if (survey.state == CHB_SURVEY_IDLE)
+    {
+        return chb_get_channel();
+    }
+
+    for (ch=survey.first; ch<=survey.last; ch++)
+    {
+        total = busy = energy = 0;
+        for (i=0; i<CHB_SURVEY_BINS; i++)
+        {
+            total += table[ch].bins[i];
+            energy += (U32)table[ch].bins[i] * i;
+            if (i >= CHB_SURVEY_BUSYBIN)
+            {
+                busy += table[ch].bins[i];
+            }
+        }
+        if (!total)
+        {
+            continue;
+        }
+
+        // per mille of the samples, and average bin * 1000
+        busy = busy * 1000 / total;
+        energy = energy * 1000 / total;
+
+        if ((best == 0xFF) ||
+            (busy < best_busy) ||
+            ((busy == best_busy) && (energy < best_energy)) ||
+            ((busy == best_busy) && (energy == best_energy) && (table[ch].max < table[best].max)))
+        {
+            best = ch;
+            best_busy = busy;
+            best_energy = energy;
+        }
+    }
+
+    return (best == 0xFF) ? chb_get_channel() : best;
+}
+
+/**************************************************************************/
+/*!
+    Surveys channels 'first' to 'last' for 'sweeps' sweeps (at least one)
+    without returning in between, and returns the quietest channel.
+    The radio is left on the channel it was on before.
+*/
+/**************************************************************************/
+U8 chb_survey_run(U8 first, U8 last, U16 sweeps)
+{
+    if (!chb_survey_start(first, last, sweeps ? sweeps : 1, NULL))
+    {
+        return chb_get_channel();
+    }
+
+    while (survey.state == CHB_SURVEY_BUSY)
+    {
+        chb_survey_poll();
+    }
+    return chb_survey_quietest();
+}
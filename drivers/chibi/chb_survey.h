@@ -0,0 +1,73 @@
+/**************************************************************************/
+/*!
+    @file     chb_survey.h
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#ifndef CHB_SURVEY_H
+#define CHB_SURVEY_H
+
+#include "types.h"
+
+#define CHB_SURVEY_MAXCHANNEL   10      // highest sub-GHz channel (page 0/2)
+#define CHB_SURVEY_BINS         8       // ED histogram bins per channel
+#define CHB_SURVEY_BINWIDTH     11      // ED levels per bin (ED goes up to 0x54)
+#define CHB_SURVEY_BUSYBIN      1       // samples in this bin or above count as busy
+#define CHB_SURVEY_DWELL        20      // ms on each channel per sweep
+#define CHB_SURVEY_BATCH        4       // ED samples per batch (about 2ms)
+
+enum
+{
+    CHB_SURVEY_IDLE = 0,
+    CHB_SURVEY_BUSY,                    // hopping through the channels
+    CHB_SURVEY_DONE                     // all sweeps finished (or stopped)
+};
+
+// ED histogram for one channel, accumulated over every dwell
+typedef struct
+{
+    U16 bins[CHB_SURVEY_BINS];          // samples per ED range (saturating)
+    U8 max;                             // highest ED level seen
+} __attribute__((packed)) chb_survey_chan_t;   // 17 bytes, no padding
+
+// Called at the end of every dwell with the channel just measured
+typedef void (*chb_survey_cb_t)(U8 channel, const chb_survey_chan_t *entry);
+
+bool chb_survey_start(U8 first, U8 last, U16 sweeps, chb_survey_cb_t cb);
+void chb_survey_stop();
+U8 chb_survey_status();
+void chb_survey_poll();
+const chb_survey_chan_t *chb_survey_get(U8 channel);
+U8 chb_survey_quietest();
+U8 chb_survey_run(U8 first, U8 last, U16 sweeps);
+
+#endif
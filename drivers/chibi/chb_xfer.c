@@ -0,0 +1,547 @@
+/**************************************************************************/
+/*!
+    @file     chb_xfer.c
+
+    @section DESCRIPTION
+
+    Reliable bulk transfers on top of chibi
+
+    A message of up to 64K is split into fragments of CHB_XFER_FRAGSIZE
+    bytes, each sent as one chibi frame with a small header:
+
+    @code
+    DATA:   0xB1, message ID, fragment number (16), total length (16), data
+    ACK:    0xB2, message ID, next fragment expected (16), bitmap
+    ABORT:  0xB3, message ID
+    @endcode
+
+    The sender keeps up to CHB_XFER_WINDOW fragments in flight.  The
+    receiver acknowledges the first fragment it is still missing plus a
+    bitmap of the ones it already has after that (bit 0 = the one after
+    the missing fragment), so only the fragments that were really lost
+    are sent again when their CHB_XFER_RTO retransmission timer (off
+    systick) runs out.  In-order fragments are acknowledged in pairs or
+    after CHB_XFER_ACKDELAY, anything else straight away.  Fragments
+    are copied straight into place in the caller's buffer.
+
+    Message IDs start from a random value, so a sender that has been
+    reset doesn't reuse the ID of the message it sent last, which the
+    receiver would take for a repeat and answer with its final ACK.
+
+    One message can be sent and one received at a time.  Nothing
+    blocks: received frames are handed to chb_xfer_rx by whoever reads
+    the chibi receive queue, and chb_xfer_poll runs the timers.
+
+    @code
+    chb_frame_t *frame;
+
+    chb_xfer_recv(deck, sizeof(deck));
+    while (1)
+    {
+        while ((frame = chb_get_frame()) != NULL)
+        {
+            if (!chb_xfer_rx(frame))
+            {
+                // not a transfer frame, handle it here
+            }
+            chb_free_frame();
+        }
+        chb_xfer_poll();
+
+        if (chb_xfer_recv_status(&len, &src) == CHB_XFER_DONE)
+        {
+            // use deck[0..len-1], then wait for the next one
+            chb_xfer_recv(deck, sizeof(deck));
+        }
+    }
+    @endcode
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <string.h>
+
+#include "chb_xfer.h"
+#include "chb_drvr.h"
+#include "core/systick/systick.h"
+
+// sending side
+static struct
+{
+    U8 state;
+    U8 msg_id;
+    bool seeded;                    // msg_id has been randomised
+    U16 addr;
+    const U8 *data;
+    U16 len;
+    U16 nfrags;
+    U16 base;                       // oldest fragment not acknowledged
+    U16 next;                       // next fragment to send for the first time
+    U8 acked;                       // bit i: fragment base + i acknowledged
+    U32 sent[CHB_XFER_WINDOW];      // when each fragment in flight was last sent
+    U8 tries[CHB_XFER_WINDOW];
+} tx;
+
+// receiving side
+static struct
+{
+    U8 state;
+    U8 msg_id;
+    U16 src;
+    U8 *buf;
+    U16 size;
+    U16 len;
+    U16 nfrags;
+    U16 base;                       // first fragment still missing
+    U8 got;                         // bit i: fragment base + i received
+    U8 unacked;                     // in-order fragments since the last ACK
+    bool ack_due;
+    U32 ack_time;
+    U32 last;                       // when the last fragment arrived
+
+    // the last message received, so that its final ACK can be repeated
+    bool done_valid;
+    U8 done_id;
+    U16 done_src;
+    U16 done_len;
+    U16 done_nfrags;
+} rx;
+
+/**************************************************************************/
+/*!
+    Returns true once 'time' (in systick ms) has been reached
+*/
+/**************************************************************************/
+static bool chb_xfer_expired(U32 time)
+{
+    return (S32)(systickGetTicks() - time) >= 0;
+}
+
+/**************************************************************************/
+/*!
+    Returns a byte that differs from one reset to the next, for the
+    first message ID. The radio's RND_VALUE bits (PHY_RSSI 6:5) are
+    noise while it is receiving, and the systick count adds how long
+    the application took to send its first message.
+*/
+/**************************************************************************/
+static U8 chb_xfer_random()
+{
+    U8 i, val = (U8)systickGetTicks();
+
+    for (i = 0; i < 4; i++)
+    {
+        val ^= ((chb_reg_read(PHY_RSSI) >> 5) & 3) << (2 * i);
+    }
+    return val;
+}
+
+/**************************************************************************/
+/*!
+    Queue one fragment of the message being sent. Returns false if the
+    chibi tx queue is full, in which case it is tried again later.
+*/
+/**************************************************************************/
+static bool chb_xfer_send_frag(U16 frag)
+{
+    U8 buf[CHB_MAX_PAYLOAD];
+    U16 offset = frag * CHB_XFER_FRAGSIZE;
+    U8 len = (tx.len - offset > CHB_XFER_FRAGSIZE) ? CHB_XFER_FRAGSIZE : tx.len - offset;
+
+    buf[0] = CHB_XFER_DATA;
+    buf[1] = tx.msg_id;
+    buf[2] = frag & 0xFF;
+    buf[3] = frag >> 8;
+    buf[4] = tx.len & 0xFF;
+    buf[5] = tx.len >> 8;
+    memcpy(buf + CHB_XFER_DATAHDR, tx.data + offset, len);
+
+    if (chb_write_async(tx.addr, buf, CHB_XFER_DATAHDR + len) != CHB_SUCCESS)
+    {
+        return false;
+    }
+    tx.sent[frag % CHB_XFER_WINDOW] = systickGetTicks();
+    tx.tries[frag % CHB_XFER_WINDOW]++;
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Resend fragments whose timer has run out, then fill the window with
+    new ones
+*/
+/**************************************************************************/
+static void chb_xfer_send_pump()
+{
+    U16 i, slot;
+
+    if (tx.state != CHB_XFER_BUSY)
+    {
+        return;
+    }
+
+    for (i = 0; i < tx.next - tx.base; i++)
+    {
+        slot = (tx.base + i) % CHB_XFER_WINDOW;
+        if ((tx.acked & (1 << i)) || !chb_xfer_expired(tx.sent[slot] + CHB_XFER_RTO))
+        {
+            continue;
+        }
+        if (tx.tries[slot] >= CHB_XFER_MAXTRIES)
+        {
+            tx.state = CHB_XFER_FAILED;
+            return;
+        }
+        if (!chb_xfer_send_frag(tx.base + i))
+        {
+            return;
+        }
+    }
+
+    while ((tx.next < tx.nfrags) && (tx.next - tx.base < CHB_XFER_WINDOW))
+    {
+        tx.tries[tx.next % CHB_XFER_WINDOW] = 0;
+        if (!chb_xfer_send_frag(tx.next))
+        {
+            return;
+        }
+        tx.next++;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Start sending a message to 'addr'. The data is not copied and must
+    stay untouched until chb_xfer_send_status returns CHB_XFER_DONE or
+    CHB_XFER_FAILED. Returns false if a message is still being sent.
+*/
+/**************************************************************************/
+bool chb_xfer_send(U16 addr, const U8 *data, U16 len)
+{
+    if ((tx.state == CHB_XFER_BUSY) || (len == 0))
+    {
+        return false;
+    }
+
+    if (!tx.seeded)
+    {
+        tx.msg_id = chb_xfer_random();
+        tx.seeded = true;
+    }
+    tx.msg_id++;
+    tx.addr = addr;
+    tx.data = data;
+    tx.len = len;
+    tx.nfrags = (len + CHB_XFER_FRAGSIZE - 1) / CHB_XFER_FRAGSIZE;
+    tx.base = 0;
+    tx.next = 0;
+    tx.acked = 0;
+    tx.state = CHB_XFER_BUSY;
+
+    chb_xfer_send_pump();
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    Returns the state of the message being sent (CHB_XFER_...)
+*/
+/**************************************************************************/
+U8 chb_xfer_send_status()
+{
+    return tx.state;
+}
+
+/**************************************************************************/
+/*!
+    Process an ACK for the message being sent
+*/
+/**************************************************************************/
+static void chb_xfer_ack_rcvd(U16 src, U8 *p)
+{
+    U16 ack_base = p[2] | (p[3] << 8);
+
+    if ((tx.state != CHB_XFER_BUSY) || (src != tx.addr) || (p[1] != tx.msg_id) ||
+        (ack_base < tx.base) || (ack_base > tx.next))
+    {
+        return;
+    }
+
+    // everything before ack_base has arrived, and the fragments in the bitmap
+    tx.acked = (ack_base - tx.base < 8) ? tx.acked >> (ack_base - tx.base) : 0;
+    tx.base = ack_base;
+    tx.acked |= p[4] << 1;
+    while (tx.acked & 1)
+    {
+        tx.acked >>= 1;
+        tx.base++;
+    }
+
+    if (tx.base >= tx.nfrags)
+    {
+        tx.state = CHB_XFER_DONE;
+        return;
+    }
+    chb_xfer_send_pump();
+}
+
+/**************************************************************************/
+/*!
+    Give the receiver a buffer for the next message. Any message already
+    being received is dropped.
+*/
+/**************************************************************************/
+void chb_xfer_recv(U8 *buf, U16 size)
+{
+    rx.buf = buf;
+    rx.size = size;
+    rx.ack_due = false;
+    rx.state = CHB_XFER_READY;
+}
+
+/**************************************************************************/
+/*!
+    Returns the state of the receiver (CHB_XFER_...). Once it is
+    CHB_XFER_DONE, 'len' and 'src' hold the message length and sender.
+*/
+/**************************************************************************/
+U8 chb_xfer_recv_status(U16 *len, U16 *src)
+{
+    if (rx.state == CHB_XFER_DONE)
+    {
+        *len = rx.len;
+        *src = rx.src;
+    }
+    return rx.state;
+}
+
+/**************************************************************************/
+/*!
+    Send an ACK (or an ABORT) for the given message
+*/
+/**************************************************************************/
+static bool chb_xfer_send_ack(U16 addr, U8 type, U8 msg_id, U16 base, U8 bitmap)
+{
+    U8 buf[5];
+
+    buf[0] = type;
+    buf[1] = msg_id;
+    buf[2] = base & 0xFF;
+    buf[3] = base >> 8;
+    buf[4] = bitmap;
+    return chb_write_async(addr, buf, (type == CHB_XFER_ACK) ? 5 : 2) == CHB_SUCCESS;
+}
+
+/**************************************************************************/
+/*!
+    Acknowledge the message being received now, or as soon as there is
+    room in the tx queue
+*/
+/**************************************************************************/
+static void chb_xfer_ack_now()
+{
+    rx.ack_due = !chb_xfer_send_ack(rx.src, CHB_XFER_ACK, rx.msg_id, rx.base, rx.got >> 1);
+    rx.ack_time = systickGetTicks();
+    rx.unacked = 0;
+}
+
+/**************************************************************************/
+/*!
+    Process a DATA fragment
+*/
+/**************************************************************************/
+static void chb_xfer_data_rcvd(U16 src, U8 *p, U8 len)
+{
+    U8 msg_id = p[1];
+    U16 frag = p[2] | (p[3] << 8);
+    U16 total = p[4] | (p[5] << 8);
+    U16 offset = frag * CHB_XFER_FRAGSIZE;
+    U8 bit;
+
+    // the sender missed the final ACK of the last message. the length
+    // has to match too, in case the sender was reset and the ID came
+    // round again for a new message
+    if (rx.done_valid && (src == rx.done_src) && (msg_id == rx.done_id) && (rx.state != CHB_XFER_BUSY) &&
+        (total == rx.done_len) && (frag < rx.done_nfrags))
+    {
+        chb_xfer_send_ack(src, CHB_XFER_ACK, msg_id, rx.done_nfrags, 0);
+        return;
+    }
+
+    // a new message, if there is a buffer for it. one that is still
+    // coming in is only given up once it has gone quiet
+    if ((rx.state == CHB_XFER_READY) || 
+        ((rx.state == CHB_XFER_BUSY) && ((src != rx.src) || (msg_id != rx.msg_id)) &&
+         chb_xfer_expired(rx.last + CHB_XFER_RXTIMEOUT)))
+    {
+        if (total > rx.size)
+        {
+            chb_xfer_send_ack(src, CHB_XFER_ABORT, msg_id, 0, 0);
+            return;
+        }
+        rx.src = src;
+        rx.msg_id = msg_id;
+        rx.len = total;
+        rx.nfrags = (total + CHB_XFER_FRAGSIZE - 1) / CHB_XFER_FRAGSIZE;
+        rx.base = 0;
+        rx.got = 0;
+        rx.unacked = 0;
+        rx.ack_due = false;
+        rx.state = CHB_XFER_BUSY;
+    }
+
+    if ((rx.state != CHB_XFER_BUSY) || (src != rx.src) || (msg_id != rx.msg_id) || (total != rx.len))
+    {
+        return;
+    }
+    rx.last = systickGetTicks();
+
+    // already have it (the ACK was lost), or too far ahead to track
+    if ((frag < rx.base) || (frag - rx.base >= 8) || (rx.got & (1 << (frag - rx.base))))
+    {
+        if (frag - rx.base < 8)
+        {
+            chb_xfer_ack_now();
+        }
+        return;
+    }
+
+    // every fragment but the last is full size
+    if ((frag >= rx.nfrags) || 
+        (len != ((total - offset > CHB_XFER_FRAGSIZE) ? CHB_XFER_FRAGSIZE : total - offset)))
+    {
+        return;
+    }
+
+    memcpy(rx.buf + offset, p + CHB_XFER_DATAHDR, len);
+    bit = frag - rx.base;
+    rx.got |= 1 << bit;
+    while (rx.got & 1)
+    {
+        rx.got >>= 1;
+        rx.base++;
+    }
+
+    if (rx.base == rx.nfrags)
+    {
+        rx.state = CHB_XFER_DONE;
+        rx.done_valid = true;
+        rx.done_id = rx.msg_id;
+        rx.done_src = rx.src;
+        rx.done_len = rx.len;
+        rx.done_nfrags = rx.nfrags;
+        chb_xfer_ack_now();
+    }
+    else if ((bit != 0) || (++rx.unacked >= (CHB_XFER_WINDOW + 1) / 2))
+    {
+        // out of order (tell the sender what's missing), or enough to report
+        chb_xfer_ack_now();
+    }
+    else if (!rx.ack_due)
+    {
+        rx.ack_due = true;
+        rx.ack_time = systickGetTicks() + CHB_XFER_ACKDELAY;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Offer a received chibi frame to the transfer layer. Returns true if it
+    was a transfer frame (it has been dealt with), false if it is for
+    someone else. The caller frees the frame either way.
+*/
+/**************************************************************************/
+bool chb_xfer_rx(chb_frame_t *frame)
+{
+    U8 *p, len;
+    U16 src;
+
+    if (!frame->crc_ok || (frame->len < CHB_HDR_SZ + CHB_FCS_LEN + 2))
+    {
+        return false;
+    }
+    p = frame->data + CHB_HDR_SZ;
+    len = frame->len - CHB_HDR_SZ - CHB_FCS_LEN;
+    src = frame->data[7] | (frame->data[8] << 8);
+
+    switch (p[0])
+    {
+    case CHB_XFER_DATA:
+        if (len >= CHB_XFER_DATAHDR)
+        {
+            chb_xfer_data_rcvd(src, p, len - CHB_XFER_DATAHDR);
+        }
+        return true;
+
+    case CHB_XFER_ACK:
+        if (len >= 5)
+        {
+            chb_xfer_ack_rcvd(src, p);
+        }
+        return true;
+
+    case CHB_XFER_ABORT:
+        if ((tx.state == CHB_XFER_BUSY) && (src == tx.addr) && (p[1] == tx.msg_id))
+        {
+            tx.state = CHB_XFER_FAILED;
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/**************************************************************************/
+/*!
+    Runs the retransmission and ACK timers. Call it from the main loop.
+*/
+/**************************************************************************/
+void chb_xfer_poll()
+{
+    chb_xfer_send_pump();
+
+    if (rx.state == CHB_XFER_BUSY)
+    {
+        if (rx.ack_due && chb_xfer_expired(rx.ack_time))
+        {
+            chb_xfer_ack_now();
+        }
+        else if (chb_xfer_expired(rx.last + CHB_XFER_RXTIMEOUT))
+        {
+            rx.state = CHB_XFER_FAILED;
+        }
+    }
+    else if (rx.ack_due && chb_xfer_expired(rx.ack_time))
+    {
+        // the final ACK couldn't be queued straight away
+        rx.ack_due = !chb_xfer_send_ack(rx.done_src, CHB_XFER_ACK, rx.done_id, rx.done_nfrags, 0);
+    }
+}
@@ -0,0 +1,74 @@
+/**************************************************************************/
+/*!
+    @file     chb_xfer.h
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#ifndef CHB_XFER_H
+#define CHB_XFER_H
+
+#include "types.h"
+#include "chb.h"
+
+#define CHB_XFER_DATA       0xB1    // payload type bytes
+#define CHB_XFER_ACK        0xB2
+#define CHB_XFER_ABORT      0xB3
+
+#define CHB_XFER_DATAHDR    6       // type, message ID, fragment (16), total length (16)
+#define CHB_XFER_FRAGSIZE   (CHB_MAX_PAYLOAD - CHB_XFER_DATAHDR)
+#define CHB_XFER_WINDOW     4       // fragments in flight (8 at most)
+#define CHB_XFER_RTO        100     // ms before an unacknowledged fragment is sent again
+#define CHB_XFER_MAXTRIES   8       // sends per fragment before the transfer fails
+#define CHB_XFER_ACKDELAY   10      // ms an in-order fragment's ACK can be held back
+#define CHB_XFER_RXTIMEOUT  2000    // ms without a fragment before a reception is dropped
+
+#if CHB_XFER_WINDOW > 8
+    #error "CHB_XFER_WINDOW must be 8 or less"
+#endif
+
+enum
+{
+    CHB_XFER_IDLE = 0,              // nothing going on (receiver: no buffer)
+    CHB_XFER_READY,                 // receiver: waiting for a message
+    CHB_XFER_BUSY,                  // message being sent or received
+    CHB_XFER_DONE,                  // message delivered / received in full
+    CHB_XFER_FAILED                 // retries exhausted, aborted or timed out
+};
+
+bool chb_xfer_send(U16 addr, const U8 *data, U16 len);
+U8 chb_xfer_send_status();
+void chb_xfer_recv(U8 *buf, U16 size);
+U8 chb_xfer_recv_status(U16 *len, U16 *src);
+bool chb_xfer_rx(chb_frame_t *frame);
+void chb_xfer_poll();
+
+#endif
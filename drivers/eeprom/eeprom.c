@@ -3,6 +3,22 @@
     @file     eeprom.c
     @author   K. Townsend (microBuilder.eu)
 
+    @section DESCRIPTION
+
+    Reads and writes typed values in the I2C EEPROM.
+
+    The first CFG_I2CEEPROM_SHADOWSIZE bytes (the reserved settings area)
+    are kept in a RAM shadow, loaded on first use.  Writes there only
+    update the shadow and mark the 32 byte pages they touch as dirty,
+    and eepromFlush writes each dirty page back in one page write.
+    Saving a dozen settings then costs a few page writes instead of a
+    write cycle per value.  Writes that don't change anything don't
+    dirty the page.  Anything beyond the shadow is written straight
+    through, split on page boundaries.
+
+    @note  Call eepromFlush once a group of settings has been written,
+           otherwise the changes are lost at the next reset.
+
     @section LICENSE
 
     Software License Agreement (BSD License)
@@ -41,7 +57,66 @@
 // Currently only the MCP24AA I2C EEPROM is used
 #include "drivers/eeprom/mcp24aa/mcp24aa.h"
 
-static uint8_t buf[32];
+#define EEPROM_SHADOWPAGES  (CFG_I2CEEPROM_SHADOWSIZE / MCP24AA_PAGESIZE)
+
+#if CFG_I2CEEPROM_SHADOWSIZE > 0
+static uint8_t  _eepromShadow[CFG_I2CEEPROM_SHADOWSIZE];
+static uint32_t _eepromDirty = 0;           // One bit per shadowed page
+static bool     _eepromShadowLoaded = false;
+#endif
+
+static eepromError_e _eepromLastError = EEPROM_ERROR_OK;
+
+/**************************************************************************/
+/*! 
+    @brief Translates an MCP24AA driver error
+*/
+/**************************************************************************/
+static eepromError_e eepromError(mcp24aaError_e error)
+{
+  switch (error)
+  {
+    case MCP24AA_ERROR_OK:
+      return EEPROM_ERROR_OK;
+    case MCP24AA_ERROR_ADDRERR:
+      return EEPROM_ERROR_ADDRERR;
+    case MCP24AA_ERROR_TIMEOUT:
+      return EEPROM_ERROR_TIMEOUT;
+    default:
+      return EEPROM_ERROR_I2C;
+  }
+}
+
+#if CFG_I2CEEPROM_SHADOWSIZE > 0
+/**************************************************************************/
+/*! 
+    @brief Loads the RAM shadow from EEPROM the first time it is needed
+*/
+/**************************************************************************/
+static eepromError_e eepromLoadShadow(void)
+{
+  mcp24aaError_e error;
+  uint32_t i;
+
+  if (_eepromShadowLoaded)
+  {
+    return EEPROM_ERROR_OK;
+  }
+
+  for (i = 0; i < CFG_I2CEEPROM_SHADOWSIZE; i += MCP24AA_PAGESIZE)
+  {
+    error = mcp24aaReadBuffer(i, _eepromShadow + i, MCP24AA_PAGESIZE);
+    if (error)
+    {
+      return eepromError(error);
+    }
+  }
+
+  _eepromShadowLoaded = true;
+  _eepromDirty = 0;
+  return EEPROM_ERROR_OK;
+}
+#endif
 
 /**************************************************************************/
 /*! 
@@ -61,23 +136,183 @@ bool eepromCheckAddress(uint16_t addr)
 
 /**************************************************************************/
 /*! 
-    @brief Reads 1 byte from EEPROM
+    @brief Returns the error from the last read or write (the typed read
+           functions can only report errors this way)
+*/
+/**************************************************************************/
+eepromError_e eepromGetLastError(void)
+{
+  return _eepromLastError;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Reads a variable length buffer from EEPROM
 
     @param[in]  addr
                 The 16-bit address to read from in EEPROM
+    @param[out] buffer
+                Pointer to the buffer that will store any retrieved bytes
+    @param[in]  bufferLength
+                The number of bytes to read
+*/
+/**************************************************************************/
+eepromError_e eepromReadBuffer(uint16_t addr, uint8_t *buffer, uint32_t bufferLength)
+{
+  eepromError_e error = EEPROM_ERROR_OK;
+  uint32_t len;
+
+  if (addr + bufferLength > MCP24AA_MAXADDR + 1)
+  {
+    return _eepromLastError = EEPROM_ERROR_ADDRERR;
+  }
+
+#if CFG_I2CEEPROM_SHADOWSIZE > 0
+  // The shadowed part comes from RAM
+  if (addr < CFG_I2CEEPROM_SHADOWSIZE && bufferLength)
+  {
+    error = eepromLoadShadow();
+    if (error)
+    {
+      return _eepromLastError = error;
+    }
+    len = CFG_I2CEEPROM_SHADOWSIZE - addr;
+    if (len > bufferLength)
+    {
+      len = bufferLength;
+    }
+    memcpy(buffer, _eepromShadow + addr, len);
+    addr += len;
+    buffer += len;
+    bufferLength -= len;
+  }
+#endif
+
+  // The rest straight from EEPROM, a page at a time
+  while (bufferLength && !error)
+  {
+    len = bufferLength > MCP24AA_PAGESIZE ? MCP24AA_PAGESIZE : bufferLength;
+    error = eepromError(mcp24aaReadBuffer(addr, buffer, len));
+    addr += len;
+    buffer += len;
+    bufferLength -= len;
+  }
+
+  return _eepromLastError = error;
+}
 
-    @return     An unsigned 8-bit value (uint8_t)
+/**************************************************************************/
+/*! 
+    @brief Writes a variable length buffer to EEPROM.  Shadowed bytes only
+           reach the EEPROM on the next eepromFlush.
+
+    @param[in]  addr
+                The 16-bit address to write to in EEPROM
+    @param[in]  buffer
+                Pointer to the bytes to write
+    @param[in]  bufferLength
+                The number of bytes to write
 */
 /**************************************************************************/
-uint8_t eepromReadU8(uint16_t addr)
+eepromError_e eepromWriteBuffer(uint16_t addr, const uint8_t *buffer, uint32_t bufferLength)
+{
+  eepromError_e error = EEPROM_ERROR_OK;
+  uint32_t len;
+
+  if (addr + bufferLength > MCP24AA_MAXADDR + 1)
+  {
+    return _eepromLastError = EEPROM_ERROR_ADDRERR;
+  }
+
+#if CFG_I2CEEPROM_SHADOWSIZE > 0
+  // Update the shadow, marking the pages that actually change
+  if (addr < CFG_I2CEEPROM_SHADOWSIZE && bufferLength)
+  {
+    error = eepromLoadShadow();
+    if (error)
+    {
+      return _eepromLastError = error;
+    }
+    while (addr < CFG_I2CEEPROM_SHADOWSIZE && bufferLength)
+    {
+      if (_eepromShadow[addr] != *buffer)
+      {
+        _eepromShadow[addr] = *buffer;
+        _eepromDirty |= 1UL << (addr / MCP24AA_PAGESIZE);
+      }
+      addr++;
+      buffer++;
+      bufferLength--;
+    }
+  }
+#endif
+
+  // Write the rest straight through, without crossing a page
+  while (bufferLength && !error)
+  {
+    len = MCP24AA_PAGESIZE - (addr % MCP24AA_PAGESIZE);
+    if (len > bufferLength)
+    {
+      len = bufferLength;
+    }
+    error = eepromError(mcp24aaWriteBuffer(addr, (uint8_t *)buffer, len));
+    addr += len;
+    buffer += len;
+    bufferLength -= len;
+  }
+
+  return _eepromLastError = error;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Writes every changed page of the RAM shadow to EEPROM (one
+           page write each) and waits for the last write to finish
+*/
+/**************************************************************************/
+eepromError_e eepromFlush(void)
 {
   mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(uint8_t));
 
-  // ToDo: Handle any errors
-  if (error) { };
+#if CFG_I2CEEPROM_SHADOWSIZE > 0
+  uint32_t page;
+
+  for (page = 0; page < EEPROM_SHADOWPAGES && !error; page++)
+  {
+    if (_eepromDirty & (1UL << page))
+    {
+      error = mcp24aaWriteBuffer(page * MCP24AA_PAGESIZE, _eepromShadow + page * MCP24AA_PAGESIZE, MCP24AA_PAGESIZE);
+      if (!error)
+      {
+        _eepromDirty &= ~(1UL << page);
+      }
+    }
+  }
+#endif
+
+  if (!error)
+  {
+    error = mcp24aaWaitReady();
+  }
+
+  return _eepromLastError = eepromError(error);
+}
 
-  return buf[0];
+/**************************************************************************/
+/*! 
+    @brief Reads 1 byte from EEPROM
+
+    @param[in]  addr
+                The 16-bit address to read from in EEPROM
+
+    @return     An unsigned 8-bit value (uint8_t)
+*/
+/**************************************************************************/
+uint8_t eepromReadU8(uint16_t addr)
+{
+  uint8_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(uint8_t));
+  return results;
 }
 
 /**************************************************************************/
@@ -92,15 +327,8 @@ uint8_t eepromReadU8(uint16_t addr)
 /**************************************************************************/
 int8_t eepromReadS8(uint16_t addr)
 {
-  int8_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(int8_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(int8_t));
+  int8_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(int8_t));
   return results;
 }
 
@@ -116,16 +344,8 @@ int8_t eepromReadS8(uint16_t addr)
 /**************************************************************************/
 uint16_t eepromReadU16(uint16_t addr)
 {
-  uint16_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(uint16_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(uint16_t));
-
+  uint16_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(uint16_t));
   return results;
 }
 
@@ -141,15 +361,8 @@ uint16_t eepromReadU16(uint16_t addr)
 /**************************************************************************/
 int16_t eepromReadS16(uint16_t addr)
 {
-  int16_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(int16_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(int16_t));
+  int16_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(int16_t));
   return results;
 }
 
@@ -165,15 +378,8 @@ int16_t eepromReadS16(uint16_t addr)
 /**************************************************************************/
 uint32_t eepromReadU32(uint16_t addr)
 {
-  uint32_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(uint32_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(uint32_t));
+  uint32_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(uint32_t));
   return results;
 }
 
@@ -189,15 +395,8 @@ uint32_t eepromReadU32(uint16_t addr)
 /**************************************************************************/
 int32_t eepromReadS32(uint16_t addr)
 {
-  int32_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(int32_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(int32_t));
+  int32_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(int32_t));
   return results;
 }
 
@@ -213,15 +412,8 @@ int32_t eepromReadS32(uint16_t addr)
 /**************************************************************************/
 uint64_t eepromReadU64(uint16_t addr)
 {
-  uint64_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(uint64_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(uint64_t));
+  uint64_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(uint64_t));
   return results;
 }
 
@@ -237,42 +429,11 @@ uint64_t eepromReadU64(uint16_t addr)
 /**************************************************************************/
 int64_t eepromReadS64(uint16_t addr)
 {
-  int64_t results;
-
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaReadBuffer(addr, buf, sizeof(int64_t));
-  
-  // ToDo: Handle any errors
-  if (error) { };
-
-  memcpy(&results, buf, sizeof(int64_t));
+  int64_t results = 0;
+  eepromReadBuffer(addr, (uint8_t *)&results, sizeof(int64_t));
   return results;
 }
 
-/**************************************************************************/
-/*! 
-    @brief Reads a variabls length buffer from EEPROM
-
-    @param[in]  addr
-                The 16-bit address to write to in EEPROM
-    @param[out] buffer
-                Pointer to the buffer that will store any retrieved bytes
-    @param[in]  bufferLength
-                The number of bytes to read
-*/
-/**************************************************************************/
-void eepromReadBuffer(uint16_t addr, uint8_t *buffer, uint32_t bufferLength)
-{
-  // Instantiate error message placeholder
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  
-  // Read the contents of address
-  error = mcp24aaReadBuffer(addr, buffer, bufferLength);
-
-  // ToDo: Handle any errors
-  if (error) { };
-}
-
 /**************************************************************************/
 /*! 
     @brief Writes 1 byte to EEPROM
@@ -281,13 +442,9 @@ void eepromReadBuffer(uint16_t addr, uint8_t *buffer, uint32_t bufferLength)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteU8(uint16_t addr, uint8_t value)
+eepromError_e eepromWriteU8(uint16_t addr, uint8_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -298,13 +455,9 @@ void eepromWriteU8(uint16_t addr, uint8_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteS8(uint16_t addr, int8_t value)
+eepromError_e eepromWriteS8(uint16_t addr, int8_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -315,13 +468,9 @@ void eepromWriteS8(uint16_t addr, int8_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteU16(uint16_t addr, uint16_t value)
+eepromError_e eepromWriteU16(uint16_t addr, uint16_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -332,13 +481,9 @@ void eepromWriteU16(uint16_t addr, uint16_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteS16(uint16_t addr, int16_t value)
+eepromError_e eepromWriteS16(uint16_t addr, int16_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -349,13 +494,9 @@ void eepromWriteS16(uint16_t addr, int16_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteU32(uint16_t addr, uint32_t value)
+eepromError_e eepromWriteU32(uint16_t addr, uint32_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -366,13 +507,9 @@ void eepromWriteU32(uint16_t addr, uint32_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteS32(uint16_t addr, int32_t value)
+eepromError_e eepromWriteS32(uint16_t addr, int32_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -383,13 +520,9 @@ void eepromWriteS32(uint16_t addr, int32_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteU64(uint16_t addr, uint64_t value)
+eepromError_e eepromWriteU64(uint16_t addr, uint64_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
 
 /**************************************************************************/
@@ -400,11 +533,7 @@ void eepromWriteU64(uint16_t addr, uint64_t value)
                 The 16-bit address to write to in EEPROM
 */
 /**************************************************************************/
-void eepromWriteS64(uint16_t addr, int64_t value)
+eepromError_e eepromWriteS64(uint16_t addr, int64_t value)
 {
-  mcp24aaError_e error = MCP24AA_ERROR_OK;
-  error = mcp24aaWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
-
-  // ToDo: Handle any errors
-  if (error) { };
+  return eepromWriteBuffer(addr, (uint8_t *)&value, sizeof(value));
 }
@@ -38,24 +38,37 @@
 
 #include "projectconfig.h"
 
+typedef enum
+{
+  EEPROM_ERROR_OK = 0,                // Everything executed normally
+  EEPROM_ERROR_ADDRERR,               // Address out of range
+  EEPROM_ERROR_I2C,                   // The EEPROM didn't respond (or the bus failed)
+  EEPROM_ERROR_TIMEOUT,               // A write cycle never finished
+  EEPROM_ERROR_LAST
+}
+eepromError_e;
+
 // Method Prototypes
-bool      eepromCheckAddress ( uint16_t addr );
-uint8_t   eepromReadU8 ( uint16_t addr );
-int8_t    eepromReadS8 ( uint16_t addr );
-uint16_t  eepromReadU16 ( uint16_t addr );
-int16_t   eepromReadS16 ( uint16_t addr );
-uint32_t  eepromReadU32 ( uint16_t addr );
-int32_t   eepromReadS32 ( uint16_t addr );
-uint64_t  eepromReadU64 ( uint16_t addr );
-int64_t   eepromReadS64 ( uint16_t addr );
-void      eepromReadBuffer ( uint16_t addr, uint8_t *buffer, uint32_t bufferLength);
-void      eepromWriteU8 ( uint16_t addr, uint8_t value );
-void      eepromWriteS8 ( uint16_t addr, int8_t value );
-void      eepromWriteU16 ( uint16_t addr, uint16_t value );
-void      eepromWriteS16 ( uint16_t addr, int16_t value );
-void      eepromWriteU32 ( uint16_t addr, uint32_t value );
-void      eepromWriteS32 ( uint16_t addr, int32_t value );
-void      eepromWriteU64 ( uint16_t addr, uint64_t value );
-void      eepromWriteS64 ( uint16_t addr, int64_t value );
+bool          eepromCheckAddress ( uint16_t addr );
+eepromError_e eepromGetLastError ( void );
+uint8_t       eepromReadU8 ( uint16_t addr );
+int8_t        eepromReadS8 ( uint16_t addr );
+uint16_t      eepromReadU16 ( uint16_t addr );
+int16_t       eepromReadS16 ( uint16_t addr );
+uint32_t      eepromReadU32 ( uint16_t addr );
+int32_t       eepromReadS32 ( uint16_t addr );
+uint64_t      eepromReadU64 ( uint16_t addr );
+int64_t       eepromReadS64 ( uint16_t addr );
+eepromError_e eepromReadBuffer ( uint16_t addr, uint8_t *buffer, uint32_t bufferLength);
+eepromError_e eepromWriteU8 ( uint16_t addr, uint8_t value );
+eepromError_e eepromWriteS8 ( uint16_t addr, int8_t value );
+eepromError_e eepromWriteU16 ( uint16_t addr, uint16_t value );
+eepromError_e eepromWriteS16 ( uint16_t addr, int16_t value );
+eepromError_e eepromWriteU32 ( uint16_t addr, uint32_t value );
+eepromError_e eepromWriteS32 ( uint16_t addr, int32_t value );
+eepromError_e eepromWriteU64 ( uint16_t addr, uint64_t value );
+eepromError_e eepromWriteS64 ( uint16_t addr, int64_t value );
+eepromError_e eepromWriteBuffer ( uint16_t addr, const uint8_t *buffer, uint32_t bufferLength);
+eepromError_e eepromFlush ( void );
 
 #endif
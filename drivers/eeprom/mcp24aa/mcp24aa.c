@@ -109,6 +109,7 @@ extern volatile uint8_t   I2CSlaveBuffer[I2C_BUFSIZE];
 extern volatile uint32_t  I2CReadLength, I2CWriteLength;
 
 static bool _mcp24aaInitialised = false;
+static bool _mcp24aaWriteBusy = false;    // A write cycle may still be running
 
 /**************************************************************************/
 /*! 
@@ -134,7 +135,8 @@ mcp24aaError_e mcp24aaInit()
     @brief Reads the specified number of bytes from the supplied address.
 
     This function will read one or more bytes starting at the supplied
-    address.  A maximum of 8 bytes can be read in one operation.
+    address.  Up to I2C_BUFSIZE bytes can be read in one operation,
+    across page boundaries.
 
     @param[in]  address
                 The 16-bit address where the read will start.  The maximum
@@ -147,6 +149,8 @@ mcp24aaError_e mcp24aaInit()
 /**************************************************************************/
 mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bufferLength)
 {
+  mcp24aaError_e error;
+
   if (!_mcp24aaInitialised) mcp24aaInit();
 
   if (address >= MCP24AA_MAXADDR)
@@ -154,12 +158,17 @@ mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bu
     return MCP24AA_ERROR_ADDRERR;
   }
 
-  if (bufferLength > 8)
+  if (bufferLength > I2C_BUFSIZE)
   {
     return MCP24AA_ERROR_BUFFEROVERFLOW;
   }
 
-  // ToDo: Check if I2C is ready
+  // Let the last write cycle finish, the EEPROM ignores us until then
+  error = mcp24aaWaitReady();
+  if (error)
+  {
+    return error;
+  }
 
   // Clear buffers
   uint32_t i;
@@ -181,7 +190,10 @@ mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bu
   I2CMasterBuffer[3] = MCP24AA_ADDR | MCP24AA_READBIT;  
 
   // Transmit command
-  i2cEngine();
+  if (i2cEngine() != I2CSTATE_ACK)
+  {
+    return MCP24AA_ERROR_NOACK;
+  }
 
   // Fill response buffer
   for (i = 0; i < bufferLength; i++)
@@ -197,7 +209,7 @@ mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bu
     @brief Writes the supplied bytes at a specified address.
 
     This function will write one or more bytes starting at the supplied
-    address.  A maximum of 8 bytes can be written in one operation.
+    address.  The write must stay within one MCP24AA_PAGESIZE page.
 
     @param[in]  address
                 The 16-bit address where the write will start.  The
@@ -211,6 +223,8 @@ mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bu
 /**************************************************************************/
 mcp24aaError_e mcp24aaWriteBuffer (uint16_t address, uint8_t *buffer, uint32_t bufferLength)
 {
+  mcp24aaError_e error;
+
   if (!_mcp24aaInitialised) mcp24aaInit();
 
   if (address >= MCP24AA_MAXADDR)
@@ -218,12 +232,18 @@ mcp24aaError_e mcp24aaWriteBuffer (uint16_t address, uint8_t *buffer, uint32_t b
     return MCP24AA_ERROR_ADDRERR;
   }
 
-  if (bufferLength > 8)
+  // The address wraps round within the page, so a write can't cross one
+  if ((address % MCP24AA_PAGESIZE) + bufferLength > MCP24AA_PAGESIZE)
   {
     return MCP24AA_ERROR_BUFFEROVERFLOW;
   }
 
-  // ToDo: Check if I2C is ready
+  // Let the last write cycle finish, the EEPROM ignores us until then
+  error = mcp24aaWaitReady();
+  if (error)
+  {
+    return error;
+  }
 
   // Clear write buffer
   uint32_t i;
@@ -244,11 +264,15 @@ mcp24aaError_e mcp24aaWriteBuffer (uint16_t address, uint8_t *buffer, uint32_t b
   }
 
   // Transmit command
-  i2cEngine();
+  if (i2cEngine() != I2CSTATE_ACK)
+  {
+    return MCP24AA_ERROR_NOACK;
+  }
+
+  // Rather than waiting out the worst case write time here, the next
+  // operation polls until the EEPROM answers again
+  _mcp24aaWriteBusy = true;
 
-  // Wait at least 10ms
-  systickDelay(10);
-  
   return MCP24AA_ERROR_OK;
 }
 
@@ -337,3 +361,44 @@ mcp24aaError_e mcp24aaWriteByte (uint16_t address, uint8_t value)
   return mcp24aaWriteBuffer(address, wBuffer, 1);
 }
 
+/**************************************************************************/
+/*! 
+    @brief Waits for the write cycle started by the last write to finish.
+
+    The EEPROM doesn't acknowledge its address while it is busy writing,
+    so it is polled until it does (typically a few ms, rather than the
+    fixed 10ms this driver used to wait after every write).  Reads and
+    writes call this themselves.
+
+    @return MCP24AA_ERROR_TIMEOUT if the EEPROM hasn't answered after
+            MCP24AA_WRITETIMEOUT ms
+*/
+/**************************************************************************/
+mcp24aaError_e mcp24aaWaitReady (void)
+{
+  uint32_t start;
+
+  if (!_mcp24aaWriteBusy)
+  {
+    return MCP24AA_ERROR_OK;
+  }
+
+  start = systickGetTicks();
+  do
+  {
+    // Set the address pointer without writing anything
+    I2CWriteLength = 3;
+    I2CReadLength = 0;
+    I2CMasterBuffer[0] = MCP24AA_ADDR;
+    I2CMasterBuffer[1] = 0;
+    I2CMasterBuffer[2] = 0;
+    if (i2cEngine() == I2CSTATE_ACK)
+    {
+      _mcp24aaWriteBusy = false;
+      return MCP24AA_ERROR_OK;
+    }
+  }
+  while (systickGetTicks() - start <= MCP24AA_WRITETIMEOUT / CFG_SYSTICK_DELAY_IN_MS);
+
+  return MCP24AA_ERROR_TIMEOUT;
+}
@@ -45,6 +45,8 @@
 #define MCP24AA_RW      0x01
 #define MCP24AA_READBIT 0x01
 #define MCP24AA_MAXADDR 0xFFF         // 4K = 4096
+#define MCP24AA_PAGESIZE 32           // A write can't cross a 32 byte page
+#define MCP24AA_WRITETIMEOUT 10       // ms to wait for a write cycle (5ms max)
 
 typedef enum
 {
@@ -52,7 +54,9 @@ typedef enum
   MCP24AA_ERROR_I2CINIT,              // Unable to initialise I2C
   MCP24AA_ERROR_I2CBUSY,              // I2C already in use
   MCP24AA_ERROR_ADDRERR,              // Address out of range
-  MCP24AA_ERROR_BUFFEROVERFLOW,       // Max 8 bytes can be read/written in one operation
+  MCP24AA_ERROR_BUFFEROVERFLOW,       // Read larger than the I2C buffer, or write crossing a page
+  MCP24AA_ERROR_NOACK,                // The EEPROM didn't respond (or the bus failed)
+  MCP24AA_ERROR_TIMEOUT,              // The last write cycle never finished
   MCP24AA_ERROR_LAST
 }
 mcp24aaError_e;
@@ -62,6 +66,7 @@ mcp24aaError_e mcp24aaReadBuffer (uint16_t address, uint8_t *buffer, uint32_t bu
 mcp24aaError_e mcp24aaWriteBuffer (uint16_t address, uint8_t *buffer, uint32_t bufferLength);
 mcp24aaError_e mcp24aaReadByte (uint16_t address, uint8_t *buffer);
 mcp24aaError_e mcp24aaWriteByte (uint16_t address, uint8_t value);
+mcp24aaError_e mcp24aaWaitReady (void);
 
 
 #endif
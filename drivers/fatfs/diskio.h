@@ -67,6 +67,13 @@ void	disk_timerproc (void);
 #define ATA_GET_MODEL		21
 #define ATA_GET_SN			22
 
+/* Sector cache control commands (see CFG_SDCARD_CACHESECTORS) */
+#define CTRL_CACHE_PIN		30	/* Prefer to keep a range of sectors (DWORD[2]: start, count) */
+#define CTRL_CACHE_STATS	31	/* Get cache hits and misses (DWORD[2]) */
+
+/* Write combining control command (see CFG_SDCARD_WRITECOMBINE) */
+#define CTRL_WRITE_IDLE		32	/* Write out held sectors if no write came within the timeout */
+
 
 
 /* Card type flags (CardType) */
@@ -1560,6 +1560,13 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occured */
 		fs->dirbase = fs->fatbase + fsize;				/* Root directory start sector (lba) */
 	fs->database = fs->fatbase + fsize + fs->n_rootdir / (SS(fs)/32);	/* Data start sector (lba) */
 
+	{	/* Ask the disk layer to keep the first FAT cached (if it has a cache) */
+		DWORD pin[2];
+		pin[0] = fs->fatbase;
+		pin[1] = fs->sects_fat;
+		disk_ioctl(fs->drive, CTRL_CACHE_PIN, pin);
+	}
+
 #if !_FS_READONLY
 	/* Initialize allocation information */
 	fs->free_clust = 0xFFFFFFFF;
@@ -12,6 +12,8 @@
 #include "core/ssp/ssp.h"
 #include "core/systick/systick.h"
 
+#include <string.h>
+
 
 /* Definitions for MMC/SDC command */
 #define CMD0	(0x40+0)	/* GO_IDLE_STATE */
@@ -42,6 +44,13 @@
 
 #define FDELAY(ms) systickDelay(ms)     // Assumes delay = 1ms, ugly
 
+/* Write combining is only needed when FatFS can write */
+#if CFG_SDCARD_READONLY == 0 && _READONLY == 0
+#define WC_SECTORS	CFG_SDCARD_WRITECOMBINE
+#else
+#define WC_SECTORS	0
+#endif
+
 /*--------------------------------------------------------------------------
 
    Module Private Functions
@@ -57,6 +66,40 @@ BYTE Timer1, Timer2;	/* 100Hz decrement timer */
 static
 BYTE CardType;			/* Card type flags */
 
+#if CFG_SDCARD_CACHESECTORS > 0
+static
+BYTE CacheBuf[CFG_SDCARD_CACHESECTORS][512];	/* Cached sector data */
+
+static
+DWORD CacheSector[CFG_SDCARD_CACHESECTORS];	/* Sector held by each line */
+
+static
+DWORD CacheStamp[CFG_SDCARD_CACHESECTORS];	/* Last use of each line (0:empty) */
+
+static
+DWORD CacheClock, CacheHits, CacheMisses;
+
+static
+DWORD PinStart, PinCount;	/* Sectors kept in preference to others (FAT) */
+
+static
+DWORD NextSector = 0xFFFFFFFF;	/* Sector following the last one read */
+#endif
+
+#if WC_SECTORS > 0
+static
+BYTE WcBuf[WC_SECTORS][512];	/* Consecutive sectors waiting to be written */
+
+static
+DWORD WcSector;			/* First sector held in WcBuf */
+
+static
+BYTE WcCount;			/* Number of sectors held in WcBuf (0:empty) */
+
+static volatile
+WORD WcTimer;			/* 100Hz decrement timer, restarted on each write */
+#endif
+
 /**************************************************************************/
 /*! 
     Set SSP clock to slow (400 KHz)
@@ -142,12 +185,6 @@ BYTE rcvr_spi (void)
     return data;
 }
 
-/* Alternative macro to receive data fast */
-
-#define rcvr_spi_m(dst) \
-    do { \
-        sspReceive(0, (uint8_t*)(dst), 1); \
-    } while(0)
 
 
 
@@ -246,14 +283,8 @@ BOOL rcvr_datablock (
 	} while ((token == 0xFF) && Timer1);
 	if(token != 0xFE) return FALSE;	/* If not valid data token, retutn with error */
 
-	do {							/* Receive the data block into buffer */
-		rcvr_spi_m(buff++);
-		rcvr_spi_m(buff++);
-		rcvr_spi_m(buff++);
-		rcvr_spi_m(buff++);
-	} while (btr -= 4);
-	rcvr_spi();						/* Discard CRC */
-	rcvr_spi();
+	sspTransfer(0, 0, buff, btr);	/* Receive the data block into buffer */
+	sspTransfer(0, 0, 0, 2);		/* Discard CRC */
 
 	return TRUE;					/* Return with success */
 }
@@ -271,20 +302,15 @@ BOOL xmit_datablock (
 	BYTE token			/* Data/Stop token */
 )
 {
-	BYTE resp, wc;
+	BYTE resp;
 
 
 	if (wait_ready() != 0xFF) return FALSE;
 
 	xmit_spi(token);					/* Xmit data token */
 	if (token != 0xFD) {	/* Is data token */
-		wc = 0;
-		do {							/* Xmit the 512 byte data block to MMC */
-			xmit_spi(*buff++);
-			xmit_spi(*buff++);
-		} while (--wc);
-		xmit_spi(0xFF);					/* CRC (Dummy) */
-		xmit_spi(0xFF);
+		sspTransfer(0, buff, 0, 512);	/* Xmit the 512 byte data block to MMC */
+		sspTransfer(0, 0, 0, 2);		/* CRC (Dummy) */
 		resp = rcvr_spi();				/* Reveive data response */
 		if ((resp & 0x1F) != 0x05)		/* If not accepted, return with error */
 			return FALSE;
@@ -342,6 +368,232 @@ BYTE send_cmd (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Read sector(s) from the card                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+BYTE mmc_read (		/* Returns number of sectors NOT read (0:Successful) */
+	DWORD sector,		/* Start sector number (LBA) */
+	BYTE count,			/* Sector count (1..255) */
+	BYTE *buff,			/* Data buffer for all sectors, or... */
+	BYTE **buffs		/* ...one data buffer per sector if buff is 0 */
+)
+{
+	BYTE n = 0;
+
+
+	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
+
+	if (count == 1) {	/* Single block read */
+		if ((send_cmd(CMD17, sector) == 0)	/* READ_SINGLE_BLOCK */
+			&& rcvr_datablock(buff ? buff : buffs[0], 512))
+			count = 0;
+	}
+	else {				/* Multiple block read */
+		if (send_cmd(CMD18, sector) == 0) {	/* READ_MULTIPLE_BLOCK */
+			do {
+				if (!rcvr_datablock(buff ? buff : buffs[n], 512)) break;
+				if (buff) buff += 512;
+				n++;
+			} while (--count);
+			send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
+		}
+	}
+	deselect();
+
+	return count;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write sector(s) to the card                                           */
+/*-----------------------------------------------------------------------*/
+
+#if _READONLY == 0
+static
+BYTE mmc_write (		/* Returns number of sectors NOT written (0:Successful) */
+	DWORD sector,		/* Start sector number (LBA) */
+	const BYTE *buff1,	/* Data of the first run of sectors */
+	BYTE count1,		/* Sector count of the first run */
+	const BYTE *buff2,	/* Data of the sectors following them */
+	BYTE count2			/* Sector count of the second run (count1 + count2: 1..255) */
+)
+{
+	BYTE count = count1 + count2;
+
+
+	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
+
+	if (count == 1) {	/* Single block write */
+		if ((send_cmd(CMD24, sector) == 0)	/* WRITE_BLOCK */
+			&& xmit_datablock(count1 ? buff1 : buff2, 0xFE))
+			count = 0;
+	}
+	else {				/* Multiple block write */
+		if (CardType & CT_SDC) send_cmd(ACMD23, count);	/* Pre-erase exactly the sectors to be written */
+		if (send_cmd(CMD25, sector) == 0) {	/* WRITE_MULTIPLE_BLOCK */
+			do {
+				if (!count1) {				/* Move on to the second run */
+					buff1 = buff2;
+					count1 = count2;
+				}
+				if (!xmit_datablock(buff1, 0xFC)) break;
+				buff1 += 512;
+				count1--;
+			} while (--count);
+			if (!xmit_datablock(0, 0xFD))	/* STOP_TRAN token */
+				count = 1;
+		}
+	}
+	deselect();
+
+	return count;
+}
+#endif /* _READONLY == 0 */
+
+
+
+#if CFG_SDCARD_CACHESECTORS > 0
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+int cache_find (	/* Returns the line holding the sector or -1 */
+	DWORD sector
+)
+{
+	int i;
+
+
+	for (i = 0; i < CFG_SDCARD_CACHESECTORS; i++) {
+		if (CacheStamp[i] && CacheSector[i] == sector) return i;
+	}
+	return -1;
+}
+
+
+static
+int cache_victim (	/* Returns the line to replace or -1 */
+	BOOL pinned			/* TRUE: lines holding pinned sectors may be used */
+)
+{
+	int i, victim = -1, pvictim = -1;
+
+
+	for (i = 0; i < CFG_SDCARD_CACHESECTORS; i++) {
+		if (!CacheStamp[i]) return i;				/* Empty line */
+		if (CacheSector[i] - PinStart < PinCount) {	/* Least recently used pinned line */
+			if (pvictim < 0 || CacheStamp[i] < CacheStamp[pvictim]) pvictim = i;
+		} else {									/* Least recently used line */
+			if (victim < 0 || CacheStamp[i] < CacheStamp[victim]) victim = i;
+		}
+	}
+	return (victim < 0 && pinned) ? pvictim : victim;
+}
+
+
+static
+DRESULT cache_read (
+	BYTE *buff,			/* Pointer to the data buffer to store read data */
+	DWORD sector		/* Sector number (LBA) */
+)
+{
+	BYTE *buffs[CFG_SDCARD_READAHEAD + 1];
+	int lines[CFG_SDCARD_READAHEAD + 1];
+	int i;
+	BYTE n;
+
+
+	i = cache_find(sector);
+	if (i >= 0) {							/* Cache hit */
+		CacheHits++;
+		CacheStamp[i] = ++CacheClock;
+		NextSector = sector + 1;
+		memcpy(buff, CacheBuf[i], 512);
+		return RES_OK;
+	}
+	CacheMisses++;
+
+	n = 0;
+	i = cache_victim(TRUE);
+	do {									/* Claim a line for each sector to read */
+		lines[n] = i;
+		buffs[n] = CacheBuf[i];
+		CacheSector[i] = sector + n;
+		CacheStamp[i] = ++CacheClock;
+		n++;
+		if (sector != NextSector || n > CFG_SDCARD_READAHEAD) break;	/* Only read ahead on sequential reads */
+		if (cache_find(sector + n) >= 0) break;
+		i = cache_victim(FALSE);
+	} while (i >= 0 && (!CacheStamp[i] || CacheSector[i] - sector >= n));	/* Stop if the lines run out */
+
+	if (mmc_read(sector, n, 0, buffs)) {	/* Read failed (maybe past the end of the card) */
+		for (i = 0; i < n; i++) CacheStamp[lines[i]] = 0;
+		if (n == 1 || mmc_read(sector, 1, 0, buffs)) return RES_ERROR;
+		CacheStamp[lines[0]] = ++CacheClock;
+	}
+
+	NextSector = sector + 1;
+	memcpy(buff, buffs[0], 512);
+	return RES_OK;
+}
+
+
+static
+void cache_update (
+	const BYTE *buff,	/* Data written, or 0 to drop the sectors */
+	DWORD sector,		/* Start sector number (LBA) */
+	BYTE count			/* Sector count (1..255) */
+)
+{
+	int i;
+
+
+	for ( ; count; count--, sector++) {
+		i = cache_find(sector);
+		if (i >= 0) {
+			if (buff)
+				memcpy(CacheBuf[i], buff, 512);
+			else
+				CacheStamp[i] = 0;
+		}
+		if (buff) buff += 512;
+	}
+}
+#endif /* CFG_SDCARD_CACHESECTORS */
+
+
+
+#if WC_SECTORS > 0
+/*-----------------------------------------------------------------------*/
+/* Write combining                                                       */
+/*-----------------------------------------------------------------------*/
+/* Consecutive writes are held in WcBuf and sent with one CMD25 when the */
+/* run breaks, the buffer overflows, on CTRL_SYNC or once idle.          */
+
+static
+BYTE wc_flush (void)	/* Returns number of sectors NOT written (0:Successful) */
+{
+	BYTE n = WcCount, res;
+
+
+	if (!n) return 0;
+	WcCount = 0;
+	res = mmc_write(WcSector, WcBuf[0], n, 0, 0);
+
+#if CFG_SDCARD_CACHESECTORS > 0
+	if (res) cache_update(0, WcSector, n);	/* The card may not hold what the cache does */
+#endif
+
+	return res;
+}
+#endif /* WC_SECTORS */
+
+
+
 /*--------------------------------------------------------------------------
 
    Public Functions
@@ -363,11 +615,13 @@ DSTATUS disk_initialize (
         sspInit(0, sspClockPolarity_Low, sspClockPhase_RisingEdge); 
     
         gpioSetDir( SSP0_CSPORT, SSP0_CSPIN, gpioDirection_Output ); /* CS */
+#if CFG_SDCARD_CARDDETECT == 1
         gpioSetDir( CFG_SDCARD_CDPORT, CFG_SDCARD_CDPIN, gpioDirection_Input ); /* Card Detect */
         gpioSetPullup (&IOCON_PIO3_0, gpioPullupMode_Inactive);
 
         // Wait 20ms for card detect to stabilise
         systickDelay(20);        
+#endif
 
 	if (drv) return STA_NOINIT;			/* Supports only single drive */
 	if (Stat & STA_NODISK) return Stat;	/* No card in the socket */
@@ -402,6 +656,15 @@ DSTATUS disk_initialize (
 	CardType = ty;
 	deselect();
 
+#if CFG_SDCARD_CACHESECTORS > 0
+	memset(CacheStamp, 0, sizeof(CacheStamp));	/* The card may have been changed */
+	PinCount = 0;
+	NextSector = 0xFFFFFFFF;
+#endif
+#if WC_SECTORS > 0
+	WcCount = 0;
+#endif
+
 	if (ty) {			/* Initialization succeded */
 		Stat &= ~STA_NOINIT;		/* Clear STA_NOINIT */
 		FCLK_FAST();
@@ -442,25 +705,22 @@ DRESULT disk_read (
 	if (drv || !count) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
-
-	if (count == 1) {	/* Single block read */
-		if ((send_cmd(CMD17, sector) == 0)	/* READ_SINGLE_BLOCK */
-			&& rcvr_datablock(buff, 512))
-			count = 0;
-	}
-	else {				/* Multiple block read */
-		if (send_cmd(CMD18, sector) == 0) {	/* READ_MULTIPLE_BLOCK */
-			do {
-				if (!rcvr_datablock(buff, 512)) break;
-				buff += 512;
-			} while (--count);
-			send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
+#if WC_SECTORS > 0
+	if (WcCount && sector < WcSector + WcCount && sector + count > WcSector) {	/* Overlaps the held sectors */
+		if (count == 1) {
+			memcpy(buff, WcBuf[sector - WcSector], 512);
+			return RES_OK;
 		}
+		if (wc_flush()) return RES_ERROR;
 	}
-	deselect();
+#endif
 
-	return count ? RES_ERROR : RES_OK;
+#if CFG_SDCARD_CACHESECTORS > 0
+	if (count == 1) return cache_read(buff, sector);
+	NextSector = sector + count;
+#endif
+
+	return mmc_read(sector, count, buff, 0) ? RES_ERROR : RES_OK;
 }
 
 
@@ -477,31 +737,52 @@ DRESULT disk_write (
 	BYTE count			/* Sector count (1..255) */
 )
 {
+	BYTE res;
+#if WC_SECTORS > 0
+	DWORD ofs;
+#endif
+
+
 	if (drv || !count) return RES_PARERR;
 	if (Stat & STA_NOINIT) return RES_NOTRDY;
 	if (Stat & STA_PROTECT) return RES_WRPRT;
 
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* Convert to byte address if needed */
-
-	if (count == 1) {	/* Single block write */
-		if ((send_cmd(CMD24, sector) == 0)	/* WRITE_BLOCK */
-			&& xmit_datablock(buff, 0xFE))
-			count = 0;
-	}
-	else {				/* Multiple block write */
-		if (CardType & CT_SDC) send_cmd(ACMD23, count);
-		if (send_cmd(CMD25, sector) == 0) {	/* WRITE_MULTIPLE_BLOCK */
-			do {
-				if (!xmit_datablock(buff, 0xFC)) break;
-				buff += 512;
-			} while (--count);
-			if (!xmit_datablock(0, 0xFD))	/* STOP_TRAN token */
-				count = 1;
+#if CFG_SDCARD_CACHESECTORS > 0
+	cache_update(buff, sector, count);	/* Keep the cache in step with what is written */
+#endif
+
+#if WC_SECTORS > 0
+	WcTimer = CFG_SDCARD_WRITETIMEOUT / 10;
+	res = 0;
+	if (WcCount && (sector < WcSector || sector > WcSector + WcCount))	/* Run broken: write out the held sectors first */
+		res = wc_flush();
+	if (!res) {
+		if (!WcCount) WcSector = sector;
+		ofs = sector - WcSector;
+		if (ofs + count <= WC_SECTORS) {			/* Hold (or rewrite) the sectors until the run ends */
+			memcpy(WcBuf[ofs], buff, (UINT)count * 512);
+			if (WcCount < ofs + count) WcCount = (BYTE)(ofs + count);
+			return RES_OK;
+		}
+		if (ofs == WcCount && WcCount + count <= 255) {	/* Write the held and new sectors with one command */
+			res = mmc_write(WcSector, WcBuf[0], WcCount, buff, count);
+			sector = WcSector;
+			count += WcCount;
+			WcCount = 0;
+		} else {
+			res = wc_flush();
+			if (!res) res = mmc_write(sector, buff, count, 0, 0);
 		}
 	}
-	deselect();
+#else
+	res = mmc_write(sector, buff, count, 0, 0);
+#endif
+
+#if CFG_SDCARD_CACHESECTORS > 0
+	if (res) cache_update(0, sector, count);	/* The card may not hold what the cache does */
+#endif
 
-	return count ? RES_ERROR : RES_OK;
+	return res ? RES_ERROR : RES_OK;
 }
 #endif /* _READONLY == 0 */
 
@@ -527,6 +808,26 @@ DRESULT disk_ioctl (
 
 	res = RES_ERROR;
 
+#if CFG_SDCARD_CACHESECTORS > 0
+	if (ctrl == CTRL_CACHE_PIN) {		/* Keep a range of sectors (DWORD start, count) */
+		PinStart = ((DWORD*)buff)[0];
+		PinCount = ((DWORD*)buff)[1];
+		return RES_OK;
+	}
+	if (ctrl == CTRL_CACHE_STATS) {		/* Get cache hits and misses (DWORD hits, misses) */
+		((DWORD*)buff)[0] = CacheHits;
+		((DWORD*)buff)[1] = CacheMisses;
+		return RES_OK;
+	}
+#endif
+
+#if WC_SECTORS > 0
+	if (ctrl == CTRL_WRITE_IDLE) {		/* Write out held sectors once no write came for CFG_SDCARD_WRITETIMEOUT */
+		if (WcCount && !WcTimer && wc_flush()) return RES_ERROR;
+		return RES_OK;
+	}
+#endif
+
 	if (ctrl == CTRL_POWER) {
 		switch (*ptr) {
 		case 0:		/* Sub control code == 0 (POWER_OFF) */
@@ -551,6 +852,9 @@ DRESULT disk_ioctl (
 
 		switch (ctrl) {
 		case CTRL_SYNC :		/* Make sure that no pending write process. Do not remove this or written sector might not left updated. */
+#if WC_SECTORS > 0
+			if (wc_flush()) break;
+#endif
 			if (select1()) {
 				res = RES_OK;
 				deselect();
@@ -658,11 +962,18 @@ void disk_timerproc (void)
   if (n) Timer1 = --n;
   n = Timer2;
   if (n) Timer2 = --n;
+#if WC_SECTORS > 0
+  if (WcTimer) WcTimer--;
+#endif
 
   n = pv;
   pv = 0;
   /* Sample card detect pin */
+#if CFG_SDCARD_CARDDETECT == 1
   pv = gpioGetValue(CFG_SDCARD_CDPORT, CFG_SDCARD_CDPIN);
+#else
+  pv = 1;                       /* No card detect, assume a card is present */
+#endif
     
   /* Have contacts stabled? */
   if (n == pv) 
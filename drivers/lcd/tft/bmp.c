@@ -3,7 +3,8 @@
     @file     bmp.c
     @author   K. Townsend (microBuilder.eu)
 
-    @brief    Loads uncomprssed 24-bit windows bitmaps images
+    @brief    Loads 24-bit, 16-bit and 8-bit (uncompressed or RLE8)
+              windows bitmap images
 
     Based on the information available at:
     http://local.wasp.uwa.edu.au/~pbourke/dataformats/bmp/
@@ -46,89 +47,650 @@
 #include "drivers/lcd/tft/drawing.h"
 #include "drivers/lcd/tft/lcd.h"
 
-// Only include read support if CFG_SDCARD is defined
+#ifdef CFG_USBCDC
+  #include "core/usbcdc/cdcuser.h"
+#endif
+
+// Size of the blocks read from or written to the SD card (one sector)
+#define BMP_SECTORSIZE    (512)
+
+// Widest image row that can be rendered or captured (widest supported LCD)
+#define BMP_MAXROWPIXELS  (320)
+
+// Fast 8-bit per channel to RGB565 conversion
+#define BMP_RGB888TO565(r, g, b)  ((((r) & 0xF8) << 8) | (((g) & 0xFC) << 3) | ((b) >> 3))
+
+// Sector and row buffers shared by the renderers and the screenshot
+// writer (only one of them runs at a time), kept off the stack
+static uint8_t  bmpSector[BMP_SECTORSIZE];
+static uint16_t bmpLine[BMP_MAXROWPIXELS];
+
+/**************************************************************************/
+/*                                                                        */
+/* ----------------------- Private Methods ------------------------------ */
+/*                                                                        */
+/**************************************************************************/
+
+/**************************************************************************/
+/*!
+    @brief  Destination for screenshot data (SD card, USB CDC, etc.).
+            Returns false if the data couldn't be written.
+*/
+/**************************************************************************/
+typedef bool (*bmpWriteFunc_t)(const uint8_t *data, uint32_t len);
+
+/**************************************************************************/
+/*!
+    @brief  Little-endian helpers to build the header block in place
+*/
+/**************************************************************************/
+static void bmpPutU16(uint8_t *p, uint16_t value)
+{
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+}
+
+static void bmpPutU32(uint8_t *p, uint32_t value)
+{
+  p[0] = value & 0xFF;
+  p[1] = (value >> 8) & 0xFF;
+  p[2] = (value >> 16) & 0xFF;
+  p[3] = value >> 24;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Appends a byte to the sector buffer, passing the buffer to
+            'write' once it's full
+*/
+/**************************************************************************/
+static bool bmpBufferByte(uint8_t *buffer, uint32_t *pos, uint8_t value, bmpWriteFunc_t write)
+{
+  buffer[(*pos)++] = value;
+  if (*pos == BMP_SECTORSIZE)
+  {
+    *pos = 0;
+    return write(buffer, BMP_SECTORSIZE);
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Captures the LCD contents as a bitmap image, passing the data
+            to 'write' one full sector at a time
+
+    Each row is read from the LCD in a single lcdGetPixels burst,
+    converted to the requested format and appended to a sector-sized
+    buffer, so 'write' is only ever called with whole sectors (except
+    for the final block).
+*/
+/**************************************************************************/
+static bmp_error_t bmpWriteScreenshot(bmp_format_t format, bmpWriteFunc_t write)
+{
+  uint8_t   *buffer = bmpSector;
+  uint16_t  *line = bmpLine;
+  uint8_t   px[3];
+  uint32_t  lcdWidth, lcdHeight, x, y, i, pos, offset, rowSize, padding;
+  uint16_t  c;
+
+  lcdWidth = lcdGetWidth();
+  lcdHeight = lcdGetHeight();
+  if (lcdWidth > BMP_MAXROWPIXELS)
+  {
+    return BMP_ERROR_INVALIDDIMENSIONS;
+  }
+
+  // RGB565 images need the three color masks after the info header
+  offset = format == BMP_FORMAT_RGB565 ? 14 + 40 + 12 : 14 + 40;
+  rowSize = ((lcdWidth * format + 31) / 32) * 4;
+  padding = rowSize - (lcdWidth * format / 8);
+
+  // File header
+  bmpPutU16(&buffer[0], 0x4D42);                          // 'BM'
+  bmpPutU32(&buffer[2], offset + (rowSize * lcdHeight));  // File size in bytes
+  bmpPutU32(&buffer[6], 0);                               // Reserved
+  bmpPutU32(&buffer[10], offset);                         // Offset in bytes to the image data
+
+  // Info header
+  bmpPutU32(&buffer[14], 40);
+  bmpPutU32(&buffer[18], lcdWidth);
+  bmpPutU32(&buffer[22], lcdHeight);
+  bmpPutU16(&buffer[26], 1);
+  bmpPutU16(&buffer[28], format);
+  bmpPutU32(&buffer[30], format == BMP_FORMAT_RGB565 ? BMP_COMPRESSION_RGBMASK : BMP_COMPRESSION_NONE);
+  bmpPutU32(&buffer[34], rowSize * lcdHeight);
+  bmpPutU32(&buffer[38], 0x0B12);                         // 72 DPI
+  bmpPutU32(&buffer[42], 0x0B12);
+  bmpPutU32(&buffer[46], 0);
+  bmpPutU32(&buffer[50], 0);
+  if (format == BMP_FORMAT_RGB565)
+  {
+    bmpPutU32(&buffer[54], 0xF800);
+    bmpPutU32(&buffer[58], 0x07E0);
+    bmpPutU32(&buffer[62], 0x001F);
+  }
+  pos = offset;
+
+  // Image data, starting from the bottom row
+  for (y = lcdHeight; y != 0; y--)
+  {
+    lcdGetPixels(0, y - 1, line, lcdWidth);
+    for (x = 0; x < lcdWidth; x++)
+    {
+      c = line[x];
+      if (format == BMP_FORMAT_RGB565)
+      {
+        px[0] = c & 0xFF;
+        px[1] = c >> 8;
+      }
+      else
+      {
+        px[0] = ((c & 0x001F) << 3) | ((c & 0x001F) >> 2);    // Blue
+        px[1] = ((c & 0x07E0) >> 3) | ((c & 0x07E0) >> 9);    // Green
+        px[2] = ((c & 0xF800) >> 8) | ((c & 0xF800) >> 13);   // Red
+      }
+      for (i = 0; i < format / 8; i++)
+      {
+        if (!bmpBufferByte(buffer, &pos, px[i], write)) return BMP_ERROR_WRITEFAILED;
+      }
+    }
+    for (i = 0; i < padding; i++)
+    {
+      if (!bmpBufferByte(buffer, &pos, 0, write)) return BMP_ERROR_WRITEFAILED;
+    }
+  }
+
+  if (pos && (!write(buffer, pos)))
+  {
+    return BMP_ERROR_WRITEFAILED;
+  }
+
+  return BMP_ERROR_NONE;
+}
+
+// Only include SD card support if CFG_SDCARD is defined
 #ifdef CFG_SDCARD
   #include "drivers/fatfs/diskio.h"
   #include "drivers/fatfs/ff.h"
+  #ifdef CFG_ARCHIVE
+    #include "archive.h"
+  #endif
   static FATFS Fatfs[1];
+  static uint16_t bmpPalette[256];
   #if defined CFG_SDCARD_READONLY && CFG_SDCARD_READONLY == 0
-	static FILINFO Finfo;
 	static FIL bmpSDFile;
   #endif
 
 /**************************************************************************/
-/*                                                                        */
-/* ----------------------- Private Methods ------------------------------ */
-/*                                                                        */
+/*!
+    @brief  Sector-aligned read stream used to pull bitmap data from the
+            card one block at a time
+*/
 /**************************************************************************/
-bmp_error_t bmpParseBitmap(uint16_t x, uint16_t y, FIL file)
+typedef struct
 {
-  UINT              bytesRead;
-  bmp_header_t      header;
-  bmp_infoheader_t  infoHeader;
+  FIL     *file;
+  uint8_t *buffer;                    /* BMP_SECTORSIZE byte block buffer */
+  DWORD    start;                     /* File offset of buffer[0]         */
+  UINT     pos;                       /* Read position in buffer          */
+  UINT     len;                       /* Valid bytes in buffer            */
+} bmp_stream_t;
+
+/**************************************************************************/
+/*!
+    @brief  Refills the stream buffer up to the next sector boundary
 
-  // Read the file header
-  // ToDo: Optimise this to read buffer once and parse it
-  f_read(&file, &header.type, sizeof(header.type), &bytesRead);
-  f_read(&file, &header.size, sizeof(header.size), &bytesRead);
-  f_read(&file, &header.reserved1, sizeof(header.reserved1), &bytesRead);
-  f_read(&file, &header.reserved2, sizeof(header.reserved2), &bytesRead);
-  f_read(&file, &header.offset, sizeof(header.offset), &bytesRead);
+    Since every read ends on a sector boundary, all reads after the
+    first one are whole, aligned sectors that FatFS passes straight to
+    disk_read without going through the shared sector window.
+*/
+/**************************************************************************/
+static bool bmpStreamFill(bmp_stream_t *stream)
+{
+  UINT toRead = BMP_SECTORSIZE - (stream->file->fptr % BMP_SECTORSIZE);
 
-  // Make sure this is a bitmap (first two bytes = 'BM' or 0x4D42 on little-endian systems)
-  if (header.type != 0x4D42) return BMP_ERROR_NOTABITMAP;
+  stream->start = stream->file->fptr;
+  stream->pos = 0;
+  if ((f_read(stream->file, stream->buffer, toRead, &stream->len) != FR_OK) || (stream->len == 0))
+  {
+    stream->len = 0;
+    return false;
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Moves the stream to the specified file offset, only going
+            back to the card if the offset isn't already buffered
+*/
+/**************************************************************************/
+static bool bmpStreamSeek(bmp_stream_t *stream, DWORD offset)
+{
+  if ((offset >= stream->start) && (offset < stream->start + stream->len))
+  {
+    stream->pos = offset - stream->start;
+    return true;
+  }
+  if (f_lseek(stream->file, offset) != FR_OK)
+  {
+    return false;
+  }
+  return bmpStreamFill(stream);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the next byte in the stream, or -1 at EOF
+*/
+/**************************************************************************/
+static int32_t bmpStreamGetByte(bmp_stream_t *stream)
+{
+  if ((stream->pos == stream->len) && (!bmpStreamFill(stream)))
+  {
+    return -1;
+  }
+  return stream->buffer[stream->pos++];
+}
+
+/**************************************************************************/
+/*!
+    @brief  Skips the specified number of bytes (row padding, etc.)
+*/
+/**************************************************************************/
+static bool bmpStreamSkip(bmp_stream_t *stream, uint32_t bytes)
+{
+  return bmpStreamSeek(stream, stream->start + stream->pos + bytes);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Little-endian helpers to parse the header block in place
+*/
+/**************************************************************************/
+static uint16_t bmpGetU16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t bmpGetU32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sends pixels start..end-1 of a decoded row to the LCD.  'row'
+            is the row index in file order, which is bottom-up unless the
+            height is negative.
+*/
+/**************************************************************************/
+static void bmpDrawRun(uint16_t x, uint16_t y, const bmp_infoheader_t *info, uint32_t row, uint32_t start, uint32_t end, uint16_t *line)
+{
+  if (end > (uint32_t)info->width)
+  {
+    end = info->width;
+  }
+  if (start >= end)
+  {
+    return;
+  }
+
+  if (info->height > 0)
+  {
+    lcdDrawPixels(x + start, y + info->height - 1 - row, &line[start], end - start);
+  }
+  else
+  {
+    lcdDrawPixels(x + start, y + row, &line[start], end - start);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sends one whole decoded row to the LCD
+*/
+/**************************************************************************/
+static void bmpDrawRow(uint16_t x, uint16_t y, const bmp_infoheader_t *info, uint32_t row, uint16_t *line)
+{
+  bmpDrawRun(x, y, info, row, 0, info->width, line);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Renders uncompressed 24-bit pixel data
+*/
+/**************************************************************************/
+static bmp_error_t bmpRender24(bmp_stream_t *stream, uint16_t x, uint16_t y, const bmp_infoheader_t *info, uint32_t rows)
+{
+  uint16_t *line = bmpLine;
+  uint32_t row, px, n, padding;
+  const uint8_t *p;
+  int32_t r, g, b;
+
+  padding = (4 - ((info->width * 3) & 3)) & 3;
+
+  for (row = 0; row < rows; row++)
+  {
+    px = 0;
+    while (px < info->width)
+    {
+      // Convert as many whole pixels as are sitting in the buffer
+      n = (stream->len - stream->pos) / 3;
+      if (n > info->width - px)
+      {
+        n = info->width - px;
+      }
+      if (n)
+      {
+        p = &stream->buffer[stream->pos];
+        stream->pos += n * 3;
+        while (n--)
+        {
+          line[px++] = BMP_RGB888TO565(p[2], p[1], p[0]);
+          p += 3;
+        }
+      }
+      else
+      {
+        // Pixel straddles two sectors
+        b = bmpStreamGetByte(stream);
+        g = bmpStreamGetByte(stream);
+        r = bmpStreamGetByte(stream);
+        if (r < 0)
+        {
+          return BMP_ERROR_PREMATUREEOF;
+        }
+        line[px++] = BMP_RGB888TO565(r, g, b);
+      }
+    }
+    bmpDrawRow(x, y, info, row, line);
+    if (padding && (!bmpStreamSkip(stream, padding)) && (row != rows - 1))
+    {
+      return BMP_ERROR_PREMATUREEOF;
+    }
+  }
+
+  return BMP_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Renders uncompressed 16-bit (RGB555 or RGB565) pixel data
+*/
+/**************************************************************************/
+static bmp_error_t bmpRender16(bmp_stream_t *stream, uint16_t x, uint16_t y, const bmp_infoheader_t *info, uint32_t rows, bool rgb565)
+{
+  uint16_t *line = bmpLine;
+  uint32_t row, px, padding;
+  int32_t lo, hi;
+  uint16_t c;
+
+  padding = (info->width & 1) ? 2 : 0;
 
-  // Read the info header
-  // ToDo: Optimise this to read buffer once and parse it
-  f_read(&file, &infoHeader.size, sizeof(infoHeader.size), &bytesRead);
-  f_read(&file, &infoHeader.width, sizeof(infoHeader.width), &bytesRead);
-  f_read(&file, &infoHeader.height, sizeof(infoHeader.height), &bytesRead);
-  f_read(&file, &infoHeader.planes, sizeof(infoHeader.planes), &bytesRead);
-  f_read(&file, &infoHeader.bits, sizeof(infoHeader.bits), &bytesRead);
-  f_read(&file, &infoHeader.compression, sizeof(infoHeader.compression), &bytesRead);
-  f_read(&file, &infoHeader.imagesize, sizeof(infoHeader.imagesize), &bytesRead);
-  f_read(&file, &infoHeader.xresolution, sizeof(infoHeader.xresolution), &bytesRead);
-  f_read(&file, &infoHeader.yresolution, sizeof(infoHeader.yresolution), &bytesRead);
-  f_read(&file, &infoHeader.ncolours, sizeof(infoHeader.ncolours), &bytesRead);
-  f_read(&file, &infoHeader.importantcolours, sizeof(infoHeader.importantcolours), &bytesRead);
-
-  // Make sure that this is a 24-bit image
-  if (infoHeader.bits != 24) 
+  for (row = 0; row < rows; row++)
+  {
+    for (px = 0; px < info->width; px++)
+    {
+      if (stream->len - stream->pos >= 2)
+      {
+        c = bmpGetU16(&stream->buffer[stream->pos]);
+        stream->pos += 2;
+      }
+      else
+      {
+        // Pixel straddles two sectors (only with odd data offsets)
+        lo = bmpStreamGetByte(stream);
+        hi = bmpStreamGetByte(stream);
+        if (hi < 0)
+        {
+          return BMP_ERROR_PREMATUREEOF;
+        }
+        c = lo | (hi << 8);
+      }
+      line[px] = rgb565 ? c : ((c & 0x7FE0) << 1) | (c & 0x001F);
+    }
+    bmpDrawRow(x, y, info, row, line);
+    if (padding && (!bmpStreamSkip(stream, padding)) && (row != rows - 1))
+    {
+      return BMP_ERROR_PREMATUREEOF;
+    }
+  }
+
+  return BMP_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Renders 8-bit palettised pixel data, either uncompressed or
+            RLE8 compressed.  Pixels skipped by an RLE8 delta or end of
+            line code are left untouched on the LCD: only the runs of
+            decoded pixels are drawn.
+*/
+/**************************************************************************/
+static bmp_error_t bmpRender8(bmp_stream_t *stream, uint16_t x, uint16_t y, const bmp_infoheader_t *info, uint32_t rows, DWORD paletteOffset, DWORD dataOffset)
+{
+  uint16_t *palette = bmpPalette;
+  uint16_t *line = bmpLine;
+  uint32_t i, colors, row, px, start, padding;
+  int32_t b, g, r, count, value;
+
+  // Convert the palette to RGB565 once
+  colors = info->ncolours ? info->ncolours : 256;
+  if (colors > 256)
+  {
     return BMP_ERROR_INVALIDBITDEPTH;
+  }
+  if (!bmpStreamSeek(stream, paletteOffset))
+  {
+    return BMP_ERROR_PREMATUREEOF;
+  }
+  memset(palette, 0, sizeof(bmpPalette));
+  for (i = 0; i < colors; i++)
+  {
+    b = bmpStreamGetByte(stream);
+    g = bmpStreamGetByte(stream);
+    r = bmpStreamGetByte(stream);
+    if ((bmpStreamGetByte(stream) < 0) || (r < 0))
+    {
+      return BMP_ERROR_PREMATUREEOF;
+    }
+    palette[i] = BMP_RGB888TO565(r, g, b);
+  }
 
-  // Check image dimensions
-  if ((infoHeader.width > lcdGetWidth()) | (infoHeader.height > lcdGetHeight()))
-    return BMP_ERROR_INVALIDDIMENSIONS;
+  if (!bmpStreamSeek(stream, dataOffset))
+  {
+    return BMP_ERROR_PREMATUREEOF;
+  }
+
+  if (info->compression == BMP_COMPRESSION_NONE)
+  {
+    padding = (4 - (info->width & 3)) & 3;
+    for (row = 0; row < rows; row++)
+    {
+      for (px = 0; px < info->width; px++)
+      {
+        if ((value = bmpStreamGetByte(stream)) < 0)
+        {
+          return BMP_ERROR_PREMATUREEOF;
+        }
+        line[px] = palette[value];
+      }
+      bmpDrawRow(x, y, info, row, line);
+      if (padding && (!bmpStreamSkip(stream, padding)) && (row != rows - 1))
+      {
+        return BMP_ERROR_PREMATUREEOF;
+      }
+    }
+    return BMP_ERROR_NONE;
+  }
 
-  // Make sure image is not compressed
-  if (infoHeader.compression != BMP_COMPRESSION_NONE) 
-    return BMP_ERROR_COMPRESSEDDATA;
+  // RLE8 compressed data.  'start' is where the run of pixels decoded
+  // since the last escape code begins.
+  row = 0;
+  px = 0;
+  start = 0;
 
-  // Read 24-bit image data
-  uint32_t px, py;
-  FRESULT res;
-  uint8_t buffer[infoHeader.width * 3];
-  for (py = infoHeader.height; py > 0; py--)
+  while (row < rows)
   {
-    // Read one row at a time
-    res = f_read(&file, &buffer, infoHeader.width * 3, &bytesRead);
-    if (res || bytesRead == 0)
+    count = bmpStreamGetByte(stream);
+    value = bmpStreamGetByte(stream);
+    if (value < 0)
     {
-      // Error or EOF
       return BMP_ERROR_PREMATUREEOF;
     }
-    for (px = 0; px < infoHeader.width; px++)
+
+    if (count > 0)
     {
-      // Render pixel
-      // ToDo: This is a brutally slow way of rendering bitmaps ...
-      //        update to pass one row of data at a time
-      drawPixel(x + px, y + py - 1, drawRGB24toRGB565(buffer[(px * 3) + 2], buffer[(px * 3) + 1], buffer[(px * 3)]));
+      // Encoded run of 'count' identical pixels
+      while (count-- && (px < info->width))
+      {
+        line[px++] = palette[value];
+      }
+    }
+    else if (value == 0 || value == 1)
+    {
+      // End of line or end of bitmap
+      bmpDrawRun(x, y, info, row++, start, px, line);
+      if (value == 1)
+      {
+        break;
+      }
+      px = 0;
+      start = 0;
+    }
+    else if (value == 2)
+    {
+      // Delta: move right and down, leaving skipped pixels untouched
+      count = bmpStreamGetByte(stream);
+      value = bmpStreamGetByte(stream);
+      if (value < 0)
+      {
+        return BMP_ERROR_PREMATUREEOF;
+      }
+      bmpDrawRun(x, y, info, row, start, px, line);
+      row += value;
+      px += count;
+      start = px;
+    }
+    else
+    {
+      // Absolute run of 'value' pixels, padded to a 16-bit boundary
+      for (i = 0; i < (uint32_t)value; i++)
+      {
+        if ((count = bmpStreamGetByte(stream)) < 0)
+        {
+          return BMP_ERROR_PREMATUREEOF;
+        }
+        if (px < info->width)
+        {
+          line[px++] = palette[count];
+        }
+      }
+      if ((value & 1) && (bmpStreamGetByte(stream) < 0))
+      {
+        return BMP_ERROR_PREMATUREEOF;
+      }
     }
   }
 
   return BMP_ERROR_NONE;
 }
 
+bmp_error_t bmpParseBitmap(uint16_t x, uint16_t y, FIL *file)
+{
+  bmp_stream_t      stream;
+  bmp_header_t      header;
+  bmp_infoheader_t  infoHeader;
+  uint32_t          rows;
+  const uint8_t     *p;
+
+  stream.file = file;
+  stream.buffer = bmpSector;
+
+  // Read the first block and parse both headers from it in place
+  if ((!bmpStreamFill(&stream)) || (stream.len < 54))
+  {
+    return BMP_ERROR_NOTABITMAP;
+  }
+  p = stream.buffer;
+  header.type = bmpGetU16(&p[0]);
+  header.size = bmpGetU32(&p[2]);
+  header.reserved1 = bmpGetU16(&p[6]);
+  header.reserved2 = bmpGetU16(&p[8]);
+  header.offset = bmpGetU32(&p[10]);
+
+  // Make sure this is a bitmap (first two bytes = 'BM' or 0x4D42 on little-endian systems)
+  if (header.type != 0x4D42) return BMP_ERROR_NOTABITMAP;
+
+  infoHeader.size = bmpGetU32(&p[14]);
+  infoHeader.width = (int32_t)bmpGetU32(&p[18]);
+  infoHeader.height = (int32_t)bmpGetU32(&p[22]);
+  infoHeader.planes = bmpGetU16(&p[26]);
+  infoHeader.bits = bmpGetU16(&p[28]);
+  infoHeader.compression = bmpGetU32(&p[30]);
+  infoHeader.imagesize = bmpGetU32(&p[34]);
+  infoHeader.xresolution = (int32_t)bmpGetU32(&p[38]);
+  infoHeader.yresolution = (int32_t)bmpGetU32(&p[42]);
+  infoHeader.ncolours = bmpGetU32(&p[46]);
+  infoHeader.importantcolours = bmpGetU32(&p[50]);
+
+  // Check image dimensions
+  rows = infoHeader.height < 0 ? -infoHeader.height : infoHeader.height;
+  if ((infoHeader.width <= 0) || (infoHeader.width > BMP_MAXROWPIXELS) ||
+      (x + infoHeader.width > lcdGetWidth()) || (y + rows > lcdGetHeight()))
+    return BMP_ERROR_INVALIDDIMENSIONS;
+
+  switch (infoHeader.bits)
+  {
+    case 24:
+      if (infoHeader.compression != BMP_COMPRESSION_NONE)
+        return BMP_ERROR_COMPRESSEDDATA;
+      if (!bmpStreamSeek(&stream, header.offset))
+        return BMP_ERROR_PREMATUREEOF;
+      return bmpRender24(&stream, x, y, &infoHeader, rows);
+
+    case 16:
+      if (infoHeader.compression == BMP_COMPRESSION_NONE)
+      {
+        // Uncompressed 16-bit images are always RGB555
+        if (!bmpStreamSeek(&stream, header.offset))
+          return BMP_ERROR_PREMATUREEOF;
+        return bmpRender16(&stream, x, y, &infoHeader, rows, false);
+      }
+      if (infoHeader.compression == BMP_COMPRESSION_RGBMASK)
+      {
+        // The color masks follow the 40-byte info header (or are part
+        // of the V4/V5 header), so they're always in the first block
+        if (stream.len < 66) 
+          return BMP_ERROR_PREMATUREEOF;
+        if ((bmpGetU32(&p[54]) == 0xF800) && (bmpGetU32(&p[58]) == 0x07E0) && (bmpGetU32(&p[62]) == 0x001F))
+        {
+          if (!bmpStreamSeek(&stream, header.offset))
+            return BMP_ERROR_PREMATUREEOF;
+          return bmpRender16(&stream, x, y, &infoHeader, rows, true);
+        }
+        if ((bmpGetU32(&p[54]) == 0x7C00) && (bmpGetU32(&p[58]) == 0x03E0) && (bmpGetU32(&p[62]) == 0x001F))
+        {
+          if (!bmpStreamSeek(&stream, header.offset))
+            return BMP_ERROR_PREMATUREEOF;
+          return bmpRender16(&stream, x, y, &infoHeader, rows, false);
+        }
+        return BMP_ERROR_INVALIDBITDEPTH;
+      }
+      return BMP_ERROR_COMPRESSEDDATA;
+
+    case 8:
+      if ((infoHeader.compression != BMP_COMPRESSION_NONE) && (infoHeader.compression != BMP_COMPRESSION_RLE8))
+        return BMP_ERROR_COMPRESSEDDATA;
+      return bmpRender8(&stream, x, y, &infoHeader, rows, 14 + infoHeader.size, header.offset);
+
+    default:
+      return BMP_ERROR_INVALIDBITDEPTH;
+  }
+}
+
 /**************************************************************************/
 /*                                                                        */
 /* ----------------------- Public Methods ------------------------------- */
@@ -137,8 +699,12 @@ bmp_error_t bmpParseBitmap(uint16_t x, uint16_t y, FIL file)
 
 /**************************************************************************/
 /*!
-    @brief  Loads a 24-bit Windows bitmap image from an SD card and
-            renders it
+    @brief  Loads a Windows bitmap image from an SD card and renders it
+
+    24-bit, 16-bit (RGB555 or RGB565) and 8-bit palettised images are
+    supported, with 8-bit images optionally RLE8 compressed.  Image
+    data is read one sector at a time and rendered a full row at a
+    time, starting with the bottom row for normal bottom-up images.
 
     @section Example
 
@@ -162,6 +728,15 @@ bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename)
   DSTATUS stat;
   BYTE res;
 
+#ifdef CFG_ARCHIVE
+  // The archive has the drive mounted with a file open, which must not
+  // be unmounted from under it
+  if (archiveIsOpen())
+  {
+    return BMP_ERROR_SDBUSY;
+  }
+#endif
+
   stat = disk_initialize(0);
 
   if ((stat & STA_NOINIT) || (stat & STA_NODISK))
@@ -189,7 +764,7 @@ bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename)
         return BMP_ERROR_FILENOTFOUND;
       }
       // Try to render the specified image
-      error = bmpParseBitmap(x, y, imgfile);
+      error = bmpParseBitmap(x, y, &imgfile);
       // Close file
       f_close(&imgfile);
       // Unmount drive
@@ -206,9 +781,27 @@ bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename)
 #if defined CFG_SDCARD_READONLY && CFG_SDCARD_READONLY == 0
 /**************************************************************************/
 /*!
-    @brief  Writes the contents of the LCD screen to a 24-bit bitmap
-            images.  CFG_SDCARD_READONLY must be set to '0' to be able
-            to use this function.
+    @brief  Screenshot sink that writes to the currently open file
+*/
+/**************************************************************************/
+static bool bmpWriteSD(const uint8_t *data, uint32_t len)
+{
+  UINT bytesWritten;
+  return (f_write(&bmpSDFile, data, len, &bytesWritten) == FR_OK) && (bytesWritten == len);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Writes the contents of the LCD screen to a bitmap image.
+            CFG_SDCARD_READONLY must be set to '0' to be able to use
+            this function.
+
+    @param[in]  filename
+                The file to create (any existing file is overwritten)
+    @param[in]  format
+                BMP_FORMAT_RGB565 for a lossless 16-bit image (two
+                thirds the size of a 24-bit image) or BMP_FORMAT_RGB24
+                for a 24-bit image that any viewer can open
 
     @section Example
 
@@ -218,14 +811,10 @@ bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename)
 
     bmp_error_t error;
 
-    // Note: The LED stays on while the image is being written since
-    //       it can take quite a while to read the entire screen
-    //       pixel by pixel and write the data to the SD card
-
     // Turn the LED on to signal busy state
     gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_ON); 
     // Write the screen contents to a bitmap image
-    error = bmpSaveScreenshot("capture.bmp");
+    error = bmpSaveScreenshot("capture.bmp", BMP_FORMAT_RGB565);
     // Turn the LED off to indicate that the capture is complete
     gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_OFF); 
 
@@ -234,118 +823,87 @@ bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename)
     @endcode
 */
 /**************************************************************************/
-bmp_error_t bmpSaveScreenshot(const char* filename)
+bmp_error_t bmpSaveScreenshot(const char* filename, bmp_format_t format)
 {
   DSTATUS stat;
-  bmp_error_t error = BMP_ERROR_NONE;
-  bmp_header_t header;
-  bmp_infoheader_t infoHeader;
-  uint32_t lcdWidth, lcdHeight, x, y, bgra32;
-  UINT bytesWritten;
-  uint16_t rgb565, eof;
-  uint8_t r, g, b;
+  bmp_error_t error;
+
+#ifdef CFG_ARCHIVE
+  // The archive has the drive mounted with a file open, which must not
+  // be unmounted from under it
+  if (archiveIsOpen())
+  {
+    return BMP_ERROR_SDBUSY;
+  }
+#endif
 
-  // Create a new file (Crossworks only)
   stat = disk_initialize(0);
-  if (stat & STA_NOINIT) 
+  if ((stat & STA_NOINIT) || (stat & STA_NODISK))
   {
     return BMP_ERROR_SDINITFAIL;
   }
-  if (stat & STA_NODISK) 
+
+  // Try to mount drive
+  if (f_mount(0, &Fatfs[0]) != FR_OK) 
   {
     return BMP_ERROR_SDINITFAIL;
   }
-  if (stat == 0)
-  {
-    // SD card sucessfully initialised
-    DSTATUS stat;
-    DWORD p2;
-    WORD w1;
-    BYTE res, b1;
-    DIR dir; 
-    // Try to mount drive
-    res = f_mount(0, &Fatfs[0]);
-    if (res != FR_OK) 
-    {
-      return BMP_ERROR_SDINITFAIL;
-    }
-    if (res == FR_OK)
-    {
-      // Create a file (overwriting any existing file!)
-      if(f_open(&bmpSDFile, filename, FA_READ | FA_WRITE | FA_CREATE_ALWAYS)!=FR_OK) 
-      {  
-        return BMP_ERROR_UNABLETOCREATEFILE; 
-      }
-    }
+
+  // Create a file (overwriting any existing file!)
+  if (f_open(&bmpSDFile, filename, FA_READ | FA_WRITE | FA_CREATE_ALWAYS) != FR_OK) 
+  {  
+    f_mount(0, 0);
+    return BMP_ERROR_UNABLETOCREATEFILE; 
   }
 
-  lcdWidth = lcdGetWidth();
-  lcdHeight = lcdGetHeight();
+  error = bmpWriteScreenshot(format, bmpWriteSD);
 
-  // Create header
-  header.type = 0x4d42;   // 'BM'
-  header.size = (lcdWidth * lcdHeight * 3) + sizeof(header) + sizeof(infoHeader);   // File size in bytes
-  header.reserved1 = 0;
-  header.reserved2 = 0;
-  header.offset = 0x36;   // Offset in bytes to the image data
-  
-  // Create infoheader
-  infoHeader.size = sizeof(infoHeader);
-  infoHeader.width = lcdWidth;
-  infoHeader.height = lcdHeight;
-  infoHeader.planes = 1;
-  infoHeader.bits = 24;
-  infoHeader.compression = BMP_COMPRESSION_NONE;
-  infoHeader.imagesize = (lcdWidth * lcdHeight * 3) + 2;  // 3 bytes per pixel + 2 bytes for EOF
-  infoHeader.xresolution = 0x0B12;
-  infoHeader.yresolution = 0x0B12;
-  infoHeader.ncolours = 0;
-  infoHeader.importantcolours = 0;
-
-  // Write header to disk
-  f_write(&bmpSDFile, &header.type, sizeof(header.type), &bytesWritten);
-  f_write(&bmpSDFile, &header.size, sizeof(header.size), &bytesWritten);
-  f_write(&bmpSDFile, &header.reserved1, sizeof(header.reserved1), &bytesWritten);
-  f_write(&bmpSDFile, &header.reserved2, sizeof(header.reserved2), &bytesWritten);
-  f_write(&bmpSDFile, &header.offset, sizeof(header.offset), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.size, sizeof(infoHeader.size), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.width, sizeof(infoHeader.width), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.height, sizeof(infoHeader.height), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.planes, sizeof(infoHeader.planes), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.bits, sizeof(infoHeader.bits), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.compression, sizeof(infoHeader.compression), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.imagesize, sizeof(infoHeader.imagesize), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.xresolution, sizeof(infoHeader.xresolution), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.yresolution, sizeof(infoHeader.yresolution), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.ncolours, sizeof(infoHeader.ncolours), &bytesWritten);
-  f_write(&bmpSDFile, &infoHeader.importantcolours, sizeof(infoHeader.importantcolours), &bytesWritten);
-
-  // Write image data to disk (starting from bottom row)
-  for (y = lcdHeight; y != 0; y--)
+  // Close the file and unmount the drive
+  if ((f_close(&bmpSDFile) != FR_OK) && (error == BMP_ERROR_NONE))
   {
-    for (x = 0; x < lcdWidth; x++)
-    {
-      rgb565 = lcdGetPixel(x, y - 1);               // Get RGB565 pixel
-      bgra32 = drawRGB565toBGRA32(rgb565);          // Convert RGB565 to 24-bit color
-      r = (bgra32 & 0x00FF0000) >> 16;
-      g = (bgra32 & 0x0000FF00) >> 8;
-      b = (bgra32 & 0x000000FF);
-      f_write(&bmpSDFile, &b, 1, &bytesWritten);    // Write RGB data
-      f_write(&bmpSDFile, &g, 1, &bytesWritten);
-      f_write(&bmpSDFile, &r, 1, &bytesWritten);
-    }    
-  }
-  
-  // Write EOF (2 bytes)
-  eof = 0x0000;
-  f_write(&bmpSDFile, &eof, 2, &bytesWritten);
-
-  // Close the file
-  f_close(&bmpSDFile);
+    error = BMP_ERROR_WRITEFAILED;
+  }
+  f_mount(0, 0);
 
-  // Return OK signal
-  return BMP_ERROR_NONE;
+  return error;
 }
 #endif  // End of read-only check to write bitmaps
 
 #endif  // End of CFG_SDCARD check
+
+#ifdef CFG_USBCDC
+/**************************************************************************/
+/*!
+    @brief  Screenshot sink that sends data to the USB CDC port
+*/
+/**************************************************************************/
+static bool bmpWriteCDC(const uint8_t *data, uint32_t len)
+{
+  while (len--)
+  {
+    if (CDC_putchar(*data++) < 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sends the contents of the LCD screen over USB CDC as a
+            bitmap image, exactly as it would be written to the SD card
+            by bmpSaveScreenshot
+
+    The host can tell where the image ends from the file size in the
+    bitmap header.
+
+    @param[in]  format
+                BMP_FORMAT_RGB565 or BMP_FORMAT_RGB24
+*/
+/**************************************************************************/
+bmp_error_t bmpSendScreenshot(bmp_format_t format)
+{
+  return bmpWriteScreenshot(format, bmpWriteCDC);
+}
+#endif
@@ -99,8 +99,8 @@ typedef struct
 /**************************************************************************/
 /*!
     @brief  Describes the different compression methods available in
-            Windows bitmap images, though compression is not currently
-            supported by this code.
+            Windows bitmap images.  Only RLE8 (for 8-bit images) and
+            RGBMASK (for 16-bit RGB565/RGB555 images) are supported.
 */
 /**************************************************************************/
 typedef enum
@@ -111,6 +111,17 @@ typedef enum
   BMP_COMPRESSION_RGBMASK = 3
 } bmp_compression_t;
 
+/**************************************************************************/
+/*!
+    @brief  Pixel formats that screenshots can be saved in
+*/
+/**************************************************************************/
+typedef enum
+{
+  BMP_FORMAT_RGB565 = 16,             /* 16-bit RGB565 (lossless for the LCD) */
+  BMP_FORMAT_RGB24 = 24               /* 24-bit RGB */
+} bmp_format_t;
+
 /**************************************************************************/
 /*!
     @brief  24-bit pixel data
@@ -134,17 +145,23 @@ typedef enum
   BMP_ERROR_SDINITFAIL = 1,
   BMP_ERROR_FILENOTFOUND = 2,
   BMP_ERROR_UNABLETOCREATEFILE = 3,
+  BMP_ERROR_WRITEFAILED = 4,          /* Unable to write screenshot data */
+  BMP_ERROR_SDBUSY = 5,               /* SD card is in use by the card archive */
   BMP_ERROR_NOTABITMAP = 10,          /* First two bytes of the image not 'BM' */
-  BMP_ERROR_INVALIDBITDEPTH = 11,     /* Image is not 24-bits */
-  BMP_ERROR_COMPRESSEDDATA = 12,      /* Image contains compressed data (not supported) */
-  BMP_ERROR_INVALIDDIMENSIONS = 13,   /* Image is > CFG_TFTLCD_WIDTH pixels wide or > CFG_TFTLCD_HEIGHT pixels high */
+  BMP_ERROR_INVALIDBITDEPTH = 11,     /* Image is not 8, 16 or 24-bits */
+  BMP_ERROR_COMPRESSEDDATA = 12,      /* Image uses an unsupported compression method */
+  BMP_ERROR_INVALIDDIMENSIONS = 13,   /* Image doesn't fit on the LCD at the requested position */
   BMP_ERROR_PREMATUREEOF = 14         /* EOF reached unexpectedly in pixel data */
 } bmp_error_t;
 
 bmp_error_t bmpDrawBitmap(uint16_t x, uint16_t y, const char* filename);
 
 #if defined CFG_SDCARD_READONLY && CFG_SDCARD_READONLY == 0
-bmp_error_t bmpSaveScreenshot(const char* filename);
+bmp_error_t bmpSaveScreenshot(const char* filename, bmp_format_t format);
+#endif
+
+#ifdef CFG_USBCDC
+bmp_error_t bmpSendScreenshot(bmp_format_t format);
 #endif
 
 #endif
@@ -0,0 +1,361 @@
+/**************************************************************************/
+/*! 
+    @file     console.c
+
+    @brief    Scrolling text console for TFT LCDs
+
+    Text is written into a small ring of pending lines in RAM, which
+    costs no LCD I/O at all and can be done from time critical code.
+    consoleUpdate should be called from the idle loop, and renders one
+    pending line per call using a fixed-width font grid.
+
+    The ring has a single producer and a single consumer: consolePutChar
+    only moves consoleHead and consoleUpdate only moves consoleTail, so
+    text can be written from one interrupt handler (or from main, but
+    not both) while the idle loop renders it.
+
+    On displays that support HW scrolling (see lcdGetProperties), GRAM
+    is treated as a circular buffer: each new line is written below the
+    previous one and the scroll offset is moved so that the newest line
+    sits at the bottom of the screen.  Only the newly exposed line is
+    ever drawn, regardless of how much text is already on the screen.
+    Displays without HW scrolling wrap back to the top and overwrite the
+    oldest line in place.
+
+    The console always runs in portrait mode, since the controller can
+    only scroll along the long axis of the panel.
+
+    @section Example
+
+    @code 
+    #include "drivers/lcd/tft/console.h"
+    #include "drivers/lcd/tft/fonts/dejavusansmono8.h"
+
+    consoleInit(&dejaVuSansMono8ptFontInfo, COLOR_WHITE, COLOR_BLACK);
+    consolePrint("Card reader ready\n");
+
+    while (1)
+    {
+      // Render any queued lines while there is nothing else to do
+      consoleUpdate();
+    }
+
+    @endcode
+
+    @section LICENSE
+
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <string.h>
+
+#include "console.h"
+#include "lcd.h"
+
+static const FONT_INFO *consoleFont;
+static uint16_t consoleColor;
+static uint16_t consoleBgColor;
+static uint16_t consoleWidth;           // Display width in pixels
+static uint16_t consoleHeight;          // Display (and GRAM) height in pixels
+static uint8_t  consoleColumns;         // Characters per line
+static uint8_t  consoleCharWidth;       // Character pitch including 1 pixel gap
+static bool     consoleHWScroll;
+static bool     consoleScrolling;       // Set once the screen has been filled
+static uint16_t consoleY;               // GRAM row where the next line goes
+
+static char     consoleLines[CONSOLE_PENDINGLINES][CONSOLE_MAXCOLUMNS];
+static uint8_t  consoleLineLen[CONSOLE_PENDINGLINES];
+static volatile uint8_t consoleHead;   // Line currently being written to (producer only)
+static volatile uint8_t consoleTail;   // Oldest line waiting to be rendered (consumer only)
+static uint32_t consoleDropped;
+
+// Keeps the compiler from moving line buffer accesses past a head or
+// tail update, which is what hands a line over to the other side
+#define CONSOLE_BARRIER()   __asm volatile ("" ::: "memory")
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of complete lines waiting to be rendered
+*/
+/**************************************************************************/
+static inline uint8_t consolePending(void)
+{
+  return (consoleHead + CONSOLE_PENDINGLINES - consoleTail) % CONSOLE_PENDINGLINES;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Renders one text line into GRAM starting at row y, wrapping
+            around the bottom of GRAM if required
+*/
+/**************************************************************************/
+static void consoleRenderLine(uint16_t y, const char *text, uint8_t len)
+{
+  uint16_t buffer[CONSOLE_MAXWIDTH];
+  uint16_t x, row, pages;
+  uint8_t col, bit, c, glyphWidth;
+  const uint8_t *glyph;
+
+  for (row = 0; row < consoleFont->height; row++)
+  {
+    x = 0;
+    for (col = 0; col < consoleColumns; col++)
+    {
+      c = col < len ? (uint8_t)text[col] : ' ';
+      if ((c < consoleFont->startChar) || (c > consoleFont->endChar))
+      {
+        c = ' ';
+      }
+      c -= consoleFont->startChar;
+      glyphWidth = consoleFont->charInfo[c].widthBits;
+      pages = (glyphWidth + 7) / 8;
+      glyph = &consoleFont->data[consoleFont->charInfo[c].offset + row * pages];
+
+      // Every cell is consoleCharWidth wide, so the glyph is padded or clipped
+      for (bit = 0; bit < consoleCharWidth - 1; bit++)
+      {
+        if ((bit < glyphWidth) && (glyph[bit >> 3] & (0x80 >> (bit & 7))))
+          buffer[x++] = consoleColor;
+        else
+          buffer[x++] = consoleBgColor;
+      }
+      buffer[x++] = consoleBgColor;
+    }
+
+    // Clear whatever is left to the right of the last column
+    while (x < consoleWidth)
+    {
+      buffer[x++] = consoleBgColor;
+    }
+
+    lcdDrawPixels(0, (y + row) % consoleHeight, buffer, consoleWidth);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Clears len rows of GRAM starting at row y
+*/
+/**************************************************************************/
+static void consoleClearRows(uint16_t y, uint16_t len)
+{
+  uint16_t buffer[CONSOLE_MAXWIDTH];
+  uint16_t i;
+
+  for (i = 0; i < consoleWidth; i++)
+  {
+    buffer[i] = consoleBgColor;
+  }
+
+  while (len--)
+  {
+    lcdDrawPixels(0, y, buffer, consoleWidth);
+    y = (y + 1) % consoleHeight;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Initialises the console and clears the screen
+
+    @param[in]  fontInfo
+                Fixed-width font to use (ex. dejaVuSansMono8ptFontInfo)
+    @param[in]  color
+                Text color
+    @param[in]  bgColor
+                Background color
+*/
+/**************************************************************************/
+void consoleInit(const FONT_INFO *fontInfo, uint16_t color, uint16_t bgColor)
+{
+  consoleFont = fontInfo;
+  consoleColor = color;
+  consoleBgColor = bgColor;
+
+  lcdSetOrientation(LCD_ORIENTATION_PORTRAIT);
+  consoleWidth = lcdGetWidth();
+  consoleHeight = lcdGetHeight();
+  if (consoleWidth > CONSOLE_MAXWIDTH)
+  {
+    consoleWidth = CONSOLE_MAXWIDTH;
+  }
+  consoleHWScroll = lcdGetProperties().hwscrolling;
+
+  // Use the width of 'M' as the cell size for the whole font
+  if (('M' >= fontInfo->startChar) && ('M' <= fontInfo->endChar))
+    consoleCharWidth = fontInfo->charInfo['M' - fontInfo->startChar].widthBits + 1;
+  else
+    consoleCharWidth = fontInfo->charInfo[0].widthBits + 1;
+  consoleColumns = consoleWidth / consoleCharWidth;
+  if (consoleColumns > CONSOLE_MAXCOLUMNS)
+  {
+    consoleColumns = CONSOLE_MAXCOLUMNS;
+  }
+
+  consoleHead = 0;
+  consoleTail = 0;
+  consoleDropped = 0;
+  consoleLineLen[0] = 0;
+  consoleY = 0;
+  consoleScrolling = false;
+
+  if (consoleHWScroll)
+  {
+    lcdScroll(0, bgColor);
+  }
+  lcdFillRGB(bgColor);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds a single character to the console
+
+    No LCD I/O takes place here.  '\n' completes the current line and
+    queues it for rendering, '\r' is ignored, and lines longer than the
+    display are wrapped.  If the pending queue is full the completed
+    line is discarded and counted (see consoleGetDroppedLines).
+
+    This can be called from an interrupt handler, as long as only one
+    context (that handler, or main) writes to the console.
+*/
+/**************************************************************************/
+void consolePutChar(char c)
+{
+  if (c == '\r')
+  {
+    return;
+  }
+
+  uint8_t head = consoleHead;
+
+  if (c != '\n')
+  {
+    consoleLines[head][consoleLineLen[head]++] = c;
+    if (consoleLineLen[head] < consoleColumns)
+    {
+      return;
+    }
+  }
+
+  // Line complete, keep one slot free for the line being written
+  if (consolePending() < CONSOLE_PENDINGLINES - 1)
+  {
+    head = (head + 1) % CONSOLE_PENDINGLINES;
+    CONSOLE_BARRIER();
+    consoleHead = head;
+  }
+  else
+  {
+    consoleDropped++;
+  }
+  consoleLineLen[head] = 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds a null-terminated string to the console
+*/
+/**************************************************************************/
+void consolePrint(const char *str)
+{
+  while (*str)
+  {
+    consolePutChar(*str++);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Renders the oldest pending line, if any
+
+    @return The number of lines still waiting to be rendered
+*/
+/**************************************************************************/
+uint32_t consoleUpdate(void)
+{
+  uint16_t y;
+  uint8_t height;
+
+  if (!consolePending())
+  {
+    return 0;
+  }
+  CONSOLE_BARRIER();
+
+  height = consoleFont->height;
+  y = consoleY;
+
+  if (consoleHWScroll)
+  {
+    // GRAM is circular, so just keep going and move the scroll offset
+    consoleRenderLine(y, consoleLines[consoleTail], consoleLineLen[consoleTail]);
+    consoleY = (y + height) % consoleHeight;
+    if (y + height >= consoleHeight)
+    {
+      consoleScrolling = true;
+    }
+    if (consoleScrolling)
+    {
+      // Rows left over at the top of the screen (height doesn't divide
+      // evenly into the display) would show the remains of an old line
+      if (consoleHeight % height)
+      {
+        consoleClearRows(consoleY, consoleHeight % height);
+      }
+      lcdScroll(consoleY, consoleBgColor);
+    }
+  }
+  else
+  {
+    // No HW scrolling, so overwrite the oldest line in place
+    if (y + height > consoleHeight)
+    {
+      y = 0;
+    }
+    consoleRenderLine(y, consoleLines[consoleTail], consoleLineLen[consoleTail]);
+    consoleY = y + height;
+  }
+
+  // Only now can the producer reuse the line
+  CONSOLE_BARRIER();
+  consoleTail = (consoleTail + 1) % CONSOLE_PENDINGLINES;
+
+  return consolePending();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of lines discarded because consoleUpdate
+            wasn't called often enough
+*/
+/**************************************************************************/
+uint32_t consoleGetDroppedLines(void)
+{
+  return consoleDropped;
+}
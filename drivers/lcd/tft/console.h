@@ -0,0 +1,53 @@
+/**************************************************************************/
+/*! 
+    @file     console.h
+
+    @brief    Scrolling text console for TFT LCDs
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2010, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include "projectconfig.h"
+#include "drivers/lcd/tft/fonts/bitmapfonts.h"
+
+#define CONSOLE_MAXCOLUMNS    (40)    // Longest line (in characters) that will be stored
+#define CONSOLE_MAXWIDTH      (240)   // Widest supported display in portrait mode (in pixels)
+#define CONSOLE_PENDINGLINES  (8)     // Number of lines that can be queued for rendering
+
+void     consoleInit(const FONT_INFO *fontInfo, uint16_t color, uint16_t bgColor);
+void     consolePutChar(char c);
+void     consolePrint(const char *str);
+uint32_t consoleUpdate(void);
+uint32_t consoleGetDroppedLines(void);
+
+#endif
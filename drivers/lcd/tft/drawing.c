@@ -110,6 +110,107 @@ void drawCharBitmap(const uint16_t xPixel, const uint16_t yPixel, uint16_t color
   }
 }
 
+/**************************************************************************/
+/*!
+    @brief  Fills 'table' with the RGB565 colors for every coverage level
+            of an anti-aliased font, blending from 'bgColor' (level 0)
+            to 'color' (the highest level)
+*/
+/**************************************************************************/
+void drawBlendTable(uint16_t *table, uint8_t bitsPerPixel, uint16_t color, uint16_t bgColor)
+{
+  uint32_t level, max;
+  uint32_t fr, fg, fb, br, bg, bb;
+
+  max = (1 << bitsPerPixel) - 1;
+
+  fr = (color >> 11) & 0x1F;
+  fg = (color >> 5) & 0x3F;
+  fb = color & 0x1F;
+  br = (bgColor >> 11) & 0x1F;
+  bg = (bgColor >> 5) & 0x3F;
+  bb = bgColor & 0x1F;
+
+  for (level = 0; level <= max; level++)
+  {
+    table[level] = ((((fr * level) + (br * (max - level)) + (max / 2)) / max) << 11) |
+                   ((((fg * level) + (bg * (max - level)) + (max / 2)) / max) << 5) |
+                    (((fb * level) + (bb * (max - level)) + (max / 2)) / max);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Draws a single anti-aliased character, including the one
+            pixel wide gap to its right, using the supplied blend table
+
+    Every row is converted to RGB565 in a small line buffer and sent
+    with lcdDrawPixels, so the cost per pixel is a single GRAM write
+    no matter how many coverage levels the font has.
+*/
+/**************************************************************************/
+void drawCharAA(uint16_t xPixel, uint16_t yPixel, const uint16_t *table, const uint8_t *glyph, uint8_t bitsPerPixel, uint8_t cols, uint8_t rows)
+{
+  uint16_t line[16];
+  uint16_t _row, _col, _len, _bytesPerRow, _visibleCols;
+  uint8_t mask, shift, bits;
+  const uint8_t *src;
+
+  if ((xPixel >= lcdGetWidth()) || (yPixel >= lcdGetHeight()))
+  {
+    return;
+  }
+
+  _bytesPerRow = ((cols * bitsPerPixel) + 7) / 8;
+  mask = (1 << bitsPerPixel) - 1;
+
+  // Clip the character (and the gap after it) to the right edge
+  _visibleCols = cols + 1;
+  if (xPixel + _visibleCols > lcdGetWidth())
+  {
+    _visibleCols = lcdGetWidth() - xPixel;
+  }
+
+  for (_row = 0; _row < rows; _row++)
+  {
+    if (yPixel + _row >= lcdGetHeight())
+    {
+      break;
+    }
+
+    src = glyph + (_row * _bytesPerRow);
+    bits = *src++;
+    shift = 8;
+    _len = 0;
+
+    for (_col = 0; _col < _visibleCols; _col++)
+    {
+      if (_col < cols)
+      {
+        if (shift == 0)
+        {
+          bits = *src++;
+          shift = 8;
+        }
+        shift -= bitsPerPixel;
+        line[_len++] = table[(bits >> shift) & mask];
+      }
+      else
+      {
+        // Inter-character gap
+        line[_len++] = table[0];
+      }
+
+      // Flush the line buffer when it's full or the row is complete
+      if ((_len == sizeof(line) / sizeof(line[0])) || (_col == _visibleCols - 1))
+      {
+        lcdDrawPixels(xPixel + _col + 1 - _len, yPixel + _row, line, _len);
+        _len = 0;
+      }
+    }
+  }
+}
+
 #if defined CFG_TFTLCD_INCLUDESMALLFONTS & CFG_TFTLCD_INCLUDESMALLFONTS == 1
 /**************************************************************************/
 /*!
@@ -403,6 +504,96 @@ uint16_t drawGetStringWidth(const FONT_INFO *fontInfo, char *str)
   return width > 0 ? width - 1 : width;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Draws a string using the supplied anti-aliased font
+
+    Unlike drawString, which only sets the pixels that are part of each
+    character, anti-aliased text is rendered opaquely: every pixel in
+    the text's bounding box is written, with partially covered pixels
+    blended between 'color' and 'bgColor'.  The blend table is
+    calculated once per string, so 'bgColor' should match whatever is
+    already behind the text.
+
+    @param[in]  x
+                Starting x co-ordinate
+    @param[in]  y
+                Starting y co-ordinate
+    @param[in]  color
+                Color to use when rendering the font
+    @param[in]  bgColor
+                Background color to blend the font edges with
+    @param[in]  fontInfo
+                Pointer to the FONT_AA_INFO to use when drawing the string
+    @param[in]  str
+                The string to render
+
+    @section Example
+
+    @code 
+
+    // 'sans9ptAAFontInfo' is a FONT_AA_INFO with 2-bit glyph data
+    drawStringAA(0, 90, COLOR_WHITE, COLOR_BLACK, &sans9ptAAFontInfo, "Sans 9 (AA)");
+
+    @endcode
+*/
+/**************************************************************************/
+void drawStringAA(uint16_t x, uint16_t y, uint16_t color, uint16_t bgColor, const FONT_AA_INFO *fontInfo, char *str)
+{
+  uint16_t table[16];
+  uint16_t currentX;
+  const FONT_CHAR_INFO *charInfo;
+
+  // Only 2 and 4-bit fonts are supported
+  if ((fontInfo->bitsPerPixel != 2) && (fontInfo->bitsPerPixel != 4))
+  {
+    return;
+  }
+
+  // Calculate the colors for every coverage level once
+  drawBlendTable(table, fontInfo->bitsPerPixel, color, bgColor);
+
+  currentX = x;
+
+  while (*str != '\0')
+  {
+    if (((uint8_t)*str >= fontInfo->startChar) && ((uint8_t)*str <= fontInfo->endChar))
+    {
+      charInfo = &fontInfo->charInfo[(uint8_t)*str - fontInfo->startChar];
+      drawCharAA(currentX, y, table, &fontInfo->data[charInfo->offset], fontInfo->bitsPerPixel, charInfo->widthBits, fontInfo->height);
+      currentX += charInfo->widthBits + 1;
+    }
+    str++;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the width in pixels of a string when it is rendered
+            with an anti-aliased font
+
+    @param[in]  fontInfo
+                Pointer to the FONT_AA_INFO for the font that will be used
+    @param[in]  str
+                The string that will be rendered
+*/
+/**************************************************************************/
+uint16_t drawGetStringWidthAA(const FONT_AA_INFO *fontInfo, char *str)
+{
+  uint16_t width = 0;
+
+  while (*str != '\0')
+  {
+    if (((uint8_t)*str >= fontInfo->startChar) && ((uint8_t)*str <= fontInfo->endChar))
+    {
+      width += fontInfo->charInfo[(uint8_t)*str - fontInfo->startChar].widthBits + 1;
+    }
+    str++;
+  }
+
+  return width > 0 ? width - 1 : width;
+}
+
 /**************************************************************************/
 /*!
     @brief  Draws a bresenham line
@@ -1358,8 +1549,8 @@ void drawIcon16(uint16_t x, uint16_t y, uint16_t color, uint16_t icon[])
 #ifdef CFG_SDCARD
 /**************************************************************************/
 /*!
-    @brief  Loads a 24-bit Windows bitmap image from an SD card and
-            renders it
+    @brief  Loads a 24, 16 or 8-bit Windows bitmap image from an SD
+            card and renders it
 
     @section Example
 
@@ -1378,14 +1569,17 @@ void drawIcon16(uint16_t x, uint16_t y, uint16_t color, uint16_t icon[])
           break;
         case BMP_ERROR_FILENOTFOUND:
           break;
+        case BMP_ERROR_SDBUSY:
+          // The card archive has the SD card open
+          break;
         case BMP_ERROR_NOTABITMAP:
           // First two bytes of image not 'BM'
           break;
         case BMP_ERROR_INVALIDBITDEPTH:
-          // Image is not 24-bits
+          // Image is not 8, 16 or 24-bits
           break;
         case BMP_ERROR_COMPRESSEDDATA:
-          // Image contains compressed data
+          // Image uses an unsupported compression method
           break;
         case BMP_ERROR_INVALIDDIMENSIONS:
           // Width or Height is > LCD size
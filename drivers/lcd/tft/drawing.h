@@ -100,6 +100,8 @@ void      drawTriangle         ( uint16_t x0, uint16_t y0, uint16_t x1, uint16_t
 void      drawTriangleFilled   ( uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t color);
 void      drawString           ( uint16_t x, uint16_t y, uint16_t color, const FONT_INFO *fontInfo, char *str );
 uint16_t  drawGetStringWidth   ( const FONT_INFO *fontInfo, char *str );
+void      drawStringAA         ( uint16_t x, uint16_t y, uint16_t color, uint16_t bgColor, const FONT_AA_INFO *fontInfo, char *str );
+uint16_t  drawGetStringWidthAA ( const FONT_AA_INFO *fontInfo, char *str );
 void      drawProgressBar      ( uint16_t x, uint16_t y, uint16_t width, uint16_t height, drawRoundedCorners_t borderCorners, drawRoundedCorners_t progressCorners, uint16_t borderColor, uint16_t borderFillColor, uint16_t progressBorderColor, uint16_t progressFillColor, uint8_t progress );
 void      drawButton           ( uint16_t x, uint16_t y, uint16_t width, uint16_t height, const FONT_INFO *fontInfo, uint16_t fontHeight, uint16_t borderclr, uint16_t fillclr, uint16_t fontclr, char* text );
 void      drawIcon16           ( uint16_t x, uint16_t y, uint16_t color, uint16_t icon[] );
@@ -65,4 +65,25 @@ typedef struct
   const uint8_t*          data;         // pointer to generated array of character visual representation
 } FONT_INFO;
 
+/**************************************************************************/
+/*! 
+    @brief Describes a single anti-aliased (2 or 4 bits per pixel) font
+
+    Glyph bitmaps are stored row by row, starting at the top of the
+    character.  Each row is padded to a full byte, with the left-most
+    pixel in the most significant bits.  A pixel value of 0 is fully
+    background and (1 << bitsPerPixel) - 1 is fully foreground, with
+    the values in between being blended between the two colors.
+*/
+/**************************************************************************/
+typedef struct
+{
+  const uint8_t           height;       // height of the font's characters
+  const uint8_t           startChar;    // the first character in the font (e.g. in charInfo and data)
+  const uint8_t           endChar;      // the last character in the font (e.g. in charInfo and data)
+  const uint8_t           bitsPerPixel; // 2 or 4 bits of coverage per pixel
+  const FONT_CHAR_INFO*	  charInfo;     // pointer to array of char information
+  const uint8_t*          data;         // pointer to generated array of character visual representation
+} FONT_AA_INFO;
+
 #endif
@@ -53,6 +53,10 @@
 // Uncomment this to use faster inline methods, but requires more flash
 // #define ILI9235_USE_INLINE_METHODS (1)
 
+// Delay (in units of 10 NOPs) while RD is low during burst GRAM reads,
+// the same read strobe that ili9325ReadData has always used
+#define ILI9325_GRAMREADDELAY (100)
+
 static lcdOrientation_t lcdOrientation = LCD_ORIENTATION_PORTRAIT;
 static lcdProperties_t ili9325Properties = { 240, 320, TRUE, TRUE, TRUE };
 
@@ -512,6 +516,60 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
   lcdSetOrientation(oldOrientation);
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left, using the
+            GRAM window so the address is only set once.  A one pixel
+            wide window draws a whole column in a single transfer.
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+  uint32_t width = x1 - x0 + 1;
+  uint32_t i;
+  int32_t row;
+
+  if (lcdOrientation == LCD_ORIENTATION_LANDSCAPE)
+  {
+    // Screen x is the GRAM vertical address (incremented first) and
+    // screen y the horizontal address, which decrements, so the rows
+    // are written from the bottom up
+    ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSSTARTPOSITION, y0);
+    ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSENDPOSITION, y1);
+    ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSSTARTPOSITION, x0);
+    ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSENDPOSITION, x1);
+    ili9325SetCursor(x0, y1);
+    ili9325WriteCmd(ILI9325_COMMANDS_WRITEDATATOGRAM);
+    for (row = y1 - y0; row >= 0; row--)
+    {
+      for (i = 0; i < width; i++)
+      {
+        ili9325WriteData(data[row * width + i]);
+      }
+    }
+  }
+  else
+  {
+    ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSSTARTPOSITION, x0);
+    ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSENDPOSITION, x1);
+    ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSSTARTPOSITION, y0);
+    ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSENDPOSITION, y1);
+    ili9325SetCursor(x0, y0);
+    ili9325WriteCmd(ILI9325_COMMANDS_WRITEDATATOGRAM);
+    for (i = 0; i < width * (y1 - y0 + 1); i++)
+    {
+      ili9325WriteData(data[i]);
+    }
+  }
+
+  // Back to the full screen, which everything else relies on
+  ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSSTARTPOSITION, 0);
+  ili9325Command(ILI9325_COMMANDS_HORIZONTALADDRESSENDPOSITION, ili9325Properties.width - 1);
+  ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSSTARTPOSITION, 0);
+  ili9325Command(ILI9325_COMMANDS_VERTICALADDRESSENDPOSITION, ili9325Properties.height - 1);
+}
+
 /**************************************************************************/
 /*! 
     @brief  Gets the 16-bit color of the pixel at the specified location
@@ -531,6 +589,51 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
   return ili9325ReadData();
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Reads an array of consecutive RGB565 pixels starting at the
+            specified location (much faster than reading each pixel
+            individually)
+
+    The cursor is only set once, after which the GRAM address
+    auto-increments with every read.  CS is held low and the data bus
+    left as an input for the whole burst.
+*/
+/**************************************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+  uint16_t high, low;
+
+  // Same prefetch sequence as lcdGetPixel, but only once per burst
+  ili9325SetCursor(x, y);
+  ili9325WriteCmd(ILI9325_COMMANDS_WRITEDATATOGRAM);
+  ili9325ReadData();
+  ili9325SetCursor(x, y);
+  ili9325WriteCmd(ILI9325_COMMANDS_WRITEDATATOGRAM);
+
+  SET_CD_RD_WR;
+  CLR_CS;
+  ILI9325_GPIO2DATA_SETINPUT;
+
+  while (len--)
+  {
+    CLR_RD;
+    ili9325Delay(ILI9325_GRAMREADDELAY);
+    high = (ILI9325_GPIO2DATA_DATA >> ILI9325_DATA_OFFSET) & 0xFF;
+    SET_RD;
+
+    CLR_RD;
+    ili9325Delay(ILI9325_GRAMREADDELAY);
+    low = (ILI9325_GPIO2DATA_DATA >> ILI9325_DATA_OFFSET) & 0xFF;
+    SET_RD;
+
+    *data++ = (high << 8) | low;
+  }
+
+  SET_CS;
+  ILI9325_GPIO2DATA_SETOUTPUT;
+}
+
 /**************************************************************************/
 /*! 
     @brief  Sets the LCD orientation to horizontal and vertical
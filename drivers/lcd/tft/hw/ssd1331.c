@@ -395,6 +395,41 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
   ssd1331DrawLine((uint8_t)x, (uint8_t)y0, (uint8_t)x, (uint8_t)y1, color); 
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left.  The column
+            and row address ranges are set to the rectangle, so the
+            controller wraps each row and the pixels are sent in one
+            go.
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+  uint32_t i, pixels;
+
+  if ((x1 >= ssd1331Properties.width) || (y1 >= ssd1331Properties.height) || (x0 > x1) || (y0 > y1))
+    return;
+
+  CMD(SSD1331_CMD_SETCOLUMN);
+  CMD(x0);
+  CMD(x1);
+
+  CMD(SSD1331_CMD_SETROW);
+  CMD(y0);
+  CMD(y1);
+
+  // ssd1331SetCursor puts the end addresses back for everything else
+  pixels = (x1 - x0 + 1) * (y1 - y0 + 1);
+  SET_CS; SET_DC; CLR_CS;
+  for (i = 0; i < pixels; i++)
+  {
+    ssd1331SendByte(data[i] >> 8);
+    ssd1331SendByte(data[i]);
+  }
+  SET_CS;
+}
+
 /**************************************************************************/
 /*! 
     @brief  Gets the 16-bit color of the pixel at the specified location
@@ -406,6 +441,20 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
   return 0;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Reads an array of consecutive RGB565 pixels starting at the
+            specified location
+*/
+/**************************************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+  while (len--)
+  {
+    *data++ = lcdGetPixel(x++, y);
+  }
+}
+
 /**************************************************************************/
 /*! 
     @brief  Sets the LCD orientation to horizontal and vertical
@@ -387,6 +387,40 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
   // ToDo
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left.  The column
+            and row address ranges are set to the rectangle, so the
+            controller wraps each row and the pixels follow a single
+            WRITERAM.
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+  uint32_t i, pixels;
+
+  if ((x1 >= ssd1351Properties.width) || (y1 >= ssd1351Properties.height) || (x0 > x1) || (y0 > y1))
+    return;
+
+  CMD(SSD1351_CMD_SETCOLUMNADDRESS);
+  DATA(x0);                           // Start Address
+  DATA(x1);                           // End Address
+
+  CMD(SSD1351_CMD_SETROWADDRESS);
+  DATA(y0);                           // Start Address
+  DATA(y1);                           // End Address
+
+  // ssd1351SetCursor puts the end addresses back for everything else
+  pixels = (x1 - x0 + 1) * (y1 - y0 + 1);
+  CMD(SSD1351_CMD_WRITERAM);
+  for (i = 0; i < pixels; i++)
+  {
+    DATA(data[i] >> 8);
+    DATA(data[i]);
+  }
+}
+
 /**************************************************************************/
 /*! 
     @brief  Gets the 16-bit color of the pixel at the specified location
@@ -398,6 +432,20 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
   return 0;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Reads an array of consecutive RGB565 pixels starting at the
+            specified location
+*/
+/**************************************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+  while (len--)
+  {
+    *data++ = lcdGetPixel(x++, y);
+  }
+}
+
 /**************************************************************************/
 /*! 
     @brief  Sets the LCD orientation to horizontal and vertical
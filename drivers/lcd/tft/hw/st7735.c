@@ -393,6 +393,31 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
   st7735WriteCmd(ST7735_NOP);
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left, as a single
+            RAMWR to the CASET/RASET window
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+  uint32_t i, pixels;
+
+  if ((x1 >= lcdGetWidth()) || (y1 >= lcdGetHeight()) || (x0 > x1) || (y0 > y1))
+    return;
+
+  pixels = (x1 - x0 + 1) * (y1 - y0 + 1);
+  st7735SetAddrWindow(x0, y0, x1, y1);
+  st7735WriteCmd(ST7735_RAMWR);  // write to RAM
+  for (i = 0; i < pixels; i++)
+  {
+    st7735WriteData(data[i] >> 8);
+    st7735WriteData(data[i]);
+  }
+  st7735WriteCmd(ST7735_NOP);
+}
+
 /*************************************************/
 uint16_t lcdGetPixel(uint16_t x, uint16_t y)
 {
@@ -400,6 +425,15 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
   return 0;
 }
 
+/*************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+  while (len--)
+  {
+    *data++ = lcdGetPixel(x++, y);
+  }
+}
+
 /*************************************************/
 void lcdSetOrientation(lcdOrientation_t orientation)
 {
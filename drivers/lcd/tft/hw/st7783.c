@@ -418,6 +418,62 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
   lcdSetOrientation(orientation);
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left, using the
+            GRAM window (R50h..R53h) so the address is only set once
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+  uint32_t width = x1 - x0 + 1;
+  uint32_t i;
+  int32_t row;
+
+  if (lcdOrientation == LCD_ORIENTATION_LANDSCAPE)
+  {
+    // Screen x is the GRAM vertical address (incremented first) and
+    // screen y the horizontal address, which decrements, so the rows
+    // are written from the bottom up.  st7783SetCursor would move the
+    // window end, so the GRAM address is set directly.
+    st7783Command(0x0050, y0);         // Window Horizontal RAM Address Start (R50h)
+    st7783Command(0x0051, y1);         // Window Horizontal RAM Address End (R51h)
+    st7783Command(0x0052, x0);         // Window Vertical RAM Address Start (R52h)
+    st7783Command(0x0053, x1);         // Window Vertical RAM Address End (R53h)
+    st7783Command(0x0020, y1);
+    st7783Command(0x0021, x0);
+    st7783WriteCmd(0x0022);            // Write Data to GRAM (R22h)
+    for (row = y1 - y0; row >= 0; row--)
+    {
+      for (i = 0; i < width; i++)
+      {
+        st7783WriteData(data[row * width + i]);
+      }
+    }
+  }
+  else
+  {
+    st7783Command(0x0050, x0);
+    st7783Command(0x0051, x1);
+    st7783Command(0x0052, y0);
+    st7783Command(0x0053, y1);
+    st7783Command(0x0020, x0);
+    st7783Command(0x0021, y0);
+    st7783WriteCmd(0x0022);
+    for (i = 0; i < width * (y1 - y0 + 1); i++)
+    {
+      st7783WriteData(data[i]);
+    }
+  }
+
+  // Back to the full screen, which everything else relies on
+  st7783Command(0x0050, 0x0000);
+  st7783Command(0x0051, st7783Properties.width - 1);
+  st7783Command(0x0052, 0x0000);
+  st7783Command(0x0053, st7783Properties.height - 1);
+}
+
 /*************************************************/
 uint16_t lcdGetPixel(uint16_t x, uint16_t y)
 {
@@ -433,6 +489,15 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
   return st7783ReadData();
 }
 
+/*************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+  while (len--)
+  {
+    *data++ = lcdGetPixel(x++, y);
+  }
+}
+
 /*************************************************/
 void lcdSetOrientation(lcdOrientation_t orientation)
 {
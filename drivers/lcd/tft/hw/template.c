@@ -131,6 +131,16 @@ void lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color)
 {
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Fills the rectangle from x0,y0 to x1,y1 (inclusive) with
+            RGB565 pixels, row by row from the top left
+*/
+/**************************************************************************/
+void lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data)
+{
+}
+
 /**************************************************************************/
 /*! 
     @brief  Gets the 16-bit color of the pixel at the specified location
@@ -140,6 +150,16 @@ uint16_t lcdGetPixel(uint16_t x, uint16_t y)
 {
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Reads an array of consecutive RGB565 pixels starting at the
+            specified location
+*/
+/**************************************************************************/
+void lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len)
+{
+}
+
 /**************************************************************************/
 /*! 
     @brief  Sets the LCD orientation to horizontal and vertical
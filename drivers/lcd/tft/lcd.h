@@ -64,11 +64,13 @@ typedef struct
 extern void     lcdInit(void);
 extern void     lcdTest(void);
 extern uint16_t lcdGetPixel(uint16_t x, uint16_t y);
+extern void     lcdGetPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len);
 extern void     lcdFillRGB(uint16_t data);
 extern void     lcdDrawPixel(uint16_t x, uint16_t y, uint16_t color);
 extern void     lcdDrawPixels(uint16_t x, uint16_t y, uint16_t *data, uint32_t len);
 extern void     lcdDrawHLine(uint16_t x0, uint16_t x1, uint16_t y, uint16_t color);
 extern void     lcdDrawVLine(uint16_t x, uint16_t y0, uint16_t y1, uint16_t color);
+extern void     lcdDrawWindow(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint16_t *data);
 extern void     lcdBacklight(bool state);
 extern void     lcdScroll(int16_t pixels, uint16_t fillColor);
 extern uint16_t lcdGetWidth(void);
@@ -0,0 +1,355 @@
+/**************************************************************************/
+/*! 
+    @file     scope.c
+
+    @brief    Oscilloscope style trace rendering for TFT LCDs
+
+    Each trace is drawn from a block of samples spread across the width
+    of the plot area.  For every column only the vertical span covered
+    by the trace is kept (the min and max pixel row of the samples that
+    fall in that column, joined to the previous column), so a new block
+    is drawn by comparing each column's new span with the old one and
+    rewriting only the rows that changed.  Those rows are rendered
+    together, with the grid and any other traces underneath, and sent
+    as one lcdDrawWindow call per changed run, so the cost of a refresh
+    depends on how much the signal moved rather than on the size of
+    the plot area.
+
+    Sample values run from 0 (bottom) to the trace's full scale value
+    (top), and samples can be taken straight out of an interleaved
+    multi-channel block such as the ones from adcStreamGetBlock.
+
+    @section Example
+
+    @code 
+    #include "core/adc/adc.h"
+    #include "drivers/lcd/tft/scope.h"
+
+    uint16_t samples[2 * 200];
+    uint16_t *block;
+
+    lcdSetOrientation(LCD_ORIENTATION_LANDSCAPE);
+    scopeInit(10, 20, 200, 150, 25, 25, COLOR_BLACK, COLOR_GRAY_50);
+    scopeSetTrace(0, COLOR_YELLOW, 1023);
+
+    adcStreamStart(ADC_STREAM_TIMER, ADC_AD0CR_SEL_AD0, 2000, 1, samples, 200);
+    while (1)
+    {
+      block = adcStreamGetBlock();
+      if (block)
+      {
+        scopeDrawBlock(0, block, 200, 1);
+        adcStreamReleaseBlock();
+      }
+    }
+
+    @endcode
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <string.h>
+
+#include "scope.h"
+#include "lcd.h"
+
+#define SCOPE_EMPTY           (0xFF)  // Span min for a column with nothing drawn
+
+typedef struct
+{
+  uint16_t color;
+  uint16_t fullScale;
+  uint8_t  min[SCOPE_MAXWIDTH];       // Top row of the span in each column
+  uint8_t  max[SCOPE_MAXWIDTH];       // Bottom row of the span in each column
+} scopeTrace_t;
+
+static uint16_t scopeX;               // Top left of the plot area
+static uint16_t scopeY;
+static uint16_t scopeWidth;
+static uint16_t scopeHeight;
+static uint16_t scopeGridX;           // Grid spacing in pixels, 0 for none
+static uint16_t scopeGridY;
+static uint16_t scopeBgColor;
+static uint16_t scopeGridColor;
+static scopeTrace_t scopeTraces[SCOPE_MAXTRACES];
+
+/**************************************************************************/
+/*!
+    @brief  Draws rows y0..y1 of a column as they should currently look,
+            with later traces on top of earlier ones
+*/
+/**************************************************************************/
+static uint32_t scopeRenderRows(uint16_t col, uint8_t y0, uint8_t y1)
+{
+  uint16_t buffer[SCOPE_MAXHEIGHT];
+  uint16_t base, color;
+  bool gridCol;
+  uint8_t y;
+  int8_t t;
+
+  gridCol = scopeGridX && ((col % scopeGridX) == 0);
+  for (y = y0; ; y++)
+  {
+    base = (gridCol || (scopeGridY && ((y % scopeGridY) == 0))) ? scopeGridColor : scopeBgColor;
+    color = base;
+    for (t = SCOPE_MAXTRACES - 1; t >= 0; t--)
+    {
+      if ((scopeTraces[t].min[col] <= y) && (y <= scopeTraces[t].max[col]))
+      {
+        color = scopeTraces[t].color;
+        break;
+      }
+    }
+    buffer[y - y0] = color;
+    if (y == y1)
+      break;
+  }
+
+  lcdDrawWindow(scopeX + col, scopeY + y0, scopeX + col, scopeY + y1, buffer);
+  return y1 - y0 + 1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Changes the span of a trace in one column, redrawing only the
+            rows that were covered before or are covered now, but not both
+*/
+/**************************************************************************/
+static uint32_t scopeUpdateColumn(scopeTrace_t *trace, uint16_t col, uint8_t newMin, uint8_t newMax)
+{
+  uint8_t oldMin = trace->min[col];
+  uint8_t oldMax = trace->max[col];
+  uint32_t pixels = 0;
+
+  if ((oldMin == newMin) && (oldMax == newMax))
+  {
+    return 0;
+  }
+
+  trace->min[col] = newMin;
+  trace->max[col] = newMax;
+
+  if (oldMin == SCOPE_EMPTY)
+  {
+    // Nothing there before
+    return newMin == SCOPE_EMPTY ? 0 : scopeRenderRows(col, newMin, newMax);
+  }
+  if ((newMin == SCOPE_EMPTY) || (newMax < oldMin) || (newMin > oldMax))
+  {
+    // No overlap, erase the old span and draw the new one
+    pixels += scopeRenderRows(col, oldMin, oldMax);
+    if (newMin != SCOPE_EMPTY)
+      pixels += scopeRenderRows(col, newMin, newMax);
+    return pixels;
+  }
+
+  // Overlapping, only the ends differ
+  if (newMin != oldMin)
+  {
+    pixels += scopeRenderRows(col, newMin < oldMin ? newMin : oldMin, (newMin < oldMin ? oldMin : newMin) - 1);
+  }
+  if (newMax != oldMax)
+  {
+    pixels += scopeRenderRows(col, (newMax < oldMax ? newMax : oldMax) + 1, newMax < oldMax ? oldMax : newMax);
+  }
+  return pixels;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets up the plot area and draws the empty grid
+
+    @param[in]  x, y
+                Top left corner of the plot area
+    @param[in]  width, height
+                Size of the plot area in pixels (up to SCOPE_MAXWIDTH
+                and SCOPE_MAXHEIGHT)
+    @param[in]  gridX, gridY
+                Pixels between grid lines, or 0 for no grid lines
+    @param[in]  bgColor, gridColor
+                Background and grid line colors
+*/
+/**************************************************************************/
+void scopeInit(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t gridX, uint16_t gridY, uint16_t bgColor, uint16_t gridColor)
+{
+  uint8_t t;
+
+  scopeX = x;
+  scopeY = y;
+  scopeWidth = width > SCOPE_MAXWIDTH ? SCOPE_MAXWIDTH : width;
+  scopeHeight = height > SCOPE_MAXHEIGHT ? SCOPE_MAXHEIGHT : height;
+  scopeGridX = gridX;
+  scopeGridY = gridY;
+  scopeBgColor = bgColor;
+  scopeGridColor = gridColor;
+
+  for (t = 0; t < SCOPE_MAXTRACES; t++)
+  {
+    memset(scopeTraces[t].min, SCOPE_EMPTY, sizeof(scopeTraces[t].min));
+    memset(scopeTraces[t].max, 0, sizeof(scopeTraces[t].max));
+    scopeTraces[t].color = COLOR_WHITE;
+    scopeTraces[t].fullScale = 1023;
+  }
+
+  scopeRedraw();
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sets the color of a trace, and the sample value that is
+            drawn at the top of the plot area (0 is at the bottom)
+*/
+/**************************************************************************/
+void scopeSetTrace(uint8_t trace, uint16_t color, uint16_t fullScale)
+{
+  if (trace >= SCOPE_MAXTRACES)
+  {
+    return;
+  }
+
+  scopeTraces[trace].color = color;
+  scopeTraces[trace].fullScale = fullScale ? fullScale : 1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Replaces a trace with a new block of samples, spread evenly
+            across the width of the plot area
+
+    @param[in]  trace
+                The trace to update (0..SCOPE_MAXTRACES-1)
+    @param[in]  samples
+                The first sample to draw
+    @param[in]  count
+                The number of samples to draw.  With more samples than
+                columns, each column shows the range of its samples.
+    @param[in]  stride
+                The distance between consecutive samples, for example
+                the number of channels in an interleaved ADC block
+
+    @return     The number of pixels written to the LCD
+*/
+/**************************************************************************/
+uint32_t scopeDrawBlock(uint8_t trace, const uint16_t *samples, uint16_t count, uint8_t stride)
+{
+  scopeTrace_t *t;
+  uint32_t pixels = 0;
+  uint32_t first, last, s;
+  uint16_t col, value;
+  uint8_t y, yMin, yMax, yPrev = 0;
+
+  if ((trace >= SCOPE_MAXTRACES) || (count == 0))
+  {
+    return 0;
+  }
+  if (stride == 0)
+  {
+    stride = 1;
+  }
+
+  t = &scopeTraces[trace];
+  for (col = 0; col < scopeWidth; col++)
+  {
+    // Samples falling in this column (at least one)
+    first = ((uint32_t)col * count) / scopeWidth;
+    last = ((uint32_t)(col + 1) * count) / scopeWidth;
+    if (last <= first)
+    {
+      last = first + 1;
+    }
+
+    yMin = scopeHeight - 1;
+    yMax = 0;
+    for (s = first; s < last; s++)
+    {
+      value = samples[s * stride];
+      if (value > t->fullScale)
+      {
+        value = t->fullScale;
+      }
+      y = (scopeHeight - 1) - ((uint32_t)value * (scopeHeight - 1)) / t->fullScale;
+      if (y < yMin) yMin = y;
+      if (y > yMax) yMax = y;
+    }
+
+    // Join up with the previous column so steep edges stay continuous
+    if (col)
+    {
+      if (yPrev < yMin) yMin = yPrev;
+      if (yPrev > yMax) yMax = yPrev;
+    }
+    yPrev = y;
+
+    pixels += scopeUpdateColumn(t, col, yMin, yMax);
+  }
+
+  return pixels;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Removes a trace from the plot area
+
+    @return     The number of pixels written to the LCD
+*/
+/**************************************************************************/
+uint32_t scopeClearTrace(uint8_t trace)
+{
+  uint32_t pixels = 0;
+  uint16_t col;
+
+  if (trace >= SCOPE_MAXTRACES)
+  {
+    return 0;
+  }
+
+  for (col = 0; col < scopeWidth; col++)
+  {
+    pixels += scopeUpdateColumn(&scopeTraces[trace], col, SCOPE_EMPTY, 0);
+  }
+
+  return pixels;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Redraws the whole plot area, for example after something
+            else has been drawn over it
+*/
+/**************************************************************************/
+void scopeRedraw(void)
+{
+  uint16_t col;
+
+  for (col = 0; col < scopeWidth; col++)
+  {
+    scopeRenderRows(col, 0, scopeHeight - 1);
+  }
+}
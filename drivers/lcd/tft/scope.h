@@ -0,0 +1,52 @@
+/**************************************************************************/
+/*! 
+    @file     scope.h
+
+    @brief    Oscilloscope style trace rendering for TFT LCDs
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2010, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#ifndef __SCOPE_H__
+#define __SCOPE_H__
+
+#include "projectconfig.h"
+
+#define SCOPE_MAXWIDTH        (320)   // Widest supported plot area (in pixels)
+#define SCOPE_MAXHEIGHT       (240)   // Tallest supported plot area (in pixels, 255 max)
+#define SCOPE_MAXTRACES       (2)     // Number of traces that can be shown at once
+
+void     scopeInit(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t gridX, uint16_t gridY, uint16_t bgColor, uint16_t gridColor);
+void     scopeSetTrace(uint8_t trace, uint16_t color, uint16_t fullScale);
+uint32_t scopeDrawBlock(uint8_t trace, const uint16_t *samples, uint16_t count, uint8_t stride);
+uint32_t scopeClearTrace(uint8_t trace);
+void     scopeRedraw(void);
+
+#endif
@@ -55,6 +55,43 @@ tsPoint_t _tsLCDPoints[3];
 tsPoint_t _tsTSPoints[3]; 
 tsMatrix_t _tsMatrix;
 
+typedef enum
+{
+  TS_STATE_IDLE = 0,
+  TS_STATE_Z1,
+  TS_STATE_Z2,
+  TS_STATE_X,
+  TS_STATE_Y
+} tsState_t;
+
+// Calibration matrix pre-divided by the divider (TS_MATRIXSHIFT fractional bits)
+typedef struct
+{
+  int32_t ax, bx, cx;
+  int32_t ay, by, cy;
+  bool valid;
+} tsFixedMatrix_t;
+
+static tsFixedMatrix_t _tsFixed;
+
+// Sampling state, only touched from the systick and ADC interrupts
+static volatile tsState_t _tsState = TS_STATE_IDLE;
+static uint8_t  _tsTicks = 0;
+static uint32_t _tsZ1, _tsZ2, _tsX;
+static uint16_t _tsHistX[3], _tsHistY[3];
+static uint8_t  _tsHistPos;
+static int32_t  _tsFiltX, _tsFiltY;
+static uint8_t  _tsDebounce;
+static bool     _tsTouched;
+
+// Latest filtered reading and the event queue, shared with the main loop
+static volatile tsTouchData_t _tsLatest;
+static tsEvent_t _tsEvents[TS_EVENTQUEUESIZE];
+static volatile uint8_t _tsEventHead = 0;
+static volatile uint8_t _tsEventTail = 0;
+
+static void tsADCCallback(uint8_t channelNum, uint32_t result);
+
 /**************************************************************************/
 /*                                                                        */
 /* ----------------------- Private Methods ------------------------------ */
@@ -63,13 +100,11 @@ tsMatrix_t _tsMatrix;
 
 /**************************************************************************/
 /*!
-    @brief  Reads the current Z/pressure level using the ADC
+    @brief  Configures the pins to read Z1 (pressure) on XP
 */
 /**************************************************************************/
-void tsReadZ(uint32_t* z1, uint32_t* z2)
+static void tsSetupZ1(void)
 {
-  if (!_tsInitialised) tsInit();
-
   // XP = ADC
   // XM = GPIO Output Low
   // YP = GPIO Output High
@@ -87,8 +122,15 @@ void tsReadZ(uint32_t* z1, uint32_t* z2)
   gpioSetValue(TS_YP_PORT, TS_YP_PIN, 1);   // 3.3V
 
   TS_XP_FUNC_ADC;
-  *z1 = adcRead(TS_XP_ADC_CHANNEL);
+}
 
+/**************************************************************************/
+/*!
+    @brief  Configures the pins to read Z2 (pressure) on YM
+*/
+/**************************************************************************/
+static void tsSetupZ2(void)
+{
   // XP = GPIO Input
   // XM = GPIO Output Low
   // YP = GPIO Output High
@@ -98,18 +140,15 @@ void tsReadZ(uint32_t* z1, uint32_t* z2)
   gpioSetDir (TS_YM_PORT, TS_YM_PIN, 0);
 
   TS_YM_FUNC_ADC;
-  *z2 = adcRead(TS_YM_ADC_CHANNEL);
 }
 
 /**************************************************************************/
 /*!
-    @brief  Reads the current X position using the ADC
+    @brief  Configures the pins to read the X position on YP
 */
 /**************************************************************************/
-uint32_t tsReadX(void)
+static void tsSetupX(void)
 {
-  if (!_tsInitialised) tsInit();
-
   // XP = GPIO Output High
   // XM = GPIO Output Low
   // YP = ADC
@@ -127,20 +166,15 @@ uint32_t tsReadX(void)
   gpioSetValue(TS_XM_PORT, TS_XM_PIN, 0);   // GND
 
   TS_YP_FUNC_ADC;  
-
-  // Return the ADC results
-  return adcRead(TS_YP_ADC_CHANNEL);
 }
 
 /**************************************************************************/
 /*!
-    @brief  Reads the current Y position using the ADC
+    @brief  Configures the pins to read the Y position on XM
 */
 /**************************************************************************/
-uint32_t tsReadY(void)
+static void tsSetupY(void)
 {
-  if (!_tsInitialised) tsInit();
-
   // YP = GPIO Output High
   // YM = GPIO Output Low
   // XP = GPIO Input
@@ -158,9 +192,232 @@ uint32_t tsReadY(void)
   gpioSetValue(TS_YM_PORT, TS_YM_PIN, 0);   // GND
 
   TS_XM_FUNC_ADC;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the median of three values
+*/
+/**************************************************************************/
+static uint16_t tsMedian3(uint16_t a, uint16_t b, uint16_t c)
+{
+  uint16_t t;
+
+  if (a > b)
+  {
+    t = a; a = b; b = t;
+  }
+  if (b > c)
+  {
+    b = (a > c) ? a : c;
+  }
+  return b;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Pre-divides the calibration matrix so that converting a
+            touch screen location only needs multiplies and a shift
+*/
+/**************************************************************************/
+static void tsUpdateFixedMatrix(void)
+{
+  int64_t divider = _tsMatrix.Divider;
+
+  if (divider == 0)
+  {
+    _tsFixed.valid = false;
+    return;
+  }
+
+  _tsFixed.ax = (int32_t)(((int64_t)_tsMatrix.An << TS_MATRIXSHIFT) / divider);
+  _tsFixed.bx = (int32_t)(((int64_t)_tsMatrix.Bn << TS_MATRIXSHIFT) / divider);
+  _tsFixed.cx = (int32_t)(((int64_t)_tsMatrix.Cn << TS_MATRIXSHIFT) / divider);
+  _tsFixed.ay = (int32_t)(((int64_t)_tsMatrix.Dn << TS_MATRIXSHIFT) / divider);
+  _tsFixed.by = (int32_t)(((int64_t)_tsMatrix.En << TS_MATRIXSHIFT) / divider);
+  _tsFixed.cy = (int32_t)(((int64_t)_tsMatrix.Fn << TS_MATRIXSHIFT) / divider);
+  _tsFixed.valid = true;
+}
 
-  // Return the ADC results
-  return adcRead(TS_XM_ADC_CHANNEL);
+/**************************************************************************/
+/*!
+    @brief  Adds an event to the queue (called from the ADC interrupt)
+
+    Consecutive move events are merged if the main loop hasn't picked
+    up the previous one yet, and the oldest event is discarded if the
+    queue is full.
+*/
+/**************************************************************************/
+static void tsPostEvent(tsEventType_t type)
+{
+  uint8_t next, last;
+  tsEvent_t *event;
+
+  last = (_tsEventHead + TS_EVENTQUEUESIZE - 1) % TS_EVENTQUEUESIZE;
+  if ((type == TS_EVENT_MOVE) && (_tsEventHead != _tsEventTail) && (_tsEvents[last].type == TS_EVENT_MOVE))
+  {
+    event = &_tsEvents[last];
+  }
+  else
+  {
+    next = (_tsEventHead + 1) % TS_EVENTQUEUESIZE;
+    if (next == _tsEventTail)
+    {
+      _tsEventTail = (_tsEventTail + 1) % TS_EVENTQUEUESIZE;
+    }
+    event = &_tsEvents[_tsEventHead];
+    _tsEventHead = next;
+  }
+
+  event->type = type;
+  event->xraw = _tsLatest.xraw;
+  event->yraw = _tsLatest.yraw;
+  event->xlcd = _tsLatest.xlcd;
+  event->ylcd = _tsLatest.ylcd;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Handles a complete set of readings (called from the ADC
+            interrupt).  X and Y are only valid if the screen is touched.
+*/
+/**************************************************************************/
+static void tsSampleComplete(uint32_t z1, uint32_t z2, uint32_t x, uint32_t y)
+{
+  bool touched = z1 >= _tsThreshhold;
+  uint16_t xmed, ymed;
+  int32_t xlcd, ylcd;
+
+  _tsLatest.z1 = z1;
+  _tsLatest.z2 = z2;
+
+  // Wait for TS_DEBOUNCESAMPLES readings before changing state
+  if (touched != _tsTouched)
+  {
+    if (++_tsDebounce < TS_DEBOUNCESAMPLES)
+    {
+      return;
+    }
+    _tsTouched = touched;
+    if (touched)
+    {
+      // Seed the filters with the first reading
+      _tsHistX[0] = _tsHistX[1] = _tsHistX[2] = x;
+      _tsHistY[0] = _tsHistY[1] = _tsHistY[2] = y;
+      _tsFiltX = x << TS_FILTERFRACBITS;
+      _tsFiltY = y << TS_FILTERFRACBITS;
+    }
+  }
+  _tsDebounce = 0;
+
+  if (!touched)
+  {
+    if (_tsLatest.valid)
+    {
+      _tsLatest.valid = false;
+      tsPostEvent(TS_EVENT_UP);
+    }
+    return;
+  }
+
+  // Running median of the last three readings removes single spikes,
+  // and the IIR filter smooths out the remaining noise
+  _tsHistX[_tsHistPos] = x;
+  _tsHistY[_tsHistPos] = y;
+  _tsHistPos = (_tsHistPos + 1) % 3;
+  xmed = tsMedian3(_tsHistX[0], _tsHistX[1], _tsHistX[2]);
+  ymed = tsMedian3(_tsHistY[0], _tsHistY[1], _tsHistY[2]);
+  _tsFiltX += (((int32_t)xmed << TS_FILTERFRACBITS) - _tsFiltX) >> TS_FILTERSHIFT;
+  _tsFiltY += (((int32_t)ymed << TS_FILTERFRACBITS) - _tsFiltY) >> TS_FILTERSHIFT;
+
+  _tsLatest.xraw = (_tsFiltX + (1 << (TS_FILTERFRACBITS - 1))) >> TS_FILTERFRACBITS;
+  _tsLatest.yraw = (_tsFiltY + (1 << (TS_FILTERFRACBITS - 1))) >> TS_FILTERFRACBITS;
+
+  // Convert to a (portrait) pixel location
+  xlcd = 0;
+  ylcd = 0;
+  if (_tsFixed.valid)
+  {
+    xlcd = (_tsFixed.ax * (int32_t)_tsLatest.xraw + _tsFixed.bx * (int32_t)_tsLatest.yraw + _tsFixed.cx) >> TS_MATRIXSHIFT;
+    ylcd = (_tsFixed.ay * (int32_t)_tsLatest.xraw + _tsFixed.by * (int32_t)_tsLatest.yraw + _tsFixed.cy) >> TS_MATRIXSHIFT;
+    if (xlcd < 0) xlcd = 0;
+    if (ylcd < 0) ylcd = 0;
+  }
+
+  if (!_tsLatest.valid)
+  {
+    _tsLatest.xlcd = xlcd;
+    _tsLatest.ylcd = ylcd;
+    _tsLatest.valid = true;
+    tsPostEvent(TS_EVENT_DOWN);
+  }
+  else if ((xlcd != _tsLatest.xlcd) || (ylcd != _tsLatest.ylcd))
+  {
+    _tsLatest.xlcd = xlcd;
+    _tsLatest.ylcd = ylcd;
+    tsPostEvent(TS_EVENT_MOVE);
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Steps through the Z1, Z2, X and Y conversions from the ADC
+            interrupt, reconfiguring the pins between each one
+*/
+/**************************************************************************/
+static void tsADCCallback(uint8_t channelNum, uint32_t result)
+{
+  switch (_tsState)
+  {
+    case TS_STATE_Z1:
+      _tsZ1 = result;
+      tsSetupZ2();
+      _tsState = TS_STATE_Z2;
+      if (adcReadAsync(TS_YM_ADC_CHANNEL, tsADCCallback)) return;
+      break;
+    case TS_STATE_Z2:
+      _tsZ2 = result;
+      if (_tsZ1 < _tsThreshhold)
+      {
+        // Not touched, so don't bother reading X/Y
+        tsSampleComplete(_tsZ1, _tsZ2, 0, 0);
+        break;
+      }
+      tsSetupX();
+      _tsState = TS_STATE_X;
+      if (adcReadAsync(TS_YP_ADC_CHANNEL, tsADCCallback)) return;
+      break;
+    case TS_STATE_X:
+      _tsX = result;
+      tsSetupY();
+      _tsState = TS_STATE_Y;
+      if (adcReadAsync(TS_XM_ADC_CHANNEL, tsADCCallback)) return;
+      break;
+    case TS_STATE_Y:
+      tsSampleComplete(_tsZ1, _tsZ2, _tsX, result);
+      break;
+    default:
+      break;
+  }
+
+  _tsState = TS_STATE_IDLE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Converts a portrait pixel location to the current orientation
+*/
+/**************************************************************************/
+static void tsAdjustOrientation(uint16_t *x, uint16_t *y)
+{
+  uint16_t oldx;
+
+  if (lcdGetOrientation() == LCD_ORIENTATION_LANDSCAPE)
+  {
+    oldx = *x;
+    *x = *y;
+    *y = lcdGetHeight() - oldx;
+  }
 }
 
 /**************************************************************************/
@@ -265,60 +522,16 @@ int setCalibrationMatrix( tsPoint_t * displayPtr, tsPoint_t * screenPtr, tsMatri
     eepromWriteS32(CFG_EEPROM_TOUCHSCREEN_CAL_FN, matrixPtr->Fn);
     eepromWriteS32(CFG_EEPROM_TOUCHSCREEN_CAL_DIVIDER, matrixPtr->Divider);
     eepromWriteU8(CFG_EEPROM_TOUCHSCREEN_CALIBRATED, 1);
-  }
+    eepromFlush();
 
-  return( retValue ) ;
-} 
-
-/**************************************************************************/
-/*!
-    @brief  Converts the supplied touch screen location (screenPtr) to
-            a pixel location on the display (displayPtr) using the
-            supplied matrix.  The screen orientation is also taken into
-            account when converting the touch screen co-ordinate to
-            a pixel location on the LCD.
-
-    @note  This is based on the public domain touch screen calibration code
-           written by Carlos E. Vidales (copyright (c) 2001).
-*/
-/**************************************************************************/
-int getDisplayPoint( tsPoint_t * displayPtr, tsPoint_t * screenPtr, tsMatrix_t * matrixPtr )
-{
-  int  retValue = TS_ERROR_NONE ;
-  
-  if( matrixPtr->Divider != 0 )
-  {
-    displayPtr->x = ( (matrixPtr->An * screenPtr->x) + 
-                      (matrixPtr->Bn * screenPtr->y) + 
-                       matrixPtr->Cn 
-                    ) / matrixPtr->Divider ;
-
-    displayPtr->y = ( (matrixPtr->Dn * screenPtr->x) + 
-                      (matrixPtr->En * screenPtr->y) + 
-                       matrixPtr->Fn 
-                    ) / matrixPtr->Divider ;
-  }
-  else
-  {
-    // ToDo: Default values required or you can never read LCD position!
-    // return TS_ERROR_NOTCALIBRATED;
-    return -1;
+    // Update the matrix used by the sampling engine
+    __disable_irq();
+    tsUpdateFixedMatrix();
+    __enable_irq();
   }
 
-  // Adjust value if the screen is in landscape mode
-  lcdOrientation_t orientation;
-  orientation = lcdGetOrientation();
-  if (orientation == LCD_ORIENTATION_LANDSCAPE)
-  {
-      uint32_t oldx, oldy;
-      oldx = displayPtr->x;
-      oldy = displayPtr->y;
-      displayPtr->x = oldy;
-      displayPtr->y = lcdGetHeight() - oldx;
-  }
-  
   return( retValue ) ;
-}
+} 
 
 /**************************************************************************/
 /*                                                                        */
@@ -330,6 +543,10 @@ int getDisplayPoint( tsPoint_t * displayPtr, tsPoint_t * screenPtr, tsMatrix_t *
 /*!
     @brief  Initialises the appropriate GPIO pins and ADC for the
             touchscreen
+
+    Once initialised, the touch screen is sampled in the background
+    every TS_SAMPLEPERIOD milliseconds (see tsTimerProc), so tsRead and
+    tsGetEvent never wait for the ADC.
 */
 /**************************************************************************/
 void tsInit(void)
@@ -352,6 +569,7 @@ void tsInit(void)
     _tsMatrix.En = eepromReadS32(CFG_EEPROM_TOUCHSCREEN_CAL_EN);
     _tsMatrix.Fn = eepromReadS32(CFG_EEPROM_TOUCHSCREEN_CAL_FN);
     _tsMatrix.Divider = eepromReadS32(CFG_EEPROM_TOUCHSCREEN_CAL_DIVIDER);
+    tsUpdateFixedMatrix();
   }
   else
   {
@@ -363,7 +581,35 @@ void tsInit(void)
 
 /**************************************************************************/
 /*!
-    @brief  Reads the current X, Y and Z co-ordinates of the touch screen
+    @brief  Starts a new set of readings every TS_SAMPLEPERIOD ticks.
+            This is called from the systick interrupt, and the readings
+            themselves are completed from the ADC interrupt.
+*/
+/**************************************************************************/
+void tsTimerProc(void)
+{
+  if (!_tsInitialised) return;
+
+  if (++_tsTicks < TS_SAMPLEPERIOD) return;
+  _tsTicks = 0;
+
+  // Skip this period if the last set of readings hasn't finished
+  // or someone else is using the ADC
+  if (_tsState != TS_STATE_IDLE) return;
+
+  tsSetupZ1();
+  _tsState = TS_STATE_Z1;
+  if (!adcReadAsync(TS_XP_ADC_CHANNEL, tsADCCallback))
+  {
+    _tsState = TS_STATE_IDLE;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the latest filtered X, Y and Z co-ordinates of the
+            touch screen.  This doesn't wait for the ADC, since the
+            readings are taken in the background.
 
     @param[in]    calibrating
                   Set to 1 if the read attempt is for calibration data.
@@ -373,66 +619,71 @@ void tsInit(void)
 /**************************************************************************/
 tsTouchError_t tsRead(tsTouchData_t* data, uint8_t calibrating)
 {
-  uint32_t x1, x2, y1, y2, z1, z2;
-
-  // Assign pressure levels regardless of touch state
-  tsReadZ(&z1, &z2);
-  data->z1 = z1;
-  data->z2 = z2;
-  data->xraw = 0;
-  data->yraw = 0;
-  data->xlcd = 0;
-  data->ylcd = 0;
-
-  // Abort if the screen is not being touched (0 levels reported)
-  if (z1 < _tsThreshhold)
-  {
-    data->valid = false;
-    return TS_ERROR_NONE;
-  }
+  if (!_tsInitialised) tsInit();
 
-  // Get two X/Y readings and compare results
-  x1 = tsReadX();
-  x2 = tsReadX();
-  y1 = tsReadY();
-  y2 = tsReadY();
+  __disable_irq();
+  *data = *(tsTouchData_t *)&_tsLatest;
+  __enable_irq();
 
-  // Throw an error if both readings aren't identical
-  if (x1 != x2 || y1 != y2)
+  if (!data->valid)
   {
-    data->valid = false;
-    data->xraw = x1;
-    data->yraw = y1;
-    return TS_ERROR_XYMISMATCH;
+    data->xraw = 0;
+    data->yraw = 0;
+    data->xlcd = 0;
+    data->ylcd = 0;
+    return TS_ERROR_NONE;
   }
 
-  // X/Y seems to be valid and reading has been confirmed twice
-  data->xraw = x1;
-  data->yraw = y1;
-
-  // Convert x/y values to pixel location with matrix multiply
-  tsPoint_t location, touch;
-  touch.x = x1;
-  touch.y = y1;
   // Only calculate the relative LCD value if this isn't for calibration
-  if (!calibrating)
-  {
-    getDisplayPoint( &location, &touch, &_tsMatrix) ;
-    data->xlcd = location.x;
-    data->ylcd = location.y;
-  }
-  else
+  if (calibrating)
   {
     // Assign some false values, but only xraw and yraw are
     // used for calibration
     data->xlcd = 0;
     data->ylcd = 0;
   }
-  data->valid = true;
+  else if (!_tsFixed.valid)
+  {
+    return TS_ERROR_NOTCALIBRATED;
+  }
+  else
+  {
+    tsAdjustOrientation(&data->xlcd, &data->ylcd);
+  }
 
   return TS_ERROR_NONE;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Gets the oldest touch event (down, move or up) from the
+            queue filled by the background sampling engine
+
+    @param[out]   event
+                  The event, with the LCD co-ordinates adjusted for the
+                  current screen orientation
+
+    @return       false if no events are waiting, otherwise true
+*/
+/**************************************************************************/
+bool tsGetEvent(tsEvent_t* event)
+{
+  if (!_tsInitialised) tsInit();
+
+  __disable_irq();
+  if (_tsEventHead == _tsEventTail)
+  {
+    __enable_irq();
+    return false;
+  }
+  *event = _tsEvents[_tsEventTail];
+  _tsEventTail = (_tsEventTail + 1) % TS_EVENTQUEUESIZE;
+  __enable_irq();
+
+  tsAdjustOrientation(&event->xlcd, &event->ylcd);
+  return true;
+}
+
 /**************************************************************************/
 /*!
     @brief  Starts the screen calibration process.  Each corner will be
@@ -604,6 +855,7 @@ int tsSetThreshhold(uint8_t value)
 
   // Persist to EEPROM
   eepromWriteU8(CFG_EEPROM_TOUCHSCREEN_THRESHHOLD, value);
+  eepromFlush();
 
   return 0;
 }
@@ -63,6 +63,13 @@
 #define TS_XM_ADC_CHANNEL   (2)   // ADC0.2
 #define TS_YM_ADC_CHANNEL   (3)   // ADC0.3
 
+#define TS_SAMPLEPERIOD     (10)  // Milliseconds between readings
+#define TS_DEBOUNCESAMPLES  (2)   // Readings required to change touch state
+#define TS_FILTERSHIFT      (2)   // IIR filter weight for new readings (1/4)
+#define TS_FILTERFRACBITS   (4)   // Fractional bits kept in the IIR filter
+#define TS_MATRIXSHIFT      (16)  // Fractional bits in the fixed-point calibration matrix
+#define TS_EVENTQUEUESIZE   (8)
+
 typedef struct Point 
 {
   int32_t x;
@@ -91,6 +98,23 @@ typedef struct
   bool valid;     // Whether this is a valid reading or not
 } tsTouchData_t;
 
+typedef enum
+{
+  TS_EVENT_NONE = 0,
+  TS_EVENT_DOWN,  // Screen touched
+  TS_EVENT_MOVE,  // Touch point moved
+  TS_EVENT_UP     // Screen released (co-ordinates are the last position)
+} tsEventType_t;
+
+typedef struct
+{
+  tsEventType_t type;
+  uint16_t xraw;  // Touch screen X
+  uint16_t yraw;  // Touch screen Y
+  uint16_t xlcd;  // LCD co-ordinate X
+  uint16_t ylcd;  // LCD co-ordinate Y
+} tsEvent_t;
+
 typedef enum
 {
   TS_ERROR_NONE          = 0,
@@ -104,6 +128,8 @@ void           tsInit ( void );
 tsTouchError_t tsRead(tsTouchData_t* data, uint8_t calibrating);
 void           tsCalibrate ( void );
 tsTouchError_t tsWaitForEvent(tsTouchData_t* data, uint32_t timeoutMS);
+bool           tsGetEvent(tsEvent_t* event);
+void           tsTimerProc(void);
 int            tsSetThreshhold(uint8_t value);
 uint8_t        tsGetThreshhold(void);
 
@@ -89,6 +89,14 @@ extern volatile uint32_t  I2CReadLength, I2CWriteLength;
 
 static bool _lm75bInitialised = false;
 
+// Queued transfers for lm75bGetTemperatureAsync
+static uint8_t _lm75bPowerOn[3]  = { LM75B_ADDRESS, LM75B_REGISTER_CONFIGURATION, LM75B_CONFIG_SHUTDOWN_POWERON };
+static uint8_t _lm75bReadTemp[3] = { LM75B_ADDRESS, LM75B_REGISTER_TEMPERATURE, LM75B_ADDRESS | LM75B_READBIT };
+static uint8_t _lm75bShutdown[3] = { LM75B_ADDRESS, LM75B_REGISTER_CONFIGURATION, LM75B_CONFIG_SHUTDOWN_SHUTDOWN };
+static uint8_t _lm75bTemp[2];
+static i2cTransfer_t _lm75bTransfer[3];
+static lm75bCallback_t _lm75bCallback;
+
 /**************************************************************************/
 /*! 
     @brief  Writes an 8 bit values over I2C
@@ -206,3 +214,71 @@ lm75bError_e lm75bConfigWrite (uint8_t configValue)
 
   return lm75bWrite8 (LM75B_REGISTER_CONFIGURATION, configValue);
 }
+
+/**************************************************************************/
+/*! 
+    @brief  Called (in interrupt context) once the shutdown write, the last
+            of the three queued transfers, is done
+*/
+/**************************************************************************/
+static void lm75bAsyncDone (i2cTransfer_t *transfer)
+{
+  int32_t temp;
+
+  // Shift values to create properly formed integer, sign extending
+  // negative numbers
+  temp = ((_lm75bTemp[0] << 8) | _lm75bTemp[1]) >> 5;
+  if (_lm75bTemp[0] & 0x80)
+  {
+    temp |= 0xFFFFFC00;
+  }
+
+  _lm75bCallback(_lm75bTransfer[1].state == I2CSTATE_ACK, temp);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Queues a temperature reading without waiting for it
+
+    The same power on/read/shut down sequence as lm75bGetTemperature is
+    queued on the I2C bus and this returns straight away.  'callback' is
+    called from interrupt context with the result (in the same 0.125°C
+    units) once the sequence is done, so it should only store it.
+
+    @return LM75B_ERROR_I2CBUSY if the previous reading hasn't finished
+*/
+/**************************************************************************/
+lm75bError_e lm75bGetTemperatureAsync (lm75bCallback_t callback)
+{
+  uint32_t i;
+
+  if (!_lm75bInitialised) lm75bInit();
+
+  for (i = 0; i < 3; i++)
+  {
+    if (_lm75bTransfer[i].state == I2CSTATE_QUEUED || _lm75bTransfer[i].state == I2CSTATE_PENDING)
+    {
+      return LM75B_ERROR_I2CBUSY;
+    }
+  }
+
+  _lm75bCallback = callback;
+
+  _lm75bTransfer[0].writeBuffer = _lm75bPowerOn;
+  _lm75bTransfer[0].writeLength = 3;
+  _lm75bTransfer[1].writeBuffer = _lm75bReadTemp;
+  _lm75bTransfer[1].writeLength = 2;
+  _lm75bTransfer[1].readBuffer = _lm75bTemp;
+  _lm75bTransfer[1].readLength = 2;
+  _lm75bTransfer[2].writeBuffer = _lm75bShutdown;
+  _lm75bTransfer[2].writeLength = 3;
+  _lm75bTransfer[2].callback = lm75bAsyncDone;
+
+  // The queue runs them in order
+  for (i = 0; i < 3; i++)
+  {
+    i2cQueue(&_lm75bTransfer[i]);
+  }
+
+  return LM75B_ERROR_OK;
+}
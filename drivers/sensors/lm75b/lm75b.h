@@ -61,9 +61,12 @@ typedef enum
 }
 lm75bError_e;
 
+typedef void (*lm75bCallback_t)(bool ok, int32_t temp);
+
 lm75bError_e lm75bInit(void);
 lm75bError_e lm75bGetTemperature (int32_t *temp);
 lm75bError_e lm75bConfigWrite (uint8_t configValue);
+lm75bError_e lm75bGetTemperatureAsync (lm75bCallback_t callback);
 
 #endif
 
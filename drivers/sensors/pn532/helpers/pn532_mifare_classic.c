@@ -142,6 +142,15 @@
         contents of the specific block, using one of the helper functions
         included in this module.
 
+    To read a whole card, pn532_mifareclassic_DumpCard() does all of the
+    above for each sector, trying a list of keys and remembering which
+    one worked for the next time the same card is dumped.
+
+    All of these go through pn532Transceive.  If PN532_I2C_IRQHANDLER
+    is defined in pn532_bus.h, PIOINT3_IRQHandler has to call
+    pn532_bus_IRQHandler, otherwise the first command hangs in the
+    default interrupt handler.
+
 */
 
 #include <string.h>
@@ -214,13 +223,17 @@ bool is_trailer_block (uint32_t uiBlock)
     @note   Possible error messages are:
 
             - PN532_ERROR_WRONGCARDTYPE
+            - PN532_ERROR_TIMEOUTWAITINGFORCARD, if no card turned up
+              within the retries set with pn532SetPassiveActivationRetries
+              (by default the PN532 keeps trying forever)
 */
 /**************************************************************************/
 pn532_error_t pn532_mifareclassic_WaitForPassiveTarget (byte_t * pbtCUID, size_t * szCUIDLen)
 {
   byte_t abtResponse[PN532_RESPONSELEN_INLISTPASSIVETARGET];
+  byte_t * pbtData;
   pn532_error_t error;
-  size_t szLen;
+  size_t szData;
 
   #ifdef PN532_DEBUGMODE
     PN532_DEBUG("Waiting for an ISO14443A Card%s", CFG_PRINTF_NEWLINE);
@@ -229,40 +242,38 @@ pn532_error_t pn532_mifareclassic_WaitForPassiveTarget (byte_t * pbtCUID, size_t
   /* Try to initialise a single ISO14443A tag at 106KBPS                  */
   /* Note:  To wait for a card with a known UID, append the four byte     */
   /*        UID to the end of the command.                                */ 
+  /* The response is read as soon as the PN532 signals it on IRQ          */
   byte_t abtCommand[] = { PN532_COMMAND_INLISTPASSIVETARGET, 0x01, PN532_MODULATION_ISO14443A_106KBPS};
-  error = pn532Write(abtCommand, sizeof(abtCommand));
+  error = pn532Transceive(abtCommand, sizeof(abtCommand), abtResponse, sizeof(abtResponse), &pbtData, &szData);
   if (error) 
     return error;
 
-  /* Wait until we get a valid response or a timeout                      */
-  do
-  {
-    systickDelay(25);
-    error = pn532Read(abtResponse, &szLen);
-  } while (error == PN532_ERROR_RESPONSEBUFFEREMPTY);
-  if (error) 
-    return error;
+  /* pbtData holds the response code (b6 in the frame) onwards            */
+  if ((szData >= 2) && (pbtData[1] == 0))
+    return PN532_ERROR_TIMEOUTWAITINGFORCARD;
+  if ((szData < 7) || (szData < 7 + (size_t)pbtData[6]))
+    return PN532_ERROR_WRONGCARDTYPE;
 
   /* Check SENSE_RES to make sure this is a Mifare Classic card           */
   /*          Classic 1K       = 00 04                                    */
   /*          Classic 4K       = 00 02                                    */
   /*          Classic Emulated = 00 08                                    */
-  if ((abtResponse[10] == 0x02) || 
-      (abtResponse[10] == 0x04) || 
-      (abtResponse[10] == 0x08))
+  if ((pbtData[4] == 0x02) || 
+      (pbtData[4] == 0x04) || 
+      (pbtData[4] == 0x08))
   {
     /* Card appears to be Mifare Classic */
-    *szCUIDLen = abtResponse[12];
+    *szCUIDLen = pbtData[6];
     uint8_t i;
     for (i=0; i < *szCUIDLen; i++) 
     {
-      pbtCUID[i] = abtResponse[13+i];
+      pbtCUID[i] = pbtData[7+i];
     }
     #ifdef PN532_DEBUGMODE
       PN532_DEBUG("Card Found: %s", CFG_PRINTF_NEWLINE);
       PN532_DEBUG("      ATQA: ");
-      pn532PrintHex(abtResponse+9, 2);
-      PN532_DEBUG("      SAK: %02x%s", abtResponse[11], CFG_PRINTF_NEWLINE);
+      pn532PrintHex(pbtData+3, 2);
+      PN532_DEBUG("      SAK: %02x%s", pbtData[5], CFG_PRINTF_NEWLINE);
       PN532_DEBUG("      UID: ");
       pn532PrintHex(pbtCUID, *szCUIDLen);
     #endif
@@ -276,14 +287,14 @@ pn532_error_t pn532_mifareclassic_WaitForPassiveTarget (byte_t * pbtCUID, size_t
     #ifdef PN532_DEBUGMODE
       PN532_DEBUG("Wrong Card Type (Expected ATQA 00 02, 00 04 or 00 08) %s%s", CFG_PRINTF_NEWLINE, CFG_PRINTF_NEWLINE);
       PN532_DEBUG("  ATQA       : ");
-      pn532PrintHex(abtResponse+9, 2);
-      PN532_DEBUG("  SAK        : %02x%s", abtResponse[11], CFG_PRINTF_NEWLINE);
-      PN532_DEBUG("  UID Length : %d%s", abtResponse[12], CFG_PRINTF_NEWLINE);
+      pn532PrintHex(pbtData+3, 2);
+      PN532_DEBUG("  SAK        : %02x%s", pbtData[5], CFG_PRINTF_NEWLINE);
+      PN532_DEBUG("  UID Length : %d%s", pbtData[6], CFG_PRINTF_NEWLINE);
       PN532_DEBUG("  UID        : ");
       size_t pos;
-      for (pos=0; pos < abtResponse[12]; pos++) 
+      for (pos=0; pos < pbtData[6]; pos++) 
       {
-        printf("%02x ", abtResponse[13 + pos]);
+        printf("%02x ", pbtData[7 + pos]);
       }
       printf("%s%s", CFG_PRINTF_NEWLINE, CFG_PRINTF_NEWLINE);
     #endif
@@ -316,7 +327,8 @@ pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t sz
   pn532_error_t error;
   byte_t abtCommand[17];
   byte_t abtResponse[PN532_RESPONSELEN_INDATAEXCHANGE];
-  size_t szLen;
+  byte_t * pbtData;
+  size_t szData;
 
   #ifdef PN532_DEBUGMODE
   PN532_DEBUG("Trying to authenticate card ");
@@ -326,7 +338,7 @@ pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t sz
   /* Prepare the authentication command */
   abtCommand[0] = PN532_COMMAND_INDATAEXCHANGE;   /* Data Exchange Header */
   abtCommand[1] = 1;                              /* Max card numbers */
-  abtCommand[2] = (uiKeyType) ? PN532_MIFARE_CMD_AUTH_A : PN532_MIFARE_CMD_AUTH_B;
+  abtCommand[2] = (uiKeyType == PN532_MIFARE_CMD_AUTH_B) ? PN532_MIFARE_CMD_AUTH_B : PN532_MIFARE_CMD_AUTH_A;
   abtCommand[3] = uiBlockNumber;                  /* Block Number (1K = 0..63, 4K = 0..255 */
   memcpy (abtCommand+4, pbtKeys, 6);
   uint8_t i;
@@ -335,25 +347,14 @@ pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t sz
     abtCommand[10+i] = pbtCUID[i];                /* 4 byte card ID */
   }
   
-  /* Send the command */
-  error = pn532Write(abtCommand, 10+szCUIDLen);
-  if (error)
-  {
-    /* Problem with the serial bus, etc. */
-    #ifdef PN532_DEBUGMODE
-      PN532_DEBUG("Authentification failed%s", CFG_PRINTF_NEWLINE);
-    #endif
-    return error;
-  }
-
-  /* Read the authentication response */
-  memset(abtResponse, 0, PN532_RESPONSELEN_INDATAEXCHANGE);
-  do
+  /* Send the command and wait for the response */
+  error = pn532Transceive(abtCommand, 10+szCUIDLen, abtResponse, sizeof(abtResponse), &pbtData, &szData);
+  if ((!error) && ((szData < 2) || (pbtData[1] & 0x3F)))
   {
-    systickDelay(25);
-    error = pn532Read(abtResponse, &szLen);
+    /* InDataExchange status byte, 0x14 = wrong key */
+    pn532GetPCB()->appError = (szData < 2) ? PN532_APPERROR_NONE : pbtData[1] & 0x3F;
+    error = PN532_ERROR_APPLEVELERROR;
   }
-  while (error == PN532_ERROR_RESPONSEBUFFEREMPTY);
   if (error)
   {
     #ifdef PN532_DEBUGMODE
@@ -362,8 +363,6 @@ pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t sz
     return error;
   }
 
-  // ToDo: How to check if authentification really worked (bad key, etc.)?
-
   /* Output the authentification data */
   #ifdef PN532_DEBUGMODE
     PN532_DEBUG("Authenticated block %d %s", uiBlockNumber, CFG_PRINTF_NEWLINE);
@@ -390,23 +389,106 @@ pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t sz
 /**************************************************************************/
 pn532_error_t pn532_mifareclassic_ReadDataBlock (uint8_t uiBlockNumber, byte_t * pbtData)
 {
+  return pn532_mifareclassic_ReadDataBlocks (uiBlockNumber, 1, pbtData);
+}
+
+/* State for a pipelined pn532_mifareclassic_ReadDataBlocks */
+typedef struct
+{
+  pn532_cmd_t       cmd;
+  byte_t            abtCommand[4];
+  byte_t            abtResponse[PN532_RESPONSELEN_INDATAEXCHANGE];
+  byte_t *          pbtOut;
+  uint8_t           uiRemaining;
+  volatile BOOL     finished;
+  pn532_error_t     error;
+} pn532_mifareclassic_readstate_t;
+
+/**************************************************************************/
+/*! 
+    Completion callback for the reads queued by
+    pn532_mifareclassic_ReadDataBlocks.  Runs in interrupt context and
+    sends the next read straight away.
+*/
+/**************************************************************************/
+static void pn532_mifareclassic_ReadDone (pn532_cmd_t * cmd)
+{
+  pn532_mifareclassic_readstate_t * state = (pn532_mifareclassic_readstate_t *)cmd->context;
+  pn532_error_t error = cmd->error;
+
+  /* Response code, status, then the 16 data bytes */
+  if ((!error) && ((cmd->szData != 18) || (cmd->pbtData[1] & 0x3F)))
+  {
+    #ifdef PN532_DEBUGMODE
+      PN532_DEBUG("Unexpected response reading block %d.  Bad key?%s", state->abtCommand[3], CFG_PRINTF_NEWLINE);
+    #endif
+    error = PN532_ERROR_BLOCKREADFAILED;
+  }
+  if (!error)
+  {
+    memcpy (state->pbtOut, cmd->pbtData + 2, 16);
+    state->pbtOut += 16;
+    state->uiRemaining--;
+    if (state->uiRemaining)
+    {
+      state->abtCommand[3]++;
+      error = pn532Queue(cmd);
+      if (!error)
+        return;
+    }
+  }
+
+  state->error = error;
+  state->finished = TRUE;
+}
+
+/**************************************************************************/
+/*! 
+    Reads consecutive 16-byte data blocks, which must all be readable
+    with the current authentication (normally the same sector).  Each
+    read is sent from the interrupt that completes the previous one, so
+    there's no gap between them.
+
+    @param  uiBlockNumber The first block to read (0..63 for 1KB cards,
+                          and 0..255 for 4KB cards)
+    @param  uiBlocks      The number of blocks to read
+    @param  pbtData       Pointer to the byte array that will hold the
+                          retrieved data (16 bytes per block)
+
+    @note   Possible error messages are:
+
+            - PN532_ERROR_BLOCKREADFAILED
+*/
+/**************************************************************************/
+pn532_error_t pn532_mifareclassic_ReadDataBlocks (uint8_t uiBlockNumber, uint8_t uiBlocks, byte_t * pbtData)
+{
+  pn532_mifareclassic_readstate_t state;
   pn532_error_t error;
-  byte_t abtCommand[4];
-  byte_t abtResponse[PN532_RESPONSELEN_INDATAEXCHANGE];
-  size_t szLen;
+
+  if (uiBlocks == 0)
+    return PN532_ERROR_NONE;
 
   #ifdef PN532_DEBUGMODE
-    PN532_DEBUG("Reading 16 bytes at block %03d%s", uiBlockNumber, CFG_PRINTF_NEWLINE);
+    PN532_DEBUG("Reading %d blocks from block %03d%s", uiBlocks, uiBlockNumber, CFG_PRINTF_NEWLINE);
   #endif
 
   /* Prepare the command */
-  abtCommand[0] = PN532_COMMAND_INDATAEXCHANGE;
-  abtCommand[1] = 1;                            /* Card number */
-  abtCommand[2] = PN532_MIFARE_CMD_READ;        /* Mifare Read command = 0x30 */
-  abtCommand[3] = uiBlockNumber;                /* Block Number (0..63 for 1K, 0..255 for 4K) */
-  
-  /* Send the commands */
-  error = pn532Write(abtCommand, sizeof(abtCommand));
+  memset(&state, 0, sizeof(state));
+  state.abtCommand[0] = PN532_COMMAND_INDATAEXCHANGE;
+  state.abtCommand[1] = 1;                            /* Card number */
+  state.abtCommand[2] = PN532_MIFARE_CMD_READ;        /* Mifare Read command = 0x30 */
+  state.abtCommand[3] = uiBlockNumber;                /* Block Number (0..63 for 1K, 0..255 for 4K) */
+  state.cmd.pbtCommand = state.abtCommand;
+  state.cmd.szCommand = sizeof(state.abtCommand);
+  state.cmd.pbtResponse = state.abtResponse;
+  state.cmd.szResponse = sizeof(state.abtResponse);
+  state.cmd.callback = pn532_mifareclassic_ReadDone;
+  state.cmd.context = &state;
+  state.pbtOut = pbtData;
+  state.uiRemaining = uiBlocks;
+
+  /* Send the first read, the callback sends the rest */
+  error = pn532Queue(&state.cmd);
   if (error)
   {
     /* Bus error, etc. */
@@ -415,44 +497,285 @@ pn532_error_t pn532_mifareclassic_ReadDataBlock (uint8_t uiBlockNumber, byte_t *
     #endif
     return error;
   }
+  while (!state.finished)
+  {
+    pn532Poll();
+  }
+
+  /* Display data for debug if requested */
+  #ifdef PN532_DEBUGMODE
+    if (!state.error)
+    {
+      uint8_t i;
+      for (i = 0; i < uiBlocks; i++)
+      {
+        PN532_DEBUG("Block %03d: ", uiBlockNumber + i);
+        pn532PrintHexChar(pbtData + 16 * i, 16);
+      }
+    }
+  #endif
+
+  return state.error;
+}
+
+/* Sector keys that worked before, by card UID.  Each entry holds the
+   index (plus one) into the key list passed to DumpCard, 0 = unknown */
+typedef struct
+{
+  byte_t            abtUID[7];
+  uint8_t           uiUIDLen;
+  uint8_t           uiKeyType;
+  uint8_t           auiKey[PN532_MIFARE_KEYCACHE_SECTORS];
+} pn532_mifareclassic_keycache_t;
+
+static pn532_mifareclassic_keycache_t pn532_mifareclassic_keyCache[PN532_MIFARE_KEYCACHE_CARDS];
+static uint8_t pn532_mifareclassic_keyCacheNext = 0;
+
+/**************************************************************************/
+/*! 
+    Clears the sector keys remembered by pn532_mifareclassic_DumpCard.
+    Call this if the key list passed to DumpCard changes.
+*/
+/**************************************************************************/
+void pn532_mifareclassic_ClearKeyCache (void)
+{
+  memset(pn532_mifareclassic_keyCache, 0, sizeof(pn532_mifareclassic_keyCache));
+  pn532_mifareclassic_keyCacheNext = 0;
+}
+
+/**************************************************************************/
+/*! 
+    Finds the key cache entry for the specified card, replacing the
+    oldest entry if the card hasn't been seen before
+*/
+/**************************************************************************/
+static pn532_mifareclassic_keycache_t * pn532_mifareclassic_GetKeyCache (byte_t * pbtCUID, size_t szCUIDLen, uint8_t uiKeyType)
+{
+  pn532_mifareclassic_keycache_t * entry;
+  uint8_t i;
 
-  /* Read the response */
-  memset(abtResponse, 0, PN532_RESPONSELEN_INDATAEXCHANGE);
-  do
+  if (szCUIDLen > sizeof(entry->abtUID))
+    szCUIDLen = sizeof(entry->abtUID);
+
+  for (i = 0; i < PN532_MIFARE_KEYCACHE_CARDS; i++)
   {
-    systickDelay(50);
-    error = pn532Read(abtResponse, &szLen);
+    entry = &pn532_mifareclassic_keyCache[i];
+    if ((entry->uiUIDLen == szCUIDLen) && 
+        (entry->uiKeyType == uiKeyType) && 
+        (memcmp(entry->abtUID, pbtCUID, szCUIDLen) == 0))
+    {
+      return entry;
+    }
   }
-  while (error == PN532_ERROR_RESPONSEBUFFEREMPTY);
+
+  entry = &pn532_mifareclassic_keyCache[pn532_mifareclassic_keyCacheNext];
+  pn532_mifareclassic_keyCacheNext = (pn532_mifareclassic_keyCacheNext + 1) % PN532_MIFARE_KEYCACHE_CARDS;
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->abtUID, pbtCUID, szCUIDLen);
+  entry->uiUIDLen = szCUIDLen;
+  entry->uiKeyType = uiKeyType;
+  return entry;
+}
+
+/**************************************************************************/
+/*! 
+    Selects the card again after a failed authentication (which drops
+    the card back to the idle state), checking that it's the same card.
+    pn532_mifareclassic_DumpCard limits the activation retries, so this
+    fails with PN532_ERROR_TIMEOUTWAITINGFORCARD if the card has gone.
+*/
+/**************************************************************************/
+static pn532_error_t pn532_mifareclassic_Reselect (byte_t * pbtCUID, size_t szCUIDLen)
+{
+  byte_t abtUID[8];
+  size_t szUIDLen;
+  pn532_error_t error;
+
+  error = pn532_mifareclassic_WaitForPassiveTarget(abtUID, &szUIDLen);
   if (error)
-  {
-    #ifdef PN532_DEBUGMODE
-      PN532_DEBUG("Read failed%s", CFG_PRINTF_NEWLINE);
-    #endif
     return error;
-  }
+  if ((szUIDLen != szCUIDLen) || (memcmp(abtUID, pbtCUID, szCUIDLen) != 0))
+    return PN532_ERROR_CARDCHANGED;
+
+  return PN532_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*! 
+    Authenticates a sector, trying the key that worked last time for
+    this card first and then the rest of the list
+
+    @returns  The index of the key that worked, or uiKeys if none did
+*/
+/**************************************************************************/
+static uint8_t pn532_mifareclassic_AuthenticateSector (byte_t * pbtCUID, size_t szCUIDLen, uint8_t uiSector, uint8_t uiBlockNumber, uint8_t uiKeyType, byte_t (*pbtKeys)[6], uint8_t uiKeys, pn532_mifareclassic_keycache_t * cache, pn532_error_t * error)
+{
+  uint8_t uiCached = uiKeys;
+  uint8_t i;
+
+  *error = PN532_ERROR_APPLEVELERROR;
+  if ((uiSector < PN532_MIFARE_KEYCACHE_SECTORS) && cache->auiKey[uiSector])
+    uiCached = cache->auiKey[uiSector] - 1;
 
-  /* Make sure we have a valid response (should be 26 bytes long) */
-  if (szLen == 26)
+  /* The cached key goes first, then everything else in order */
+  for (i = 0; i <= uiKeys; i++)
   {
-    /* Copy the 16 data bytes to the output buffer        */
-    /* Block content starts at byte 9 of a valid response */
-    memcpy (pbtData, abtResponse+8, 16);
+    uint8_t uiKey = (i == 0) ? uiCached : i - 1;
+    if ((uiKey >= uiKeys) || ((i != 0) && (uiKey == uiCached)))
+      continue;
+
+    *error = pn532_mifareclassic_AuthenticateBlock(pbtCUID, szCUIDLen, uiBlockNumber, uiKeyType, pbtKeys[uiKey]);
+    if (!*error)
+    {
+      if (uiSector < PN532_MIFARE_KEYCACHE_SECTORS)
+        cache->auiKey[uiSector] = uiKey + 1;
+      return uiKey;
+    }
+
+    /* Anything other than a rejected key means the card's gone */
+    if (*error != PN532_ERROR_APPLEVELERROR)
+      return uiKeys;
+    *error = pn532_mifareclassic_Reselect(pbtCUID, szCUIDLen);
+    if (*error)
+      return uiKeys;
+    *error = PN532_ERROR_APPLEVELERROR;
   }
-  else
+
+  if (uiSector < PN532_MIFARE_KEYCACHE_SECTORS)
+    cache->auiKey[uiSector] = 0;
+  return uiKeys;
+}
+
+/**************************************************************************/
+/*! 
+    Does the work for pn532_mifareclassic_DumpCard
+*/
+/**************************************************************************/
+static pn532_error_t pn532_mifareclassic_DumpSectors (byte_t * pbtCUID, size_t szCUIDLen, uint8_t uiSectors, uint8_t uiKeyType, byte_t (*pbtKeys)[6], uint8_t uiKeys, pn532_mifareclassic_dump_t callback, void * context)
+{
+  pn532_mifareclassic_keycache_t * cache;
+  byte_t abtBlocks[PN532_MIFARE_DUMPBLOCKS * 16];
+  pn532_error_t result = PN532_ERROR_NONE;
+  pn532_error_t gone = PN532_ERROR_NONE;
+  pn532_error_t error;
+  uint8_t uiSector, uiKey, uiCount;
+  uint16_t uiBlock, uiLast;
+
+  cache = pn532_mifareclassic_GetKeyCache(pbtCUID, szCUIDLen, uiKeyType);
+
+  for (uiSector = 0; uiSector < uiSectors; uiSector++)
   {
-    #ifdef PN532_DEBUGMODE
-      PN532_DEBUG("Unexpected response reading block %d.  Bad key?%s", uiBlockNumber, CFG_PRINTF_NEWLINE);
-    #endif
-    return PN532_ERROR_BLOCKREADFAILED;
+    /* Sectors 0..31 have 4 blocks, 32..39 (4K only) have 16 */
+    if (uiSector < 32)
+    {
+      uiBlock = uiSector * 4;
+      uiLast = uiBlock + 3;
+    }
+    else
+    {
+      uiBlock = 128 + (uiSector - 32) * 16;
+      uiLast = uiBlock + 15;
+    }
+
+    /* Once the card has gone or changed the rest of the image is zeros,
+       so the callback still gets every block */
+    uiKey = uiKeys;
+    if (!gone)
+    {
+      uiKey = pn532_mifareclassic_AuthenticateSector(pbtCUID, szCUIDLen, uiSector, uiBlock, uiKeyType, pbtKeys, uiKeys, cache, &error);
+      if ((uiKey == uiKeys) && (error != PN532_ERROR_APPLEVELERROR) && (error != PN532_ERROR_NONE))
+        gone = error;
+      #ifdef PN532_DEBUGMODE
+        if ((uiKey == uiKeys) && !gone)
+          PN532_DEBUG("No key for sector %d%s", uiSector, CFG_PRINTF_NEWLINE);
+      #endif
+    }
+
+    while (uiBlock <= uiLast)
+    {
+      uiCount = uiLast + 1 - uiBlock;
+      if (uiCount > PN532_MIFARE_DUMPBLOCKS)
+        uiCount = PN532_MIFARE_DUMPBLOCKS;
+
+      if (uiKey < uiKeys)
+        error = pn532_mifareclassic_ReadDataBlocks(uiBlock, uiCount, abtBlocks);
+      if ((uiKey == uiKeys) || error)
+      {
+        memset(abtBlocks, 0, uiCount * 16);
+        if (gone)
+          error = gone;
+        else if (!error)
+          error = PN532_ERROR_APPLEVELERROR;
+        if (!result)
+          result = error;
+        /* Rest of the sector is skipped, the card has to be reselected */
+        if (uiKey < uiKeys)
+        {
+          uiKey = uiKeys;
+          gone = pn532_mifareclassic_Reselect(pbtCUID, szCUIDLen);
+        }
+      }
+      else if ((uiBlock + uiCount - 1 == uiLast) && (uiKeyType != PN532_MIFARE_CMD_AUTH_B))
+      {
+        /* Key A always reads back as zeros, fill in the one we used */
+        memcpy(abtBlocks + (uiCount - 1) * 16, pbtKeys[uiKey], 6);
+      }
+
+      callback(uiBlock, abtBlocks, uiCount, error, context);
+      uiBlock += uiCount;
+    }
   }
 
-  /* Display data for debug if requested */
-  #ifdef PN532_DEBUGMODE
-    PN532_DEBUG("Block %03d: ", uiBlockNumber, CFG_PRINTF_NEWLINE);
-    pn532PrintHexVerbose(pbtData, 16);
-  #endif
+  return gone ? gone : result;
+}
 
-  // Return OK signal
-  return PN532_ERROR_NONE;
+/**************************************************************************/
+/*! 
+    Reads every block of the first uiSectors sectors and passes them,
+    in block order, to the callback.  Each sector is authenticated once
+    and its blocks are read back-to-back with
+    pn532_mifareclassic_ReadDataBlocks.
+
+    The key that opened each sector is remembered for the last
+    PN532_MIFARE_KEYCACHE_CARDS cards, so dumping a card again only
+    costs one authentication per sector.  Cards always read Key A back
+    as zeros, so when dumping with Key A the key that worked is put
+    into the sector trailer in the image.
+
+    @param  pbtCUID       Pointer to the card UID, from
+                          pn532_mifareclassic_WaitForPassiveTarget
+    @param  szCUIDLen     The length (in bytes) of the card's UID
+    @param  uiSectors     The number of sectors to read (16 for 1KB
+                          cards, 40 for 4KB cards)
+    @param  uiKeyType     PN532_MIFARE_CMD_AUTH_A or _AUTH_B
+    @param  pbtKeys       The keys to try on each sector
+    @param  uiKeys        The number of keys in pbtKeys
+    @param  callback      Receives the dumped blocks
+    @param  context       Passed to the callback
+
+    @note   Sectors that can't be authenticated or read are passed to
+            the callback as zeros with the error set, and the dump
+            carries on.  The first such error is returned.  If the card
+            is pulled from the field (or swapped) the rest of the blocks
+            are passed as zeros with that error, so the callback always
+            sees a whole image, and PN532_ERROR_TIMEOUTWAITINGFORCARD
+            (or PN532_ERROR_CARDCHANGED) is returned.
+*/
+/**************************************************************************/
+pn532_error_t pn532_mifareclassic_DumpCard (byte_t * pbtCUID, size_t szCUIDLen, uint8_t uiSectors, uint8_t uiKeyType, byte_t (*pbtKeys)[6], uint8_t uiKeys, pn532_mifareclassic_dump_t callback, void * context)
+{
+  pn532_error_t error, restoreError;
+
+  if (uiSectors > 40)
+    return PN532_ERROR_ADDRESSOUTOFRANGE;
+
+  /* Reselecting a card that's been pulled mustn't wait forever          */
+  error = pn532SetPassiveActivationRetries(PN532_MIFARE_RESELECTRETRIES);
+  if (error)
+    return error;
+
+  error = pn532_mifareclassic_DumpSectors(pbtCUID, szCUIDLen, uiSectors, uiKeyType, pbtKeys, uiKeys, callback, context);
+
+  restoreError = pn532SetPassiveActivationRetries(0xFF);
+  return error ? error : restoreError;
 }
@@ -10,8 +10,34 @@
 #include "projectconfig.h"
 #include "pn532_mifare.h"
 
+// Number of cards whose working sector keys are remembered
+#define PN532_MIFARE_KEYCACHE_CARDS     (4)
+// Sectors per card held in the key cache (16 covers a 1K card)
+#define PN532_MIFARE_KEYCACHE_SECTORS   (16)
+
+// Blocks passed to a dump callback at once
+#define PN532_MIFARE_DUMPBLOCKS         (4)
+
+// Activation attempts when a card is reselected during a dump, so that a
+// card pulled from the field is reported instead of waited for
+#define PN532_MIFARE_RESELECTRETRIES    (0x10)
+
+/**************************************************************************/
+/*! 
+    Receives consecutive blocks from pn532_mifareclassic_DumpCard.
+    Blocks that couldn't be read are passed as zeros, with error set,
+    so appending every call gives a packed image of the card.
+*/
+/**************************************************************************/
+typedef void (*pn532_mifareclassic_dump_t)(uint8_t uiBlockNumber, const byte_t * pbtData, uint8_t uiBlocks, pn532_error_t error, void * context);
+
+bool          is_first_block (uint32_t uiBlock);
+bool          is_trailer_block (uint32_t uiBlock);
 pn532_error_t pn532_mifareclassic_WaitForPassiveTarget (byte_t * pbtCUID, size_t * szCUIDLen);
 pn532_error_t pn532_mifareclassic_AuthenticateBlock (byte_t * pbtCUID, size_t szCUIDLen, uint32_t uiBlockNumber, uint8_t uiKeyType, byte_t * pbtKeys);
 pn532_error_t pn532_mifareclassic_ReadDataBlock (uint8_t uiBlockNumber, byte_t * pbtData);
+pn532_error_t pn532_mifareclassic_ReadDataBlocks (uint8_t uiBlockNumber, uint8_t uiBlocks, byte_t * pbtData);
+pn532_error_t pn532_mifareclassic_DumpCard (byte_t * pbtCUID, size_t szCUIDLen, uint8_t uiSectors, uint8_t uiKeyType, byte_t (*pbtKeys)[6], uint8_t uiKeys, pn532_mifareclassic_dump_t callback, void * context);
+void          pn532_mifareclassic_ClearKeyCache (void);
 
 #endif
@@ -161,3 +161,214 @@ pn532_error_t pn532Write(byte_t * abtCommand, size_t szLen)
     return PN532_ERROR_UNABLETOINIT;
   }
 }
+
+
+/**************************************************************************/
+/*! 
+    @brief      Checks a normal information frame (00 00 FF LEN LCS D5
+                ... DCS 00) received from the PN532, in place
+
+    @param      pbtFrame
+                The frame, starting at the preamble
+    @param      szFrame
+                The number of valid bytes at pbtFrame
+    @param      ppbtData
+                Set to the response code (command + 1) in the frame
+    @param      pszData
+                Set to the number of bytes from the response code on
+
+    @note   Possible error messages are:
+
+            - PN532_ERROR_PREAMBLEMISMATCH
+            - PN532_ERROR_APPLEVELERROR
+            - PN532_ERROR_EXTENDEDFRAME
+            - PN532_ERROR_LENCHECKSUMMISMATCH
+            - PN532_ERROR_RESPONSETOOLONG
+            - PN532_ERROR_DATACHECKSUMMISMATCH
+*/
+/**************************************************************************/
+pn532_error_t pn532ParseResponse(byte_t *pbtFrame, size_t szFrame, byte_t **ppbtData, size_t *pszData)
+{
+  const byte_t abtPreamble[3] = { 0x00, 0x00, 0xff };
+  byte_t btDCS;
+  size_t szPos, szLen;
+
+  pcb.appError = PN532_APPERROR_NONE;
+
+  if ((szFrame < 6) || (0 != memcmp(pbtFrame, abtPreamble, 3)))
+  {
+    return PN532_ERROR_PREAMBLEMISMATCH;
+  }
+
+  if ((0x01 == pbtFrame[3]) && (0xff == pbtFrame[4]))
+  {
+    // Error frame
+    pcb.appError = pbtFrame[5];
+    return PN532_ERROR_APPLEVELERROR;
+  }
+  if ((0xff == pbtFrame[3]) && (0xff == pbtFrame[4]))
+  {
+    return PN532_ERROR_EXTENDEDFRAME;
+  }
+  if ((256 != (pbtFrame[3] + pbtFrame[4])) || (pbtFrame[3] < 2) || (pbtFrame[5] != 0xD5))
+  {
+    return PN532_ERROR_LENCHECKSUMMISMATCH;
+  }
+
+  // LEN counts TFI and the data, then come DCS and the postamble
+  szLen = pbtFrame[3];
+  if (szLen + 7 > szFrame)
+  {
+    return PN532_ERROR_RESPONSETOOLONG;
+  }
+  btDCS = 0;
+  for (szPos = 0; szPos <= szLen; szPos++)
+  {
+    btDCS += pbtFrame[5 + szPos];
+  }
+  if (btDCS != 0)
+  {
+    return PN532_ERROR_DATACHECKSUMMISMATCH;
+  }
+
+  *ppbtData = pbtFrame + 6;
+  *pszData = szLen - 1;
+  return PN532_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Queues a command.  It is sent as soon as the commands
+                ahead of it have finished, and completes without any
+                further calls once the PN532 signals (on its IRQ line)
+                that the response is ready.  cmd->done, cmd->error and
+                cmd->pbtData/szData are then set and the callback runs.
+
+    @param      cmd
+                The command descriptor, see pn532_cmd_t
+
+    @note   On the UART bus there is no ready signal, so the command
+            runs to completion before pn532Queue returns.
+*/
+/**************************************************************************/
+pn532_error_t pn532Queue(pn532_cmd_t *cmd)
+{
+  if (!pcb.initialised) pn532Init();
+
+  // Try to wake the device up if it's in sleep mode
+  if (pcb.state == PN532_STATE_SLEEP)
+  {
+    pn532_error_t wakeupError = pn532_bus_Wakeup();
+    if (wakeupError)
+      return wakeupError;
+  }
+
+  return pn532_bus_QueueCommand(cmd);
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Blocks until a queued command has finished, and returns
+                its error code.  Don't call this from a callback.
+*/
+/**************************************************************************/
+pn532_error_t pn532Wait(pn532_cmd_t *cmd)
+{
+  while (!cmd->done)
+  {
+    pn532_bus_Poll();
+  }
+  return cmd->error;
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Checks the PN532's ready signal for queued commands.
+                Only needed when the IRQ line isn't wired to
+                pn532_bus_IRQHandler.
+*/
+/**************************************************************************/
+void pn532Poll(void)
+{
+  pn532_bus_Poll();
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Cancels the command the PN532 is working on (for example
+                an InListPassiveTarget waiting for a card).  It finishes
+                with PN532_ERROR_ABORTED and the queue moves on.
+*/
+/**************************************************************************/
+void pn532Abort(void)
+{
+  pn532_bus_Abort();
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Sends a command through the queue and waits for the
+                response
+
+    @param      pbtCommand
+                The command byte and any parameters
+    @param      szCommand
+                The number of bytes in pbtCommand
+    @param      pbtResponse
+                Buffer for the raw response frame
+    @param      szResponse
+                Size of pbtResponse
+    @param      ppbtData
+                Set to the response code (command + 1) in pbtResponse
+    @param      pszData
+                Set to the number of bytes from the response code on
+
+    @note       The IRQ pin is polled while waiting.  If
+                PN532_I2C_IRQHANDLER is defined in pn532_bus.h its
+                interrupt is turned on as well, and the application
+                has to call pn532_bus_IRQHandler from its
+                PIOINT3_IRQHandler (see pn532_bus.h)
+*/
+/**************************************************************************/
+pn532_error_t pn532Transceive(const byte_t *pbtCommand, size_t szCommand, byte_t *pbtResponse, size_t szResponse, byte_t **ppbtData, size_t *pszData)
+{
+  pn532_cmd_t cmd;
+  pn532_error_t error;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.pbtCommand = pbtCommand;
+  cmd.szCommand = szCommand;
+  cmd.pbtResponse = pbtResponse;
+  cmd.szResponse = szResponse;
+
+  error = pn532Queue(&cmd);
+  if (error)
+    return error;
+
+  error = pn532Wait(&cmd);
+  *ppbtData = cmd.pbtData;
+  *pszData = cmd.szData;
+  return error;
+}
+
+/**************************************************************************/
+/*! 
+    @brief      Sets how many times InListPassiveTarget tries to activate
+                a card before it gives up and reports that no card was
+                found (RFConfiguration, MaxRetries item)
+
+    @param      uiRetries
+                The number of retries, or 0xFF (the power-on default)
+                to keep trying until a card turns up
+*/
+/**************************************************************************/
+pn532_error_t pn532SetPassiveActivationRetries(uint8_t uiRetries)
+{
+  byte_t abtResponse[16];
+  byte_t * pbtData;
+  size_t szData;
+
+  /* MxRtyATR and MxRtyPSL are left at their defaults                     */
+  byte_t abtCommand[] = { PN532_COMMAND_RFCONFIGURATION, 0x05, 0xFF, 0x01, uiRetries };
+  return pn532Transceive(abtCommand, sizeof(abtCommand), abtResponse, sizeof(abtResponse), &pbtData, &szData);
+}
@@ -33,7 +33,11 @@ typedef enum pn532_error_e
   PN532_ERROR_BLOCKREADFAILED         = 0x0C,   // Unexpected response to block read request
   PN532_ERROR_WRONGCARDTYPE           = 0x0D,   // Card is not the expected format (based on SENS_RES/ATQA value)
   PN532_ERROR_ADDRESSOUTOFRANGE       = 0x0E,   // Specified block and page is out of range
-  PN532_ERROR_I2C_NACK                = 0x0F    // I2C Bus - No ACK was received for master to slave data transfer
+  PN532_ERROR_I2C_NACK                = 0x0F,   // I2C Bus - No ACK was received for master to slave data transfer
+  PN532_ERROR_ABORTED                 = 0x10,   // Queued command cancelled with pn532Abort
+  PN532_ERROR_DATACHECKSUMMISMATCH    = 0x11,   // Response data checksum (DCS) mismatch
+  PN532_ERROR_RESPONSETOOLONG         = 0x12,   // Response doesn't fit in the supplied buffer
+  PN532_ERROR_CARDCHANGED             = 0x13    // A different card answered when reselecting
 } pn532_error_t;
 
 typedef enum pn532_modulation_e
@@ -134,11 +138,40 @@ typedef struct
   uint32_t            appError;
 } pn532_pcb_t;
 
+/* One command for pn532Queue.  The caller owns the descriptor and both */
+/* buffers until 'done' is set (just before the callback runs).  The    */
+/* response frame is read into pbtResponse as is and checked in place;  */
+/* pbtData then points at the response code (command + 1) inside it.    */
+struct pn532_cmd_s;
+typedef void (*pn532_callback_t)(struct pn532_cmd_s *cmd);
+
+typedef struct pn532_cmd_s
+{
+  const byte_t         *pbtCommand;   // Command byte and parameters
+  size_t                szCommand;
+  byte_t               *pbtResponse;  // Receives the raw response frame
+  size_t                szResponse;   // Size of pbtResponse
+  pn532_callback_t      callback;     // May be NULL. Runs in interrupt context and may queue commands
+  void                 *context;      // For the callback
+  byte_t               *pbtData;      // Set when done: response code and data
+  size_t                szData;       // Set when done: bytes at pbtData
+  volatile pn532_error_t error;       // Set when done
+  volatile BOOL         done;
+  struct pn532_cmd_s   *next;         // Internal: queue link
+} pn532_cmd_t;
+
 void          pn532PrintHex(const byte_t * pbtData, const size_t szBytes);
 void          pn532PrintHexChar(const byte_t * pbtData, const size_t szBytes);
 pn532_pcb_t * pn532GetPCB();
 void          pn532Init();
 pn532_error_t pn532Read(byte_t *pbtResponse, size_t * pszLen);
 pn532_error_t pn532Write(byte_t *abtCommand, size_t szLen);
+pn532_error_t pn532ParseResponse(byte_t *pbtFrame, size_t szFrame, byte_t **ppbtData, size_t *pszData);
+pn532_error_t pn532Queue(pn532_cmd_t *cmd);
+pn532_error_t pn532Wait(pn532_cmd_t *cmd);
+void          pn532Poll(void);
+void          pn532Abort(void);
+pn532_error_t pn532Transceive(const byte_t *pbtCommand, size_t szCommand, byte_t *pbtResponse, size_t szResponse, byte_t **ppbtData, size_t *pszData);
+pn532_error_t pn532SetPassiveActivationRetries(uint8_t uiRetries);
 
 #endif
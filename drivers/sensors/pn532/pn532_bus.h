@@ -18,6 +18,20 @@
 #define PN532_I2C_IRQPORT                     (3)
 #define PN532_I2C_IRQPIN                      (2)
 
+// By default queued commands only move on when pn532Poll or pn532Wait
+// see the IRQ pin go low.  Define this to have them move on from the
+// falling edge interrupt instead, which needs the application to
+// forward the GPIO interrupt for PN532_I2C_IRQPORT to the driver:
+//
+//    void PIOINT3_IRQHandler(void)
+//    {
+//      pn532_bus_IRQHandler();
+//    }
+//
+// Without that handler the interrupt lands in the default handler and
+// the MCU hangs.
+// #define PN532_I2C_IRQHANDLER
+
 #define PN532_NORMAL_FRAME__DATA_MAX_LEN      (254)
 #define PN532_NORMAL_FRAME__OVERHEAD          (8)
 #define PN532_EXTENDED_FRAME__DATA_MAX_LEN    (264)
@@ -29,6 +43,7 @@
 #define PN532_I2C_ADDRESS                     (0x48)
 #define PN532_I2C_READBIT                     (0x01)
 #define PN532_I2C_READYTIMEOUT                (20)    // Max number of attempts to read Ready bit (see UM 5-Nov-2007 Section 6.2.4)
+#define PN532_I2C_QUEUEFRAMELEN               (64)    // Largest frame pn532_bus_QueueCommand can send (commands up to 56 bytes)
 
 // Generic interface for the different serial buses available on the PN532
 void          pn532_bus_HWInit(void);
@@ -36,4 +51,10 @@ pn532_error_t pn532_bus_SendCommand(const byte_t * pbtData, const size_t szData)
 pn532_error_t pn532_bus_ReadResponse(byte_t * pbtResponse, size_t * pszRxLen);
 pn532_error_t pn532_bus_Wakeup(void);
 
+// Queued (non-blocking) commands
+pn532_error_t pn532_bus_QueueCommand(pn532_cmd_t *cmd);
+void          pn532_bus_Poll(void);
+void          pn532_bus_Abort(void);
+void          pn532_bus_IRQHandler(void);
+
 #endif
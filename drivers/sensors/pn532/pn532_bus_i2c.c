@@ -48,6 +48,29 @@ extern volatile uint8_t   I2CMasterBuffer[I2C_BUFSIZE];
 extern volatile uint8_t   I2CSlaveBuffer[I2C_BUFSIZE];
 extern volatile uint32_t  I2CReadLength, I2CWriteLength;
 
+/* Queued commands (see pn532_bus_QueueCommand) */
+typedef enum
+{
+  PN532_QUEUESTAGE_IDLE,
+  PN532_QUEUESTAGE_SEND,          // Writing the command frame
+  PN532_QUEUESTAGE_WAITACK,       // Waiting for IRQ, then the ACK frame
+  PN532_QUEUESTAGE_READACK,
+  PN532_QUEUESTAGE_WAITRESPONSE,  // Waiting for IRQ, then the response
+  PN532_QUEUESTAGE_READRESPONSE,
+  PN532_QUEUESTAGE_ABORT          // Writing an ACK frame to cancel the command
+} pn532_queuestage_t;
+
+static pn532_cmd_t * volatile pn532QueueHead = NULL;
+static pn532_cmd_t *pn532QueueTail = NULL;
+static volatile pn532_queuestage_t pn532QueueStage = PN532_QUEUESTAGE_IDLE;
+static i2cTransfer_t pn532Transfer;
+static byte_t pn532TxBuffer[1 + PN532_I2C_QUEUEFRAMELEN];   // SLA+W and the frame
+static byte_t pn532RxAddress = PN532_I2C_ADDRESS | PN532_I2C_READBIT;
+static byte_t pn532AckBuffer[7];                            // Ready byte and ACK frame
+static const byte_t pn532Ack[6] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+
+static void pn532_bus_i2c_QueueStep(i2cTransfer_t *transfer);
+
 /* ======================================================================
    PRIVATE FUNCTIONS                                                      
    ====================================================================== */
@@ -180,6 +203,175 @@ pn532_error_t pn532_bus_i2c_BuildFrame(byte_t * pbtFrame, size_t * pszFrame, con
   return PN532_ERROR_NONE;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Starts an I2C transfer for the command at the head of the
+            queue.  For a read only 'pbtWrite' is SLA+R and 'szWrite' 0.
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueTransfer(byte_t * pbtWrite, size_t szWrite, byte_t * pbtRead, size_t szRead)
+{
+  pn532Transfer.writeBuffer = pbtWrite;
+  pn532Transfer.writeLength = szWrite;
+  pn532Transfer.readBuffer = pbtRead;
+  pn532Transfer.readLength = szRead;
+  pn532Transfer.timeout = 0;
+  pn532Transfer.callback = pn532_bus_i2c_QueueStep;
+  i2cQueue(&pn532Transfer);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sends the command at the head of the queue, if there is one
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueStart(void)
+{
+  pn532_cmd_t *cmd = pn532QueueHead;
+  size_t szFrame;
+
+  if (cmd == NULL)
+  {
+    pn532GetPCB()->state = PN532_STATE_READY;
+    return;
+  }
+
+  pn532GetPCB()->state = PN532_STATE_BUSY;
+  pn532GetPCB()->lastCommand = cmd->pbtCommand[0];
+
+  pn532TxBuffer[0] = PN532_I2C_ADDRESS;
+  pn532TxBuffer[1] = 0x00;
+  pn532TxBuffer[2] = 0x00;
+  pn532TxBuffer[3] = 0xff;
+  pn532_bus_i2c_BuildFrame(pn532TxBuffer + 1, &szFrame, cmd->pbtCommand, cmd->szCommand);
+
+  pn532QueueStage = PN532_QUEUESTAGE_SEND;
+  pn532_bus_i2c_QueueTransfer(pn532TxBuffer, szFrame + 1, NULL, 0);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Finishes the command at the head of the queue, runs its
+            callback and sends the next one
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueFinish(pn532_error_t error)
+{
+  pn532_cmd_t *cmd = pn532QueueHead;
+
+  gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+
+  pn532QueueHead = cmd->next;
+  if (pn532QueueHead == NULL)
+  {
+    pn532QueueTail = NULL;
+    pn532GetPCB()->state = PN532_STATE_READY;
+  }
+  pn532QueueStage = PN532_QUEUESTAGE_IDLE;
+
+  cmd->next = NULL;
+  cmd->error = error;
+  cmd->done = TRUE;
+  if (cmd->callback)
+  {
+    cmd->callback(cmd);
+  }
+
+  // The callback may already have started a new command
+  if (pn532QueueStage == PN532_QUEUESTAGE_IDLE)
+  {
+    pn532_bus_i2c_QueueStart();
+  }
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Called once the PN532 pulls IRQ low: reads the ACK frame or
+            the response, depending on what we are waiting for
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueReady(void)
+{
+  pn532_cmd_t *cmd;
+
+  __disable_irq();
+  if (pn532QueueStage == PN532_QUEUESTAGE_WAITACK)
+  {
+    pn532QueueStage = PN532_QUEUESTAGE_READACK;
+    gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+    pn532_bus_i2c_QueueTransfer(&pn532RxAddress, 0, pn532AckBuffer, sizeof(pn532AckBuffer));
+  }
+  else if (pn532QueueStage == PN532_QUEUESTAGE_WAITRESPONSE)
+  {
+    // Read straight into the caller's buffer (the ready byte goes first)
+    cmd = pn532QueueHead;
+    pn532QueueStage = PN532_QUEUESTAGE_READRESPONSE;
+    gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+    pn532_bus_i2c_QueueTransfer(&pn532RxAddress, 0, cmd->pbtResponse, cmd->szResponse);
+  }
+  __enable_irq();
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Waits for IRQ to go low, which may already have happened
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueWait(pn532_queuestage_t stage)
+{
+  pn532QueueStage = stage;
+  #ifdef PN532_I2C_IRQHANDLER
+  gpioIntClear(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+  gpioIntEnable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+  #endif
+  if (!gpioGetValue(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN))
+  {
+    pn532_bus_i2c_QueueReady();
+  }
+}
+
+/**************************************************************************/
+/*! 
+    @brief  I2C completion callback, moves the queued command along
+*/
+/**************************************************************************/
+static void pn532_bus_i2c_QueueStep(i2cTransfer_t *transfer)
+{
+  pn532_cmd_t *cmd = pn532QueueHead;
+  pn532_error_t error;
+
+  if (transfer->state != I2CSTATE_ACK)
+  {
+    pn532_bus_i2c_QueueFinish(pn532QueueStage == PN532_QUEUESTAGE_ABORT ? PN532_ERROR_ABORTED : PN532_ERROR_I2C_NACK);
+    return;
+  }
+
+  switch (pn532QueueStage)
+  {
+    case PN532_QUEUESTAGE_SEND:
+      pn532_bus_i2c_QueueWait(PN532_QUEUESTAGE_WAITACK);
+      break;
+    case PN532_QUEUESTAGE_READACK:
+      if (0 != memcmp(pn532AckBuffer + 1, pn532Ack, sizeof(pn532Ack)))
+      {
+        pn532_bus_i2c_QueueFinish(PN532_ERROR_INVALIDACK);
+        break;
+      }
+      pn532_bus_i2c_QueueWait(PN532_QUEUESTAGE_WAITRESPONSE);
+      break;
+    case PN532_QUEUESTAGE_READRESPONSE:
+      cmd->szData = 0;
+      error = pn532ParseResponse(cmd->pbtResponse + 1, cmd->szResponse - 1, &cmd->pbtData, &cmd->szData);
+      pn532_bus_i2c_QueueFinish(error);
+      break;
+    case PN532_QUEUESTAGE_ABORT:
+      pn532_bus_i2c_QueueFinish(PN532_ERROR_ABORTED);
+      break;
+    default:
+      break;
+  }
+}
+
 /* ======================================================================
    PUBLIC FUNCTIONS                                                      
    ====================================================================== */
@@ -198,6 +390,12 @@ void pn532_bus_HWInit(void)
 
   // Set IRQ pin to input
   gpioSetDir(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN, gpioDirection_Input);
+  #ifdef PN532_I2C_IRQHANDLER
+  // Falling edge = response ready, only enabled while a queued command waits
+  gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+  gpioSetInterrupt(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN, gpioInterruptSense_Edge, gpioInterruptEdge_Single, gpioInterruptEvent_ActiveLow);
+  gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+  #endif
 
   // Set reset pin as output and reset device
   gpioSetDir(PN532_RSTPD_PORT, PN532_RSTPD_PIN, gpioDirection_Output);
@@ -487,4 +685,107 @@ pn532_error_t pn532_bus_Wakeup(void)
   return error;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Queues a command, see pn532Queue.  Every step after the
+            first I2C write is started from the I2C or GPIO interrupt.
+
+    @note   Possible error messages are:
+
+            - PN532_ERROR_EXTENDEDFRAME       // Command too long for the queue
+            - PN532_ERROR_BUSY                // Descriptor already queued, or a
+                                              // blocking command is running
+*/
+/**************************************************************************/
+pn532_error_t pn532_bus_QueueCommand(pn532_cmd_t *cmd)
+{
+  if ((cmd->szCommand == 0) || (cmd->szCommand + PN532_NORMAL_FRAME__OVERHEAD > PN532_I2C_QUEUEFRAMELEN))
+  {
+    return PN532_ERROR_EXTENDEDFRAME;
+  }
+
+  __disable_irq();
+  if ((pn532QueueHead == NULL) && (pn532GetPCB()->state == PN532_STATE_BUSY))
+  {
+    // pn532_bus_SendCommand or pn532_bus_ReadResponse in progress
+    __enable_irq();
+    return PN532_ERROR_BUSY;
+  }
+  if ((cmd == pn532QueueHead) || (cmd->next != NULL) || (cmd == pn532QueueTail))
+  {
+    __enable_irq();
+    return PN532_ERROR_BUSY;
+  }
+
+  cmd->done = FALSE;
+  cmd->error = PN532_ERROR_NONE;
+  cmd->pbtData = NULL;
+  cmd->szData = 0;
+  cmd->next = NULL;
+  if (pn532QueueTail == NULL)
+  {
+    pn532QueueHead = pn532QueueTail = cmd;
+    pn532_bus_i2c_QueueStart();
+  }
+  else
+  {
+    pn532QueueTail->next = cmd;
+    pn532QueueTail = cmd;
+  }
+  __enable_irq();
+
+  return PN532_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Checks the IRQ pin for a queued command that is waiting for
+            the PN532 (in case the GPIO interrupt isn't used)
+*/
+/**************************************************************************/
+void pn532_bus_Poll(void)
+{
+  if (((pn532QueueStage == PN532_QUEUESTAGE_WAITACK) || (pn532QueueStage == PN532_QUEUESTAGE_WAITRESPONSE)) &&
+      !gpioGetValue(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN))
+  {
+    pn532_bus_i2c_QueueReady();
+  }
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Cancels the queued command the PN532 is working on by
+            sending it an ACK frame (UM0701-02 section 6.2.1.3)
+*/
+/**************************************************************************/
+void pn532_bus_Abort(void)
+{
+  __disable_irq();
+  if (pn532QueueStage == PN532_QUEUESTAGE_WAITRESPONSE)
+  {
+    gpioIntDisable(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+    pn532QueueStage = PN532_QUEUESTAGE_ABORT;
+    pn532TxBuffer[0] = PN532_I2C_ADDRESS;
+    memcpy(pn532TxBuffer + 1, pn532Ack, sizeof(pn532Ack));
+    pn532_bus_i2c_QueueTransfer(pn532TxBuffer, sizeof(pn532Ack) + 1, NULL, 0);
+  }
+  __enable_irq();
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Call this from the GPIO interrupt handler for
+            PN532_I2C_IRQPORT (PIOINT3_IRQHandler), see
+            PN532_I2C_IRQHANDLER in pn532_bus.h
+*/
+/**************************************************************************/
+void pn532_bus_IRQHandler(void)
+{
+  if (gpioIntStatus(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN))
+  {
+    gpioIntClear(PN532_I2C_IRQPORT, PN532_I2C_IRQPIN);
+    pn532_bus_i2c_QueueReady();
+  }
+}
+
 #endif  // #ifdef PN532_BUS_I2C
\ No newline at end of file
@@ -295,4 +295,79 @@ pn532_error_t pn532_bus_Wakeup(void)
   return PN532_ERROR_NONE;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Runs a command for pn532Queue.  The UART has no ready signal
+            to wait for in the background, so the command is sent and
+            its response collected before this returns.
+*/
+/**************************************************************************/
+pn532_error_t pn532_bus_QueueCommand(pn532_cmd_t *cmd)
+{
+  pn532_pcb_t *pn532 = pn532GetPCB();
+  uart_pcb_t *uart = uartGetPCB();
+  size_t szLen = 0;
+  pn532_error_t error;
+
+  cmd->done = FALSE;
+  cmd->pbtData = NULL;
+  cmd->szData = 0;
+  cmd->next = NULL;
+
+  error = pn532_bus_SendCommand(cmd->pbtCommand, cmd->szCommand);
+  if (!error)
+  {
+    // Collect the response until the whole frame is there
+    pn532->state = PN532_STATE_BUSY;
+    error = PN532_ERROR_RESPONSEBUFFEREMPTY;
+    while (error == PN532_ERROR_RESPONSEBUFFEREMPTY)
+    {
+      while (uart->rxfifo.len && (szLen < cmd->szResponse))
+      {
+        cmd->pbtResponse[szLen++] = uartRxBufferRead();
+      }
+      if ((szLen >= 6) && ((szLen >= (size_t)cmd->pbtResponse[3] + 7) || (szLen == cmd->szResponse)))
+      {
+        error = pn532ParseResponse(cmd->pbtResponse, szLen, &cmd->pbtData, &cmd->szData);
+      }
+    }
+    pn532->state = PN532_STATE_READY;
+  }
+
+  cmd->error = error;
+  cmd->done = TRUE;
+  if (cmd->callback)
+  {
+    cmd->callback(cmd);
+  }
+  return PN532_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Nothing to do on UART, queued commands complete straight away
+*/
+/**************************************************************************/
+void pn532_bus_Poll(void)
+{
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Nothing to do on UART, queued commands complete straight away
+*/
+/**************************************************************************/
+void pn532_bus_Abort(void)
+{
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Nothing to do on UART, there is no IRQ line
+*/
+/**************************************************************************/
+void pn532_bus_IRQHandler(void)
+{
+}
+
 #endif  // #ifdef PN532_BUS_UART
\ No newline at end of file
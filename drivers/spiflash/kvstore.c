@@ -0,0 +1,1025 @@
+/**************************************************************************/
+/*!
+    @file     kvstore.c
+
+    @section DESCRIPTION
+
+    Log-structured key/value store on the SPI flash
+
+    Values (up to 255 bytes, keyed by a 16-bit number) are appended to
+    the 'head' sector of a range of CFG_KVSTORE_SECTORS erase sectors
+    starting at CFG_KVSTORE_FIRSTSECTOR, so saving a value only costs
+    a page program rather than an erase.  A RAM index holds the
+    location of the newest record for each key.
+
+    Sector layout:
+
+    @code
+    0x000  Header: magic, erase count, sequence number, ~sequence number
+    0x010  Records: key (16), length (8), type (8), CRC-16 (16), data
+    ...
+    0xF00  Summary: magic (16), count (16), then one entry per record
+           (key, offset | KVSTORE_DELETED for deletions)
+    @endcode
+
+    Erased sectors get their header (with the erase count carried
+    over) straight away, and the sequence number is only programmed
+    when the sector is allocated.  A full sector is sealed by writing
+    its summary, so at boot only the head sector needs to be walked
+    record by record.  Sectors are replayed in sequence order so that
+    newer records replace older ones.
+
+    Space is reclaimed by copying the live records out of the sector
+    with the most stale ones and erasing it.  kvstoreCompact does this
+    in the background; kvstorePut only does it itself when the last
+    spare sector would otherwise be used.  New sectors are taken from
+    the free sector with the lowest erase count, and sectors holding
+    static data are moved once the erase counts drift too far apart.
+
+    Records are checked with a CRC, so a record torn by a power loss is
+    ignored and the rest of its sector is left unused.
+
+    @section Example
+
+    @code
+    #include "drivers/spiflash/kvstore.h"
+
+    uint32_t count, len;
+
+    kvstoreInit();
+    if (kvstoreGet(0x0100, (uint8_t *)&count, sizeof(count), &len))
+    {
+      count = 0;
+    }
+    count++;
+    kvstorePut(0x0100, (uint8_t *)&count, sizeof(count));
+    ...
+    // From the main loop
+    kvstoreCompact();
+    @endcode
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <stddef.h>
+#include <string.h>
+
+#include "kvstore.h"
+
+#ifdef CFG_KVSTORE
+
+#include "spiflash.h"
+
+#define KVSTORE_SUMMARYOFFSET   (KVSTORE_SECTORSIZE - KVSTORE_SUMMARYSIZE)
+#define KVSTORE_FREE            (0xFFFFFFFF)  // Sequence number of a sector that isn't allocated
+#define KVSTORE_UNUSABLE        (0)           // Sequence number of a sector that couldn't be prepared
+#define KVSTORE_NOSECTOR        (0xFF)        // No head sector
+#define KVSTORE_DELETED         (0x8000)      // Set in an entry offset for a deletion
+#define KVSTORE_CHUNKSIZE       (32)          // Bytes read at a time when checking or copying data
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t eraseCount;
+  uint32_t seq;                         // Allocation order (KVSTORE_FREE until allocated)
+  uint32_t seqCheck;                    // ~seq, so that a torn allocation can be detected
+}
+kvstoreSectorHeader_t;
+
+typedef struct
+{
+  uint16_t key;
+  uint8_t  len;
+  uint8_t  type;
+  uint16_t crc;                         // CRC-16 of key, len, type and data
+}
+kvstoreRecord_t;
+
+typedef struct
+{
+  uint16_t key;
+  uint16_t offset;                      // Record offset in the sector (| KVSTORE_DELETED)
+}
+kvstoreEntry_t;
+
+typedef struct
+{
+  uint16_t key;
+  uint16_t offset;                      // Record offset in the sector (| KVSTORE_DELETED)
+  uint8_t  sector;
+}
+kvstoreIndex_t;
+
+static kvstoreIndex_t kvstoreIndex[CFG_KVSTORE_MAXKEYS];
+static uint32_t kvstoreKeys = 0;
+static uint32_t kvstoreSeq[CFG_KVSTORE_SECTORS];
+static uint32_t kvstoreErase[CFG_KVSTORE_SECTORS];
+static uint8_t  kvstoreRecords[CFG_KVSTORE_SECTORS];
+static uint8_t  kvstoreHead = KVSTORE_NOSECTOR;
+static uint16_t kvstoreHeadOffset = 0;
+static uint32_t kvstoreNextSeq = 1;
+static bool     kvstoreOverflow = false;
+static bool     kvstoreWearPending = false;
+static bool     kvstoreInitialised = false;
+
+static kvstoreError_e kvstoreCompactSector(uint8_t victim);
+
+/**************************************************************************/
+/*!
+    @brief  Returns the flash address of an offset in one of our sectors
+*/
+/**************************************************************************/
+static uint32_t kvstoreAddress(uint8_t sector, uint32_t offset)
+{
+  return (CFG_KVSTORE_FIRSTSECTOR + sector) * KVSTORE_SECTORSIZE + offset;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds len bytes to a CRC-16 (CCITT polynomial)
+*/
+/**************************************************************************/
+static uint16_t kvstoreCRC(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  while (len--)
+  {
+    crc ^= (uint16_t)*data++ << 8;
+    for (i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads back the data of a record and checks it against the
+            CRC in its header
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreCheckRecord(uint8_t sector, uint32_t offset, const kvstoreRecord_t *rec)
+{
+  uint8_t chunk[KVSTORE_CHUNKSIZE];
+  uint32_t pos, n;
+  uint16_t crc;
+
+  crc = kvstoreCRC(0xFFFF, (const uint8_t *)rec, 4);
+  for (pos = 0; pos < rec->len; pos += n)
+  {
+    n = rec->len - pos;
+    if (n > sizeof(chunk)) n = sizeof(chunk);
+    if (spiflashReadBuffer(kvstoreAddress(sector, offset + KVSTORE_RECORDSIZE + pos), chunk, n))
+    {
+      return KVSTORE_ERROR_FLASH;
+    }
+    crc = kvstoreCRC(crc, chunk, n);
+  }
+
+  return crc == rec->crc ? KVSTORE_ERROR_OK : KVSTORE_ERROR_CRC;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the index slot for a key, or -1 if it isn't there
+*/
+/**************************************************************************/
+static int32_t kvstoreFind(uint16_t key)
+{
+  uint32_t i;
+
+  for (i = 0; i < kvstoreKeys; i++)
+  {
+    if (kvstoreIndex[i].key == key) return i;
+  }
+
+  return -1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Points the index entry for a key at a record
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreIndexSet(uint16_t key, uint8_t sector, uint16_t offset)
+{
+  int32_t i = kvstoreFind(key);
+
+  if (i < 0)
+  {
+    if (kvstoreKeys == CFG_KVSTORE_MAXKEYS) return KVSTORE_ERROR_FULL;
+    i = kvstoreKeys++;
+    kvstoreIndex[i].key = key;
+  }
+  kvstoreIndex[i].sector = sector;
+  kvstoreIndex[i].offset = offset;
+
+  return KVSTORE_ERROR_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of live records (including deletions that
+            still hide older records) in a sector
+*/
+/**************************************************************************/
+static uint32_t kvstoreLive(uint8_t sector)
+{
+  uint32_t i, live = 0;
+
+  for (i = 0; i < kvstoreKeys; i++)
+  {
+    if (kvstoreIndex[i].sector == sector) live++;
+  }
+
+  return live;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of erased sectors waiting to be allocated
+*/
+/**************************************************************************/
+uint32_t kvstoreGetFreeSectors(void)
+{
+  uint32_t s, free = 0;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if (kvstoreSeq[s] == KVSTORE_FREE) free++;
+  }
+
+  return free;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Erases a sector and writes its header, leaving it free
+*/
+/**************************************************************************/
+static kvstoreError_e kvstorePrepare(uint8_t sector, uint32_t eraseCount)
+{
+  kvstoreSectorHeader_t header;
+
+  kvstoreSeq[sector] = KVSTORE_UNUSABLE;
+  kvstoreErase[sector] = eraseCount;
+  kvstoreRecords[sector] = 0;
+
+  if (spiflashEraseSector(CFG_KVSTORE_FIRSTSECTOR + sector))
+  {
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  header.magic = KVSTORE_MAGIC;
+  header.eraseCount = eraseCount;
+  header.seq = KVSTORE_FREE;
+  header.seqCheck = 0xFFFFFFFF;
+  if (spiflashWrite(kvstoreAddress(sector, 0), (uint8_t *)&header, sizeof(header)))
+  {
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  kvstoreSeq[sector] = KVSTORE_FREE;
+  return KVSTORE_ERROR_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Walks the records of a sector that has no summary, checking
+            each one, and either adds them to the index or (if summarise
+            is true) seals the sector by writing its summary
+
+    @return The offset after the last intact record, or
+            KVSTORE_SUMMARYOFFSET if a damaged record was found (nothing
+            more may be appended to the sector)
+*/
+/**************************************************************************/
+static uint16_t kvstoreScan(uint8_t sector, bool summarise)
+{
+  static const uint8_t erased[KVSTORE_RECORDSIZE] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  kvstoreEntry_t entries[16];
+  kvstoreRecord_t rec;
+  uint16_t summary[2];
+  uint32_t offset = KVSTORE_HEADERSIZE;
+  uint32_t count = 0, first = 0, n = 0;
+  bool damaged = false;
+
+  while ((count < KVSTORE_MAXRECORDS) && (offset + KVSTORE_RECORDSIZE <= KVSTORE_SUMMARYOFFSET))
+  {
+    if (spiflashReadBuffer(kvstoreAddress(sector, offset), (uint8_t *)&rec, KVSTORE_RECORDSIZE))
+    {
+      damaged = true;
+      break;
+    }
+    if (!memcmp(&rec, erased, KVSTORE_RECORDSIZE))
+    {
+      break;                            // End of the log
+    }
+    if (((rec.type != KVSTORE_RECORD_VALUE) && (rec.type != KVSTORE_RECORD_DELETE)) ||
+        (rec.key == 0xFFFF) ||
+        (offset + KVSTORE_RECORDSIZE + rec.len > KVSTORE_SUMMARYOFFSET) ||
+        kvstoreCheckRecord(sector, offset, &rec))
+    {
+      damaged = true;                   // Torn write
+      break;
+    }
+
+    if (summarise)
+    {
+      entries[n].key = rec.key;
+      entries[n].offset = offset | (rec.type == KVSTORE_RECORD_DELETE ? KVSTORE_DELETED : 0);
+      if (++n == sizeof(entries) / sizeof(entries[0]))
+      {
+        spiflashWrite(kvstoreAddress(sector, KVSTORE_SUMMARYOFFSET + 4 + first * 4), (uint8_t *)entries, n * 4);
+        first += n;
+        n = 0;
+      }
+    }
+    else if (kvstoreIndexSet(rec.key, sector, offset | (rec.type == KVSTORE_RECORD_DELETE ? KVSTORE_DELETED : 0)))
+    {
+      kvstoreOverflow = true;
+    }
+
+    offset += KVSTORE_RECORDSIZE + rec.len;
+    count++;
+  }
+
+  if (summarise)
+  {
+    // Entries first, then the summary header that makes them valid
+    if (n)
+    {
+      spiflashWrite(kvstoreAddress(sector, KVSTORE_SUMMARYOFFSET + 4 + first * 4), (uint8_t *)entries, n * 4);
+    }
+    summary[0] = KVSTORE_SUMMARYMAGIC;
+    summary[1] = count;
+    spiflashWrite(kvstoreAddress(sector, KVSTORE_SUMMARYOFFSET), (uint8_t *)summary, sizeof(summary));
+  }
+
+  kvstoreRecords[sector] = count;
+  return damaged ? KVSTORE_SUMMARYOFFSET : offset;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds the records of a sealed sector to the index from its
+            summary
+
+    @return False if the sector has no (valid) summary
+*/
+/**************************************************************************/
+static bool kvstoreLoadSummary(uint8_t sector)
+{
+  kvstoreEntry_t entries[16];
+  uint16_t summary[2];
+  uint32_t i, n, pos;
+
+  if (spiflashReadBuffer(kvstoreAddress(sector, KVSTORE_SUMMARYOFFSET), (uint8_t *)summary, sizeof(summary)) ||
+      (summary[0] != KVSTORE_SUMMARYMAGIC) || (summary[1] > KVSTORE_MAXRECORDS))
+  {
+    return false;
+  }
+
+  for (pos = 0; pos < summary[1]; pos += n)
+  {
+    n = summary[1] - pos;
+    if (n > sizeof(entries) / sizeof(entries[0])) n = sizeof(entries) / sizeof(entries[0]);
+    if (spiflashReadBuffer(kvstoreAddress(sector, KVSTORE_SUMMARYOFFSET + 4 + pos * 4), (uint8_t *)entries, n * 4))
+    {
+      return false;
+    }
+    for (i = 0; i < n; i++)
+    {
+      if (kvstoreIndexSet(entries[i].key, sector, entries[i].offset)) kvstoreOverflow = true;
+    }
+  }
+
+  kvstoreRecords[sector] = summary[1];
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Seals the head sector (if any) and allocates the free sector
+            with the lowest erase count as the new head
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreNextSector(void)
+{
+  uint32_t s, seq[2];
+  uint8_t best = KVSTORE_NOSECTOR;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if ((kvstoreSeq[s] == KVSTORE_FREE) &&
+        ((best == KVSTORE_NOSECTOR) || (kvstoreErase[s] < kvstoreErase[best])))
+    {
+      best = s;
+    }
+  }
+  if (best == KVSTORE_NOSECTOR)
+  {
+    return KVSTORE_ERROR_FULL;
+  }
+
+  if (kvstoreHead != KVSTORE_NOSECTOR)
+  {
+    kvstoreScan(kvstoreHead, true);
+    kvstoreHead = KVSTORE_NOSECTOR;
+  }
+
+  seq[0] = kvstoreNextSeq;
+  seq[1] = ~kvstoreNextSeq;
+  if (spiflashWrite(kvstoreAddress(best, offsetof(kvstoreSectorHeader_t, seq)), (uint8_t *)seq, sizeof(seq)))
+  {
+    kvstoreSeq[best] = KVSTORE_UNUSABLE;
+    return KVSTORE_ERROR_FLASH;
+  }
+  kvstoreSeq[best] = kvstoreNextSeq++;
+  kvstoreRecords[best] = 0;
+  kvstoreHead = best;
+  kvstoreHeadOffset = KVSTORE_HEADERSIZE;
+  kvstoreWearPending = true;
+
+  return KVSTORE_ERROR_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of bytes the live records of a sector
+            would take up if copied
+*/
+/**************************************************************************/
+static uint32_t kvstoreLiveBytes(uint8_t sector)
+{
+  kvstoreRecord_t rec;
+  uint32_t i, bytes = 0;
+
+  for (i = 0; i < kvstoreKeys; i++)
+  {
+    if (kvstoreIndex[i].sector != sector) continue;
+    bytes += KVSTORE_RECORDSIZE + KVSTORE_MAXVALUESIZE;
+    if (!spiflashReadBuffer(kvstoreAddress(sector, kvstoreIndex[i].offset & ~KVSTORE_DELETED), (uint8_t *)&rec, KVSTORE_RECORDSIZE))
+    {
+      bytes -= KVSTORE_MAXVALUESIZE - rec.len;
+    }
+  }
+
+  return bytes;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the sealed sector with the most stale records (the
+            oldest if several have as many), or -1 if none have any
+
+    A sector with no live records at all is always picked first.  If no
+    sector has stale records, a sector that was sealed early by a torn
+    write is picked if its live records fit in half a sector.
+*/
+/**************************************************************************/
+static int32_t kvstorePickVictim(void)
+{
+  uint32_t s, live, stale, bytes, mostStale = 0, fewestBytes = 0;
+  int32_t victim = -1, sparse = -1;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if ((kvstoreSeq[s] == KVSTORE_FREE) || (kvstoreSeq[s] == KVSTORE_UNUSABLE) || (s == kvstoreHead))
+    {
+      continue;
+    }
+    live = kvstoreLive(s);
+    stale = live ? kvstoreRecords[s] - live : KVSTORE_MAXRECORDS + 1;   // Nothing to copy
+    if ((stale > mostStale) || (stale && (stale == mostStale) && (kvstoreSeq[s] < kvstoreSeq[victim])))
+    {
+      mostStale = stale;
+      victim = s;
+    }
+    if (!stale && (live <= KVSTORE_MAXRECORDS / 2))
+    {
+      bytes = kvstoreLiveBytes(s);
+      if ((bytes <= (KVSTORE_SUMMARYOFFSET - KVSTORE_HEADERSIZE) / 2) && ((sparse < 0) || (bytes < fewestBytes)))
+      {
+        fewestBytes = bytes;
+        sparse = s;
+      }
+    }
+  }
+
+  return victim >= 0 ? victim : sparse;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the sealed sector with the lowest erase count if it
+            is at least KVSTORE_WEARSPREAD erases behind the most worn
+            sector, or -1
+*/
+/**************************************************************************/
+static int32_t kvstoreWearVictim(void)
+{
+  uint32_t s, mostWorn = 0;
+  int32_t victim = -1;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if (kvstoreErase[s] > mostWorn) mostWorn = kvstoreErase[s];
+    if ((kvstoreSeq[s] == KVSTORE_FREE) || (kvstoreSeq[s] == KVSTORE_UNUSABLE) || (s == kvstoreHead))
+    {
+      continue;
+    }
+    if ((victim < 0) || (kvstoreErase[s] < kvstoreErase[victim]))
+    {
+      victim = s;
+    }
+  }
+
+  return ((victim >= 0) && (mostWorn - kvstoreErase[victim] >= KVSTORE_WEARSPREAD)) ? victim : -1;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Makes sure the head sector has room for a record with len
+            bytes of data, compacting first if that would use the last
+            free sector (unless called from compaction)
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreReserve(uint32_t len, bool compacting)
+{
+  kvstoreError_e error;
+  int32_t victim;
+  uint32_t tries;
+
+  for (tries = 0; tries <= CFG_KVSTORE_SECTORS; tries++)
+  {
+    if ((kvstoreHead != KVSTORE_NOSECTOR) &&
+        (kvstoreRecords[kvstoreHead] < KVSTORE_MAXRECORDS) &&
+        (kvstoreHeadOffset + KVSTORE_RECORDSIZE + len <= KVSTORE_SUMMARYOFFSET))
+    {
+      return KVSTORE_ERROR_OK;
+    }
+
+    // Keep one free sector back so compaction always has somewhere to copy to
+    if (compacting || (kvstoreGetFreeSectors() >= 2))
+    {
+      return kvstoreNextSector();
+    }
+
+    victim = kvstorePickVictim();
+    if (victim < 0)
+    {
+      return KVSTORE_ERROR_FULL;
+    }
+    error = kvstoreCompactSector(victim);
+    if (error)
+    {
+      return error;
+    }
+  }
+
+  return KVSTORE_ERROR_FULL;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reserves room for a record in the head sector and writes its
+            header
+
+    @param[out] *offset
+                The offset of the record in the head sector.  The data
+                must be written straight after the header.
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreWriteHeader(const kvstoreRecord_t *rec, bool compacting, uint16_t *offset)
+{
+  kvstoreError_e error;
+
+  error = kvstoreReserve(rec->len, compacting);
+  if (error)
+  {
+    return error;
+  }
+
+  *offset = kvstoreHeadOffset;
+  kvstoreHeadOffset += KVSTORE_RECORDSIZE + rec->len;
+  kvstoreRecords[kvstoreHead]++;
+
+  if (spiflashWrite(kvstoreAddress(kvstoreHead, *offset), (uint8_t *)rec, KVSTORE_RECORDSIZE))
+  {
+    kvstoreHeadOffset = KVSTORE_SUMMARYOFFSET;    // Seal it with the next write
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  return KVSTORE_ERROR_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Copies the live records out of a sector and erases it
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreCompactSector(uint8_t victim)
+{
+  uint8_t chunk[KVSTORE_CHUNKSIZE];
+  kvstoreRecord_t rec;
+  kvstoreError_e error;
+  uint32_t i, s, pos, n;
+  uint16_t from, to;
+  bool oldest = true;
+
+  // Deletions only need to be kept while an older sector might still
+  // hold a value for the key
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if ((kvstoreSeq[s] != KVSTORE_FREE) && (kvstoreSeq[s] != KVSTORE_UNUSABLE) && (kvstoreSeq[s] < kvstoreSeq[victim]))
+    {
+      oldest = false;
+    }
+  }
+
+  i = 0;
+  while (i < kvstoreKeys)
+  {
+    if (kvstoreIndex[i].sector != victim)
+    {
+      i++;
+      continue;
+    }
+    if ((kvstoreIndex[i].offset & KVSTORE_DELETED) && oldest)
+    {
+      kvstoreIndex[i] = kvstoreIndex[--kvstoreKeys];
+      continue;
+    }
+
+    from = kvstoreIndex[i].offset & ~KVSTORE_DELETED;
+    if (spiflashReadBuffer(kvstoreAddress(victim, from), (uint8_t *)&rec, KVSTORE_RECORDSIZE))
+    {
+      return KVSTORE_ERROR_FLASH;
+    }
+    error = kvstoreWriteHeader(&rec, true, &to);
+    if (error)
+    {
+      return error;
+    }
+    for (pos = 0; pos < rec.len; pos += n)
+    {
+      n = rec.len - pos;
+      if (n > sizeof(chunk)) n = sizeof(chunk);
+      if (spiflashReadBuffer(kvstoreAddress(victim, from + KVSTORE_RECORDSIZE + pos), chunk, n) ||
+          spiflashWrite(kvstoreAddress(kvstoreHead, to + KVSTORE_RECORDSIZE + pos), chunk, n))
+      {
+        kvstoreHeadOffset = KVSTORE_SUMMARYOFFSET;
+        return KVSTORE_ERROR_FLASH;
+      }
+    }
+    kvstoreIndex[i].sector = kvstoreHead;
+    kvstoreIndex[i].offset = to | (kvstoreIndex[i].offset & KVSTORE_DELETED);
+    i++;
+  }
+
+  return kvstorePrepare(victim, kvstoreErase[victim] + 1);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Appends a record to the head sector and points the index at
+            it
+*/
+/**************************************************************************/
+static kvstoreError_e kvstoreAppend(uint16_t key, uint8_t type, const uint8_t *data, uint32_t len)
+{
+  kvstoreRecord_t rec;
+  kvstoreError_e error;
+  uint16_t offset;
+
+  rec.key = key;
+  rec.len = len;
+  rec.type = type;
+  rec.crc = kvstoreCRC(kvstoreCRC(0xFFFF, (const uint8_t *)&rec, 4), data, len);
+
+  error = kvstoreWriteHeader(&rec, false, &offset);
+  if (error)
+  {
+    return error;
+  }
+  if (len && spiflashWrite(kvstoreAddress(kvstoreHead, offset + KVSTORE_RECORDSIZE), (uint8_t *)data, len))
+  {
+    kvstoreHeadOffset = KVSTORE_SUMMARYOFFSET;
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  return kvstoreIndexSet(key, kvstoreHead, offset | (type == KVSTORE_RECORD_DELETE ? KVSTORE_DELETED : 0));
+}
+
+/**************************************************************************/
+/*!
+    @brief  Checks the store's sectors and rebuilds the RAM index
+
+    Sectors that don't have a valid header (the first time the store is
+    used, or after an erase or allocation was interrupted) are erased.
+
+    @return KVSTORE_ERROR_FULL if more than CFG_KVSTORE_MAXKEYS keys are
+            stored (the store can still be used, but some keys will be
+            missing), KVSTORE_ERROR_FLASH if the flash doesn't match
+            KVSTORE_SECTORSIZE or the store's range
+*/
+/**************************************************************************/
+kvstoreError_e kvstoreInit (void)
+{
+  kvstoreSectorHeader_t header;
+  spiflashSizeInfo_t size;
+  uint32_t s, last;
+  int32_t next;
+
+  size = spiflashGetSizeInfo();
+  if ((size.sectorSize != KVSTORE_SECTORSIZE) ||
+      (CFG_KVSTORE_FIRSTSECTOR + CFG_KVSTORE_SECTORS > size.sectorCount))
+  {
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  kvstoreKeys = 0;
+  kvstoreHead = KVSTORE_NOSECTOR;
+  kvstoreNextSeq = 1;
+  kvstoreOverflow = false;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if (spiflashReadBuffer(kvstoreAddress(s, 0), (uint8_t *)&header, sizeof(header)) ||
+        (header.magic != KVSTORE_MAGIC))
+    {
+      kvstorePrepare(s, 0);
+      continue;
+    }
+    if ((header.seq == KVSTORE_FREE) ? (header.seqCheck != 0xFFFFFFFF) : (header.seqCheck != ~header.seq))
+    {
+      // Allocation was interrupted, so no records were written yet
+      kvstorePrepare(s, header.eraseCount + 1);
+      continue;
+    }
+    kvstoreSeq[s] = header.seq;
+    kvstoreErase[s] = header.eraseCount;
+    kvstoreRecords[s] = 0;
+    if ((header.seq != KVSTORE_FREE) && (header.seq >= kvstoreNextSeq))
+    {
+      kvstoreNextSeq = header.seq + 1;
+    }
+  }
+
+  // Replay the allocated sectors oldest first, so newer records
+  // replace older ones.  Only the newest can be unsealed.
+  last = KVSTORE_UNUSABLE;
+  for (;;)
+  {
+    next = -1;
+    for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+    {
+      if ((kvstoreSeq[s] != KVSTORE_FREE) && (kvstoreSeq[s] > last) &&
+          ((next < 0) || (kvstoreSeq[s] < kvstoreSeq[next])))
+      {
+        next = s;
+      }
+    }
+    if (next < 0) break;
+    last = kvstoreSeq[next];
+
+    if (kvstoreLoadSummary(next))
+    {
+      kvstoreHead = KVSTORE_NOSECTOR;
+    }
+    else
+    {
+      kvstoreHead = next;
+      kvstoreHeadOffset = kvstoreScan(next, false);
+    }
+  }
+
+  kvstoreWearPending = false;
+  kvstoreInitialised = true;
+
+  return kvstoreOverflow ? KVSTORE_ERROR_FULL : KVSTORE_ERROR_OK;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Erases every sector of the store (keeping the erase counts)
+*/
+/**************************************************************************/
+kvstoreError_e kvstoreFormat (void)
+{
+  kvstoreSectorHeader_t header;
+  kvstoreError_e error = KVSTORE_ERROR_OK;
+  uint32_t s;
+
+  for (s = 0; s < CFG_KVSTORE_SECTORS; s++)
+  {
+    if (spiflashReadBuffer(kvstoreAddress(s, 0), (uint8_t *)&header, sizeof(header)) ||
+        (header.magic != KVSTORE_MAGIC))
+    {
+      header.eraseCount = 0;
+    }
+    else
+    {
+      header.eraseCount++;
+    }
+    if (kvstorePrepare(s, header.eraseCount))
+    {
+      error = KVSTORE_ERROR_FLASH;
+    }
+  }
+
+  kvstoreKeys = 0;
+  kvstoreHead = KVSTORE_NOSECTOR;
+  kvstoreNextSeq = 1;
+  kvstoreWearPending = false;
+  kvstoreInitialised = true;
+
+  return error;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads the value stored for a key
+
+    @param[in]  key
+                The key (0x0000..0xFFFE)
+    @param[out] *buffer
+                Buffer to store the value in
+    @param[in]  size
+                Size of the buffer
+    @param[out] *len
+                Set to the length of the value (even if the buffer is
+                too small), may be 0
+*/
+/**************************************************************************/
+kvstoreError_e kvstoreGet (uint16_t key, uint8_t *buffer, uint32_t size, uint32_t *len)
+{
+  kvstoreRecord_t rec;
+  uint16_t offset;
+  int32_t i;
+
+  if (!kvstoreInitialised) return KVSTORE_ERROR_NOTINITIALISED;
+
+  i = kvstoreFind(key);
+  if ((i < 0) || (kvstoreIndex[i].offset & KVSTORE_DELETED))
+  {
+    return KVSTORE_ERROR_NOTFOUND;
+  }
+
+  offset = kvstoreIndex[i].offset;
+  if (spiflashReadBuffer(kvstoreAddress(kvstoreIndex[i].sector, offset), (uint8_t *)&rec, KVSTORE_RECORDSIZE))
+  {
+    return KVSTORE_ERROR_FLASH;
+  }
+  if (len) *len = rec.len;
+  if (rec.len > size)
+  {
+    return KVSTORE_ERROR_TOOLARGE;
+  }
+  if (rec.len && spiflashReadBuffer(kvstoreAddress(kvstoreIndex[i].sector, offset + KVSTORE_RECORDSIZE), buffer, rec.len))
+  {
+    return KVSTORE_ERROR_FLASH;
+  }
+
+  return kvstoreCRC(kvstoreCRC(0xFFFF, (const uint8_t *)&rec, 4), buffer, rec.len) == rec.crc ?
+         KVSTORE_ERROR_OK : KVSTORE_ERROR_CRC;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Stores a value for a key, replacing any previous value
+
+    Nothing is written if the stored value is already the same.
+
+    @param[in]  key
+                The key (0x0000..0xFFFE)
+    @param[in]  *data
+                The value
+    @param[in]  len
+                Length of the value (0..KVSTORE_MAXVALUESIZE)
+*/
+/**************************************************************************/
+kvstoreError_e kvstorePut (uint16_t key, const uint8_t *data, uint32_t len)
+{
+  uint8_t chunk[KVSTORE_CHUNKSIZE];
+  kvstoreRecord_t rec;
+  uint32_t pos, n;
+  int32_t i;
+
+  if (!kvstoreInitialised) return KVSTORE_ERROR_NOTINITIALISED;
+  if (key == 0xFFFF) return KVSTORE_ERROR_INVALIDKEY;
+  if (len > KVSTORE_MAXVALUESIZE) return KVSTORE_ERROR_TOOLARGE;
+
+  i = kvstoreFind(key);
+  if (i < 0)
+  {
+    if (kvstoreKeys == CFG_KVSTORE_MAXKEYS) return KVSTORE_ERROR_FULL;
+  }
+  else if (!(kvstoreIndex[i].offset & KVSTORE_DELETED) &&
+           !spiflashReadBuffer(kvstoreAddress(kvstoreIndex[i].sector, kvstoreIndex[i].offset), (uint8_t *)&rec, KVSTORE_RECORDSIZE) &&
+           (rec.len == len))
+  {
+    // Skip the write (and the wear) if the value hasn't changed
+    for (pos = 0; pos < len; pos += n)
+    {
+      n = len - pos;
+      if (n > sizeof(chunk)) n = sizeof(chunk);
+      if (spiflashReadBuffer(kvstoreAddress(kvstoreIndex[i].sector, kvstoreIndex[i].offset + KVSTORE_RECORDSIZE + pos), chunk, n) ||
+          memcmp(chunk, data + pos, n))
+      {
+        break;
+      }
+    }
+    if (pos >= len) return KVSTORE_ERROR_OK;
+  }
+
+  return kvstoreAppend(key, KVSTORE_RECORD_VALUE, data, len);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Removes the value stored for a key
+*/
+/**************************************************************************/
+kvstoreError_e kvstoreDelete (uint16_t key)
+{
+  int32_t i;
+
+  if (!kvstoreInitialised) return KVSTORE_ERROR_NOTINITIALISED;
+
+  i = kvstoreFind(key);
+  if ((i < 0) || (kvstoreIndex[i].offset & KVSTORE_DELETED))
+  {
+    return KVSTORE_ERROR_NOTFOUND;
+  }
+
+  return kvstoreAppend(key, KVSTORE_RECORD_DELETE, 0, 0);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Call from the main loop.  Reclaims one sector when free
+            sectors run low, or moves one sector of static data after a
+            new sector has been allocated if the erase counts have
+            drifted apart.
+
+    @return True if a sector was compacted
+*/
+/**************************************************************************/
+bool kvstoreCompact (void)
+{
+  uint32_t free;
+  int32_t victim = -1;
+
+  if (!kvstoreInitialised) return false;
+
+  free = kvstoreGetFreeSectors();
+  if (free <= KVSTORE_COMPACTFREE)
+  {
+    victim = kvstorePickVictim();
+  }
+  if ((victim < 0) && kvstoreWearPending && (free >= 2))
+  {
+    kvstoreWearPending = false;
+    victim = kvstoreWearVictim();
+  }
+  if (victim < 0)
+  {
+    return false;
+  }
+
+  return kvstoreCompactSector(victim) == KVSTORE_ERROR_OK;
+}
+
+#endif
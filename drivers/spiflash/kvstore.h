@@ -0,0 +1,82 @@
+/**************************************************************************/
+/*!
+    @file     kvstore.h
+
+    @section LICENSE
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+
+#ifndef _KVSTORE_H_
+#define _KVSTORE_H_
+
+#include "projectconfig.h"
+
+#define KVSTORE_SECTORSIZE      (4096)  // Flash erase sector size
+#define KVSTORE_SUMMARYSIZE     (256)   // One page at the end of each sector
+#define KVSTORE_HEADERSIZE      (16)    // Sector header at the start of each sector
+#define KVSTORE_RECORDSIZE      (6)     // Record header (key, length, type, CRC)
+#define KVSTORE_MAXVALUESIZE    (255)   // Largest value that can be stored
+#define KVSTORE_MAXRECORDS      ((KVSTORE_SUMMARYSIZE - 4) / 4)   // Records per sector (one summary entry each)
+#define KVSTORE_COMPACTFREE     (2)     // Compact in the background when this few sectors are free
+#define KVSTORE_WEARSPREAD      (64)    // Move static data once erase counts differ by this much
+
+#define KVSTORE_MAGIC           (0x3153564B)  // "KVS1"
+#define KVSTORE_SUMMARYMAGIC    (0x4D53)      // "SM"
+#define KVSTORE_RECORD_VALUE    (0x01)
+#define KVSTORE_RECORD_DELETE   (0x02)
+
+/**************************************************************************/
+/*!
+    @brief  Error messages
+*/
+/**************************************************************************/
+typedef enum
+{
+  KVSTORE_ERROR_OK = 0,                     // Everything executed normally
+  KVSTORE_ERROR_NOTINITIALISED = 1,         // kvstoreInit hasn't been called (or failed)
+  KVSTORE_ERROR_NOTFOUND = 2,               // No value stored for this key
+  KVSTORE_ERROR_INVALIDKEY = 3,             // Key 0xFFFF is reserved
+  KVSTORE_ERROR_TOOLARGE = 4,               // Value larger than KVSTORE_MAXVALUESIZE or the buffer
+  KVSTORE_ERROR_FULL = 5,                   // No space left even after compaction, or too many keys
+  KVSTORE_ERROR_CRC = 6,                    // Stored value is corrupt
+  KVSTORE_ERROR_FLASH = 7,                  // The SPI flash reported an error
+  KVSTORE_ERROR_LAST
+}
+kvstoreError_e;
+
+kvstoreError_e kvstoreInit (void);
+kvstoreError_e kvstoreFormat (void);
+kvstoreError_e kvstoreGet (uint16_t key, uint8_t *buffer, uint32_t size, uint32_t *len);
+kvstoreError_e kvstorePut (uint16_t key, const uint8_t *data, uint32_t len);
+kvstoreError_e kvstoreDelete (uint16_t key);
+bool           kvstoreCompact (void);
+uint32_t       kvstoreGetFreeSectors (void);
+
+#endif
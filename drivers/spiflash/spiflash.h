@@ -56,6 +56,8 @@ typedef enum
   SPIFLASH_ERROR_NOTSTARTOFPAGE = 7,        // The supplied address is not the start of a new page
   SPIFLASH_ERROR_DATAEXCEEDSPAGESIZE = 9,   // When writing page data, you can't exceed page size
   SPIFLASH_ERROR_PAGEWRITEOVERFLOW = 10,    // Page data will overflow beause (start address + len) > page size
+  SPIFLASH_ERROR_ABORTED = 11,              // The read callback stopped a streaming read
+  SPIFLASH_ERROR_QUEUEFULL = 12,            // No room to queue another background operation
   SPIFLASH_ERROR_LAST
 }
 spiflashError_e;
@@ -75,6 +77,22 @@ typedef struct
 }
 spiflashSizeInfo_t;
 
+/**************************************************************************/
+/*! 
+    @brief  Called by spiflashReadStream with each chunk of data read.
+            Return false to stop the read.
+*/
+/**************************************************************************/
+typedef bool (*spiflashReadCallback_t)(const uint8_t *data, uint32_t len, void *context);
+
+/**************************************************************************/
+/*! 
+    @brief  Called by spiflashPoll when a background program or erase
+            has finished (error is SPIFLASH_ERROR_OK if it succeeded)
+*/
+/**************************************************************************/
+typedef void (*spiflashDoneCallback_t)(spiflashError_e error, void *context);
+
 /**************************************************************************/
 /*! 
     @brief Tries to initialise the flash device, and sets up any HW
@@ -158,6 +176,46 @@ void spiflashWriteEnable (bool enable);
 /**************************************************************************/
 spiflashError_e spiflashReadBuffer (uint32_t address, uint8_t *buffer, uint32_t len);
 
+/**************************************************************************/
+/*! 
+    @brief Reads len bytes from the supplied address and passes them to
+           a callback in small chunks, so that large reads (fonts,
+           images, ...) can go straight to the LCD or USB without a
+           buffer the size of the whole read.
+
+    @param[in]  address
+                The 24-bit address where the read will start.
+    @param[in]  len
+                Number of bytes to read.
+    @param[in]  callback
+                Called with each chunk, returns false to stop the read
+                (SPIFLASH_ERROR_ABORTED is then returned)
+    @param[in]  context
+                Passed on to the callback
+
+    @note  The flash stays selected while the callback runs, so the
+           callback must not use anything else on the SPI bus (such as
+           the SD card).
+
+    @section EXAMPLE
+
+    @code
+    static bool sendToUSB(const uint8_t *data, uint32_t len, void *context)
+    {
+      while (len--)
+      {
+        CDC_putchar(*data++);
+      }
+      return true;
+    }
+
+    ...
+    spiflashReadStream (0x10000, 32768, sendToUSB, 0);
+    @endcode
+*/
+/**************************************************************************/
+spiflashError_e spiflashReadStream (uint32_t address, uint32_t len, spiflashReadCallback_t callback, void *context);
+
 /**************************************************************************/
 /*! 
     @brief Erases the contents of a single sector
@@ -336,4 +394,45 @@ spiflashError_e spiflashWritePage (uint32_t address, uint8_t *buffer, uint32_t l
 /**************************************************************************/
 spiflashError_e spiflashWrite (uint32_t address, uint8_t *buffer, uint32_t len);
 
+/**************************************************************************/
+/*! 
+    @brief Background (non-blocking) program and erase
+
+    Operations are queued and started one at a time by spiflashPoll,
+    which must be called regularly from the main loop.  spiflashPoll
+    only reads the status register while the flash is busy, so the
+    caller can carry on with other work during a 400ms sector erase (or
+    a chip erase that can take 10 seconds).  The callback, if any, is
+    called from spiflashPoll once the operation has finished.
+
+    Every blocking function (reads included) first waits for the queue
+    to empty, so reads always see the result of earlier writes.
+
+    @note  The buffer passed to spiflashWritePageAsync must stay valid
+           until the callback has been called.
+
+    @section EXAMPLE
+
+    @code
+    static void erased(spiflashError_e error, void *context)
+    {
+      // Sector erased (or error)
+    }
+
+    ...
+    spiflashEraseSectorAsync(12, erased, 0);
+    while (1)
+    {
+      spiflashPoll();
+      // ... anything else that needs doing
+    }
+    @endcode
+*/
+/**************************************************************************/
+spiflashError_e spiflashWritePageAsync (uint32_t address, const uint8_t *buffer, uint32_t len, spiflashDoneCallback_t callback, void *context);
+spiflashError_e spiflashEraseSectorAsync (uint32_t sectorNumber, spiflashDoneCallback_t callback, void *context);
+spiflashError_e spiflashEraseChipAsync (spiflashDoneCallback_t callback, void *context);
+bool            spiflashPoll (void);
+void            spiflashFlush (void);
+
 #endif
@@ -51,6 +51,32 @@
 // Flag to indicate whether the SPI flash has been initialised or not
 static bool _w25q16bvInitialised = false;
 
+// Queue of background program/erase operations (see spiflashPoll)
+typedef enum
+{
+  W25Q16BV_OP_PAGEPROG,
+  W25Q16BV_OP_SECTERASE,
+  W25Q16BV_OP_CHIPERASE
+}
+w25q16bvOpType_e;
+
+typedef struct
+{
+  w25q16bvOpType_e type;
+  uint32_t address;
+  const uint8_t *buffer;
+  uint32_t len;
+  spiflashDoneCallback_t callback;
+  void *context;
+}
+w25q16bvOp_t;
+
+static w25q16bvOp_t _w25q16bvQueue[W25Q16BV_QUEUESIZE];
+static uint8_t _w25q16bvQueueHead = 0;
+static uint8_t _w25q16bvQueueCount = 0;
+static bool _w25q16bvOpStarted = false;     // The op at the head has been sent to the flash
+static uint32_t _w25q16bvOpTicks;           // When it was sent
+
 /**************************************************************************/
 /*   HW Specific Functions                                                */
 /*   -------------------------------------------------------------------  */
@@ -113,6 +139,13 @@ spiflashError_e w25q16bvWaitForReady()
   uint32_t timeout = 0;
   uint8_t status;
 
+  // Anything queued in the background has to finish first, so that the
+  // caller sees (and doesn't overtake) earlier writes
+  if (_w25q16bvQueueCount)
+  {
+    spiflashFlush();
+  }
+
   while ( timeout < SSP_MAX_TIMEOUT )
   {
     status = w25q16bvGetStatus() & W25Q16BV_STAT1_BUSY;
@@ -160,6 +193,54 @@ void w25q16bvGetUniqueID(uint8_t *buffer)
   W25Q16BV_DESELECT();
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Selects the flash and sends a FAST READ (0x0B) command, with
+            SSP0 switched to the fastest clock the flash allows for it.
+            The clock the bus was using (it is shared with the SD card)
+            is saved so that w25q16bvEndRead can put it back.
+
+    @param[in]  address
+                The 24-bit address where the read will start.
+    @param[out] saved
+                SSP0CLKDIV, SSP0CR0 and SSP0CPSR to restore afterwards
+*/
+/**************************************************************************/
+static void w25q16bvStartRead(uint32_t address, uint32_t *saved)
+{
+  uint8_t cmd[5];
+
+  // READ DATA (0x03) is limited to 50MHz, FAST READ to 80MHz with one
+  // dummy byte, so FAST READ can always run as fast as the SSP goes
+  saved[0] = SCB_SSP0CLKDIV;
+  saved[1] = SSP_SSP0CR0;
+  saved[2] = SSP_SSP0CPSR;
+  SCB_SSP0CLKDIV = SCB_SSP0CLKDIV_DIV1;
+  SSP_SSP0CR0 = (saved[1] & ~SSP_SSP0CR0_SCR_MASK) | (W25Q16BV_READSCR << 8);
+  SSP_SSP0CPSR = SSP_SSP0CPSR_CPSDVSR_DIV2;
+
+  cmd[0] = W25Q16BV_CMD_FREAD;                       // 0x0B
+  cmd[1] = (address >> 16) & 0xFF;                   // address upper 8
+  cmd[2] = (address >> 8) & 0xFF;                    // address mid 8
+  cmd[3] = address & 0xFF;                           // address lower 8
+  cmd[4] = 0xFF;                                     // dummy byte
+  W25Q16BV_SELECT();
+  sspTransfer(0, cmd, 0, 5);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Deselects the flash and restores the SSP0 clock
+*/
+/**************************************************************************/
+static void w25q16bvEndRead(const uint32_t *saved)
+{
+  W25Q16BV_DESELECT();
+  SCB_SSP0CLKDIV = saved[0];
+  SSP_SSP0CR0 = saved[1];
+  SSP_SSP0CPSR = saved[2];
+}
+
 /**************************************************************************/
 /*   Generic spiflash.h Functions                                         */
 /*   -------------------------------------------------------------------  */
@@ -293,8 +374,7 @@ spiflashError_e spiflashReadBuffer (uint32_t address, uint8_t *buffer, uint32_t
 {
   if (!_w25q16bvInitialised) spiflashInit();
 
-  uint32_t a, i;
-  a = i = 0;
+  uint32_t saved[3];
 
   // Make sure the address is valid
   if (address >= W25Q16BV_MAXADDRESS)
@@ -302,27 +382,76 @@ spiflashError_e spiflashReadBuffer (uint32_t address, uint8_t *buffer, uint32_t
     return SPIFLASH_ERROR_ADDROUTOFRANGE;
   }
 
+  // Make sure we won't run off the end of the flash memory
+  if (address + len > W25Q16BV_MAXADDRESS + 1)
+  {
+    return SPIFLASH_ERROR_ADDROVERFLOW;
+  }
+
   // Wait until the device is ready or a timeout occurs
   if (w25q16bvWaitForReady())
     return SPIFLASH_ERROR_TIMEOUT_READY;
 
-  // Send the read data command
-  W25Q16BV_SELECT();
-  w25q16bv_TransferByte(W25Q16BV_CMD_READDATA);      // 0x03
-  w25q16bv_TransferByte((address >> 16) & 0xFF);     // address upper 8
-  w25q16bv_TransferByte((address >> 8) & 0xFF);      // address mid 8
-  w25q16bv_TransferByte(address & 0xFF);             // address lower 8
-  // Fill response buffer
-  for (a = address; a < address + len; a++, i++)
+  // Fill response buffer in one FIFO-pipelined transfer
+  w25q16bvStartRead(address, saved);
+  sspTransfer(0, 0, buffer, len);
+  w25q16bvEndRead(saved);
+
+  return SPIFLASH_ERROR_OK;
+}
+
+/**************************************************************************/
+/*! 
+    @brief Reads len bytes from the supplied address and passes them to
+           a callback in chunks of up to W25Q16BV_STREAMCHUNK bytes.
+
+    The read is a single FAST READ command, and the chunks are aligned
+    so that none crosses a page boundary.  See spiflash.h for details.
+*/
+/**************************************************************************/
+spiflashError_e spiflashReadStream (uint32_t address, uint32_t len, spiflashReadCallback_t callback, void *context)
+{
+  if (!_w25q16bvInitialised) spiflashInit();
+
+  uint8_t chunk[W25Q16BV_STREAMCHUNK];
+  uint32_t saved[3];
+  uint32_t n;
+
+  // Make sure the address is valid
+  if (address >= W25Q16BV_MAXADDRESS)
   {
-    if (a > W25Q16BV_MAXADDRESS)
+    return SPIFLASH_ERROR_ADDROUTOFRANGE;
+  }
+
+  // Make sure we won't run off the end of the flash memory
+  if (address + len > W25Q16BV_MAXADDRESS + 1)
+  {
+    return SPIFLASH_ERROR_ADDROVERFLOW;
+  }
+
+  // Wait until the device is ready or a timeout occurs
+  if (w25q16bvWaitForReady())
+    return SPIFLASH_ERROR_TIMEOUT_READY;
+
+  w25q16bvStartRead(address, saved);
+  while (len)
+  {
+    // The first chunk only goes up to the next chunk boundary
+    n = W25Q16BV_STREAMCHUNK - (address % W25Q16BV_STREAMCHUNK);
+    if (n > len)
     {
-      // Oops ... we're at the end of the flash memory
-      return SPIFLASH_ERROR_ADDROVERFLOW;
+      n = len;
     }
-    buffer[i] = w25q16bv_TransferByte(0xFF);
+    sspTransfer(0, 0, chunk, n);
+    if (!callback(chunk, n, context))
+    {
+      w25q16bvEndRead(saved);
+      return SPIFLASH_ERROR_ABORTED;
+    }
+    address += n;
+    len -= n;
   }
-  W25Q16BV_DESELECT();
+  w25q16bvEndRead(saved);
 
   return SPIFLASH_ERROR_OK;
 }
@@ -517,7 +646,7 @@ spiflashError_e spiflashEraseChip (void)
 spiflashError_e spiflashWritePage (uint32_t address, uint8_t *buffer, uint32_t len)
 {
   uint8_t status;
-  uint32_t i;
+  uint8_t cmd[4];
 
   if (!_w25q16bvInitialised) spiflashInit();
 
@@ -558,24 +687,22 @@ spiflashError_e spiflashWritePage (uint32_t address, uint8_t *buffer, uint32_t l
   }
 
   // Send page write command (0x02) plus 24-bit address
-  W25Q16BV_SELECT();
-  w25q16bv_TransferByte(W25Q16BV_CMD_PAGEPROG);      // 0x02
-  w25q16bv_TransferByte((address >> 16) & 0xFF);     // address upper 8
-  w25q16bv_TransferByte((address >> 8) & 0xFF);      // address mid 8
+  cmd[0] = W25Q16BV_CMD_PAGEPROG;                    // 0x02
+  cmd[1] = (address >> 16) & 0xFF;                   // address upper 8
+  cmd[2] = (address >> 8) & 0xFF;                    // address mid 8
   if (len == 256)
   {
     // If len = 256 bytes, lower 8 bits must be 0 (see datasheet 11.2.17)
-    w25q16bv_TransferByte(0);
+    cmd[3] = 0;
   }
   else
   {
-    w25q16bv_TransferByte(address & 0xFF);           // address lower 8
+    cmd[3] = address & 0xFF;                         // address lower 8
   }
+  W25Q16BV_SELECT();
+  sspTransfer(0, cmd, 0, 4);
   // Transfer data
-  for (i = 0; i < len; i++)
-  {
-    w25q16bv_TransferByte(buffer[i]);
-  }
+  sspTransfer(0, buffer, 0, len);
   // Write only occurs after the CS line is de-asserted
   W25Q16BV_DESELECT();
 
@@ -694,4 +821,251 @@ spiflashError_e spiflashWrite (uint32_t address, uint8_t *buffer, uint32_t len)
   return SPIFLASH_ERROR_OK;
 }
 
+/**************************************************************************/
+/*! 
+    @brief  Adds an operation to the background queue
+*/
+/**************************************************************************/
+static spiflashError_e w25q16bvQueueOp(w25q16bvOpType_e type, uint32_t address, const uint8_t *buffer, uint32_t len, spiflashDoneCallback_t callback, void *context)
+{
+  w25q16bvOp_t *op;
+
+  if (!_w25q16bvInitialised) spiflashInit();
+
+  if (_w25q16bvQueueCount == W25Q16BV_QUEUESIZE)
+  {
+    return SPIFLASH_ERROR_QUEUEFULL;
+  }
+
+  op = &_w25q16bvQueue[(_w25q16bvQueueHead + _w25q16bvQueueCount) % W25Q16BV_QUEUESIZE];
+  op->type = type;
+  op->address = address;
+  op->buffer = buffer;
+  op->len = len;
+  op->callback = callback;
+  op->context = context;
+  _w25q16bvQueueCount++;
+
+  // Get it going straight away if the flash is free
+  spiflashPoll();
+
+  return SPIFLASH_ERROR_OK;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Sends the operation at the head of the queue to the flash,
+            without waiting for it to finish
+*/
+/**************************************************************************/
+static spiflashError_e w25q16bvStartOp(const w25q16bvOp_t *op)
+{
+  uint8_t cmd[4];
+
+  // Make sure the chip is write enabled
+  spiflashWriteEnable (TRUE);
+
+  // Make sure the write enable latch is actually set
+  if (!(w25q16bvGetStatus() & W25Q16BV_STAT1_WRTEN))
+  {
+    // Throw a write protection error (write enable latch not set)
+    return SPIFLASH_ERROR_PROTECTIONERR;
+  }
+
+  switch (op->type)
+  {
+    case W25Q16BV_OP_PAGEPROG:
+      cmd[0] = W25Q16BV_CMD_PAGEPROG;
+      break;
+    case W25Q16BV_OP_SECTERASE:
+      cmd[0] = W25Q16BV_CMD_SECTERASE4;
+      break;
+    default:
+      cmd[0] = W25Q16BV_CMD_CHIPERASE;
+      break;
+  }
+  cmd[1] = (op->address >> 16) & 0xFF;               // address upper 8
+  cmd[2] = (op->address >> 8) & 0xFF;                // address mid 8
+  cmd[3] = op->address & 0xFF;                       // address lower 8
+
+  W25Q16BV_SELECT();
+  sspTransfer(0, cmd, 0, op->type == W25Q16BV_OP_CHIPERASE ? 1 : 4);
+  if (op->type == W25Q16BV_OP_PAGEPROG)
+  {
+    sspTransfer(0, op->buffer, 0, op->len);
+  }
+  // Program/erase only starts after the CS line is de-asserted
+  W25Q16BV_DESELECT();
+
+  return SPIFLASH_ERROR_OK;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Queues a page program to run in the background
+
+    @param[in]  address
+                The 24-bit address where the write will start.
+    @param[in]  *buffer
+                Data to write, which must stay valid until the callback
+    @param[in]  len
+                1 to 256 bytes, within the page containing address
+    @param[in]  callback
+                Called when the write has finished (can be 0)
+    @param[in]  context
+                Passed on to the callback
+*/
+/**************************************************************************/
+spiflashError_e spiflashWritePageAsync (uint32_t address, const uint8_t *buffer, uint32_t len, spiflashDoneCallback_t callback, void *context)
+{
+  // Make sure the address is valid
+  if (address >= W25Q16BV_MAXADDRESS)
+  {
+    return SPIFLASH_ERROR_ADDROUTOFRANGE;
+  }
+
+  // Make sure that the supplied data is no larger than the page size
+  if (len > W25Q16BV_PAGESIZE)
+  {
+    return SPIFLASH_ERROR_DATAEXCEEDSPAGESIZE;
+  }
+
+  // Make sure that the data won't wrap around to the beginning of the page
+  if ((address % W25Q16BV_PAGESIZE) + len > W25Q16BV_PAGESIZE)
+  {
+    return SPIFLASH_ERROR_PAGEWRITEOVERFLOW;
+  }
+
+  return w25q16bvQueueOp(W25Q16BV_OP_PAGEPROG, address, buffer, len, callback, context);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Queues a sector erase to run in the background
+
+    @param[in]  sectorNumber
+                The sector number to erase (zero-based).
+    @param[in]  callback
+                Called when the erase has finished (can be 0)
+    @param[in]  context
+                Passed on to the callback
+*/
+/**************************************************************************/
+spiflashError_e spiflashEraseSectorAsync (uint32_t sectorNumber, spiflashDoneCallback_t callback, void *context)
+{
+  // Make sure the address is valid
+  if (sectorNumber >= W25Q16BV_SECTORS)
+  {
+    return SPIFLASH_ERROR_ADDROUTOFRANGE;
+  }
+
+  return w25q16bvQueueOp(W25Q16BV_OP_SECTERASE, sectorNumber * W25Q16BV_SECTORSIZE, 0, 0, callback, context);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Queues a chip erase to run in the background
+
+    @param[in]  callback
+                Called when the erase has finished (can be 0)
+    @param[in]  context
+                Passed on to the callback
+*/
+/**************************************************************************/
+spiflashError_e spiflashEraseChipAsync (spiflashDoneCallback_t callback, void *context)
+{
+  return w25q16bvQueueOp(W25Q16BV_OP_CHIPERASE, 0, 0, 0, callback, context);
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Moves the background queue along: checks whether the
+            operation in progress has finished (one status register
+            read), calls its callback and starts the next one.
+
+    Call this from the main loop, not from an interrupt, since it uses
+    the SPI bus.
+
+    @return True while there are operations queued or in progress
+*/
+/**************************************************************************/
+bool spiflashPoll (void)
+{
+  w25q16bvOp_t *op;
+  spiflashDoneCallback_t callback;
+  void *context;
+  spiflashError_e error;
+  uint32_t timeout;
+
+  while (_w25q16bvQueueCount)
+  {
+    op = &_w25q16bvQueue[_w25q16bvQueueHead];
 
+    if (!_w25q16bvOpStarted)
+    {
+      // Leave it for the next poll if the flash is still busy
+      if (w25q16bvGetStatus() & W25Q16BV_STAT1_BUSY)
+      {
+        return true;
+      }
+      error = w25q16bvStartOp(op);
+      if (!error)
+      {
+        _w25q16bvOpStarted = true;
+        _w25q16bvOpTicks = systickGetTicks();
+        return true;
+      }
+    }
+    else
+    {
+      if (w25q16bvGetStatus() & W25Q16BV_STAT1_BUSY)
+      {
+        switch (op->type)
+        {
+          case W25Q16BV_OP_PAGEPROG:
+            timeout = W25Q16BV_TIMEOUT_PAGEPROG;
+            break;
+          case W25Q16BV_OP_SECTERASE:
+            timeout = W25Q16BV_TIMEOUT_SECTERASE;
+            break;
+          default:
+            timeout = W25Q16BV_TIMEOUT_CHIPERASE;
+            break;
+        }
+        if (systickGetTicks() - _w25q16bvOpTicks <= timeout / CFG_SYSTICK_DELAY_IN_MS)
+        {
+          return true;
+        }
+        error = SPIFLASH_ERROR_TIMEOUT_READY;
+      }
+      else
+      {
+        error = SPIFLASH_ERROR_OK;
+      }
+    }
+
+    // Done (or failed), so take it off the queue before the callback,
+    // which is then free to queue something else (in the same slot)
+    callback = op->callback;
+    context = op->context;
+    _w25q16bvOpStarted = false;
+    _w25q16bvQueueHead = (_w25q16bvQueueHead + 1) % W25Q16BV_QUEUESIZE;
+    _w25q16bvQueueCount--;
+    if (callback)
+    {
+      callback(error, context);
+    }
+  }
+
+  return false;
+}
+
+/**************************************************************************/
+/*! 
+    @brief  Waits until every queued operation has finished
+*/
+/**************************************************************************/
+void spiflashFlush (void)
+{
+  while (spiflashPoll());
+}
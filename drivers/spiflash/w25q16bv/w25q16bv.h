@@ -46,6 +46,13 @@
 #define W25Q16BV_SECTORS         512    // 2,097,152 Bytes / 4096 bytes per sector
 #define W25Q16BV_MANUFACTURERID  0xEF   // Used to validate read data
 #define W25Q16BV_DEVICEID        0x14   // Used to validate read data
+#define W25Q16BV_READSCR         0      // Serial clock rate for reads, 72MHz / (2 x [SCR + 1]) = 36MHz
+#define W25Q16BV_STREAMCHUNK     64     // Chunk size for spiflashReadStream (a divisor of the page size)
+#define W25Q16BV_QUEUESIZE       4      // Background program/erase operations that can be queued
+
+#define W25Q16BV_TIMEOUT_PAGEPROG    10     // ms, datasheet max is 3ms
+#define W25Q16BV_TIMEOUT_SECTERASE   1000   // ms, datasheet max is 400ms
+#define W25Q16BV_TIMEOUT_CHIPERASE   20000  // ms, datasheet max is 10s
 
 #define W25Q16BV_STAT1_BUSY      0x01   // Erase/Write in Progress
 #define W25Q16BV_STAT1_WRTEN     0x02   // Write Enable Latch
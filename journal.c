@@ -0,0 +1,722 @@
+/**************************************************************************/
+/*! 
+    @file     journal.c
+
+    @brief    Power-loss safe journal of captured cards on the SPI flash
+
+    Cards are written to the SPI flash as soon as they are read, one
+    card per 256 byte page, and are only dropped once the host has
+    acknowledged them.  Nothing is lost if the host goes away or the
+    power fails, and the reader never has to wait for the host.
+
+    The journal is a ring of CFG_JOURNAL_SECTORS sectors starting at
+    CFG_JOURNAL_FIRSTSECTOR.  Page 0 of each sector holds a header
+    with a sequence number (and its complement, to detect a torn
+    write), pages 1..15 hold one card each:
+
+    @code
+    SSSSSSSS                  Card sequence number
+    LL                        Number of columns
+    AA                        0x00 once the host acknowledged this card
+                              and every card before it, else 0xFF
+    CCCC                      CRC-16 of the sequence number, length and
+                              columns
+    <packed columns>          12 bits per column, two in three bytes
+    @endcode
+
+    After a reset the newest sector (highest sequence number) gives the
+    write head, and walking back from there to the newest acknowledged
+    card gives the tail.  journalPoll starts a background erase of the
+    sector ahead of the write head once it holds nothing unacknowledged,
+    so adding a card normally only costs a page program.  The flash
+    can't be read or programmed during the erase (up to 400ms), so
+    until journalPoll sees it finish journalAddCard returns
+    JOURNAL_ERROR_BUSY, journalNextCard has nothing to send and
+    acknowledgements are held back, rather than waiting for it.
+
+    The host drains the journal in windows of JOURNAL_WINDOW cards and
+    acknowledges by sequence number.  Unacknowledged cards are sent
+    again after JOURNAL_ACKTIMEOUT, so the host must ignore cards it
+    has already seen.
+
+    @section Example
+
+    @code 
+    #include "journal.h"
+
+    journalInit();
+    ...
+    journalAddCard(card, len);
+    ...
+    // From the main loop
+    journalPoll();
+    while (journalNextCard(card, &len, &seq))
+    {
+      // Send the card to the host
+    }
+    ...
+    // When the host acknowledges a card
+    journalAck(seq);
+    @endcode
+
+    @section LICENSE
+
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#include <stddef.h>
+#include <string.h>
+
+#include "journal.h"
+
+#ifdef CFG_JOURNAL
+
+#include "core/systick/systick.h"
+#include "drivers/spiflash/spiflash.h"
+
+#define JOURNAL_SLOTS           (CFG_JOURNAL_SECTORS * JOURNAL_PAGESPERSECTOR)
+#define JOURNAL_HEADERSIZE      (8)     // Card header in front of the packed columns
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t seq;                         // Sector sequence number
+  uint32_t seqCheck;                    // ~seq
+}
+journalSectorHeader_t;
+
+typedef struct
+{
+  uint32_t seq;                         // Card sequence number
+  uint8_t  len;                         // Number of columns
+  uint8_t  ack;                         // 0x00 once acknowledged (with every card before it)
+  uint16_t crc;                         // CRC-16 of seq, len and the packed columns
+  uint8_t  data[JOURNAL_PAGESIZE - JOURNAL_HEADERSIZE];
+}
+journalRecord_t;
+
+static journalRecord_t journalRecord;
+static uint32_t journalHead;            // Slot for the next card (page 0: sector not started yet)
+static uint32_t journalHeadSeq;         // Sequence number of the next card
+static uint32_t journalTail;            // Slot of the oldest unacknowledged card (journalHead if none)
+static uint32_t journalTailSeq;         // Sequence number of the oldest unacknowledged card
+static uint32_t journalSend;            // Next slot to send to the host
+static uint32_t journalSentSeq;         // Sequence number of the last card sent
+static uint32_t journalSent = 0;        // Cards sent but not yet acknowledged
+static uint32_t journalSentTicks;       // When the last card was sent
+static uint32_t journalSectorSeq;       // Sequence number for the next sector started
+static bool     journalReady = false;   // The sector the head goes into next is erased
+static bool     journalErasing = false; // A background erase of that sector is running
+static bool     journalEraseFailed = false;
+static bool     journalAckPending = false; // An ack arrived during the erase
+static uint16_t journalAckSeq;
+static bool     journalInitialised = false;
+
+/**************************************************************************/
+/*!
+    @brief  Returns the flash address of a slot (one page)
+*/
+/**************************************************************************/
+static uint32_t journalAddress(uint32_t slot)
+{
+  return CFG_JOURNAL_FIRSTSECTOR * JOURNAL_SECTORSIZE + slot * JOURNAL_PAGESIZE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the slot after (or before) a slot, wrapping around
+*/
+/**************************************************************************/
+static uint32_t journalNextSlot(uint32_t slot)
+{
+  return (slot + 1) % JOURNAL_SLOTS;
+}
+
+static uint32_t journalPrevSlot(uint32_t slot)
+{
+  return (slot + JOURNAL_SLOTS - 1) % JOURNAL_SLOTS;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds len bytes to a CRC-16 (CCITT polynomial)
+*/
+/**************************************************************************/
+static uint16_t journalCRC(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+  uint32_t i;
+
+  while (len--)
+  {
+    crc ^= (uint16_t)*data++ << 8;
+    for (i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the CRC of the card in journalRecord
+*/
+/**************************************************************************/
+static uint16_t journalRecordCRC(void)
+{
+  uint16_t crc;
+
+  crc = journalCRC(0xFFFF, (const uint8_t *)&journalRecord.seq, 5);
+  return journalCRC(crc, journalRecord.data, (journalRecord.len * 3 + 1) / 2);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads the card header of a slot into journalRecord
+
+    @return False for a sector header or an unwritten page
+*/
+/**************************************************************************/
+static bool journalReadHeader(uint32_t slot)
+{
+  if (!(slot % JOURNAL_PAGESPERSECTOR) ||
+      spiflashReadBuffer(journalAddress(slot), (uint8_t *)&journalRecord, JOURNAL_HEADERSIZE))
+  {
+    return false;
+  }
+
+  return (journalRecord.seq != 0xFFFFFFFF) || (journalRecord.len != 0xFF);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads the card in a slot into journalRecord and checks it
+
+    @return False for a sector header, an unwritten page or a card that
+            was torn by a power loss
+*/
+/**************************************************************************/
+static bool journalReadRecord(uint32_t slot)
+{
+  if (!journalReadHeader(slot) || (journalRecord.len > JOURNAL_MAXCOLUMNS) ||
+      spiflashReadBuffer(journalAddress(slot) + JOURNAL_HEADERSIZE, journalRecord.data, (journalRecord.len * 3 + 1) / 2))
+  {
+    return false;
+  }
+
+  return journalRecordCRC() == journalRecord.crc;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads the header of a sector
+
+    @return The sector's sequence number in *seq, false if the header
+            isn't valid (erased or torn)
+*/
+/**************************************************************************/
+static bool journalReadSector(uint32_t sector, uint32_t *seq)
+{
+  journalSectorHeader_t header;
+
+  if (spiflashReadBuffer(journalAddress(sector * JOURNAL_PAGESPERSECTOR), (uint8_t *)&header, sizeof(header)) ||
+      (header.magic != JOURNAL_MAGIC) || (header.seqCheck != ~header.seq))
+  {
+    return false;
+  }
+
+  *seq = header.seq;
+  return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the sector the write head goes into next
+*/
+/**************************************************************************/
+static uint32_t journalNextSector(void)
+{
+  uint32_t sector = journalHead / JOURNAL_PAGESPERSECTOR;
+
+  if (journalHead % JOURNAL_PAGESPERSECTOR)
+  {
+    sector = (sector + 1) % CFG_JOURNAL_SECTORS;
+  }
+
+  return sector;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Called by spiflashPoll once a background erase has finished
+*/
+/**************************************************************************/
+static void journalErased(spiflashError_e error, void *context)
+{
+  journalErasing = false;
+  if (error)
+  {
+    journalEraseFailed = true;
+  }
+  else
+  {
+    journalReady = true;
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Erases the sector the write head goes into next, unless it
+            still holds unacknowledged cards
+
+    @param[in]  background
+                Only start the erase (journalErased is called once it
+                has finished) rather than waiting for it
+*/
+/**************************************************************************/
+static journalError_t journalPrepare(bool background)
+{
+  uint32_t sector = journalNextSector();
+
+  if ((journalTail != journalHead) && (journalTail / JOURNAL_PAGESPERSECTOR == sector))
+  {
+    return JOURNAL_ERROR_FULL;
+  }
+
+  if (background)
+  {
+    if (spiflashEraseSectorAsync(CFG_JOURNAL_FIRSTSECTOR + sector, journalErased, 0))
+    {
+      return JOURNAL_ERROR_FLASH;
+    }
+    journalErasing = true;
+    return JOURNAL_ERROR_NONE;
+  }
+
+  if (spiflashEraseSector(CFG_JOURNAL_FIRSTSECTOR + sector))
+  {
+    return JOURNAL_ERROR_FLASH;
+  }
+
+  journalReady = true;
+  return JOURNAL_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Finds the write head and the oldest unacknowledged card
+*/
+/**************************************************************************/
+journalError_t journalInit(void)
+{
+  spiflashSizeInfo_t size;
+  uint32_t s, seq, newestSeq = 0, expected, slot;
+  int32_t newest = -1;
+  bool first = true;
+
+  // Let anything still running in the background finish
+  spiflashFlush();
+  journalErasing = false;
+  journalEraseFailed = false;
+  journalAckPending = false;
+
+  size = spiflashGetSizeInfo();
+  if ((size.sectorSize != JOURNAL_SECTORSIZE) || (size.pageSize != JOURNAL_PAGESIZE) ||
+      (CFG_JOURNAL_FIRSTSECTOR + CFG_JOURNAL_SECTORS > size.sectorCount))
+  {
+    return JOURNAL_ERROR_FLASH;
+  }
+
+  // The newest sector holds the write head
+  for (s = 0; s < CFG_JOURNAL_SECTORS; s++)
+  {
+    if (journalReadSector(s, &seq) && ((newest < 0) || ((int32_t)(seq - newestSeq) > 0)))
+    {
+      newest = s;
+      newestSeq = seq;
+    }
+  }
+
+  journalHead = 0;
+  journalHeadSeq = 0;
+  journalSectorSeq = 0;
+  if (newest >= 0)
+  {
+    journalSectorSeq = newestSeq + 1;
+    journalHead = (newest + 1) * JOURNAL_PAGESPERSECTOR % JOURNAL_SLOTS;
+    for (s = 1; s < JOURNAL_PAGESPERSECTOR; s++)
+    {
+      if (!journalReadHeader(newest * JOURNAL_PAGESPERSECTOR + s))
+      {
+        journalHead = newest * JOURNAL_PAGESPERSECTOR + s;
+        break;
+      }
+    }
+  }
+  journalTail = journalHead;
+
+  // Walk back through consecutive sectors to the newest acknowledged
+  // card.  The first card found gives the next sequence number.
+  slot = journalHead;
+  expected = newestSeq;
+  while (newest >= 0)
+  {
+    slot = journalPrevSlot(slot);
+    if (slot == journalHead)
+    {
+      break;                            // Every card is unacknowledged
+    }
+    if (!(slot % JOURNAL_PAGESPERSECTOR))
+    {
+      // Moving back into the previous sector, which must be the one
+      // started just before this one
+      if (journalReadSector(journalPrevSlot(slot) / JOURNAL_PAGESPERSECTOR, &seq) && (seq == expected - 1))
+      {
+        expected--;
+        continue;
+      }
+      break;
+    }
+    if (!journalReadRecord(slot))
+    {
+      continue;                         // Unwritten or torn
+    }
+    if (first)
+    {
+      journalHeadSeq = journalRecord.seq + 1;
+      first = false;
+    }
+    if (!journalRecord.ack)
+    {
+      break;
+    }
+    journalTail = slot;
+    journalTailSeq = journalRecord.seq;
+  }
+  if (journalTail == journalHead)
+  {
+    journalTailSeq = journalHeadSeq;
+  }
+
+  journalSend = journalTail;
+  journalSent = 0;
+  journalReady = false;
+  journalInitialised = true;
+
+  return JOURNAL_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Adds a card to the journal
+
+    @param[in]  data
+                Column values (the lower 12 bits are stored)
+    @param[in]  len
+                Number of columns (0..JOURNAL_MAXCOLUMNS)
+
+    @return JOURNAL_ERROR_FULL if the card would overwrite cards the
+            host hasn't acknowledged yet, JOURNAL_ERROR_BUSY while a
+            background erase is running (see journalBusy)
+*/
+/**************************************************************************/
+journalError_t journalAddCard(const int *data, int len)
+{
+  journalSectorHeader_t header;
+  journalError_t error;
+  uint8_t *p;
+  int i;
+
+  if (!journalInitialised)
+  {
+    return JOURNAL_ERROR_NOTINITIALISED;
+  }
+  if (journalErasing)
+  {
+    return JOURNAL_ERROR_BUSY;
+  }
+  if (len > JOURNAL_MAXCOLUMNS)
+  {
+    len = JOURNAL_MAXCOLUMNS;
+  }
+
+  if (!(journalHead % JOURNAL_PAGESPERSECTOR))
+  {
+    // Start a new sector, erasing it now if journalPoll hasn't already
+    if (!journalReady)
+    {
+      error = journalPrepare(false);
+      if (error)
+      {
+        return error;
+      }
+    }
+    journalReady = false;
+
+    header.magic = JOURNAL_MAGIC;
+    header.seq = journalSectorSeq;
+    header.seqCheck = ~journalSectorSeq;
+    if (spiflashWritePage(journalAddress(journalHead), (uint8_t *)&header, sizeof(header)))
+    {
+      return JOURNAL_ERROR_FLASH;
+    }
+    journalSectorSeq++;
+    if (journalTail == journalHead)
+    {
+      journalTail = journalSend = journalNextSlot(journalHead);
+    }
+    journalHead = journalNextSlot(journalHead);
+  }
+
+  journalRecord.seq = journalHeadSeq;
+  journalRecord.len = len;
+  journalRecord.ack = 0xFF;
+  p = journalRecord.data;
+  for (i = 0; i + 1 < len; i += 2)
+  {
+    *p++ = (data[i] >> 4) & 0xFF;
+    *p++ = ((data[i] & 0x0F) << 4) | ((data[i + 1] >> 8) & 0x0F);
+    *p++ = data[i + 1] & 0xFF;
+  }
+  if (i < len)
+  {
+    *p++ = (data[i] >> 4) & 0xFF;
+    *p++ = (data[i] & 0x0F) << 4;
+  }
+  journalRecord.crc = journalRecordCRC();
+
+  error = spiflashWritePage(journalAddress(journalHead), (uint8_t *)&journalRecord, p - (uint8_t *)&journalRecord) ?
+          JOURNAL_ERROR_FLASH : JOURNAL_ERROR_NONE;
+
+  // Move on even if the write failed, the page will be skipped
+  journalHead = journalNextSlot(journalHead);
+  journalHeadSeq++;
+
+  return error;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Gets the next card to send to the host, if any and if fewer
+            than JOURNAL_WINDOW cards are waiting to be acknowledged.
+            Returns false while a background erase is running.
+
+    @param[out] data
+                Column values (JOURNAL_MAXCOLUMNS entries)
+    @param[out] len
+                Number of columns
+    @param[out] seq
+                Sequence number the host acknowledges the card with
+*/
+/**************************************************************************/
+bool journalNextCard(int *data, int *len, uint32_t *seq)
+{
+  uint32_t slot;
+  uint8_t *p;
+  int i;
+
+  if (!journalInitialised || journalErasing)
+  {
+    return false;
+  }
+
+  while ((journalSend != journalHead) && (journalSent < JOURNAL_WINDOW))
+  {
+    slot = journalSend;
+    journalSend = journalNextSlot(journalSend);
+    if (!journalReadRecord(slot))
+    {
+      continue;                         // Sector header or torn card
+    }
+
+    p = journalRecord.data;
+    for (i = 0; i + 1 < journalRecord.len; i += 2, p += 3)
+    {
+      data[i] = (p[0] << 4) | (p[1] >> 4);
+      data[i + 1] = ((p[1] & 0x0F) << 8) | p[2];
+    }
+    if (i < journalRecord.len)
+    {
+      data[i] = (p[0] << 4) | (p[1] >> 4);
+    }
+    *len = journalRecord.len;
+    *seq = journalRecord.seq;
+
+    journalSentSeq = journalRecord.seq;
+    journalSent++;
+    journalSentTicks = systickGetTicks();
+    return true;
+  }
+
+  return false;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Acknowledges every card sent up to and including the one
+            whose sequence number ends in seq (only the low 16 bits are
+            compared, which is what the host sees)
+
+    @return JOURNAL_ERROR_BUSY if a background erase is running, in
+            which case the ack is kept and applied by journalPoll once
+            the erase has finished
+*/
+/**************************************************************************/
+journalError_t journalAck(uint16_t seq)
+{
+  uint32_t slot, next;
+  uint8_t acked = 0x00;
+
+  if (!journalInitialised)
+  {
+    return JOURNAL_ERROR_NOTINITIALISED;
+  }
+  if (journalErasing)
+  {
+    // Acks are cumulative, so only the latest one needs keeping
+    journalAckPending = true;
+    journalAckSeq = seq;
+    return JOURNAL_ERROR_BUSY;
+  }
+
+  for (slot = journalTail; journalSent && (slot != journalSend); slot = next)
+  {
+    next = journalNextSlot(slot);
+    if (!journalReadHeader(slot) || ((journalRecord.seq & 0xFFFF) != seq))
+    {
+      continue;
+    }
+
+    // Only this card is marked, which covers every card before it
+    if (spiflashWritePage(journalAddress(slot) + offsetof(journalRecord_t, ack), &acked, 1))
+    {
+      return JOURNAL_ERROR_FLASH;
+    }
+    journalTail = next;
+    if ((journalTail != journalHead) && !(journalTail % JOURNAL_PAGESPERSECTOR))
+    {
+      // Keep the tail off the sector header, where it would look the
+      // same as an empty journal once the head wraps round to it
+      journalTail = journalNextSlot(journalTail);
+    }
+    journalTailSeq = journalRecord.seq + 1;
+    journalSent = journalSentSeq - journalRecord.seq;
+    journalSentTicks = systickGetTicks();
+    break;
+  }
+
+  return JOURNAL_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Sends every unacknowledged card again
+*/
+/**************************************************************************/
+void journalRewind(void)
+{
+  journalSend = journalTail;
+  journalSent = 0;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Call from the main loop.  Resends cards that weren't
+            acknowledged within JOURNAL_ACKTIMEOUT, and erases the sector
+            ahead of the write head in the background once it is free
+            (this also runs the SPI flash's background queue).
+*/
+/**************************************************************************/
+journalError_t journalPoll(void)
+{
+  journalError_t error;
+
+  if (!journalInitialised)
+  {
+    return JOURNAL_ERROR_NOTINITIALISED;
+  }
+
+  if (journalSent && (systickGetTicks() - journalSentTicks > JOURNAL_ACKTIMEOUT / CFG_SYSTICK_DELAY_IN_MS))
+  {
+    journalRewind();
+  }
+
+  // Move any background erase along
+  spiflashPoll();
+  if (journalEraseFailed)
+  {
+    journalEraseFailed = false;
+    return JOURNAL_ERROR_FLASH;
+  }
+
+  if (journalAckPending && !journalErasing)
+  {
+    journalAckPending = false;
+    error = journalAck(journalAckSeq);
+    if (error)
+    {
+      return error;
+    }
+  }
+
+  if (!journalReady && !journalErasing)
+  {
+    error = journalPrepare(true);
+    if (error == JOURNAL_ERROR_FLASH)
+    {
+      return error;
+    }
+  }
+
+  return JOURNAL_ERROR_NONE;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns the number of cards waiting to be acknowledged
+*/
+/**************************************************************************/
+uint32_t journalPending(void)
+{
+  return journalHeadSeq - journalTailSeq;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Returns true while a background erase is running, during
+            which journalAddCard returns JOURNAL_ERROR_BUSY
+*/
+/**************************************************************************/
+bool journalBusy(void)
+{
+  return journalErasing;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**************************************************************************/
+/*! 
+    @file     journal.h
+
+    @section LICENSE
+
+
+    Software License Agreement (BSD License)
+
+    Copyright (c) 2011, microBuilder SARL
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+    1. Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holders nor the
+    names of its contributors may be used to endorse or promote products
+    derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/**************************************************************************/
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include "projectconfig.h"
+
+#define JOURNAL_SECTORSIZE      (4096)  // SPI flash erase sector size
+#define JOURNAL_PAGESIZE        (256)   // SPI flash page size (one card per page)
+#define JOURNAL_PAGESPERSECTOR  (JOURNAL_SECTORSIZE / JOURNAL_PAGESIZE)
+#define JOURNAL_MAXCOLUMNS      (160)   // Columns that fit in a page, 12 bits each
+#define JOURNAL_WINDOW          (8)     // Cards sent to the host before waiting for an ack
+#define JOURNAL_ACKTIMEOUT      (2000)  // ms without an ack before unacked cards are resent
+
+#define JOURNAL_MAGIC           (0x314E524A)  // "JRN1"
+
+typedef enum
+{
+  JOURNAL_ERROR_NONE = 0,
+  JOURNAL_ERROR_NOTINITIALISED = 1,   // journalInit hasn't been called
+  JOURNAL_ERROR_FULL = 2,             // The next sector still holds unacknowledged cards
+  JOURNAL_ERROR_FLASH = 3,            // The SPI flash reported an error
+  JOURNAL_ERROR_BUSY = 4              // A background erase is running, try again later
+} journalError_t;
+
+journalError_t journalInit(void);
+journalError_t journalAddCard(const int *data, int len);
+bool           journalNextCard(int *data, int *len, uint32_t *seq);
+journalError_t journalAck(uint16_t seq);
+void           journalRewind(void);
+journalError_t journalPoll(void);
+uint32_t       journalPending(void);
+bool           journalBusy(void);
+
+#endif
@@ -3365,6 +3365,12 @@ static inline void NVIC_DisableIRQ(IRQn_t IRQn)
 #define ADC_AD0CR_START_MASK                      (0x07000000)
 #define ADC_AD0CR_START_NOSTART                   (0x00000000)
 #define ADC_AD0CR_START_STARTNOW                  (0x01000000)
+#define ADC_AD0CR_START_CT16B0_CAP0               (0x02000000)    // Start on an edge of PIO0_2/CT16B0_CAP0
+#define ADC_AD0CR_START_CT32B0_CAP0               (0x03000000)    // Start on an edge of PIO1_5/CT32B0_CAP0
+#define ADC_AD0CR_START_CT32B0_MAT0               (0x04000000)    // Start on an edge of CT32B0_MAT0
+#define ADC_AD0CR_START_CT32B0_MAT1               (0x05000000)    // Start on an edge of CT32B0_MAT1
+#define ADC_AD0CR_START_CT16B0_MAT0               (0x06000000)    // Start on an edge of CT16B0_MAT0
+#define ADC_AD0CR_START_CT16B0_MAT1               (0x07000000)    // Start on an edge of CT16B0_MAT1
 #define ADC_AD0CR_EDGE_MASK                       (0x08000000)
 #define ADC_AD0CR_EDGE_FALLING                    (0x08000000)
 #define ADC_AD0CR_EDGE_RISING                     (0x00000000)
@@ -51,6 +51,20 @@
 
 #include "core/usbcdc/cdcuser.h"
 
+// The TFT LCD bus (data on 1.8..1.11, control on 2.4..2.7, reset/IM on
+// 3.3) shares the card reader's lines, so the two can't be used together
+#ifdef CFG_TFTLCD
+  #error "CFG_TFTLCD can not be used with the card reader (shared GPIO lines)"
+#endif
+
+#ifdef CFG_ARCHIVE
+  #include "archive.h"
+#endif
+
+#ifdef CFG_JOURNAL
+  #include "journal.h"
+#endif
+
 /*
  * Pin  Signal  Direc   GPIO    LED     Color       Comment  
     A   -D12    in      1.11            hvid/blå*
@@ -81,6 +95,10 @@
     P   continous pick on (until error)
     p   continous pick off
     s   print status + buffer
+    W   start archiving to SD card (new file, needs CFG_ARCHIVE)
+    w   stop archiving and close the file
+    K   KNNNN CR acknowledges journalled cards up to card number NNNN
+        (hex), needs CFG_JOURNAL
 
  * Output
     0   (default = RAW)
@@ -89,6 +107,17 @@
     3   RCB [NNNN][HEADSTMT]CCCCCCCC[TAILSTMT] CR LF 
     4   EBCDIC  CCCCCCCCCCCCCCCCCCCCCCCC CR LF
     5   ASCII   CCCCCCCCCCCCCCCCCCCCCCCC CR LF
+
+    With CFG_JOURNAL every card is kept in the SPI flash until it is
+    acknowledged with K, the card number is the journal's sequence
+    number, and cards that aren't acknowledged within two seconds are
+    sent again (so the host must skip card numbers it already has).
+    A card that can't be journalled (journal full or flash error) is
+    sent once as a DIRECT: line instead of DATA:, numbered separately.
+    It must not be acknowledged or checked against the card numbers
+    already seen.  It follows a line giving the reason: "JOURNAL: full",
+    "JOURNAL: flash error", "JOURNAL: busy" or "JOURNAL: not
+    initialised".
  
 */
 
@@ -103,6 +132,7 @@ volatile int overrun = 0;
 int outfmt = 0;
 volatile int cardsread = 0;
 volatile int multipick = 0;
+volatile int deckend = 0;
 
 void Reset(void) 
 {
@@ -121,6 +151,7 @@ void PIOINT2_IRQHandler(void)
     {
         gpioSetValue(3,1,1);
         multipick = 0;
+        deckend = 1;
         gpioIntClear(2, 5);
     }
 }
@@ -242,15 +273,15 @@ void putstringint(char * str, int val)
 }
 
 static int cardswritten=0;
-void OutFmtData(int *data, int len)
+void OutFmtData(char *tag, int cardno, int *data, int len)
 {
     int i;
     switch (outfmt)
     {
         case 0:
         case 1: // RAW
-                putstring("DATA: ");
-                put4hexspace(cardswritten++);
+                putstring(tag);
+                put4hexspace(cardno);
                 for (i=0; i<len; i++)
                     put3hexspace(*data++);
                 putCRNL();
@@ -281,6 +312,9 @@ void OutStatus()
         putstringint("Error",gpioGetValue(2,6));
         putstringint("Ready",gpioGetValue(3,0));
         putstringint("Pick",gpioGetValue(3,1));
+#ifdef CFG_JOURNAL
+        putstringint("journal",journalPending());
+#endif
         putstring("Data "); put3hexspace( ~GPIO_GPIO1DATA);
     putCRNL();
 }
@@ -290,9 +324,15 @@ static void prt(void)
     int i, j;
     int  actmode=0;
     long cnt=0;
+#ifdef CFG_JOURNAL
+    int  acking=0;
+    unsigned int ackseq=0;
+    uint32_t seq;
+#endif
 
     printf("\r\nUSB-RC3671 v20180117cb\r\n");
 
+
     // All GPIO's input per default
     
     //data
@@ -342,9 +382,35 @@ static void prt(void)
 
     //code
     multipick = 0;
+#ifdef CFG_JOURNAL
+    if (journalInit())
+    {
+        putstring("JOURNAL: init failed");
+        putCRNL();
+    }
+#endif
     while (1) 
     {
         j = CDC_getchar();
+#ifdef CFG_JOURNAL
+            // Collect the hex card number after K, CR or LF acknowledges
+            if (j && acking)
+            {
+                if (j >= '0' && j <= '9')
+                    ackseq = (ackseq << 4) | (j - '0');
+                else if (j >= 'A' && j <= 'F')
+                    ackseq = (ackseq << 4) | (j - 'A' + 10);
+                else if (j >= 'a' && j <= 'f')
+                    ackseq = (ackseq << 4) | (j - 'a' + 10);
+                else
+                {
+                    if (j == 13 || j == 10)
+                        journalAck(ackseq);
+                    acking = 0;
+                }
+                j = 0;
+            }
+#endif
             if (j)
             {
                     switch (j)
@@ -362,16 +428,89 @@ static void prt(void)
                             case 's':   
                         case 'a':   actmode = (actmode + 1) % 3;break;
                         case '?':   OutStatus(); break;
+#ifdef CFG_ARCHIVE
+                        case 'W':   putstringint("ARCHIVE: open", archiveOpen()); putCRNL(); break;
+                        case 'w':   putstringint("ARCHIVE: close", archiveClose()); putCRNL(); break;
+#endif
+#ifdef CFG_JOURNAL
+                        case 'K':   acking = 1; ackseq = 0; break;
+#endif
                     }
             }   
 
             int len;
             int card[MAXPOS];
 
+#ifdef CFG_JOURNAL
+            // Leave cards in the capture buffer while the journal is
+            // erasing rather than waiting for the flash
+            while (!journalBusy() && 0 < (len = GetData(card)))
+#else
             while (0 < (len = GetData(card)))
+#endif
             {
-                    OutFmtData(card, len);
+#ifdef CFG_JOURNAL
+                    // Only sent once it is safe in the journal, unless
+                    // the journal is full (or broken)
+                    journalError_t jerr = journalAddCard(card, len);
+                    if (jerr)
+                    {
+                        switch (jerr)
+                        {
+                            case JOURNAL_ERROR_FULL:
+                                putstring("JOURNAL: full");
+                                break;
+                            case JOURNAL_ERROR_FLASH:
+                                putstring("JOURNAL: flash error");
+                                break;
+                            case JOURNAL_ERROR_BUSY:
+                                putstring("JOURNAL: busy");
+                                break;
+                            case JOURNAL_ERROR_NOTINITIALISED:
+                                putstring("JOURNAL: not initialised");
+                                break;
+                            default:
+                                putstringint("JOURNAL: error", jerr);
+                                break;
+                        }
+                        putCRNL();
+                        OutFmtData("DIRECT: ", cardswritten++, card, len);
+                    }
+#else
+                    OutFmtData("DATA: ", cardswritten++, card, len);
+#endif
+#ifdef CFG_ARCHIVE
+                    if (archiveIsOpen() && archiveAddCard(card, len))
+                    {
+                        putstring("ARCHIVE: write failed");
+                        putCRNL();
+                    }
+#endif
             }   
+#ifdef CFG_ARCHIVE
+            // Hopper empty, so sync the archive once all cards are in
+            if (deckend && currrowwr == currrowrd)
+            {
+                deckend = 0;
+                if (archiveIsOpen() && archiveEndDeck())
+                {
+                    putstring("ARCHIVE: sync failed");
+                    putCRNL();
+                }
+            }
+            else if (archiveIsOpen() && archivePoll())
+            {
+                putstring("ARCHIVE: write failed");
+                putCRNL();
+            }
+#endif
+#ifdef CFG_JOURNAL
+            // Erase ahead and resend unacknowledged cards, then send
+            // whatever the host hasn't seen while it has the port open
+            journalPoll();
+            while (CDC_isOpen() && journalNextCard(card, &len, &seq))
+                OutFmtData("DATA: ", seq & 0xFFFF, card, len);
+#endif
         if (actmode < 2)
             gpioSetValue(2,7,actmode);
         else
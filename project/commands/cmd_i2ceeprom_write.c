@@ -91,7 +91,11 @@ void cmd_i2ceeprom_write(uint8_t argc, char **argv)
   val = (uint8_t)val32;
 
   // Write data at supplied address
-  eepromWriteU8(addr, val);
+  if (eepromWriteU8(addr, val) || eepromFlush())
+  {
+    printf("EEPROM write failed%s", CFG_PRINTF_NEWLINE);
+    return;
+  }
 
   // Write successful
   printf("0x%02X written at 0x%04X%s", val, addr, CFG_PRINTF_NEWLINE);
@@ -120,7 +120,7 @@ void cmd_sysinfo(uint8_t argc, char **argv)
     printf("%-25s : %d.%d C %s", "Temperature", temp / 1000, temp % 1000, CFG_PRINTF_NEWLINE);
   #endif
 
-  #ifdef CFG_SDCARD
+  #if defined CFG_SDCARD && CFG_SDCARD_CARDDETECT == 1
     printf("%-25s : %s %s", "SD Card Present", gpioGetValue(CFG_SDCARD_CDPORT, CFG_SDCARD_CDPIN) ? "True" : "False", CFG_PRINTF_NEWLINE);
   #endif
 }
@@ -69,6 +69,7 @@ void cmd_uart(uint8_t argc, char **argv)
     // Write baud rate to EEPROM and reinitialise UART if using it
     printf("Setting UART to: %d%s", (int)speed, CFG_PRINTF_NEWLINE);
     eepromWriteU32(CFG_EEPROM_UART_SPEED, speed);
+    eepromFlush();
     #ifdef CFG_PRINTF_UART
     uartInit(speed);
     #endif
@@ -80,13 +80,19 @@ void cmd_bmp(uint8_t argc, char **argv)
       printf("Not a Bitmap: '%s'%s", filename, CFG_PRINTF_NEWLINE);
       break;
     case BMP_ERROR_INVALIDBITDEPTH:
-      printf("Not a 24-Bit Image%s", CFG_PRINTF_NEWLINE);
+      printf("Not an 8, 16 or 24-Bit Image%s", CFG_PRINTF_NEWLINE);
       break;
     case BMP_ERROR_INVALIDDIMENSIONS:
       printf("Image Exceeds %d x %d Pixels%s", lcdGetWidth(), lcdGetHeight(), CFG_PRINTF_NEWLINE);
       break;
     case BMP_ERROR_COMPRESSEDDATA:
-      printf("Compressed Images Unsupported%s", CFG_PRINTF_NEWLINE);
+      printf("Compression Method Unsupported%s", CFG_PRINTF_NEWLINE);
+      break;
+    case BMP_ERROR_WRITEFAILED:
+      printf("Write Failed%s", CFG_PRINTF_NEWLINE);
+      break;
+    case BMP_ERROR_SDBUSY:
+      printf("SD card in use by the archive%s", CFG_PRINTF_NEWLINE);
       break;
     case BMP_ERROR_PREMATUREEOF:
       printf("Premature EOF%s", CFG_PRINTF_NEWLINE);
@@ -389,8 +389,30 @@
     CFG_SDCARD_READONLY       If this is set to 1, all commands to
                               write to the SD card will be removed
                               saving some flash space.
+    CFG_SDCARD_CARDDETECT     If this is set to 1, the card detect pin
+                              is sampled and a card is only accessed
+                              while present.  If set to 0 the card is
+                              assumed to be present and the pin is left
+                              alone (an empty socket then fails in
+                              disk_initialize).
     CFG_SDCARD_CDPORT         The card detect port number
     CFG_SDCARD_CDPIN          The card detect pin number
+    CFG_SDCARD_CACHESECTORS   Number of 512 byte sectors cached in SRAM
+                              below FatFS (0 to disable).  The FAT is
+                              kept in preference to other sectors.
+    CFG_SDCARD_READAHEAD      Number of extra sectors read (with one
+                              multi-block read) when sectors are read
+                              sequentially.  Must be less than
+                              CFG_SDCARD_CACHESECTORS.
+    CFG_SDCARD_WRITECOMBINE   Number of 512 byte sectors that consecutive
+                              writes are held in before being sent to
+                              the card with one multi-block write (0 to
+                              disable).  Held sectors are written when
+                              the run breaks, on f_sync/f_close or once
+                              idle.  Ignored if CFG_SDCARD_READONLY is 1.
+    CFG_SDCARD_WRITETIMEOUT   Time in milliseconds after the last write
+                              before held sectors are considered idle
+                              (see CTRL_WRITE_IDLE in diskio.h).
 
     NOTE:                     All config settings for FAT32 are defined
                               in ffconf.h
@@ -407,36 +429,105 @@
     #ifdef CFG_BRD_LPC1343_REFDESIGN
       // #define CFG_SDCARD
       #define CFG_SDCARD_READONLY         (1)   // Must be 0 or 1
+      #define CFG_SDCARD_CARDDETECT       (1)   // Must be 0 or 1
       #define CFG_SDCARD_CDPORT           (3)
       #define CFG_SDCARD_CDPIN            (0)
+      #define CFG_SDCARD_CACHESECTORS     (0)
+      #define CFG_SDCARD_READAHEAD        (0)
+      #define CFG_SDCARD_WRITECOMBINE     (0)
+      #define CFG_SDCARD_WRITETIMEOUT     (100)
     #endif
 
     #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
       // #define CFG_SDCARD
       #define CFG_SDCARD_READONLY         (1)   // Must be 0 or 1
+      #define CFG_SDCARD_CARDDETECT       (1)   // Must be 0 or 1
       #define CFG_SDCARD_CDPORT           (3)
       #define CFG_SDCARD_CDPIN            (0)
+      #define CFG_SDCARD_CACHESECTORS     (0)
+      #define CFG_SDCARD_READAHEAD        (0)
+      #define CFG_SDCARD_WRITECOMBINE     (0)
+      #define CFG_SDCARD_WRITETIMEOUT     (100)
     #endif
 
     #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
       #define CFG_SDCARD
       #define CFG_SDCARD_READONLY         (1)   // Must be 0 or 1
+      #define CFG_SDCARD_CARDDETECT       (1)   // Must be 0 or 1
       #define CFG_SDCARD_CDPORT           (3)
       #define CFG_SDCARD_CDPIN            (0)
+      #define CFG_SDCARD_CACHESECTORS     (4)
+      #define CFG_SDCARD_READAHEAD        (2)
+      #define CFG_SDCARD_WRITECOMBINE     (2)
+      #define CFG_SDCARD_WRITETIMEOUT     (100)
     #endif
 
     #ifdef CFG_BRD_LPC1343_802154USBSTICK
       // #define CFG_SDCARD
       #define CFG_SDCARD_READONLY         (1)   // Must be 0 or 1
+      #define CFG_SDCARD_CARDDETECT       (1)   // Must be 0 or 1
       #define CFG_SDCARD_CDPORT           (3)
       #define CFG_SDCARD_CDPIN            (0)
+      #define CFG_SDCARD_CACHESECTORS     (0)
+      #define CFG_SDCARD_READAHEAD        (0)
+      #define CFG_SDCARD_WRITECOMBINE     (0)
+      #define CFG_SDCARD_WRITETIMEOUT     (100)
     #endif
 
     #ifdef CFG_BRD_LPC1343_OLIMEX_P
       // #define CFG_SDCARD
       #define CFG_SDCARD_READONLY         (1)   // Must be 0 or 1
+      #define CFG_SDCARD_CARDDETECT       (0)   // Must be 0 or 1
       #define CFG_SDCARD_CDPORT           (3)
       #define CFG_SDCARD_CDPIN            (0)
+      #define CFG_SDCARD_CACHESECTORS     (0)
+      #define CFG_SDCARD_READAHEAD        (0)
+      #define CFG_SDCARD_WRITECOMBINE     (0)
+      #define CFG_SDCARD_WRITETIMEOUT     (100)
+    #endif
+/*=========================================================================*/
+
+
+/*=========================================================================
+    CARD ARCHIVE
+    -----------------------------------------------------------------------
+
+    CFG_ARCHIVE               If this field is defined, cards captured
+                              by the reader can be archived to the SD
+                              card without a PC attached (see archive.c)
+    CFG_ARCHIVE_PREALLOCATE   The size in bytes that each new archive
+                              file is pre-allocated to.  Unused space is
+                              trimmed when the file is closed.
+
+    DEPENDENCIES:             ARCHIVE requires CFG_SDCARD with
+                              CFG_SDCARD_READONLY set to 0.  The default
+                              card detect pin (3.0) is the reader's RDY
+                              signal, so CFG_SDCARD_CARDDETECT must be 0
+                              or card detect moved to another pin.
+    -----------------------------------------------------------------------*/
+    #ifdef CFG_BRD_LPC1343_REFDESIGN
+      // #define CFG_ARCHIVE
+      #define CFG_ARCHIVE_PREALLOCATE     (1048576)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
+      // #define CFG_ARCHIVE
+      #define CFG_ARCHIVE_PREALLOCATE     (1048576)
+    #endif
+
+    #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
+      // #define CFG_ARCHIVE
+      #define CFG_ARCHIVE_PREALLOCATE     (1048576)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_802154USBSTICK
+      // #define CFG_ARCHIVE
+      #define CFG_ARCHIVE_PREALLOCATE     (1048576)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_OLIMEX_P
+      // #define CFG_ARCHIVE
+      #define CFG_ARCHIVE_PREALLOCATE     (1048576)
     #endif
 /*=========================================================================*/
 
@@ -747,31 +838,146 @@
     CFG_I2CEEPROM             If defined, drivers for the onboard EEPROM
                               will be included during build
     CFG_I2CEEPROM_SIZE        The number of bytes available on the EEPROM
+    CFG_I2CEEPROM_SHADOWSIZE  The number of bytes at the start of the
+                              EEPROM (the settings area below) kept in
+                              a RAM shadow.  Writes there are collected
+                              until eepromFlush writes the changed 32
+                              byte pages.  A multiple of 32, up to
+                              1024, or 0 to write everything straight
+                              through.
 
     -----------------------------------------------------------------------*/
     #ifdef CFG_BRD_LPC1343_REFDESIGN
       #define CFG_I2CEEPROM
       #define CFG_I2CEEPROM_SIZE          (3072)
+      #define CFG_I2CEEPROM_SHADOWSIZE    (128)
     #endif
 
     #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
       // #define CFG_I2CEEPROM
       #define CFG_I2CEEPROM_SIZE          (3072)
+      #define CFG_I2CEEPROM_SHADOWSIZE    (128)
     #endif
 
     #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
       #define CFG_I2CEEPROM
       #define CFG_I2CEEPROM_SIZE          (3072)
+      #define CFG_I2CEEPROM_SHADOWSIZE    (128)
     #endif
 
     #ifdef CFG_BRD_LPC1343_802154USBSTICK
       #define CFG_I2CEEPROM
       #define CFG_I2CEEPROM_SIZE          (3072)
+      #define CFG_I2CEEPROM_SHADOWSIZE    (128)
     #endif
 
     #ifdef CFG_BRD_LPC1343_OLIMEX_P
       // #define CFG_I2CEEPROM
       #define CFG_I2CEEPROM_SIZE          (3072)
+      #define CFG_I2CEEPROM_SHADOWSIZE    (128)
+    #endif
+/*=========================================================================*/
+
+
+/*=========================================================================
+    SPI FLASH KEY/VALUE STORE
+    -----------------------------------------------------------------------
+
+    CFG_KVSTORE               If defined, a log-structured key/value
+                              store (drivers/spiflash/kvstore.c) is
+                              kept on the SPI flash
+    CFG_KVSTORE_FIRSTSECTOR   The first 4KB SPI flash sector used by
+                              the store
+    CFG_KVSTORE_SECTORS       The number of sectors used by the store
+                              (3..254).  One sector is always kept
+                              free for compaction.
+    CFG_KVSTORE_MAXKEYS       The number of keys that can be stored.
+                              The RAM index takes 6 bytes per key.
+
+    DEPENDENCIES:             KVSTORE requires the use of SSP0.
+    -----------------------------------------------------------------------*/
+    #ifdef CFG_BRD_LPC1343_REFDESIGN
+      // #define CFG_KVSTORE
+      #define CFG_KVSTORE_FIRSTSECTOR     (0)
+      #define CFG_KVSTORE_SECTORS         (16)
+      #define CFG_KVSTORE_MAXKEYS         (32)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
+      // #define CFG_KVSTORE
+      #define CFG_KVSTORE_FIRSTSECTOR     (0)
+      #define CFG_KVSTORE_SECTORS         (16)
+      #define CFG_KVSTORE_MAXKEYS         (32)
+    #endif
+
+    #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
+      // #define CFG_KVSTORE
+      #define CFG_KVSTORE_FIRSTSECTOR     (0)
+      #define CFG_KVSTORE_SECTORS         (16)
+      #define CFG_KVSTORE_MAXKEYS         (32)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_802154USBSTICK
+      // #define CFG_KVSTORE
+      #define CFG_KVSTORE_FIRSTSECTOR     (0)
+      #define CFG_KVSTORE_SECTORS         (16)
+      #define CFG_KVSTORE_MAXKEYS         (32)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_OLIMEX_P
+      // #define CFG_KVSTORE
+      #define CFG_KVSTORE_FIRSTSECTOR     (0)
+      #define CFG_KVSTORE_SECTORS         (16)
+      #define CFG_KVSTORE_MAXKEYS         (32)
+    #endif
+/*=========================================================================*/
+
+
+/*=========================================================================
+    CAPTURE JOURNAL
+    -----------------------------------------------------------------------
+
+    CFG_JOURNAL               If defined, every captured card is written
+                              to a circular journal on the SPI flash
+                              (journal.c) and kept until the host
+                              acknowledges it, so cards survive a lost
+                              USB connection or a power failure
+    CFG_JOURNAL_FIRSTSECTOR   The first 4KB SPI flash sector used by
+                              the journal (after the key/value store)
+    CFG_JOURNAL_SECTORS       The number of sectors used by the journal
+                              (at least 2).  Each sector holds 15 cards.
+
+    DEPENDENCIES:             JOURNAL requires the use of SSP0 and
+                              CFG_USBCDC.
+    -----------------------------------------------------------------------*/
+    #ifdef CFG_BRD_LPC1343_REFDESIGN
+      // #define CFG_JOURNAL
+      #define CFG_JOURNAL_FIRSTSECTOR     (16)
+      #define CFG_JOURNAL_SECTORS         (496)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
+      // #define CFG_JOURNAL
+      #define CFG_JOURNAL_FIRSTSECTOR     (16)
+      #define CFG_JOURNAL_SECTORS         (496)
+    #endif
+
+    #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
+      // #define CFG_JOURNAL
+      #define CFG_JOURNAL_FIRSTSECTOR     (16)
+      #define CFG_JOURNAL_SECTORS         (496)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_802154USBSTICK
+      // #define CFG_JOURNAL
+      #define CFG_JOURNAL_FIRSTSECTOR     (16)
+      #define CFG_JOURNAL_SECTORS         (496)
+    #endif
+
+    #ifdef CFG_BRD_LPC1343_OLIMEX_P
+      // #define CFG_JOURNAL
+      #define CFG_JOURNAL_FIRSTSECTOR     (16)
+      #define CFG_JOURNAL_SECTORS         (496)
     #endif
 /*=========================================================================*/
 
@@ -851,9 +1057,30 @@
     CFG_CHIBI_PANID             16-bit PAN Identifier (ex.0x1234)
     CFG_CHIBI_PROMISCUOUS       Set to 1 to enabled promiscuous mode or
                                 0 to disable it.  If promiscuous mode is
-                                enabled be sure to set CFG_CHIBI_BUFFERSIZE
-                                to an appropriately large value (ex. 1024)
-    CFG_CHIBI_BUFFERSIZE        The size of the message buffer in bytes
+                                enabled be sure to set CFG_CHIBI_RXFRAMES
+                                to an appropriately large value (ex. 7)
+    CFG_CHIBI_RXFRAMES          The number of received frames that can be
+                                queued (140 bytes of RAM each)
+    CFG_CHIBI_TXFRAMES          The number of frames chb_write_async can
+                                queue for transmission (128 bytes each)
+    CFG_CHIBI_RXTIMESTAMP       If defined, the 32-bit timer with this
+                                number (0..1) counts microseconds and every
+                                received frame is stamped with its value at
+                                RX_START (see the sniffer_wsbridge example).
+                                The timer can't be used for anything else.
+                                Timer 0 (CT32B0) also paces adcStreamStart
+                                in ADC_STREAM_TIMER mode, which then
+                                returns false, so use timer 1 if the ADC
+                                stream is needed
+    CFG_CHIBI_AUTOCHANNEL       If defined, chb_init surveys channels 1-10
+                                this many times (20ms each per sweep) and
+                                uses the quietest one instead of
+                                CFG_CHIBI_CHANNEL.  915 MHz modes only.
+                                chb_init blocks for the whole survey (about
+                                800ms with 4 sweeps) at boot.  Every node
+                                picks its own quietest channel, so nodes
+                                that hear different noise can end up on
+                                different channels and not see each other
 
     DEPENDENCIES:               Chibi requires the use of SSP0, 16-bit timer
                                 0 and pins 3.1, 3.2, 3.3.  It also requires
@@ -870,7 +1097,10 @@
       #define CFG_CHIBI_CHANNEL           (0)                 // 868-868.6 MHz
       #define CFG_CHIBI_PANID             (0x1234)
       #define CFG_CHIBI_PROMISCUOUS       (0)
-      #define CFG_CHIBI_BUFFERSIZE        (128)
+      #define CFG_CHIBI_RXFRAMES          (2)
+      #define CFG_CHIBI_TXFRAMES          (2)
+      // #define CFG_CHIBI_RXTIMESTAMP    (1)
+      // #define CFG_CHIBI_AUTOCHANNEL    (4)
     #endif
 
     #ifdef CFG_BRD_LPC1343_REFDESIGN_MINIMAL
@@ -880,7 +1110,10 @@
       #define CFG_CHIBI_CHANNEL           (0)                 // 868-868.6 MHz
       #define CFG_CHIBI_PANID             (0x1234)
       #define CFG_CHIBI_PROMISCUOUS       (0)
-      #define CFG_CHIBI_BUFFERSIZE        (128)
+      #define CFG_CHIBI_RXFRAMES          (2)
+      #define CFG_CHIBI_TXFRAMES          (2)
+      // #define CFG_CHIBI_RXTIMESTAMP    (1)
+      // #define CFG_CHIBI_AUTOCHANNEL    (4)
     #endif
 
     #if defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_USB || defined CFG_BRD_LPC1343_TFTLCDSTANDALONE_UART
@@ -890,7 +1123,10 @@
       #define CFG_CHIBI_CHANNEL           (0)                 // 868-868.6 MHz
       #define CFG_CHIBI_PANID             (0x1234)
       #define CFG_CHIBI_PROMISCUOUS       (0)
-      #define CFG_CHIBI_BUFFERSIZE        (128)
+      #define CFG_CHIBI_RXFRAMES          (2)
+      #define CFG_CHIBI_TXFRAMES          (2)
+      // #define CFG_CHIBI_RXTIMESTAMP    (1)
+      // #define CFG_CHIBI_AUTOCHANNEL    (4)
     #endif
 
     #ifdef CFG_BRD_LPC1343_802154USBSTICK
@@ -900,7 +1136,10 @@
       #define CFG_CHIBI_CHANNEL           (0)                 // 868-868.6 MHz
       #define CFG_CHIBI_PANID             (0x1234)
       #define CFG_CHIBI_PROMISCUOUS       (0)
-      #define CFG_CHIBI_BUFFERSIZE        (1024)
+      #define CFG_CHIBI_RXFRAMES          (7)
+      #define CFG_CHIBI_TXFRAMES          (2)
+      // #define CFG_CHIBI_RXTIMESTAMP    (1)
+      // #define CFG_CHIBI_AUTOCHANNEL    (4)
     #endif
 
     #ifdef CFG_BRD_LPC1343_OLIMEX_P
@@ -910,7 +1149,10 @@
       #define CFG_CHIBI_CHANNEL           (0)                 // 868-868.6 MHz
       #define CFG_CHIBI_PANID             (0x1234)
       #define CFG_CHIBI_PROMISCUOUS       (0)
-      #define CFG_CHIBI_BUFFERSIZE        (128)
+      #define CFG_CHIBI_RXFRAMES          (2)
+      #define CFG_CHIBI_TXFRAMES          (2)
+      // #define CFG_CHIBI_RXTIMESTAMP    (1)
+      // #define CFG_CHIBI_AUTOCHANNEL    (4)
     #endif
 
 /*=========================================================================*/
@@ -1079,6 +1321,45 @@
   #endif
 #endif
 
+#ifdef CFG_SDCARD
+  #if CFG_SDCARD_CACHESECTORS > 0 && CFG_SDCARD_READAHEAD >= CFG_SDCARD_CACHESECTORS
+    #error "CFG_SDCARD_READAHEAD must be less than CFG_SDCARD_CACHESECTORS"
+  #endif
+#endif
+
+#ifdef CFG_I2CEEPROM
+  #if CFG_I2CEEPROM_SHADOWSIZE % 32 != 0 || CFG_I2CEEPROM_SHADOWSIZE > 1024
+    #error "CFG_I2CEEPROM_SHADOWSIZE must be a multiple of 32, up to 1024"
+  #endif
+#endif
+
+#ifdef CFG_KVSTORE
+  #if CFG_KVSTORE_SECTORS < 3 || CFG_KVSTORE_SECTORS > 254
+    #error "CFG_KVSTORE_SECTORS must be between 3 and 254"
+  #endif
+#endif
+
+#ifdef CFG_JOURNAL
+  #if !defined CFG_USBCDC
+    #error "CFG_JOURNAL requires CFG_USBCDC"
+  #endif
+  #if CFG_JOURNAL_SECTORS < 2
+    #error "CFG_JOURNAL_SECTORS must be at least 2"
+  #endif
+  #if defined CFG_KVSTORE && CFG_JOURNAL_FIRSTSECTOR < CFG_KVSTORE_FIRSTSECTOR + CFG_KVSTORE_SECTORS && CFG_KVSTORE_FIRSTSECTOR < CFG_JOURNAL_FIRSTSECTOR + CFG_JOURNAL_SECTORS
+    #error "CFG_JOURNAL and CFG_KVSTORE use the same SPI flash sectors"
+  #endif
+#endif
+
+#ifdef CFG_ARCHIVE
+  #if !defined CFG_SDCARD || CFG_SDCARD_READONLY != 0
+    #error "CFG_ARCHIVE requires CFG_SDCARD with CFG_SDCARD_READONLY set to 0"
+  #endif
+  #if CFG_SDCARD_CARDDETECT == 1 && CFG_SDCARD_CDPORT == 3 && CFG_SDCARD_CDPIN == 0
+    #error "CFG_ARCHIVE can not use card detect on pin 3.0 since it is the reader's RDY line. Set CFG_SDCARD_CARDDETECT to 0."
+  #endif
+#endif
+
 #ifdef CFG_CHIBI
   #if !defined CFG_I2CEEPROM
     #error "CFG_CHIBI requires CFG_I2CEEPROM to store and retrieve addresses"
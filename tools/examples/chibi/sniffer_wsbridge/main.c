@@ -37,6 +37,7 @@
 #include "sysinit.h"
 
 #include "core/gpio/gpio.h"
+#include "core/systick/systick.h"
 
 #if defined CFG_CHIBI
   #include <string.h>
@@ -44,28 +45,103 @@
   #include "drivers/chibi/chb.h"
   #include "drivers/chibi/chb_drvr.h"
   #include "core/uart/uart.h"
-  static chb_rx_data_t rx_data;
 #endif
 
 #ifdef CFG_PRINTF_USBCDC
-  volatile unsigned int lastTick;
   #include "core/usbcdc/usb.h"
   #include "core/usbcdc/usbcore.h"
-  #include "core/usbcdc/usbhw.h"
   #include "core/usbcdc/cdcuser.h"
-  #include "core/usbcdc/cdc_buf.h"
+#endif
+
+// Sniffer record, as understood by wsbridge:
+//
+//   sync, frame length, RX_START timestamp (us, 32-bit little endian),
+//   ED level, LQI, channel, flags, then the frame including the FCS
+#define SNIFFER_SYNC        (0xC3)  // Never a valid frame length byte
+#define SNIFFER_HDRLEN      (10)
+#define SNIFFER_FLAG_CRCOK  (0x01)
+
+#define SNIFFER_PACKETSIZE  (64)    // USB full-speed bulk packet
+
+#if defined CFG_CHIBI && CFG_CHIBI_PROMISCUOUS != 0
+static uint8_t snifferPacket[SNIFFER_PACKETSIZE];
+static uint32_t snifferPacketLen = 0;
+static uint32_t snifferPacketTick;  // When the first byte went in
+
+/**************************************************************************/
+/*! 
+    Sends the records collected so far in one go
+*/
+/**************************************************************************/
+static void snifferFlush(void)
+{
+  if (!snifferPacketLen)
+  {
+    return;
+  }
+
+  #ifdef CFG_PRINTF_UART
+    uartSend(snifferPacket, snifferPacketLen);
+  #endif
+  #ifdef CFG_PRINTF_USBCDC
+    // Wait for the previous packet to go out (unless USB isn't there)
+    while (USB_Configuration && !CDC_writePacket(snifferPacket, snifferPacketLen));
+  #endif
+
+  snifferPacketLen = 0;
+}
+
+/**************************************************************************/
+/*! 
+    Adds data to the current packet, sending every packet that fills up
+*/
+/**************************************************************************/
+static void snifferWrite(const uint8_t *data, uint32_t len)
+{
+  uint32_t n;
+
+  while (len)
+  {
+    if (!snifferPacketLen)
+    {
+      snifferPacketTick = systickGetTicks();
+    }
+
+    n = SNIFFER_PACKETSIZE - snifferPacketLen;
+    if (n > len)
+    {
+      n = len;
+    }
+    memcpy(snifferPacket + snifferPacketLen, data, n);
+    snifferPacketLen += n;
+    data += n;
+    len -= n;
+
+    if (snifferPacketLen == SNIFFER_PACKETSIZE)
+    {
+      snifferFlush();
+    }
+  }
+}
 #endif
 
 /**************************************************************************/
 /*! 
     Use Chibi as a wireless sniffer and write all captured frames
     to UART or USB CDC for wsbridge to handle (see "tools/wsbridge")
+
+    Every frame is sent as a record with the time its reception
+    started (in microseconds, from the 32-bit timer), the ED level,
+    LQI, channel and whether the FCS was valid.  Records are packed
+    into full 64 byte packets, and a partly filled packet is sent
+    once the radio has been quiet for a systick.
   
     projectconfig.h settings:
     --------------------------------------------------
     CFG_CHIBI             -> Enabled
     CFG_CHIBI_PROMISCUOUS -> 1
-    CFG_CHIBI_BUFFERSIZE  -> 1024   
+    CFG_CHIBI_RXFRAMES    -> 7
+    CFG_CHIBI_RXTIMESTAMP -> 1 (the free 32-bit timer)
 */
 /**************************************************************************/
 int main(void)
@@ -80,64 +156,52 @@ int main(void)
   #if CFG_CHIBI_PROMISCUOUS == 0
     #error "CFG_CHIBI_PROMISCUOUS must set to 1 in projectconfig.h for this example"
   #endif
+  #if !defined CFG_CHIBI_RXTIMESTAMP
+    #error "CFG_CHIBI_RXTIMESTAMP must be defined in projectconfig.h for this example"
+  #endif
   #if defined CFG_INTERFACE
     #error "CFG_INTERFACE must be disabled in projectconfig.h for this example"
   #endif
 
   #if defined CFG_CHIBI && CFG_CHIBI_PROMISCUOUS != 0
-    // Get a reference to the Chibi peripheral control block
-    chb_pcb_t *pcb = chb_get_pcb();
-    
-    // Wait for incoming frames and transmit the raw data over uart
+    chb_frame_t *frame;
+    uint8_t header[SNIFFER_HDRLEN];
+    uint8_t channel = chb_get_channel();
+
+    // Wait for incoming frames and send them to the PC
     while(1)
     {
-      // Check for incoming messages 
-      while (pcb->data_rcv) 
+      // Check for incoming messages, they are copied straight from the
+      // receive queue into the outgoing packet
+      while ((frame = chb_get_frame()) != NULL)
       { 
-        // get the length of the data
-        rx_data.len = chb_read(&rx_data);
-        // make sure the length is nonzero
-        if (rx_data.len)
-        {
-          // Enable LED to indicate message reception 
-          gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_ON); 
-
-          
-          // Send raw data the to PC for processing using wsbridge
-          uint8_t i;
-          for (i=0; i<rx_data.len; i++)
-          {
-            #ifdef CFG_PRINTF_UART
-              uartSendByte(rx_data.data[i]);
-            #endif
-            #ifdef CFG_PRINTF_USBCDC
-               // ToDo: This really needs to be refactored!
-              if (USB_Configuration) 
-              {
-                cdcBufferWrite(rx_data.data[i]);
-                // Check if we can flush the buffer now or if we need to wait
-                unsigned int currentTick = systickGetTicks();
-                if (currentTick != lastTick)
-                {
-                  uint8_t frame[64];
-                  uint32_t bytesRead = 0;
-                  while (cdcBufferDataPending())
-                  {
-                    // Read 64 byte chunks until end of data
-                    bytesRead = cdcBufferReadLen(frame, 64);
-                    // debug_printf("%d,", bytesRead);
-                    USB_WriteEP (CDC_DEP_IN, frame, bytesRead);
-                    systickDelay(1);
-                  }
-                  lastTick = currentTick;
-                }
-              }  
-            #endif
-          }
-
-          // Disable LED
-          gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_OFF); 
-        }
+        // Enable LED to indicate message reception 
+        gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_ON); 
+
+        header[0] = SNIFFER_SYNC;
+        header[1] = frame->len;
+        header[2] = frame->rx_start & 0xFF;
+        header[3] = (frame->rx_start >> 8) & 0xFF;
+        header[4] = (frame->rx_start >> 16) & 0xFF;
+        header[5] = (frame->rx_start >> 24) & 0xFF;
+        header[6] = frame->ed;
+        header[7] = frame->lqi;
+        header[8] = channel;
+        header[9] = frame->crc_ok ? SNIFFER_FLAG_CRCOK : 0;
+        snifferWrite(header, SNIFFER_HDRLEN);
+        snifferWrite(frame->data, frame->len);
+
+        // Hand the slot back to the radio
+        chb_free_frame();
+
+        // Disable LED
+        gpioSetValue (CFG_LED_PORT, CFG_LED_PIN, CFG_LED_OFF); 
+      }
+
+      // Nothing else waiting, don't hold back a partial packet for long
+      if (snifferPacketLen && (systickGetTicks() != snifferPacketTick))
+      {
+        snifferFlush();
       }
     }
   #endif
@@ -44,15 +44,44 @@
 
 #include "drivers/lcd/tft/lcd.h"
 #include "drivers/lcd/tft/drawing.h"
-#include "drivers/lcd/tft/touchscreen.h"
+#include "drivers/lcd/tft/scope.h"
 #include "drivers/lcd/tft/fonts/dejavusans9.h"
 #include "drivers/lcd/tft/fonts/dejavusansbold9.h"
 
-static uint8_t adcBuffer[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-static uint8_t digBuffer[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+// Plot area, one column per sample
+#define SCOPE_LEFT        (10)
+#define SCOPE_TOP         (25)
+#define SCOPE_WIDTH       (226)
+#define SCOPE_HEIGHT      (176)
+#define SCOPE_DIV         (25)      // Pixels per division
 
-bool adcEnabled = true;
-bool digEnabled = false;
+// AD5 is sampled at 2.5kHz, so one division (25 samples) is 10ms and
+// each block fills the width of the plot area
+#define SCOPE_SAMPLERATE  (2500)
+
+// 3.3V (1023) is drawn ~165 pixels up, leaving the top at ~3.5V
+#define SCOPE_FULLSCALE   (1023 * (SCOPE_HEIGHT - 1) / 165)
+
+static uint16_t adcSamples[2 * SCOPE_WIDTH];
+
+// P2.0 is read once per block, and scrolls across the plot area
+static uint16_t digSamples[SCOPE_WIDTH];
+
+/**************************************************************************/
+/*! 
+    Renders the channel names in their trace colors.  Touch can't be
+    used to switch them on and off, since the touch screen needs the
+    A/D converter that the sample stream is holding.
+*/
+/**************************************************************************/
+void renderLCDChannels(void)
+{
+  drawRectangleFilled(20, 210, 240, 235, COLOR_GRAY_80);
+  drawString( 25, 220, COLOR_BLACK,  &dejaVuSansBold9ptFontInfo, "P1.4 (Analog)");
+  drawString( 24, 219, COLOR_YELLOW, &dejaVuSansBold9ptFontInfo, "P1.4 (Analog)");
+  drawString(135, 220, COLOR_BLACK,  &dejaVuSansBold9ptFontInfo, "P2.0 (Digital)");
+  drawString(134, 219, COLOR_GREEN,  &dejaVuSansBold9ptFontInfo, "P2.0 (Digital)");
+}
 
 /**************************************************************************/
 /*! 
@@ -62,7 +91,7 @@ bool digEnabled = false;
 void renderLCDFrame(void)
 {
   // Clear the screen
-  drawFill(COLOR_DARKGRAY);
+  drawFill(COLOR_GRAY_80);
 
   // Render V references
   drawString(245,  27, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "3.5V");
@@ -71,19 +100,16 @@ void renderLCDFrame(void)
   drawString(244, 194, COLOR_WHITE, &dejaVuSansBold9ptFontInfo, "0.0V");
 
   // Div settings
-  drawString( 10, 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "~100ms/Div");
-  drawString(  9,  9, COLOR_WHITE, &dejaVuSansBold9ptFontInfo, "~100ms/Div");
+  drawString( 10, 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "10ms/Div");
+  drawString(  9,  9, COLOR_WHITE, &dejaVuSansBold9ptFontInfo, "10ms/Div");
   drawString( 95, 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "500mV/Div");
   drawString( 94,  9, COLOR_WHITE, &dejaVuSansBold9ptFontInfo, "500mV/Div");
 
-  // Clear the ADC output level just in case
-  drawRectangleFilled(175, 5, 250, 18, COLOR_DARKGRAY);
+  // Border around the data grid
+  drawRectangle(SCOPE_LEFT - 1, SCOPE_TOP - 1, SCOPE_LEFT + SCOPE_WIDTH, SCOPE_TOP + SCOPE_HEIGHT, COLOR_GRAY_200);
 
   // Render the channel text
-  drawString( 25, 220, COLOR_BLACK,  &dejaVuSansBold9ptFontInfo, "P1.4 (Analog)");
-  drawString( 24, 219, adcEnabled ? COLOR_YELLOW : COLOR_MEDIUMGRAY, &dejaVuSansBold9ptFontInfo, "P1.4 (Analog)");
-  drawString(135, 220, COLOR_BLACK,  &dejaVuSansBold9ptFontInfo, "P2.0 (Digital)");
-  drawString(134, 219, digEnabled ? COLOR_GREEN : COLOR_MEDIUMGRAY, &dejaVuSansBold9ptFontInfo, "P2.0 (Digital)");
+  renderLCDChannels();
 
   // ADC Warning
   drawString(245,  80, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "Warning:");
@@ -95,106 +121,22 @@ void renderLCDFrame(void)
 
 /**************************************************************************/
 /*! 
-    Converts the supplied 8-bit value to an approximate pixel height in
-    the data grid
+    Renders the latest ADC reading as text above the grid
 */
 /**************************************************************************/
-uint16_t adcValToPixel(uint8_t value)
+void renderLCDValue(uint16_t value)
 {
-  // Since the chart is 175 pixels high and 3.3V is at
-  // approximately 165 pixels height, we need to
-  // divide the 8 bit ADC readings by 1.545 (255/165)
-  // using fixed point math, and then substract
-  // the number from the bottom of the frame
-  uint16_t pixel = 0;
-  pixel = 200 - (value * 1000 / 1545);
-  return pixel;
-}
-
-/**************************************************************************/
-/*! 
-    Redraws the grid and renders the data points on the LCD
-*/
-/**************************************************************************/
-void renderLCDGrid(void)
-{
-  if ((!adcEnabled) && (!digEnabled))
-  {    
-    return;
-  }
-
-  // Redraw the grid
-  drawRectangle(9, 24, 236, 201, COLOR_LIGHTGRAY);
-  drawRectangleFilled(10, 25, 235, 200, COLOR_BLACK);
-
-  // Horizontal lines
-  drawLine(10,  50, 235,  50, COLOR_DARKERGRAY);
-  drawLine(10,  75, 235,  75, COLOR_DARKERGRAY);
-  drawLine(10, 100, 235, 100, COLOR_DARKERGRAY);
-  drawLine(10, 125, 235, 125, COLOR_DARKERGRAY);
-  drawLine(10, 150, 235, 150, COLOR_DARKERGRAY);
-  drawLine(10, 175, 235, 175, COLOR_DARKERGRAY);
-
-  // Vertical lines
-  drawLine( 35, 25,  35, 200, COLOR_DARKERGRAY);
-  drawLine( 60, 25,  60, 200, COLOR_DARKERGRAY);
-  drawLine( 85, 25,  85, 200, COLOR_DARKERGRAY);
-  drawLine(110, 25, 110, 200, COLOR_DARKERGRAY);
-  drawLine(135, 25, 135, 200, COLOR_DARKERGRAY);
-  drawLine(160, 25, 160, 200, COLOR_DARKERGRAY);
-  drawLine(185, 25, 185, 200, COLOR_DARKERGRAY);
-  drawLine(210, 25, 210, 200, COLOR_DARKERGRAY);
-
-  // Render the individual data points
-  uint32_t counter;
-  for (counter = 0; counter < 9; counter++)
-  {
-    // Draw historical data
-    uint32_t arrayPosition = 9 - counter;
-
-    // Draw analog data points (Yellow)
-    if (adcEnabled)
-    {
-      drawLine(10 + counter * 25, adcValToPixel(adcBuffer[arrayPosition]), 10 + (counter + 1) * 25, adcValToPixel(adcBuffer[arrayPosition - 1]), COLOR_YELLOW);
-    }
-
-    // Draw digital data points (Green)
-    if (digEnabled)
-    {
-      drawLine(10 + counter * 25, adcValToPixel(digBuffer[arrayPosition]), 10 + (counter + 1) * 25, adcValToPixel(digBuffer[arrayPosition - 1]), COLOR_GREEN);
-    }
-  }
-
-  // Render ADC value in text if present
-  if (adcEnabled)
-  {
-    char text[10];
-    // Assuming 3.3V supply and 8-bit ADC values, 1 unit = 12.89mV (3300/256)
-    sprintf(text, "%u.%u V", ((adcBuffer[0] * 1289) / 100) / 1000, ((adcBuffer[0] * 1294) / 100) % 1000);
-    // Clear the previous text
-    drawRectangleFilled(175, 5, 250, 18, COLOR_DARKGRAY);
-    // Render the latest value in mV
-    drawString(180, 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, text);
-    drawString(179,  9, COLOR_YELLOW, &dejaVuSansBold9ptFontInfo, text);
-  }
-}
-
-/**************************************************************************/
-/*! 
-    Shifts the buffer contents right one byte, and inserts the latest
-    value at the beginning.
-*/
-/**************************************************************************/
-void addToBuffer(uint8_t *buffer, uint8_t value)
-{
-  uint32_t counter;
-  for (counter = 9; counter > 0; counter--)
-  {
-    buffer[counter] = buffer[counter - 1];
-  }
-
-  // Append the latest value
-  buffer[0] = value;
+  char text[10];
+  uint32_t mv;
+
+  // Assuming 3.3V supply and 10-bit ADC values
+  mv = (value * 3300) / 1023;
+  sprintf(text, "%u.%03u V", (unsigned int)(mv / 1000), (unsigned int)(mv % 1000));
+  // Clear the previous text
+  drawRectangleFilled(175, 5, 250, 18, COLOR_GRAY_80);
+  // Render the latest value
+  drawString(180, 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, text);
+  drawString(179,  9, COLOR_YELLOW, &dejaVuSansBold9ptFontInfo, text);
 }
 
 /**************************************************************************/
@@ -229,44 +171,43 @@ int main(void)
   lcdSetOrientation(LCD_ORIENTATION_LANDSCAPE);
   renderLCDFrame();
 
-  tsTouchData_t touch;
+  // The scope module only redraws the parts of each trace that change
+  scopeInit(SCOPE_LEFT, SCOPE_TOP, SCOPE_WIDTH, SCOPE_HEIGHT, SCOPE_DIV, SCOPE_DIV, COLOR_BLACK, COLOR_GRAY_30);
+  scopeSetTrace(0, COLOR_YELLOW, SCOPE_FULLSCALE);
+  scopeSetTrace(1, COLOR_GREEN, SCOPE_FULLSCALE);
+
+  uint16_t *block;
+  uint32_t i;
+
+  // Sample AD5 from the ADC interrupt, paced by CT32B0, one block
+  // per sweep of the plot area
+  if (!adcStreamStart(ADC_STREAM_TIMER, ADC_AD0CR_SEL_AD5, SCOPE_SAMPLERATE, 1, adcSamples, SCOPE_WIDTH))
+  {
+    // The ADC is busy or CT32B0 is taken (see CFG_CHIBI_RXTIMESTAMP)
+    drawString(SCOPE_LEFT + 10, SCOPE_TOP + 10, COLOR_BLACK, &dejaVuSansBold9ptFontInfo, "Unable to start the ADC");
+    drawString(SCOPE_LEFT +  9, SCOPE_TOP +  9, COLOR_RED, &dejaVuSansBold9ptFontInfo, "Unable to start the ADC");
+    while (1);
+  }
 
   // Start reading
   while (1)
   {
-    // Wait up to 5ms for a touch event
-    tsTouchError_t error = tsWaitForEvent(&touch, 5);
-    if (!error)
+    // Wait for the next sweep
+    block = adcStreamGetBlock();
+    if (!block)
+      continue;
+
+    // Draw the sweep, only the columns that changed are sent to the LCD
+    scopeDrawBlock(0, block, SCOPE_WIDTH, 1);
+    renderLCDValue(block[SCOPE_WIDTH - 1]);
+    adcStreamReleaseBlock();
+
+    for (i = 0; i < SCOPE_WIDTH - 1; i++)
     {
-      if (touch.x > 25 && touch.x < 100 && touch.y > 210)
-      {
-        // Analog switch selected
-        adcEnabled = adcEnabled ? false : true;
-      }
-      if (touch.x > 125 && touch.x < 200 && touch.y > 210)
-      {
-        // Digital switch selected
-        digEnabled = digEnabled ? false : true;
-      }
-      // Refresh the frame
-      renderLCDFrame();
+      digSamples[i] = digSamples[i + 1];
     }
-
-    // Read pins
-    if (adcEnabled)
-      addToBuffer(adcBuffer, adcRead(5) / 4); // 10-bit value converted to 8-bits
-    if (digEnabled)
-      addToBuffer(digBuffer, gpioGetValue(2, 0) ? 0xFF : 0x00);
-
-    // Update the LCD is required
-    renderLCDGrid();
-
-    // Note, this will actually mean the timing is ~100mS + the amount of
-    // time it took to get the readings and update the LCD
-    // A timer interrupt could be used to get much more accurate results,
-    // filling the buffer inside the IRQ and rendering the screen updates
-    // every x milliseconds
-    systickDelay(100);
+    digSamples[SCOPE_WIDTH - 1] = gpioGetValue(2, 0) ? 1023 : 0;
+    scopeDrawBlock(1, digSamples, SCOPE_WIDTH, 1);
   }
 
   return 0;
@@ -34,6 +34,7 @@
 */
 /**************************************************************************/
 #include <stdio.h>
+#include <string.h>
 
 #include "projectconfig.h"
 #include "sysinit.h"
@@ -44,6 +45,163 @@
 #include "drivers/sensors/pn532/helpers/pn532_mifare_classic.h"
 #include "drivers/sensors/pn532/helpers/pn532_mifare_ultralight.h"
 
+// Where the dump goes:
+//
+//    DUMP_CDCHEX   Hex and ASCII, one block per line, over USB CDC
+//    DUMP_CDCRAW   A 16 byte header (see dumpHeader) and then the packed
+//                  binary image over USB CDC, one 64 byte packet per 4
+//                  blocks (no other output is printed)
+//    DUMP_SDCARD   The packed binary image to <UID>.MFD on the SD card,
+//                  7 byte UIDs go to <UID 0..2>/<UID 3..6>.MFD
+#define DUMP_CDCHEX       (0)
+#define DUMP_CDCRAW       (1)
+#define DUMP_SDCARD       (2)
+#define DUMP_OUTPUT       DUMP_CDCHEX
+
+// 16 sectors for Mifare Classic 1K cards, 40 for 4K cards
+#define DUMP_SECTORS      (16)
+
+// Image size, sectors 32..39 (4K only) have 16 blocks rather than 4
+#if DUMP_SECTORS <= 32
+  #define DUMP_IMAGESIZE  (DUMP_SECTORS * 64)
+#else
+  #define DUMP_IMAGESIZE  (2048 + (DUMP_SECTORS - 32) * 256)
+#endif
+
+// Activation attempts per check while waiting for the card to be removed
+#define DUMP_REMOVERETRIES  (0x02)
+
+#if DUMP_OUTPUT == DUMP_CDCRAW
+  #include "core/usbcdc/usb.h"
+  #include "core/usbcdc/usbcore.h"
+  #include "core/usbcdc/cdcuser.h"
+  #define DUMP_PRINTF(...)
+#else
+  #define DUMP_PRINTF(...)  printf(__VA_ARGS__)
+#endif
+
+#if DUMP_OUTPUT == DUMP_SDCARD
+  #include "drivers/fatfs/diskio.h"
+  #include "drivers/fatfs/ff.h"
+  static FATFS dumpFatfs;
+  static FIL dumpFile;
+#endif
+
+// Keys tried on every sector, the one that works is remembered for
+// the next time the same card is dumped.  For NDEF formatted cards
+// (see AN1305 - MIFARE Classic as NFC Type MIFARE Classic Tag) sector 0
+// uses 0xa0..0xa5 and the other sectors 0xd3 0xf7 ...
+static byte_t abtAuthKeys[][6] =
+{
+  { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },   // Factory default
+  { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 },   // NDEF sector 0 (MAD)
+  { 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7 }    // NDEF sectors 1..n
+};
+
+#ifdef PN532_I2C_IRQHANDLER
+/**************************************************************************/
+/*! 
+    The PN532 pulls its IRQ line (3.2) low when a response is ready,
+    which moves any queued command on to its next stage.  Only needed
+    when PN532_I2C_IRQHANDLER is defined in pn532_bus.h, otherwise the
+    driver polls the pin.
+*/
+/**************************************************************************/
+void PIOINT3_IRQHandler(void)
+{
+  pn532_bus_IRQHandler();
+}
+#endif
+
+#if DUMP_OUTPUT == DUMP_CDCRAW
+/**************************************************************************/
+/*! 
+    Sends the header that goes in front of each raw image, so the host
+    can tell where one card ends and the next begins:
+
+      0..3    "MFD1"
+      4       UID length (4 or 7)
+      5       Number of sectors
+      6..7    Image size in bytes (big endian)
+      8..14   UID, zero padded
+      15      Reserved (0)
+*/
+/**************************************************************************/
+void dumpHeader(byte_t * pbtUID, size_t szUIDLen)
+{
+  uint8_t header[16];
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, "MFD1", 4);
+  header[4] = szUIDLen;
+  header[5] = DUMP_SECTORS;
+  header[6] = (DUMP_IMAGESIZE >> 8) & 0xFF;
+  header[7] = DUMP_IMAGESIZE & 0xFF;
+  memcpy(header + 8, pbtUID, szUIDLen > 7 ? 7 : szUIDLen);
+
+  while (USB_Configuration && !CDC_writePacket(header, sizeof(header)));
+}
+#endif
+
+/**************************************************************************/
+/*! 
+    Waits until the card that was just dumped has left the field, so a
+    card left on the reader isn't dumped over and over
+*/
+/**************************************************************************/
+void dumpWaitForRemoval(byte_t * pbtUID, size_t szUIDLen)
+{
+  byte_t abtUID[8];
+  size_t szLen;
+
+  DUMP_PRINTF("Please remove the card%s%s", CFG_PRINTF_NEWLINE, CFG_PRINTF_NEWLINE);
+
+  if (pn532SetPassiveActivationRetries(DUMP_REMOVERETRIES))
+    return;
+  while ((pn532_mifareclassic_WaitForPassiveTarget(abtUID, &szLen) == PN532_ERROR_NONE) &&
+         (szLen == szUIDLen) && (memcmp(abtUID, pbtUID, szUIDLen) == 0))
+  {
+    systickDelay(200);
+  }
+  pn532SetPassiveActivationRetries(0xFF);
+}
+
+/**************************************************************************/
+/*! 
+    Receives the card contents from pn532_mifareclassic_DumpCard, up to
+    four blocks at a time and in block order
+*/
+/**************************************************************************/
+void dumpBlocks(uint8_t uiBlockNumber, const byte_t * pbtData, uint8_t uiBlocks, pn532_error_t error, void * context)
+{
+  #if DUMP_OUTPUT == DUMP_CDCHEX
+    uint8_t i;
+    for (i = 0; i < uiBlocks; i++)
+    {
+      uint8_t block = uiBlockNumber + i;
+      if (is_first_block(block))
+      {
+        printf("-------------------------Sector %02d--------------------------%s", block < 128 ? block / 4 : 32 + (block - 128) / 16, CFG_PRINTF_NEWLINE);
+      }
+      printf("Block %02d: ", block);
+      if (error)
+      {
+        printf("Unable to read this block%s", CFG_PRINTF_NEWLINE);
+      }
+      else
+      {
+        pn532PrintHexChar(pbtData + i * 16, 16);
+      }
+    }
+  #elif DUMP_OUTPUT == DUMP_CDCRAW
+    // Exactly one full speed packet, wait until the last one has gone
+    while (USB_Configuration && !CDC_writePacket((uint8_t *)pbtData, uiBlocks * 16));
+  #elif DUMP_OUTPUT == DUMP_SDCARD
+    UINT bytesWritten;
+    f_write(&dumpFile, pbtData, uiBlocks * 16, &bytesWritten);
+  #endif
+}
+
 /**************************************************************************/
 /*! 
     Main program entry point.  After reset, normal code execution will
@@ -63,6 +221,12 @@ int main (void)
   #if !defined CFG_PRINTF_USBCDC
     #error "CFG_PRINTF_USBCDC must be enabled in projectconfig.h for this demo"
   #endif
+  #if DUMP_OUTPUT == DUMP_SDCARD && !defined CFG_SDCARD
+    #error "CFG_SDCARD must be enabled in projectconfig.h for DUMP_SDCARD"
+  #endif
+  #if DUMP_OUTPUT == DUMP_SDCARD && CFG_SDCARD_READONLY != 0
+    #error "CFG_SDCARD_READONLY must be set to 0 in projectconfig.h for DUMP_SDCARD"
+  #endif
 
   // Configure cpu and mandatory peripherals
   systemInit();
@@ -73,105 +237,87 @@ int main (void)
   // Initialise the PN532
   pn532Init();
 
-  // To dump an NDEF formatted Mifare Classic Card (formatted using NXP TagWriter on Android
-  // for example), you must use the following authentication keys:
-  //
-  //    Sector 0:       0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5
-  //    Sectors 1..15:  0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7
-  //
-  // For more information on NDEF see the following document:
-  // 
-  //    AN1305 - MIFARE Classic as NFC Type MIFARE Classic Tag
-  //    http://www.nxp.com/documents/application_note/AN1305.pdf
-
-  // Set this to one for NDEF cards, or 0 for blank factory default cards
-  #define CARDFORMAT_NDEF (0)
-
   pn532_error_t error;
   byte_t abtUID[8];
-  byte_t abtBlock[32];
-  #if CARDFORMAT_NDEF == 1
-  byte_t abtAuthKey1[6] = { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5 };   // Sector 0 of NXP formatter NDEF cards
-  byte_t abtAuthKey2[6] = { 0xd3, 0xf7, 0xd3, 0xf7, 0xd3, 0xf7 };   // All other sectors use standard key (AN1305 p.20, Table 6)
-  #else
-  byte_t abtAuthKey1[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-  byte_t abtAuthKey2[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-  #endif
   size_t szUIDLen;
    
-  // Use the MIFARE Classic Helper to read/write to the tag's EEPROM storage
+  // Use the MIFARE Classic Helper to read the tag's EEPROM storage
   while(1)
   {
-    printf("Please insert a Mifare Classic 1K or 4K card%s%s", CFG_PRINTF_NEWLINE, CFG_PRINTF_NEWLINE);
+    DUMP_PRINTF("Please insert a Mifare Classic 1K or 4K card%s%s", CFG_PRINTF_NEWLINE, CFG_PRINTF_NEWLINE);
 
     // Wait for any ISO14443A card
     error = pn532_mifareclassic_WaitForPassiveTarget(abtUID, &szUIDLen);
     if (!error)
     {
-      // Mifare classic card found ... cycle through each sector
-      uint8_t block;
-      bool authenticated = false;
-      for (block = 0; block < 64; block++)
-      {
-        // Check if this is a new block so that we can reauthenticate
-        if (is_first_block(block)) authenticated = false;
-        if (!authenticated)
+      #if DUMP_OUTPUT == DUMP_SDCARD
+        // Name the image after the UID.  8.3 names only hold four bytes,
+        // so 7 byte UIDs put the first three in a directory name
+        char filename[20];
+        if ((disk_initialize(0) & (STA_NOINIT | STA_NODISK)) ||
+            (f_mount(0, &dumpFatfs) != FR_OK))
         {
-          // Start of a new sector ... try to to authenticate
-          printf("-------------------------Sector %02d--------------------------%s", block / 4, CFG_PRINTF_NEWLINE);
-          error = pn532_mifareclassic_AuthenticateBlock (abtUID, szUIDLen, block, PN532_MIFARE_CMD_AUTH_A, block / 4 ? abtAuthKey2 : abtAuthKey1);
-          if (error)
-          {
-            switch(error)
-            {
-              default:
-                printf("Authentication error (0x%02x)%s", error, CFG_PRINTF_NEWLINE);
-                break;
-            }
-          }
-          else
-          {
-            authenticated = true;
-          }
+          printf("Unable to mount the SD card%s", CFG_PRINTF_NEWLINE);
+          systickDelay(2000);
+          continue;
         }
-        // If we're still not authenticated just skip the block
-        if (!authenticated)
+        if (szUIDLen == 7)
         {
-          printf("Block %02d: ", block);
-          printf("Unable to authenticate%s", CFG_PRINTF_NEWLINE);
+          sprintf(filename, "%02X%02X%02X", abtUID[0], abtUID[1], abtUID[2]);
+          f_mkdir(filename);    // FR_EXIST is fine, f_open reports the rest
+          sprintf(filename + 6, "/%02X%02X%02X%02X.MFD", abtUID[3], abtUID[4], abtUID[5], abtUID[6]);
         }
         else
         {
-          // Authenticated ... we should be able to read the block now
-          error = pn532_mifareclassic_ReadDataBlock (block, abtBlock);
-          if (error)
-          {
-            switch(error)
-            {
-              default:
-                printf("Block %02d: ", block);
-                printf("Unable to read this block%s", CFG_PRINTF_NEWLINE);
-                break;
-            }
-          }
-          else
-          {
-            // Read successful
-            printf("Block %02d: ", block);
-            pn532PrintHexChar(abtBlock, 16);
-          }
+          sprintf(filename, "%02X%02X%02X%02X.MFD", abtUID[0], abtUID[1], abtUID[2], abtUID[3]);
+        }
+        if (f_open(&dumpFile, filename, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        {
+          printf("Unable to create %s%s", filename, CFG_PRINTF_NEWLINE);
+          f_mount(0, 0);
+          systickDelay(2000);
+          continue;
         }
+      #endif
+
+      #if DUMP_OUTPUT == DUMP_CDCRAW
+        dumpHeader(abtUID, szUIDLen);
+      #endif
+
+      // Authenticates each sector once and reads it in one go
+      error = pn532_mifareclassic_DumpCard(abtUID, szUIDLen, DUMP_SECTORS, PN532_MIFARE_CMD_AUTH_A,
+                                           abtAuthKeys, sizeof(abtAuthKeys) / sizeof(abtAuthKeys[0]),
+                                           dumpBlocks, NULL);
+
+      #if DUMP_OUTPUT == DUMP_SDCARD
+        f_close(&dumpFile);
+        f_mount(0, 0);
+        printf("Card written to %s%s", filename, CFG_PRINTF_NEWLINE);
+      #endif
+
+      // The rest of the image went out as zeros, so it's still
+      // DUMP_IMAGESIZE bytes long
+      if (error == PN532_ERROR_TIMEOUTWAITINGFORCARD)
+      {
+        DUMP_PRINTF("The card was removed before the dump finished%s", CFG_PRINTF_NEWLINE);
+        continue;
+      }
+      if (error)
+      {
+        DUMP_PRINTF("Some sectors couldn't be read (0x%02x)%s", error, CFG_PRINTF_NEWLINE);
       }
+
+      dumpWaitForRemoval(abtUID, szUIDLen);
     }
     else
     {
       switch (error)
       {
         case PN532_ERROR_WRONGCARDTYPE:
-          printf("Not a Mifare Classic 1K or 4K card%s", CFG_PRINTF_NEWLINE);
+          DUMP_PRINTF("Not a Mifare Classic 1K or 4K card%s", CFG_PRINTF_NEWLINE);
           break;
         default:
-          printf("Error establishing passive connection (0x%02x)%s", error, CFG_PRINTF_NEWLINE);
+          DUMP_PRINTF("Error establishing passive connection (0x%02x)%s", error, CFG_PRINTF_NEWLINE);
           break;
       }
     }
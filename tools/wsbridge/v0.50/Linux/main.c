@@ -37,11 +37,36 @@
     This program allows data from the Freakduino to be piped into wireshark.
     When the sniffer firmware is loaded into the Freakduino, then the Freakduino
     will be in promiscuous mode and will just dump any frames it sees. This
-    program takes the frame dump and sends it into Wireshark for analysis. The
-    global header is already set up to inform wireshark that the link layer for
-    all frames will be in IEEE 802.15.4 format. After that, it is up to the user
-    to choose any higher layer protocols to decode above 802.15.4 via the
+    program takes the frame dump and sends it into Wireshark for analysis, as a
+    pcapng stream through a named pipe, or into a series of capture files.
+    The link layer for all frames is IEEE 802.15.4. After that, it is up to the
+    user to choose any higher layer protocols to decode above 802.15.4 via the
     wireshark "enable protocols" menu. 
+
+    Two input formats are understood, frame by frame:
+
+    - legacy: a length byte (the PHY length, 3..127), then the frame without
+      its last byte. The FCS is dropped and the frame is stamped with the
+      time it reached the PC.
+    - sniffer records, recognised by the WSB_SYNC byte (which can't be a
+      valid length byte):
+
+        sync (0xC3), frame length, device timestamp (32-bit, little endian,
+        microseconds), ED level, LQI, channel, flags (bit 0 = FCS ok),
+        then the frame including its FCS
+
+      The device timestamp is used, lined up with the PC clock on the first
+      record, and frames with a bad FCS are flagged as such in wireshark.
+
+    Input is read in large chunks and frames are parsed in place; each batch
+    of frames goes out with a single writev.
+
+    Usage: wsbridge [-w file] [-C megabytes] [-v] <portname>
+
+    -w file     write capture files (file, file.1, file.2, ...) rather than
+                feeding the wireshark pipe (/tmp/wireshark)
+    -C size     start a new file once the current one reaches 'size' MB
+    -v          print every frame
 */
 /**************************************************************************/
 #include <stddef.h>
@@ -52,33 +77,80 @@
 #include <time.h>
 #include <stdint.h>
 #include <signal.h>
+#include <unistd.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <termios.h>
 
-#define PORTBUFSIZE     32
-#define BUFSIZE         1024
+#define INBUFSIZE       65536   // serial input buffer, read in one go where possible
+#define MAXBATCH        64      // frames per writev
+#define MAXIOV          1024    // buffers per writev call (POSIX minimum is 16, Linux allows 1024)
 #define PACKET_FCS      2
-#define DEBUG           1
 #define PIPENAME        "/tmp/wireshark"
 #define BAUDRATE        B115200
 
-enum FSM
-{
-    START_CAPTURE,
-    PACKET_CAPTURE
-};
+#define WSB_SYNC        0xC3    // start of a sniffer record
+#define WSB_RECHDR      10      // sync, len, timestamp (4), ed, lqi, channel, flags
+#define WSB_FLAG_CRCOK  0x01
 
-static int FD_pipe = -1;
+#define LINKTYPE_IEEE802_15_4       195     // with FCS (sniffer records)
+#define LINKTYPE_IEEE802_15_4_NOFCS 230     // without (legacy frames)
+#define IF_RECORD       0
+#define IF_LEGACY       1
+
+#define EPB_FLAG_CRCERR (1UL << 24)     // link-layer dependent error: CRC
+
+// pcapng Enhanced Packet Block, up to the packet data
+typedef struct
+{
+    uint32_t type;
+    uint32_t len;
+    uint32_t interface;
+    uint32_t ts_high;
+    uint32_t ts_low;
+    uint32_t cap_len;
+    uint32_t orig_len;
+} epb_hdr_t;
+
+// padding, the epb_flags option, end of options and the trailing length
+typedef struct
+{
+    uint8_t pad[4];
+    uint16_t flags_code;
+    uint16_t flags_len;
+    uint32_t flags;
+    uint32_t end_of_opt;
+    uint32_t len;
+} epb_tail_t;
+
+static int FD_out = -1;
 static int FD_com = -1;
-static uint8_t port_buf[PORTBUFSIZE];
-static uint8_t circ_buf[BUFSIZE];
-static uint16_t rd_idx = 0;
-static uint16_t wr_idx = 0;
-static uint8_t len;
-static uint8_t state = START_CAPTURE;
-static uint8_t file_write = 0;
+static uint8_t in_buf[INBUFSIZE];
+static size_t in_len = 0;
+
+static const char *out_name = NULL;         // NULL: wireshark pipe
+static unsigned long out_limit = 0;         // bytes per file, 0 = no rotation
+static unsigned long out_size = 0;
+static unsigned out_index = 0;
+static int verbose = 0;
+
+// device clock tracking (microseconds)
+static int have_anchor = 0;
+static uint64_t anchor_us;                  // PC time of device time 0
+static uint32_t last_dev_ts;
+static uint64_t dev_wraps = 0;
+
+// stats
+static unsigned long frames = 0, bad_crc = 0, skipped = 0;
+
+static epb_hdr_t epb_hdr[MAXBATCH];
+static epb_tail_t epb_tail[MAXBATCH];
+static struct iovec iov[MAXBATCH * 3];
+static int batch = 0;
 
 /**************************************************************************/
 /*!
@@ -91,7 +163,7 @@ static int serial_open(char *portname)
     int FD_com; // file descriptor for the serial port
     struct termios term;
 
-    FD_com = open(portname, O_RDONLY | O_NOCTTY | O_NDELAY);
+    FD_com = open(portname, O_RDONLY | O_NOCTTY);
     
     if(FD_com == -1) // if open is unsucessful
     {
@@ -99,16 +171,15 @@ static int serial_open(char *portname)
     }
     else
     {
-        // set speed of port
+        // raw 8N1, and let read() block until at least one byte is there
+        // (returning up to a whole buffer's worth once data is flowing)
+        tcgetattr(FD_com, &term);
+        cfmakeraw(&term);
         cfsetspeed(&term, BAUDRATE);
-
-        // set to 8-bits, no parity, 1 stop bit
-        term.c_cflag &= ~PARENB;
-        term.c_cflag &= ~CSTOPB;
-        term.c_cflag &= ~CSIZE;
-        term.c_cflag |= CS8;
-
+        term.c_cflag &= ~(PARENB | CSTOPB);
         term.c_cflag |= (CLOCAL | CREAD);
+        term.c_cc[VMIN] = 1;
+        term.c_cc[VTIME] = 1;
         tcsetattr(FD_com, TCSANOW, &term);
     }
     return(FD_com);
@@ -129,9 +200,9 @@ static void named_pipe_create(char *name)
         exit(1);
     }
 
-    FD_pipe = open(name, O_WRONLY);
+    FD_out = open(name, O_WRONLY);
 
-    if (FD_pipe == -1) 
+    if (FD_out == -1) 
     {
         perror("Error connecting to named pipe");
         exit(1);
@@ -140,113 +211,276 @@ static void named_pipe_create(char *name)
 
 /**************************************************************************/
 /*!
-    Write data to the pipe
+    Write all of the supplied buffers, coping with short writes
 */
 /**************************************************************************/
-size_t data_write(const void *ptr, size_t size)
+static void data_writev(struct iovec *v, int count)
 {
-    ssize_t bytes = 0;
-    if (FD_pipe != -1) 
+    ssize_t bytes;
+
+    while (count > 0)
     {
-        bytes = write(FD_pipe, ptr, size);
+        bytes = writev(FD_out, v, count > MAXIOV ? MAXIOV : count);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("Error writing capture");
+            exit(1);
+        }
+        out_size += bytes;
+
+        // skip what was written
+        while ((count > 0) && ((size_t)bytes >= v->iov_len))
+        {
+            bytes -= v->iov_len;
+            v++;
+            count--;
+        }
+        if (count > 0)
+        {
+            v->iov_base = (uint8_t *)v->iov_base + bytes;
+            v->iov_len -= bytes;
+        }
     }
 }
 
 /**************************************************************************/
 /*!
-    Write the global header to wireshark. This is only done once at the
-    beginning of the capture. 
+    Write the section header and the two interface descriptions (sniffer
+    records with FCS, legacy frames without). This is done at the start of
+    the capture and of every file.
 */
 /**************************************************************************/
 static void write_global_hdr()
 {
-    uint32_t magic_number = 0xa1b2c3d4; /* magic number */
-    uint16_t version_major = 2; /* major version number */
-    uint16_t version_minor = 4; /* minor version number */
-    int32_t thiszone = 0;       /* GMT to local correction */
-    uint32_t sigfigs = 0;       /* accuracy of timestamps */
-    uint32_t snaplen = 65535;   /* max length of captured packets, in octets */
-    uint32_t network = 195;     /* data link type (DLT) - IEEE 802.15.4 */
-
-    data_write(&magic_number, sizeof(magic_number));
-    data_write(&version_major, sizeof(version_major));
-    data_write(&version_minor, sizeof(version_minor));
-    data_write(&thiszone, sizeof(thiszone));
-    data_write(&sigfigs, sizeof(sigfigs));
-    data_write(&snaplen, sizeof(snaplen));
-    data_write(&network, sizeof(network));
+    uint32_t shb[7] = 
+    {
+        0x0A0D0D0A, 28,             // block type, length
+        0x1A2B3C4D,                 // byte order magic
+        0x00000001,                 // version 1.0
+        0xFFFFFFFF, 0xFFFFFFFF,     // section length unknown
+        28
+    };
+    uint32_t idb[2][5] =
+    {
+        { 0x00000001, 20, LINKTYPE_IEEE802_15_4, 65535, 20 },
+        { 0x00000001, 20, LINKTYPE_IEEE802_15_4_NOFCS, 65535, 20 }
+    };
+    struct iovec v[2];
+
+    v[0].iov_base = shb;
+    v[0].iov_len = sizeof(shb);
+    v[1].iov_base = idb;
+    v[1].iov_len = sizeof(idb);
+    data_writev(v, 2);
 }
 
 /**************************************************************************/
 /*!
-    Write the frame header into wireshark. This is required for the libpcap
-    format and informs wireshark that a new frame is coming.
+    Open the next capture file
 */
 /**************************************************************************/
-static void write_frame_hdr(uint8_t len)
+static void file_open()
 {
-    uint32_t ts_sec;    /* timestamp seconds */
-    uint32_t ts_usec;   /* timestamp microseconds */
-    uint32_t incl_len;  /* number of octets of packet saved in file */
-    uint32_t orig_len;  /* actual length of packet */
-    struct timeval tv;
+    char name[PATH_MAX];
 
-    gettimeofday(&tv, NULL);
-    ts_sec      = tv.tv_sec;
-    ts_usec     = tv.tv_usec;
-    incl_len    = len;
-    orig_len    = len + PACKET_FCS;
-
-    data_write(&ts_sec, sizeof(ts_sec));
-    data_write(&ts_usec, sizeof(ts_usec));
-    data_write(&incl_len, sizeof(incl_len));
-    data_write(&orig_len, sizeof(orig_len));
+    if (out_index == 0)
+    {
+        snprintf(name, sizeof(name), "%s", out_name);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "%s.%u", out_name, out_index);
+    }
+    out_index++;
+
+    FD_out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (FD_out == -1) 
+    {
+        perror("Error opening capture file");
+        exit(1);
+    }
+    out_size = 0;
+    write_global_hdr();
+    printf("Writing %s\n", name);
 }
 
 /**************************************************************************/
 /*!
-    Write one frame into wireshark (via the pipe).
+    Write the frames collected so far, then start a new file if this one
+    is full
 */
 /**************************************************************************/
-static void write_frame(uint8_t frame_len)
+static void flush_frames()
 {
-    uint8_t i;
+    if (batch)
+    {
+        data_writev(iov, batch * 3);
+        batch = 0;
+    }
 
-    // actual frame length for wireshark should not include FCS
-    frame_len -= PACKET_FCS;
+    if (out_name && out_limit && (out_size >= out_limit))
+    {
+        close(FD_out);
+        file_open();
+    }
+}
 
-    // write header to inform WS that new frame has arrived
-    write_frame_hdr(frame_len);
+/**************************************************************************/
+/*!
+    Current PC time in microseconds
+*/
+/**************************************************************************/
+static uint64_t host_us()
+{
+    struct timeval tv;
 
-    // bump rd_idx. we don't want to write the length byte
-    rd_idx = (rd_idx + 1) % BUFSIZE;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-    // write frame into wireshark
-    for (i=0; i<frame_len; i++)
+/**************************************************************************/
+/*!
+    Turn a 32-bit device timestamp into PC time, following its wraps
+*/
+/**************************************************************************/
+static uint64_t device_us(uint32_t ts)
+{
+    if (!have_anchor)
+    {
+        anchor_us = host_us() - ts;
+        have_anchor = 1;
+    }
+    else if (ts < last_dev_ts)
     {
-        data_write(&circ_buf[rd_idx], 1);
-        rd_idx = (rd_idx + 1) % BUFSIZE;
+        dev_wraps++;
     }
+    last_dev_ts = ts;
 
-    // bump rd_idx. we're not using the trailing FCS value
-    rd_idx = (rd_idx + 1) % BUFSIZE;
+    return anchor_us + (dev_wraps << 32) + ts;
 }
 
 /**************************************************************************/
 /*!
-    Calculate total number of bytes in buffer.
+    Queue one frame for writing. The frame data isn't copied, it is written
+    straight out of the input buffer (before that is touched again).
 */
 /**************************************************************************/
-static uint16_t calc_bytes_in_buf()
+static void add_frame(uint32_t interface, uint64_t ts, uint8_t *data, uint32_t len, uint32_t orig_len, uint32_t flags)
 {
-    if (rd_idx > wr_idx)
+    epb_hdr_t *h = &epb_hdr[batch];
+    epb_tail_t *t = &epb_tail[batch];
+    uint32_t pad = (4 - (len & 3)) & 3;
+    uint32_t block_len = sizeof(epb_hdr_t) + len + pad + sizeof(epb_tail_t) - sizeof(t->pad);
+
+    h->type = 0x00000006;
+    h->len = block_len;
+    h->interface = interface;
+    h->ts_high = ts >> 32;
+    h->ts_low = ts & 0xFFFFFFFF;
+    h->cap_len = len;
+    h->orig_len = orig_len;
+
+    memset(t->pad, 0, sizeof(t->pad));
+    t->flags_code = 2;              // epb_flags
+    t->flags_len = 4;
+    t->flags = flags;
+    t->end_of_opt = 0;
+    t->len = block_len;
+
+    iov[batch * 3].iov_base = h;
+    iov[batch * 3].iov_len = sizeof(epb_hdr_t);
+    iov[batch * 3 + 1].iov_base = data;
+    iov[batch * 3 + 1].iov_len = len;
+    iov[batch * 3 + 2].iov_base = t->pad + sizeof(t->pad) - pad;
+    iov[batch * 3 + 2].iov_len = pad + sizeof(epb_tail_t) - sizeof(t->pad);
+
+    frames++;
+    if (++batch == MAXBATCH)
     {
-        // read index is greater than write. we must have wrapped around
-        return (BUFSIZE - (rd_idx - wr_idx));
+        flush_frames();
     }
-    else
+}
+
+/**************************************************************************/
+/*!
+    Parse every complete frame in the input buffer and write them out.
+    Whatever is left (a partial frame) is moved to the start of the buffer.
+*/
+/**************************************************************************/
+static void parse_frames()
+{
+    size_t pos = 0;
+    uint8_t *p, len;
+    uint32_t ts;
+
+    while (pos < in_len)
     {
-        return (wr_idx - rd_idx);
+        p = in_buf + pos;
+
+        if (p[0] == WSB_SYNC)
+        {
+            // sniffer record
+            if ((in_len - pos < 2) || (in_len - pos < WSB_RECHDR + (size_t)p[1]))
+            {
+                break;
+            }
+            len = p[1];
+            if ((len < 3) || (len > 127))
+            {
+                // not really a record, look for the next frame
+                skipped++;
+                pos++;
+                continue;
+            }
+            ts = p[2] | (p[3] << 8) | (p[4] << 16) | ((uint32_t)p[5] << 24);
+            if (!(p[9] & WSB_FLAG_CRCOK))
+            {
+                bad_crc++;
+            }
+            if (verbose)
+            {
+                printf("%10u us  ch %2u  ed %3u  lqi %3u  len %3u%s\n", ts, p[8], p[6], p[7], len, 
+                       (p[9] & WSB_FLAG_CRCOK) ? "" : "  bad FCS");
+            }
+            add_frame(IF_RECORD, device_us(ts), p + WSB_RECHDR, len, len, 
+                      (p[9] & WSB_FLAG_CRCOK) ? 0 : EPB_FLAG_CRCERR);
+            pos += WSB_RECHDR + len;
+        }
+        else if ((p[0] >= 3) && (p[0] <= 127))
+        {
+            // legacy: length byte, then all but the last byte of the frame
+            len = p[0];
+            if (in_len - pos < len)
+            {
+                break;
+            }
+            if (verbose)
+            {
+                printf("len %3u (no device timestamp)\n", len);
+            }
+            add_frame(IF_LEGACY, host_us(), p + 1, len - PACKET_FCS, len - PACKET_FCS, 0);
+            pos += len;
+        }
+        else
+        {
+            // out of step, look for the next frame
+            skipped++;
+            pos++;
+        }
+    }
+
+    // the queued frames point into in_buf, so write them before moving anything
+    flush_frames();
+
+    in_len -= pos;
+    memmove(in_buf, in_buf + pos, in_len);
+    if (verbose)
+    {
+        fflush(stdout);
     }
 }
 
@@ -258,10 +492,10 @@ static uint16_t calc_bytes_in_buf()
 static void sig_int(int signo)
 {
     (void) signo;
-    if (FD_pipe != -1) 
+    if (FD_out != -1) 
     {
-        printf("\nClosing pipe.\n");
-        close(FD_pipe);
+        printf("\nClosing capture.\n");
+        close(FD_out);
     }
 
     if (FD_com != -1)
@@ -270,7 +504,8 @@ static void sig_int(int signo)
         close(FD_com);
     }
 
-    printf("\nSignal captured and devices shut down.\n");
+    printf("\n%lu frames (%lu with a bad FCS), %lu bytes skipped.\n", frames, bad_crc, skipped);
+    printf("Signal captured and devices shut down.\n");
 
     exit(0);
 }
@@ -285,6 +520,7 @@ static void signal_init(void)
     signal(SIGINT, sig_int);
     signal(SIGHUP, sig_int);
     signal(SIGTERM, sig_int);
+    signal(SIGPIPE, sig_int);
 }
 
 /**************************************************************************/
@@ -294,22 +530,41 @@ static void signal_init(void)
 /**************************************************************************/
 int main(int argc, char *argv[])
 {
-    int nbytes;
-    uint8_t i;
+    ssize_t nbytes;
+    int opt;
 
     // capture any signals that will terminate program
     signal_init();
 
+    while ((opt = getopt(argc, argv, "w:C:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'w':
+                out_name = optarg;
+                break;
+            case 'C':
+                out_limit = strtoul(optarg, NULL, 0) * 1000000UL;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
     // make sure the COM port is specified
-    if (argc == 2) 
+    if (optind == argc - 1) 
     {
         // open the COM port
-        if ((FD_com = serial_open(argv[1])) == -1)
+        if ((FD_com = serial_open(argv[optind])) == -1)
         {
             printf("Serial port not opened.\n");
             return 0;
         }
-        else
+        else if (!out_name)
         {
             printf("Serial port connected. Waiting for wireshark connection.\n");
             printf("Open wireshark and connect to local interface: %s\n", PIPENAME);
@@ -317,103 +572,36 @@ int main(int argc, char *argv[])
     }
     else
     {
-        printf("Usage: wsbridge <portname>.\n");
+        printf("Usage: wsbridge [-w file] [-C megabytes] [-v] <portname>.\n");
         return 0;
     }
 
-
-    // create and open pipe for wireshark
-    named_pipe_create(PIPENAME);
-
-    // wait for wireshark to connect to pipe. Once wireshark
-    // connects, then the global header will be written to it.
-    if (FD_pipe != -1)
+    if (out_name)
     {
+        file_open();
+    }
+    else
+    {
+        // create and open pipe for wireshark. this waits for wireshark to
+        // connect, then the pcapng header is written to it.
+        named_pipe_create(PIPENAME);
         write_global_hdr();
         printf("Client connected to pipe.\n");
     }
 
     for (;;) 
     {
-        uint16_t bytes_in_buf;
-        uint8_t frame_len, byte_ctr;
-
-        // wait for data to come in on the serial port
-        if ((nbytes = read(FD_com, port_buf, PORTBUFSIZE)) > 0)
+        // read as much as there is room for, and parse whole frames in place
+        nbytes = read(FD_com, in_buf + in_len, INBUFSIZE - in_len);
+        if (nbytes > 0)
         {
-            // write data to circular buffer. loop through all received bytes
-            for (i=0; i<nbytes; i++)
-            {
-                switch (state)
-                {
-                    case START_CAPTURE:
-                        // new frame starting
-                        len = port_buf[i];
-                        byte_ctr = 0;
-
-                        printf("Len = %02X.\n", len);
-
-                        circ_buf[wr_idx] = len;
-                        wr_idx = (wr_idx + 1) % BUFSIZE;
-                        state = PACKET_CAPTURE;
-                        break;
-
-
-                    case PACKET_CAPTURE:
-                        // continue capturing bytes until end of frame
-
-                        // write data to circular buffer and increment index
-                        circ_buf[wr_idx] = port_buf[i];
-                        
-                        printf("%02X ", circ_buf[wr_idx]);
-
-                        wr_idx = (wr_idx + 1) % BUFSIZE;
-
-                        // track number of received bytes. when received bytes
-                        // equals frame length, then restart state machine and 
-                        // write bytes to wireshark
-                        byte_ctr++;
-                        if (byte_ctr == (len - 1))
-                        {
-                            state = START_CAPTURE;
-                            file_write = 1;
-                            printf("\n");
-                        }
-                        break;
-                }
-                fflush(stdout);
-            }
-
-            // at least one frame has been written. loop through circular buffer 
-            // and write out all completed frames
-            while (file_write)
-            {
-                // capture frame length and check buffer to see if one or more frames 
-                // are available.
-                frame_len = circ_buf[rd_idx];
-                bytes_in_buf = calc_bytes_in_buf();
-            
-                if (bytes_in_buf > frame_len)
-                {
-                    // if more than one frame is available, then write one frame to 
-                    // wireshark and then see if any more are available.
-                    write_frame(frame_len);
-                }
-                else if (bytes_in_buf == frame_len)
-                {
-                    // only one frame is available. write to wireshark and then quit
-                    // the loop
-                    write_frame(frame_len);
-                    file_write = 0;
-                }
-                else
-                {
-                    // less than one frame is available. quit the loop and collect more 
-                    // bytes. we normally should not get here.
-                    file_write = 0;
-                }
-            }
+            in_len += nbytes;
+            parse_frames();
+        }
+        else if ((nbytes < 0) && (errno != EINTR) && (errno != EAGAIN))
+        {
+            perror("Error reading serial port");
+            sig_int(0);
         }
     }
 }
-